@@ -0,0 +1,414 @@
+/*
+ * CiderPress
+ * Copyright (C) 2007 by faddenSoft, LLC.  All Rights Reserved.
+ * See the file LICENSE for distribution terms.
+ */
+/*
+ * Block cache, used by DiskImg to avoid re-reading the same blocks from
+ * the data GFD over and over (directory walks, index blocks, T/S lists).
+ */
+#include "StdAfx.h"
+#include "DiskImgPriv.h"
+
+
+/*
+ * Prepare the cache.
+ *
+ * The cache never holds more units than the image has, so small images
+ * don't allocate a full-sized cache.
+ */
+DIError BlockCache::Create(GenericFD* pGFD, di_off_t length, long numSlots)
+{
+    long numUnits, hashSize;
+
+    if (pGFD == NULL || length <= 0 || numSlots <= 0)
+        return kDIErrInvalidArg;
+    if (fSlots != NULL)
+        return kDIErrAlreadyOpen;
+
+    numUnits = (long) ((length + kUnitSize-1) / kUnitSize);
+    if (numSlots > numUnits)
+        numSlots = numUnits;
+
+    /* hash table is a power of 2, at least twice the #of slots */
+    hashSize = 16;
+    while (hashSize < numSlots * 2)
+        hashSize <<= 1;
+
+    fStorage = new uint8_t[numSlots * kUnitSize];
+    fSlots = new Slot[numSlots];
+    fHashTable = new long[hashSize];
+    if (fStorage == NULL || fSlots == NULL || fHashTable == NULL)
+        return kDIErrMalloc;
+
+    for (long i = 0; i < numSlots; i++) {
+        fSlots[i].unit = -1;
+        fSlots[i].hashNext = kNoSlot;
+        fSlots[i].dirty = false;
+        fSlots[i].referenced = false;
+    }
+    for (long i = 0; i < hashSize; i++)
+        fHashTable[i] = kNoSlot;
+
+    fpGFD = pGFD;
+    fLength = length;
+    fNumSlots = numSlots;
+    fHashMask = hashSize - 1;
+    fClockHand = 0;
+
+    LOGD(" BlockCache created: %ld slots, hash=%ld, len=%ld",
+        fNumSlots, hashSize, (long) fLength);
+    return kDIErrNone;
+}
+
+/*
+ * Find the slot holding "unit".  Returns kNoSlot if it isn't cached.
+ */
+long BlockCache::FindSlot(long unit) const
+{
+    long slot = fHashTable[HashUnit(unit)];
+
+    while (slot != kNoSlot) {
+        if (fSlots[slot].unit == unit)
+            return slot;
+        slot = fSlots[slot].hashNext;
+    }
+    return kNoSlot;
+}
+
+/*
+ * Remove a slot from its hash chain.
+ */
+void BlockCache::UnlinkSlot(long slot)
+{
+    long* pLink = &fHashTable[HashUnit(fSlots[slot].unit)];
+
+    while (*pLink != kNoSlot) {
+        if (*pLink == slot) {
+            *pLink = fSlots[slot].hashNext;
+            fSlots[slot].hashNext = kNoSlot;
+            return;
+        }
+        pLink = &fSlots[*pLink].hashNext;
+    }
+    assert(false);
+}
+
+/*
+ * Write a dirty slot to the GFD.
+ */
+DIError BlockCache::WriteBackSlot(long slot)
+{
+    DIError dierr;
+    Slot* pSlot = &fSlots[slot];
+
+    assert(pSlot->dirty);
+    dierr = WriteDirect(SlotData(slot), (di_off_t) pSlot->unit * kUnitSize,
+                UnitLength(pSlot->unit));
+    if (dierr != kDIErrNone)
+        return dierr;
+
+    pSlot->dirty = false;
+    fNumDirty--;
+    fWriteBacks++;
+    return kDIErrNone;
+}
+
+/*
+ * Throw out whatever is in "slot", writing it back first if it's dirty.
+ */
+DIError BlockCache::EvictSlot(long slot)
+{
+    DIError dierr;
+
+    if (fSlots[slot].unit < 0)
+        return kDIErrNone;
+
+    if (fSlots[slot].dirty) {
+        dierr = WriteBackSlot(slot);
+        if (dierr != kDIErrNone)
+            return dierr;
+    }
+    UnlinkSlot(slot);
+    fSlots[slot].unit = -1;
+    return kDIErrNone;
+}
+
+/*
+ * Get the slot for "unit", loading it from the GFD if necessary.  If the
+ * caller is about to overwrite the entire unit, we skip the read.
+ */
+DIError BlockCache::GetSlot(long unit, bool willOverwrite, long* pSlot)
+{
+    DIError dierr;
+    long slot;
+
+    slot = FindSlot(unit);
+    if (slot != kNoSlot) {
+        fHits++;
+        fSlots[slot].referenced = true;
+        *pSlot = slot;
+        return kDIErrNone;
+    }
+    fMisses++;
+
+    /*
+     * Run the clock.  Slots that have been used since the last sweep get
+     * a second chance.  Two full passes are enough to find a victim.
+     */
+    while (true) {
+        Slot* pCand = &fSlots[fClockHand];
+        slot = fClockHand;
+        fClockHand = (fClockHand + 1) % fNumSlots;
+
+        if (pCand->unit < 0 || !pCand->referenced)
+            break;
+        pCand->referenced = false;
+    }
+
+    dierr = EvictSlot(slot);
+    if (dierr != kDIErrNone)
+        return dierr;
+
+    if (!willOverwrite) {
+        dierr = ReadDirect(SlotData(slot), (di_off_t) unit * kUnitSize,
+                    UnitLength(unit));
+        if (dierr != kDIErrNone)
+            return dierr;
+    }
+
+    fSlots[slot].unit = unit;
+    fSlots[slot].dirty = false;
+    fSlots[slot].referenced = true;
+    fSlots[slot].hashNext = fHashTable[HashUnit(unit)];
+    fHashTable[HashUnit(unit)] = slot;
+
+    *pSlot = slot;
+    return kDIErrNone;
+}
+
+/*
+ * Read data from the cache.
+ */
+DIError BlockCache::Read(void* buf, di_off_t offset, int size)
+{
+    DIError dierr;
+    uint8_t* outPtr = (uint8_t*) buf;
+
+    if (offset < 0 || size < 0)
+        return kDIErrInvalidArg;
+
+    if (size > (fNumSlots * kUnitSize) / 4 || offset + size > fLength) {
+        /*
+         * Big read, or one that runs off the end.  Pull it straight from
+         * the file, then overlay anything we're holding that hasn't been
+         * written yet.
+         */
+        dierr = ReadDirect(buf, offset, size);
+        if (dierr != kDIErrNone)
+            return dierr;
+        if (fNumDirty == 0)
+            return kDIErrNone;
+
+        long firstUnit = (long) (offset / kUnitSize);
+        long lastUnit = (long) ((offset + size - 1) / kUnitSize);
+        for (long unit = firstUnit; unit <= lastUnit; unit++) {
+            long slot = FindSlot(unit);
+            if (slot == kNoSlot || !fSlots[slot].dirty)
+                continue;
+
+            di_off_t unitStart = (di_off_t) unit * kUnitSize;
+            di_off_t start = offset > unitStart ? offset : unitStart;
+            di_off_t end = unitStart + UnitLength(unit);
+            if (end > offset + size)
+                end = offset + size;
+            memcpy(outPtr + (start - offset),
+                SlotData(slot) + (start - unitStart), (size_t) (end - start));
+        }
+        return kDIErrNone;
+    }
+
+    while (size > 0) {
+        long unit = (long) (offset / kUnitSize);
+        int unitOff = (int) (offset - (di_off_t) unit * kUnitSize);
+        int chunk = UnitLength(unit) - unitOff;
+        long slot;
+
+        if (chunk > size)
+            chunk = size;
+
+        dierr = GetSlot(unit, false, &slot);
+        if (dierr != kDIErrNone)
+            return dierr;
+        memcpy(outPtr, SlotData(slot) + unitOff, chunk);
+
+        outPtr += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+
+    return kDIErrNone;
+}
+
+/*
+ * Write data into the cache.  Nothing reaches the GFD until the unit is
+ * evicted or Flush() is called.
+ */
+DIError BlockCache::Write(const void* buf, di_off_t offset, int size)
+{
+    DIError dierr;
+    const uint8_t* inPtr = (const uint8_t*) buf;
+
+    if (offset < 0 || size < 0)
+        return kDIErrInvalidArg;
+
+    if (size > (fNumSlots * kUnitSize) / 4 || offset + size > fLength) {
+        /*
+         * Big write, or one that runs off the end.  Send it straight to
+         * the file, and update any cached copies so they stay current.  A
+         * unit that was dirty stays dirty, since it may have changes outside
+         * the range we just wrote.
+         */
+        dierr = WriteDirect(buf, offset, size);
+        if (dierr != kDIErrNone)
+            return dierr;
+
+        long firstUnit = (long) (offset / kUnitSize);
+        long lastUnit = (long) ((offset + size - 1) / kUnitSize);
+        for (long unit = firstUnit; unit <= lastUnit; unit++) {
+            long slot = FindSlot(unit);
+            if (slot == kNoSlot)
+                continue;
+
+            di_off_t unitStart = (di_off_t) unit * kUnitSize;
+            di_off_t start = offset > unitStart ? offset : unitStart;
+            di_off_t end = unitStart + UnitLength(unit);
+            if (end > offset + size)
+                end = offset + size;
+            memcpy(SlotData(slot) + (start - unitStart),
+                inPtr + (start - offset), (size_t) (end - start));
+        }
+        return kDIErrNone;
+    }
+
+    while (size > 0) {
+        long unit = (long) (offset / kUnitSize);
+        int unitOff = (int) (offset - (di_off_t) unit * kUnitSize);
+        int unitLen = UnitLength(unit);
+        int chunk = unitLen - unitOff;
+        long slot;
+
+        if (chunk > size)
+            chunk = size;
+
+        dierr = GetSlot(unit, (unitOff == 0 && chunk == unitLen), &slot);
+        if (dierr != kDIErrNone)
+            return dierr;
+        memcpy(SlotData(slot) + unitOff, inPtr, chunk);
+        if (!fSlots[slot].dirty) {
+            fSlots[slot].dirty = true;
+            fNumDirty++;
+        }
+
+        inPtr += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+
+    return kDIErrNone;
+}
+
+/*
+ * Write all dirty units to the GFD.
+ *
+ * Units are written in ascending order, so the file sees something close
+ * to a sequential write.
+ */
+DIError BlockCache::Flush(void)
+{
+    DIError dierr = kDIErrNone;
+    long* dirtyList = NULL;
+    long numDirty = 0;
+
+    if (fNumDirty == 0)
+        return kDIErrNone;
+
+    LOGD(" BlockCache flushing %ld dirty units", fNumDirty);
+
+    dirtyList = new long[fNumDirty];
+    if (dirtyList == NULL)
+        return kDIErrMalloc;
+
+    for (long i = 0; i < fNumSlots; i++) {
+        if (fSlots[i].dirty)
+            dirtyList[numDirty++] = i;
+    }
+    assert(numDirty == fNumDirty);
+
+    /* insertion sort; the list is short and usually nearly in order */
+    for (long i = 1; i < numDirty; i++) {
+        long slot = dirtyList[i];
+        long j = i - 1;
+        while (j >= 0 && fSlots[dirtyList[j]].unit > fSlots[slot].unit) {
+            dirtyList[j+1] = dirtyList[j];
+            j--;
+        }
+        dirtyList[j+1] = slot;
+    }
+
+    for (long i = 0; i < numDirty; i++) {
+        dierr = WriteBackSlot(dirtyList[i]);
+        if (dierr != kDIErrNone)
+            goto bail;
+    }
+
+bail:
+    delete[] dirtyList;
+    return dierr;
+}
+
+/*
+ * Read from the GFD.
+ */
+DIError BlockCache::ReadDirect(void* buf, di_off_t offset, int size)
+{
+    DIError dierr;
+
+    dierr = fpGFD->Seek(offset, kSeekSet);
+    if (dierr != kDIErrNone) {
+        LOGI(" BlockCache seek off=%ld failed (err=%d)", (long) offset, dierr);
+        return dierr;
+    }
+
+    dierr = fpGFD->Read(buf, size);
+    if (dierr != kDIErrNone) {
+        LOGI(" BlockCache read off=%ld size=%d failed (err=%d)",
+            (long) offset, size, dierr);
+        return dierr;
+    }
+
+    return kDIErrNone;
+}
+
+/*
+ * Write to the GFD.
+ */
+DIError BlockCache::WriteDirect(const void* buf, di_off_t offset, int size)
+{
+    DIError dierr;
+
+    dierr = fpGFD->Seek(offset, kSeekSet);
+    if (dierr != kDIErrNone) {
+        LOGI(" BlockCache seek off=%ld failed (err=%d)", (long) offset, dierr);
+        return dierr;
+    }
+
+    dierr = fpGFD->Write(buf, size);
+    if (dierr != kDIErrNone) {
+        LOGI(" BlockCache write off=%ld size=%d failed (err=%d)",
+            (long) offset, size, dierr);
+        return dierr;
+    }
+
+    return kDIErrNone;
+}
@@ -0,0 +1,117 @@
+/*
+ * CiderPress
+ * Copyright (C) 2007 by faddenSoft, LLC.  All Rights Reserved.
+ * See the file LICENSE for distribution terms.
+ */
+/*
+ * Declarations for the block cache used by DiskImg.
+ */
+#ifndef DISKIMG_BLOCKCACHE_H
+#define DISKIMG_BLOCKCACHE_H
+
+namespace DiskImgLib {
+
+/*
+ * Size-bounded write-back cache that sits between DiskImg and its data
+ * GenericFD.
+ *
+ * The image is divided into 512-byte "units" aligned to the start of the
+ * data.  (The last unit may be short if the image isn't a multiple of 512
+ * bytes, e.g. some nibble images.)  Sector reads and writes land in half
+ * of a unit, block reads and writes in exactly one.  Units are found with
+ * a small chained hash table, and replaced with the CLOCK algorithm.
+ *
+ * Writes only touch the cache; the unit is marked dirty and written back
+ * when it's evicted or when Flush() is called.  DiskImg::FlushImage must
+ * call Flush() before anybody (e.g. an ImageWrapper) reads the GFD
+ * directly.
+ *
+ * Requests larger than a fraction of the cache go straight to the GFD,
+ * with dirty cached data overlaid on reads and cached copies updated on
+ * writes, so that a big ReadBlocks call doesn't flush everything useful.
+ *
+ * This is not thread-safe.
+ */
+class BlockCache {
+public:
+    BlockCache(void) :
+        fpGFD(NULL), fLength(0), fNumSlots(0), fHashMask(0),
+        fStorage(NULL), fSlots(NULL), fHashTable(NULL), fClockHand(0),
+        fNumDirty(0), fHits(0), fMisses(0), fWriteBacks(0)
+        {}
+    ~BlockCache(void) {
+        // caller is expected to Flush first; dirty data is discarded
+        delete[] fStorage;
+        delete[] fSlots;
+        delete[] fHashTable;
+    }
+
+    enum { kUnitSize = 512 };
+
+    // prepare the cache; "numSlots" is the max #of 512-byte units held
+    DIError Create(GenericFD* pGFD, di_off_t length, long numSlots);
+
+    // read or write bytes, using the cache when possible
+    DIError Read(void* buf, di_off_t offset, int size);
+    DIError Write(const void* buf, di_off_t offset, int size);
+
+    // write all dirty units to the GFD
+    DIError Flush(void);
+
+    bool IsDirty(void) const { return fNumDirty != 0; }
+    long GetNumSlots(void) const { return fNumSlots; }
+    long GetHits(void) const { return fHits; }
+    long GetMisses(void) const { return fMisses; }
+    long GetWriteBacks(void) const { return fWriteBacks; }
+
+private:
+    enum { kNoSlot = -1 };
+
+    typedef struct Slot {
+        long        unit;           // unit number, or -1 if empty
+        long        hashNext;       // next slot in hash chain, or kNoSlot
+        bool        dirty;          // needs to be written back
+        bool        referenced;     // CLOCK "second chance" bit
+    } Slot;
+
+    long UnitLength(long unit) const {
+        di_off_t remaining = fLength - (di_off_t) unit * kUnitSize;
+        return remaining < kUnitSize ? (long) remaining : kUnitSize;
+    }
+    long HashUnit(long unit) const { return unit & fHashMask; }
+    uint8_t* SlotData(long slot) const {
+        return fStorage + slot * kUnitSize;
+    }
+
+    long FindSlot(long unit) const;
+    DIError GetSlot(long unit, bool willOverwrite, long* pSlot);
+    DIError EvictSlot(long slot);
+    DIError WriteBackSlot(long slot);
+    void UnlinkSlot(long slot);
+
+    DIError ReadDirect(void* buf, di_off_t offset, int size);
+    DIError WriteDirect(const void* buf, di_off_t offset, int size);
+
+    GenericFD*  fpGFD;          // data GFD; not owned by us
+    di_off_t    fLength;        // length of data in fpGFD
+    long        fNumSlots;
+    long        fHashMask;      // hash table size - 1 (power of 2)
+
+    uint8_t*    fStorage;       // fNumSlots * kUnitSize bytes
+    Slot*       fSlots;
+    long*       fHashTable;     // head of chain for each bucket
+    long        fClockHand;
+    long        fNumDirty;
+
+    long        fHits;
+    long        fMisses;
+    long        fWriteBacks;
+
+private:
+    BlockCache& operator=(const BlockCache&);
+    BlockCache(const BlockCache&);
+};
+
+}   // namespace DiskImgLib
+
+#endif /*DISKIMG_BLOCKCACHE_H*/
@@ -32,6 +32,7 @@
  * auto-probing.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 /*
@@ -19,6 +19,7 @@
  * filesystem implementations.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
@@ -137,10 +138,16 @@ bail:
  * on out must be handled somehow, possibly by claiming that the disk is
  * completely full and has no files on it.
  */
-DIError DiskFSCPM::Initialize(void)
+DIError DiskFSCPM::Initialize(InitMode initMode)
 {
     DIError dierr = kDIErrNone;
 
+    /* no volume name, and we don't report free space; nothing to read */
+    if (initMode == kInitHeaderOnly) {
+        LOGI(" CPM - headerOnly set, skipping file load");
+        goto bail;
+    }
+
     dierr = ReadCatalog();
     if (dierr != kDIErrNone)
         goto bail;
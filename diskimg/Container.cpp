@@ -7,6 +7,7 @@
  * Base "container FS" support.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
@@ -75,6 +75,7 @@ appear to have this issue.  Unfortunate that DDD 2.0 is what shipped on the
 SST disk.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagWrapper
 #include "DiskImgPriv.h"
 
 const int kNumSymbols = 256;
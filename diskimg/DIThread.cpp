@@ -0,0 +1,149 @@
+/*
+ * CiderPress
+ * Copyright (C) 2007 by faddenSoft, LLC.  All Rights Reserved.
+ * See the file LICENSE for distribution terms.
+ */
+/*
+ * Threading support.
+ */
+#include "StdAfx.h"
+#include "DiskImgPriv.h"
+#ifdef _WIN32
+# include <process.h>
+#endif
+
+
+/*
+ * ===========================================================================
+ *      DIMutex
+ * ===========================================================================
+ */
+
+#ifdef _WIN32
+DIMutex::DIMutex(void)
+{
+    InitializeCriticalSection(&fCritSec);
+}
+DIMutex::~DIMutex(void)
+{
+    DeleteCriticalSection(&fCritSec);
+}
+void DIMutex::Lock(void)
+{
+    EnterCriticalSection(&fCritSec);
+}
+void DIMutex::Unlock(void)
+{
+    LeaveCriticalSection(&fCritSec);
+}
+#else
+DIMutex::DIMutex(void)
+{
+    (void) pthread_mutex_init(&fMutex, NULL);
+}
+DIMutex::~DIMutex(void)
+{
+    (void) pthread_mutex_destroy(&fMutex);
+}
+void DIMutex::Lock(void)
+{
+    (void) pthread_mutex_lock(&fMutex);
+}
+void DIMutex::Unlock(void)
+{
+    (void) pthread_mutex_unlock(&fMutex);
+}
+#endif
+
+
+/*
+ * ===========================================================================
+ *      DIWorkerGroup
+ * ===========================================================================
+ */
+
+typedef struct WorkerStart {
+    DIWorkerGroup::WorkFunc func;
+    void*       arg;
+} WorkerStart;
+
+#ifdef _WIN32
+static unsigned __stdcall WorkerThreadEntry(void* vstart)
+{
+    WorkerStart* pStart = (WorkerStart*) vstart;
+    (*pStart->func)(pStart->arg);
+    return 0;
+}
+#else
+static void* WorkerThreadEntry(void* vstart)
+{
+    WorkerStart* pStart = (WorkerStart*) vstart;
+    (*pStart->func)(pStart->arg);
+    return NULL;
+}
+#endif
+
+/*
+ * Run "func" on "numThreads" threads, counting the caller.
+ */
+/*static*/ void DIWorkerGroup::Run(int numThreads, WorkFunc func, void* arg)
+{
+    WorkerStart start;
+    int numStarted = 0;
+
+    if (numThreads > kMaxThreads)
+        numThreads = kMaxThreads;
+
+    start.func = func;
+    start.arg = arg;
+
+#ifdef _WIN32
+    HANDLE threads[kMaxThreads];
+
+    while (numStarted < numThreads - 1) {
+        uintptr_t handle = _beginthreadex(NULL, 0, WorkerThreadEntry, &start,
+                            0, NULL);
+        if (handle == 0) {
+            LOGW(" DIWorkerGroup unable to start thread %d", numStarted);
+            break;
+        }
+        threads[numStarted++] = (HANDLE) handle;
+    }
+
+    (*func)(arg);
+
+    for (int i = 0; i < numStarted; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+#else
+    pthread_t threads[kMaxThreads];
+
+    while (numStarted < numThreads - 1) {
+        if (pthread_create(&threads[numStarted], NULL, WorkerThreadEntry,
+                &start) != 0)
+        {
+            LOGW(" DIWorkerGroup unable to start thread %d", numStarted);
+            break;
+        }
+        numStarted++;
+    }
+
+    (*func)(arg);
+
+    for (int i = 0; i < numStarted; i++)
+        pthread_join(threads[i], NULL);
+#endif
+}
+
+/*static*/ int DIWorkerGroup::GetProcessorCount(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int) info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int) count : 1;
+#endif
+}
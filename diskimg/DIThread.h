@@ -0,0 +1,92 @@
+/*
+ * CiderPress
+ * Copyright (C) 2007 by faddenSoft, LLC.  All Rights Reserved.
+ * See the file LICENSE for distribution terms.
+ */
+/*
+ * Minimal threading support: a mutex, and a way to run a function on
+ * several threads at once.  Uses Win32 threads under Windows and pthreads
+ * everywhere else.
+ */
+#ifndef DISKIMG_DITHREAD_H
+#define DISKIMG_DITHREAD_H
+
+#ifndef _WIN32
+# include <pthread.h>
+#endif
+
+namespace DiskImgLib {
+
+/*
+ * Plain (non-recursive) mutex.
+ */
+class DIMutex {
+public:
+    DIMutex(void);
+    ~DIMutex(void);
+
+    void Lock(void);
+    void Unlock(void);
+
+private:
+#ifdef _WIN32
+    CRITICAL_SECTION    fCritSec;
+#else
+    pthread_mutex_t     fMutex;
+#endif
+
+    DIMutex& operator=(const DIMutex&);
+    DIMutex(const DIMutex&);
+};
+
+/*
+ * Hold a mutex for the lifetime of the object.  A NULL mutex is allowed,
+ * and does nothing.
+ */
+class DIAutoLock {
+public:
+    DIAutoLock(DIMutex* pMutex) : fpMutex(pMutex) {
+        if (fpMutex != NULL)
+            fpMutex->Lock();
+    }
+    ~DIAutoLock(void) {
+        if (fpMutex != NULL)
+            fpMutex->Unlock();
+    }
+
+private:
+    DIMutex*    fpMutex;
+
+    DIAutoLock& operator=(const DIAutoLock&);
+    DIAutoLock(const DIAutoLock&);
+};
+
+/*
+ * Run a function on a group of threads, and wait for all of them to
+ * finish.
+ *
+ * The calling thread is one of the group.  The function is expected to
+ * pull work items from a queue it shares with the other threads until
+ * the queue is empty, so if we can't create as many threads as we'd like,
+ * the work still gets done, just more slowly.
+ */
+class DIWorkerGroup {
+public:
+    typedef void (*WorkFunc)(void* arg);
+
+    static void Run(int numThreads, WorkFunc func, void* arg);
+
+    // returns the number of processors available, or 1 if unknown
+    static int GetProcessorCount(void);
+
+    enum { kMaxThreads = 64 };
+
+private:
+    // no instantiation allowed
+    DIWorkerGroup(void) {}
+    ~DIWorkerGroup(void) {}
+};
+
+}   // namespace DiskImgLib
+
+#endif /*DISKIMG_DITHREAD_H*/
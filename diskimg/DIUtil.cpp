@@ -306,6 +306,45 @@ char* DiskImgLib::StrcpyNew(const char* str)
     return newStr;
 }
 
+/*
+ * Like localtime() and gmtime(), but the result goes into "*pTm" instead
+ * of a static buffer shared by every thread.
+ */
+struct tm* DiskImgLib::LocalTimeR(const time_t* pWhen, struct tm* pTm)
+{
+#ifdef _WIN32
+    if (localtime_s(pTm, pWhen) != 0)
+        return NULL;
+    return pTm;
+#else
+    return localtime_r(pWhen, pTm);
+#endif
+}
+struct tm* DiskImgLib::GmTimeR(const time_t* pWhen, struct tm* pTm)
+{
+#ifdef _WIN32
+    if (gmtime_s(pTm, pWhen) != 0)
+        return NULL;
+    return pTm;
+#else
+    return gmtime_r(pWhen, pTm);
+#endif
+}
+
+/*
+ * Like ctime(), but formats into "buf".  Returns NULL on failure.
+ */
+char* DiskImgLib::CTimeR(const time_t* pWhen, char* buf)
+{
+#ifdef _WIN32
+    if (ctime_s(buf, kCTimeBufLen, pWhen) != 0)
+        return NULL;
+    return buf;
+#else
+    return ctime_r(pWhen, buf);
+#endif
+}
+
 
 #ifdef _WIN32
 /*
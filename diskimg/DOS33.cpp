@@ -11,6 +11,7 @@
  * BUG: does not keep VolumeUsage up to date.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
@@ -221,17 +222,21 @@ DIError DiskFSDOS33::Initialize(InitMode initMode)
     if (dierr != kDIErrNone)
         goto bail;
 
-    /* run through and get file lengths and data offsets */
+    /*
+     * Run through and get file lengths and data offsets.  We need the
+     * lengths for a file listing, so this happens even in lazy mode.
+     */
     dierr = GetFileLengths();
     if (dierr != kDIErrNone)
         goto bail;
 
-    /* mark DOS tracks appropriately */
-    FixVolumeUsageMap();
-
-    fDiskIsGood = CheckDiskIsGood();
+    if (initMode == kInitLazy) {
+        LOGI(" DOS - lazy init, deferring disk check");
+        SetLazyLoadPending();
+        goto bail;
+    }
 
-    fVolumeUsage.Dump();
+    FinishVolumeScan();
 
 //  A2File* pFile;
 //  pFile = GetNextFile(NULL);
@@ -863,6 +868,28 @@ DIError DiskFSDOS33::ProcessCatalogSector(int catTrack, int catSect,
     return kDIErrNone;
 }
 
+/*
+ * Finish the usage map and check the disk for damage.
+ */
+void DiskFSDOS33::FinishVolumeScan(void)
+{
+    /* mark DOS tracks appropriately */
+    FixVolumeUsageMap();
+
+    fDiskIsGood = CheckDiskIsGood();
+
+    fVolumeUsage.Dump();
+}
+
+/*
+ * Do the checks a lazy Initialize skipped.
+ */
+DIError DiskFSDOS33::FinishLazyLoad(void)
+{
+    FinishVolumeScan();
+    return kDIErrNone;
+}
+
 /*
  * Perform consistency checks on the filesystem.
  *
@@ -1663,6 +1690,7 @@ DIError DiskFSDOS33::CreateFile(const CreateParms* pParms,  A2File** ppNewFile)
 
     if (fpImg->GetReadOnly())
         return kDIErrAccessDenied;
+    (void) CompleteLazyLoad();
     if (!fDiskIsGood)
         return kDIErrBadDiskImage;
 
@@ -2011,6 +2039,7 @@ DIError DiskFSDOS33::DeleteFile(A2File* pGenericFile)
 
     if (fpImg->GetReadOnly())
         return kDIErrAccessDenied;
+    (void) CompleteLazyLoad();
     if (!fDiskIsGood)
         return kDIErrBadDiskImage;
     if (pGenericFile->IsFileOpen())
@@ -2117,6 +2146,7 @@ DIError DiskFSDOS33::RenameFile(A2File* pGenericFile, const char* newName)
         return kDIErrInvalidArg;
     if (fpImg->GetReadOnly())
         return kDIErrAccessDenied;
+    (void) CompleteLazyLoad();
     if (!fDiskIsGood)
         return kDIErrBadDiskImage;
 
@@ -2150,6 +2180,7 @@ DIError DiskFSDOS33::RenameFile(A2File* pGenericFile, const char* newName)
     A2FileDOS::TrimTrailingSpaces(storedName);
 
     strcpy(pFile->fFileName, storedName);
+    InvalidateFileIndex();
 
 bail:
     return dierr;
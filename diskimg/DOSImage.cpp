@@ -7,6 +7,7 @@
  * DOS images.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 namespace DiskImgLib {
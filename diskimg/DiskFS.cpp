@@ -7,8 +7,15 @@
  * DiskFS base class.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
+/*
+ * Below this many files, scanning the list is about as fast as hashing the
+ * name, so we don't bother building an index.
+ */
+const long kMinIndexedFiles = 64;
+
 
 /*
  * ===========================================================================
@@ -46,6 +53,207 @@ void A2File::ResetQuality(void)
 }
 
 
+/*
+ * ===========================================================================
+ *      FileIndex
+ * ===========================================================================
+ */
+
+FileIndex::FileIndex(const uint8_t* foldTable) :
+    fFoldTable(foldTable),
+    fNumBuckets(kInitialBuckets),
+    fNumEntries(0)
+{
+    fNameBuckets = new Node*[fNumBuckets];
+    fKeyBuckets = new Node*[fNumBuckets];
+    memset(fNameBuckets, 0, fNumBuckets * sizeof(Node*));
+    memset(fKeyBuckets, 0, fNumBuckets * sizeof(Node*));
+}
+
+FileIndex::~FileIndex(void)
+{
+    /* every node is on exactly one name chain */
+    for (uint32_t i = 0; i < fNumBuckets; i++) {
+        Node* pNode = fNameBuckets[i];
+        while (pNode != NULL) {
+            Node* pNext = pNode->pNameNext;
+            delete pNode;
+            pNode = pNext;
+        }
+    }
+    delete[] fNameBuckets;
+    delete[] fKeyBuckets;
+}
+
+/*
+ * Hash a pathname (FNV-1a), folding each character first.
+ */
+uint32_t FileIndex::HashName(const char* str) const
+{
+    const uint8_t* ptr = (const uint8_t*) str;
+    uint32_t hash = 2166136261U;
+
+    if (fFoldTable != NULL) {
+        while (*ptr != '\0')
+            hash = (hash ^ fFoldTable[*ptr++]) * 16777619U;
+    } else {
+        while (*ptr != '\0') {
+            uint8_t ch = *ptr++;
+            if (ch >= 'A' && ch <= 'Z')
+                ch += 'a' - 'A';
+            hash = (hash ^ ch) * 16777619U;
+        }
+    }
+    return hash;
+}
+
+/*
+ * Add a file to the index.  "key" is -1 if the file doesn't have one.
+ */
+void FileIndex::Add(A2File* pFile, long key)
+{
+    if ((uint32_t) fNumEntries >= fNumBuckets)
+        Grow();
+
+    Node* pNode = new Node;
+    pNode->pFile = pFile;
+    pNode->nameHash = HashName(pFile->GetPathName());
+    pNode->key = key;
+
+    Node** ppBucket = &fNameBuckets[pNode->nameHash & (fNumBuckets-1)];
+    pNode->pNameNext = *ppBucket;
+    *ppBucket = pNode;
+
+    if (key >= 0) {
+        ppBucket = &fKeyBuckets[HashKey(key) & (fNumBuckets-1)];
+        pNode->pKeyNext = *ppBucket;
+        *ppBucket = pNode;
+    } else {
+        pNode->pKeyNext = NULL;
+    }
+
+    fNumEntries++;
+}
+
+/*
+ * Remove a file from the index.  The file's pathname must be the same as
+ * it was when the file was added.
+ */
+bool FileIndex::Remove(A2File* pFile)
+{
+    uint32_t nameHash = HashName(pFile->GetPathName());
+    Node** ppNode = &fNameBuckets[nameHash & (fNumBuckets-1)];
+
+    while (*ppNode != NULL && (*ppNode)->pFile != pFile)
+        ppNode = &(*ppNode)->pNameNext;
+    if (*ppNode == NULL)
+        return false;
+
+    Node* pNode = *ppNode;
+    *ppNode = pNode->pNameNext;
+
+    if (pNode->key >= 0) {
+        ppNode = &fKeyBuckets[HashKey(pNode->key) & (fNumBuckets-1)];
+        while (*ppNode != pNode) {
+            assert(*ppNode != NULL);
+            ppNode = &(*ppNode)->pKeyNext;
+        }
+        *ppNode = pNode->pKeyNext;
+    }
+
+    delete pNode;
+    fNumEntries--;
+    return true;
+}
+
+/*
+ * Find a file by pathname.  If more than one file matches, we return one
+ * of them and set "*pAmbiguous", so the caller can figure out which one
+ * comes first in the file list.
+ */
+A2File* FileIndex::FindByName(const char* pathName,
+    DiskFS::StringCompareFunc func, bool* pAmbiguous) const
+{
+    uint32_t nameHash = HashName(pathName);
+    A2File* pFound = NULL;
+
+    *pAmbiguous = false;
+    for (Node* pNode = fNameBuckets[nameHash & (fNumBuckets-1)];
+        pNode != NULL; pNode = pNode->pNameNext)
+    {
+        if (pNode->nameHash != nameHash ||
+            (*func)(pNode->pFile->GetPathName(), pathName) != 0)
+        {
+            continue;
+        }
+        if (pFound != NULL) {
+            *pAmbiguous = true;
+            break;
+        }
+        pFound = pNode->pFile;
+    }
+
+    return pFound;
+}
+
+/*
+ * Find the next file that was added with "key", after "pPrev".
+ */
+A2File* FileIndex::FindByKey(long key, const A2File* pPrev) const
+{
+    Node* pNode = fKeyBuckets[HashKey(key) & (fNumBuckets-1)];
+
+    if (pPrev != NULL) {
+        while (pNode != NULL && pNode->pFile != pPrev)
+            pNode = pNode->pKeyNext;
+        if (pNode == NULL)
+            return NULL;
+        pNode = pNode->pKeyNext;
+    }
+
+    while (pNode != NULL && pNode->key != key)
+        pNode = pNode->pKeyNext;
+    return pNode != NULL ? pNode->pFile : NULL;
+}
+
+/*
+ * Double the number of buckets, and redistribute the entries.
+ */
+void FileIndex::Grow(void)
+{
+    uint32_t newNumBuckets = fNumBuckets * 2;
+    Node** newNameBuckets = new Node*[newNumBuckets];
+    Node** newKeyBuckets = new Node*[newNumBuckets];
+    memset(newNameBuckets, 0, newNumBuckets * sizeof(Node*));
+    memset(newKeyBuckets, 0, newNumBuckets * sizeof(Node*));
+
+    for (uint32_t i = 0; i < fNumBuckets; i++) {
+        Node* pNode = fNameBuckets[i];
+        while (pNode != NULL) {
+            Node* pNext = pNode->pNameNext;
+            Node** ppBucket = &newNameBuckets[pNode->nameHash &
+                                (newNumBuckets-1)];
+            pNode->pNameNext = *ppBucket;
+            *ppBucket = pNode;
+
+            if (pNode->key >= 0) {
+                ppBucket = &newKeyBuckets[HashKey(pNode->key) &
+                                (newNumBuckets-1)];
+                pNode->pKeyNext = *ppBucket;
+                *ppBucket = pNode;
+            }
+            pNode = pNext;
+        }
+    }
+
+    delete[] fNameBuckets;
+    delete[] fKeyBuckets;
+    fNameBuckets = newNameBuckets;
+    fKeyBuckets = newKeyBuckets;
+    fNumBuckets = newNumBuckets;
+}
+
+
 /*
  * ===========================================================================
  *      DiskFS
@@ -143,141 +351,230 @@ void DiskFS::SetAllReadOnly(bool val)
  * Everything contained within a subdir comes after the subdir entry and
  * before any entries from later subdirs at the same level.
  *
- * It's unclear whether a linear list or a hierarchical tree structure is
- * the most appropriate way to hold the data.  The tree is easier to update,
- * but the linear list corresponds to the primary view in CiderPress, and
- * lists are simpler and easier to manage.  For now I'm sticking with a list.
+ * The linear list corresponds to the primary view in CiderPress, and is
+ * what GetNextFile walks.  Alongside it, every directory holds a
+ * FileChildList with its immediate children in list order (files with no
+ * parent go in fpRootFiles).  That lets us find the end of a subdir, or
+ * a file's position among its siblings, in time proportional to the size
+ * of the directory rather than the volume.
  *
  * The files MUST be in the order in which they came from the disk.  This
  * doesn't matter most of the time, but for Pascal volumes it's essential
  * for ensuring that the Write command doesn't run over the next file.
  */
 
+/*
+ * Get the child list for "pDir", or the top-level list if "pDir" is NULL.
+ * If "create" is set, an empty list is allocated if necessary.
+ */
+FileChildList* DiskFS::GetChildList(const A2File* pDir, bool create) const
+{
+    FileChildList** ppList;
+
+    if (pDir == NULL)
+        ppList = const_cast<FileChildList**>(&fpRootFiles);
+    else
+        ppList = &(const_cast<A2File*>(pDir))->fpChildren;
+
+    if (*ppList == NULL && create)
+        *ppList = new FileChildList;
+    return *ppList;
+}
+
+/*
+ * Link "pFile" into the linear list after "pPrev".  If "pPrev" is NULL,
+ * the file goes at the head of the list.
+ */
+void DiskFS::LinkFileAfter(A2File* pFile, A2File* pPrev)
+{
+    A2File* pNext = (pPrev == NULL) ? fpA2Head : pPrev->GetNext();
+
+    pFile->SetPrev(pPrev);
+    pFile->SetNext(pNext);
+    if (pPrev == NULL)
+        fpA2Head = pFile;
+    else
+        pPrev->SetNext(pFile);
+    if (pNext == NULL)
+        fpA2Tail = pFile;
+    else
+        pNext->SetPrev(pFile);
+}
+
 /*
  * Add a file to the end of our list.
+ *
+ * The file's parent, if any, must already be in the list, and the file
+ * becomes the parent's last child.  Filesystem scans add files in list
+ * order, so this holds naturally.
+ *
+ * While a pending directory is being loaded, "the end of the list" is the
+ * end of that directory, so its entries land where an eager scan would
+ * have put them.
  */
 void DiskFS::AddFileToList(A2File* pFile)
 {
     assert(pFile->GetNext() == NULL);
 
-    if (fpA2Head == NULL) {
-        assert(fpA2Tail == NULL);
-        fpA2Head = fpA2Tail = pFile;
+    fFileCount++;
+    if (fpFileIndex != NULL)
+        fpFileIndex->Add(pFile, GetFileIndexKey(pFile));
+
+    if (fpInsertAfter != NULL) {
+        LinkFileAfter(pFile, fpInsertAfter);
+        fpInsertAfter = pFile;
     } else {
-        pFile->SetPrev(fpA2Tail);
-        fpA2Tail->SetNext(pFile);
-        fpA2Tail = pFile;
+        LinkFileAfter(pFile, fpA2Tail);
     }
+    GetChildList(pFile->GetParent(), true)->Append(pFile);
 }
 
 /*
  * Insert a file into its appropriate place in the list, based on a file
  * hierarchy.
  *
- * Pass in the thing to be added ("pFile") and the previous entry ("pPrev").
- * An empty hierarchic filesystem will have an entry for the volume dir, so
- * we should never have an empty list or a NULL pPrev.
+ * Pass in the thing to be added ("pFile") and the previous entry ("pPrev"),
+ * which is either the file's parent (making it the first thing in the
+ * directory) or a sibling.  An empty hierarchic filesystem will have an
+ * entry for the volume dir, so we should never have an empty list or a
+ * NULL pPrev there.
  *
- * The part where things go pear-shaped happens if "pPrev" is a subdirectory.
- * If so, we need to come after all of the subdir's entries, including any
- * entries for sub-subdirs.  There's no graceful way to go about this in a
- * linear list.
- *
- * (We'd love to be able to find the *next* entry and then back up one,
- * but odds are that there isn't a "next" entry if we're busily creating
- * files.)
+ * If "pPrev" is a subdirectory, we need to come after all of the subdir's
+ * entries, including any entries for sub-subdirs.  SkipSubdir finds that
+ * by following the last child down the tree.
  */
 void DiskFS::InsertFileInList(A2File* pFile, A2File* pPrev)
 {
     assert(pFile->GetNext() == NULL);
 
-    if (fpA2Head == NULL) {
-        assert(pPrev == NULL);
-        fpA2Head = fpA2Tail = pFile;
-        return;
-    } else if (pPrev == NULL) {
+    fFileCount++;
+    if (fpFileIndex != NULL)
+        fpFileIndex->Add(pFile, GetFileIndexKey(pFile));
+
+    A2File* pParent = pFile->GetParent();
+    FileChildList* pSiblings = GetChildList(pParent, true);
+
+    if (pPrev == NULL) {
         // create two entries on DOS disk, delete first, add new file
-        pFile->SetNext(fpA2Head);
-        fpA2Head = pFile;
+        assert(pParent == NULL);
+        LinkFileAfter(pFile, NULL);
+        pSiblings->InsertAt(0, pFile);
         return;
     }
 
-    /*
-     * If we're inserting after the parent (i.e. we're the very first thing
-     * in a subdir) or after a plain file, just drop it in.
-     *
-     * If we're inserting after a subdir, go fish.
-     */
-    if (pPrev->IsDirectory() && pFile->GetParent() != pPrev) {
-        pPrev = SkipSubdir(pPrev);
+    if (pPrev == pParent) {
+        /* very first thing in the subdir */
+        LinkFileAfter(pFile, pPrev);
+        pSiblings->InsertAt(0, pFile);
+        return;
     }
 
-    pFile->SetNext(pPrev->GetNext());
-    pPrev->SetNext(pFile);
+    long idx = pSiblings->IndexOf(pPrev);
+    if (idx < 0) {
+        /* shouldn't happen; put it at the end of the directory */
+        LOGW("GLITCH: insert after '%s', not in same dir as '%s'",
+            pPrev->GetPathName(), pFile->GetPathName());
+        assert(false);
+        idx = pSiblings->GetCount() - 1;
+        if (idx >= 0)
+            pPrev = pSiblings->GetAt(idx);
+        else if (pParent != NULL)
+            pPrev = pParent;
+        else
+            pPrev = fpA2Tail;
+    }
+
+    LinkFileAfter(pFile, SkipSubdir(pPrev));
+    pSiblings->InsertAt(idx + 1, pFile);
 }
 
 /*
  * Skip over all entries in the subdir we're pointing to.
  *
- * The return value is the very last entry in the subdir.
+ * The return value is the very last entry in the subdir, found by following
+ * the last child of each level down.  If "pSubdir" has no children (or
+ * isn't a directory at all), it's returned unchanged.
  */
-A2File* DiskFS::SkipSubdir(A2File* pSubdir)
+A2File* DiskFS::SkipSubdir(A2File* pSubdir) const
 {
-    if (pSubdir->GetNext() == NULL)
-        return pSubdir;     // end of list reached -- subdir is empty
+    while (pSubdir->fpChildren != NULL && pSubdir->fpChildren->GetCount() > 0)
+        pSubdir = pSubdir->fpChildren->GetLast();
+    return pSubdir;
+}
 
-    A2File* pCur = pSubdir;
-    A2File* pNext = NULL;
+/*
+ * Delete a member from the list.  If it's a directory, everything in it
+ * goes too.
+ *
+ * The subtree is a contiguous run in the linear list, ending with the
+ * subdir's last descendant, so unlinking it is cheap.  Finding the file
+ * among its siblings is proportional to the size of its directory.
+ */
+void DiskFS::DeleteFileFromList(A2File* pFile)
+{
+    FileChildList* pSiblings = GetChildList(pFile->GetParent(), false);
+    long idx = (pSiblings == NULL) ? -1 : pSiblings->IndexOf(pFile);
+    if (idx < 0) {
+        LOGI("GLITCH: couldn't find element to delete!");
+        assert(false);
+        return;
+    }
+    pSiblings->RemoveAt(idx);
 
-    assert(pCur != NULL);    // at least one time through the loop
+    A2File* pLast = SkipSubdir(pFile);
+    A2File* pPrev = pFile->GetPrev();
+    A2File* pNext = pLast->GetNext();
+    if (pPrev == NULL)
+        fpA2Head = pNext;
+    else
+        pPrev->SetNext(pNext);
+    if (pNext == NULL)
+        fpA2Tail = pPrev;
+    else
+        pNext->SetPrev(pPrev);
+    pLast->SetNext(NULL);
 
-    while (pCur != NULL) {
-        pNext = pCur->GetNext();
-        if (pNext == NULL)               // end of list reached
-            return pCur;
+    while (pFile != NULL) {
+        A2File* pFollow = pFile->GetNext();
 
-        if (pNext->GetParent() != pSubdir)  // end of dir reached
-            return pCur;
-        if (pNext->IsDirectory())
-            pCur = SkipSubdir(pNext);   // get last entry in dir
-        else
-            pCur = pNext;               // advance forward one
+        if (fpFileIndex != NULL && !fpFileIndex->Remove(pFile)) {
+            LOGW("DiskFS file index out of sync, discarding");
+            InvalidateFileIndex();
+        }
+        fFileCount--;
+        if (pFile->fDirPending)
+            fPendingDirCount--;
+        delete pFile->fpChildren;
+        delete pFile;
+        pFile = pFollow;
     }
+}
 
-    /* should never get here */
-    assert(false);
-    return pNext;
+/*
+ * Return the number of files in directory "pDir" (NULL for the top level).
+ */
+long DiskFS::GetChildCount(const A2File* pDir) const
+{
+    if (pDir != NULL && pDir->fDirPending)
+        const_cast<DiskFS*>(this)->LoadPendingDir(const_cast<A2File*>(pDir));
+
+    FileChildList* pList = GetChildList(pDir, false);
+    return (pList == NULL) ? 0 : pList->GetCount();
 }
 
 /*
- * Delete a member from the list.
- *
- * We're currently singly-linked, making this rather expensive.
+ * Return the idx-th file in directory "pDir" (NULL for the top level), or
+ * NULL if "idx" is out of range.
  */
-void DiskFS::DeleteFileFromList(A2File* pFile)
+A2File* DiskFS::GetChild(const A2File* pDir, long idx) const
 {
-    if (fpA2Head == pFile) {
-        /* delete the head of the list */
-        fpA2Head = fpA2Head->GetNext();
-        delete pFile;
-    } else {
-        A2File* pCur = fpA2Head;
-        while (pCur != NULL) {
-            if (pCur->GetNext() == pFile) {
-                /* found it */
-                A2File* pNextNext = pCur->GetNext()->GetNext();
-                delete pCur->GetNext();
-                pCur->SetNext(pNextNext);
-                break;
-            }
-            pCur = pCur->GetNext();
-        }
+    if (pDir != NULL && pDir->fDirPending)
+        const_cast<DiskFS*>(this)->LoadPendingDir(const_cast<A2File*>(pDir));
 
-        if (pCur == NULL) {
-            LOGI("GLITCH: couldn't find element to delete!");
-            assert(false);
-        }
-    }
+    FileChildList* pList = GetChildList(pDir, false);
+    if (pList == NULL || idx < 0 || idx >= pList->GetCount())
+        return NULL;
+    return pList->GetAt(idx);
 }
 
 
@@ -289,6 +586,9 @@ void DiskFS::DeleteFileFromList(A2File* pFile)
  */
 A2File* DiskFS::GetNextFile(A2File* pFile) const
 {
+    if (fPendingDirCount != 0)
+        const_cast<DiskFS*>(this)->LoadAllPendingDirs(false);
+
     if (pFile == NULL)
         return fpA2Head;
     else
@@ -297,21 +597,125 @@ A2File* DiskFS::GetNextFile(A2File* pFile) const
 
 /*
  * Return the #of elements in the linear file list.
- *
- * Right now the only code that calls this is the disk info panel in
- * CiderPress, so we don't need it to be efficient.
  */
 long DiskFS::GetFileCount(void) const
 {
-    long count = 0;
+    if (fPendingDirCount != 0)
+        const_cast<DiskFS*>(this)->LoadAllPendingDirs(false);
+
+    return fFileCount;
+}
+
+/*
+ * Mark a directory whose contents haven't been read yet.
+ */
+void DiskFS::SetDirPending(A2File* pDir)
+{
+    assert(!pDir->fDirPending);
+    pDir->fDirPending = true;
+    fPendingDirCount++;
+}
+
+/*
+ * Read the contents of a pending directory.  New entries go right after
+ * the directory in the linear list.
+ *
+ * A directory that can't be read is marked damaged, which is what the
+ * eager scan does; whatever entries were read before the failure stay.
+ */
+void DiskFS::LoadPendingDir(A2File* pDir)
+{
+    DIError dierr;
 
+    assert(pDir->fDirPending);
+    assert(fpInsertAfter == NULL);
+    pDir->fDirPending = false;
+    fPendingDirCount--;
+
+    fpInsertAfter = pDir;
+    dierr = LoadDirectory(pDir);
+    fpInsertAfter = NULL;
+    if (dierr != kDIErrNone) {
+        LOGW(" DiskFS failed loading dir '%s' (err=%d)",
+            pDir->GetPathName(), dierr);
+        pDir->SetQuality(A2File::kQualityDamaged);
+    }
+}
+
+/*
+ * Read every pending directory.  A directory's entries immediately follow
+ * it in the list, so one pass picks up subdirs as they're added.
+ *
+ * If "canCancel" is set, the progress callback is checked between
+ * directories, and kDIErrCancelled is returned if it asks us to stop.
+ */
+DIError DiskFS::LoadAllPendingDirs(bool canCancel)
+{
     A2File* pFile = fpA2Head;
-    while (pFile != NULL) {
-        count++;
+
+    while (pFile != NULL && fPendingDirCount != 0) {
+        if (pFile->fDirPending) {
+            if (canCancel && !fpImg->UpdateScanProgress(NULL)) {
+                LOGI(" DiskFS lazy load cancelled by user");
+                return kDIErrCancelled;
+            }
+            LoadPendingDir(pFile);
+        }
         pFile = pFile->GetNext();
     }
+    assert(fPendingDirCount == 0);
+    return kDIErrNone;
+}
+
+/*
+ * Read the pending directories along "pathName", so that the file itself
+ * is in the list if it exists.
+ */
+void DiskFS::LoadPendingPath(const char* pathName, StringCompareFunc func)
+{
+    char* pathBuf = StrcpyNew(pathName);
+    char* cp = strchr(pathBuf, kDIFssep);
+
+    while (cp != NULL) {
+        *cp = '\0';
+        A2File* pDir = FindFileByName(pathBuf, func);
+        *cp = kDIFssep;
+        if (pDir == NULL)
+            break;
+        if (pDir->fDirPending)
+            LoadPendingDir(pDir);
+        cp = strchr(cp+1, kDIFssep);
+    }
+
+    delete[] pathBuf;
+}
+
+/*
+ * Finish loading a volume opened with kInitLazy.
+ */
+DIError DiskFS::CompleteLazyLoad(void)
+{
+    DIError dierr;
+
+    if (fPendingDirCount != 0) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "Scanning %s", GetVolumeName());
+        if (!fpImg->UpdateScanProgress(msg))
+            return kDIErrCancelled;
 
-    return count;
+        dierr = LoadAllPendingDirs(true);
+        if (dierr != kDIErrNone)
+            return dierr;
+    }
+    if (!fLazyLoadPending)
+        return kDIErrNone;
+
+    /* clear it first, in case the scans want the usage map */
+    fLazyLoadPending = false;
+    dierr = FinishLazyLoad();
+    if (dierr == kDIErrCancelled)
+        fLazyLoadPending = true;
+    return dierr;
 }
 
 /*
@@ -322,12 +726,19 @@ void DiskFS::DeleteFileList(void)
     A2File* pFile;
     A2File* pNext;
 
+    InvalidateFileIndex();
+
     pFile = fpA2Head;
     while (pFile != NULL) {
         pNext = pFile->GetNext();
+        delete pFile->fpChildren;
         delete pFile;
         pFile = pNext;
     }
+    fpA2Head = fpA2Tail = NULL;
+    delete fpRootFiles;
+    fpRootFiles = NULL;
+    fFileCount = 0;
 }
 
 /*
@@ -356,22 +767,114 @@ void DiskFS::DumpFileList(void)
  */
 A2File* DiskFS::GetFileByName(const char* fileName, StringCompareFunc func)
 {
-    A2File* pFile;
-
     if (func == NULL)
         func = ::strcasecmp;
 
-    pFile = GetNextFile(NULL);
+    if (fPendingDirCount != 0)
+        LoadPendingPath(fileName, func);
+
+    return FindFileByName(fileName, func);
+}
+
+/*
+ * Do the actual lookup for GetFileByName.  "func" may not be NULL.
+ *
+ * This looks only at what's in the list now, and doesn't read pending
+ * directories.
+ */
+A2File* DiskFS::FindFileByName(const char* fileName, StringCompareFunc func)
+{
+    A2File* pFile;
+
+    if (func == ::strcasecmp ||
+        (func == fFoldCompareFunc && fFoldCompareFunc != NULL))
+    {
+        if (fpFileIndex != NULL || BuildFileIndex()) {
+            bool ambiguous;
+            pFile = fpFileIndex->FindByName(fileName, func, &ambiguous);
+            if (!ambiguous)
+                return pFile;
+            /* duplicate names on a damaged disk; want the first one */
+        }
+    }
+
+    pFile = fpA2Head;
     while (pFile != NULL) {
         if ((*func)(pFile->GetPathName(), fileName) == 0)
             return pFile;
 
-        pFile = GetNextFile(pFile);
+        pFile = pFile->GetNext();
     }
 
     return NULL;
 }
 
+/*
+ * Set the case-folding table used for the name index.
+ */
+void DiskFS::SetFileNameFolding(const uint8_t* foldTable,
+    StringCompareFunc func)
+{
+    InvalidateFileIndex();
+    fpFoldTable = foldTable;
+    fFoldCompareFunc = func;
+}
+
+/*
+ * Throw the index away.  It'll be rebuilt the next time somebody does a
+ * lookup.
+ */
+void DiskFS::InvalidateFileIndex(void)
+{
+    delete fpFileIndex;
+    fpFileIndex = NULL;
+}
+
+/*
+ * Build the name and key index from the file list.  Returns false if the
+ * list is too short to be worth indexing.
+ */
+bool DiskFS::BuildFileIndex(void)
+{
+    assert(fpFileIndex == NULL);
+    if (fFileCount < kMinIndexedFiles)
+        return false;
+
+    fpFileIndex = new FileIndex(fpFoldTable);
+    for (A2File* pFile = fpA2Head; pFile != NULL; pFile = pFile->GetNext())
+        fpFileIndex->Add(pFile, GetFileIndexKey(pFile));
+
+    LOGD("DiskFS indexed %ld files", fpFileIndex->GetNumEntries());
+    return true;
+}
+
+/*
+ * Find the file in directory "pParent" whose key is "key".
+ *
+ * Keys can change after a file has been indexed (e.g. a ProDOS seedling
+ * growing into a sapling), so each candidate is checked against its
+ * current key.
+ */
+A2File* DiskFS::GetFileByIndexKey(long key, const A2File* pParent)
+{
+    A2File* pFound = NULL;
+
+    if (fpFileIndex == NULL && !BuildFileIndex())
+        return NULL;
+
+    A2File* pFile = fpFileIndex->FindByKey(key, NULL);
+    while (pFile != NULL) {
+        if (pFile->GetParent() == pParent && GetFileIndexKey(pFile) == key) {
+            if (pFound != NULL)
+                return NULL;        // damaged disk; let the caller sort it out
+            pFound = pFile;
+        }
+        pFile = fpFileIndex->FindByKey(key, pFile);
+    }
+
+    return pFound;
+}
+
 
 /*
  * Add a sub-volume to the end of our list.
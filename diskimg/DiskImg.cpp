@@ -231,13 +231,24 @@ DiskImg::DiskImg(void)
     fNumNibbleDescrEntries = NELEM(kStdNibbleDescrs);
     memcpy(fpNibbleDescrTable, kStdNibbleDescrs, sizeof(kStdNibbleDescrs));
 
-    fNibbleTrackBuf = NULL;
-    fNibbleTrackLoaded = -1;
+    fpNibbleSlots = NULL;
+    fNibbleUseCounter = 0;
+
+    fpBlockCache = NULL;
+    fBlockCacheSize = kDefaultBlockCacheSize;
+    fParentOffset = 0;
+    fpProbeSnapshot = NULL;
+
+    fHaveFileId = false;
+    fFileIdSize = 0;
+    fFileIdMtime = 0;
+    fFileIdHash = 0;
 
     fNuFXCompressType = kNuThreadFormatLZW2;
 
     fNotes = NULL;
     fpBadBlockMap = NULL;
+    fpDirtyMap = NULL;
     fDiskFSRefCnt = 0;
 }
 
@@ -251,11 +262,14 @@ DiskImg::~DiskImg(void)
     }
     (void) CloseImage();
     delete[] fpNibbleDescrTable;
-    delete[] fNibbleTrackBuf;
+    FreeNibbleTracks();
     delete[] fNotes;
     delete fpBadBlockMap;
+    delete fpDirtyMap;
 
     /* normally these will be closed, but perhaps not if something failed */
+    delete fpBlockCache;
+    delete fpProbeSnapshot;
     if (fpOuterGFD != NULL)
         delete fpOuterGFD;
     if (fpWrapperGFD != NULL)
@@ -293,6 +307,9 @@ void DiskImg::SetCustomNibbleDescr(const NibbleDescr* pDescr)
         //  kNibbleDescrCustom, pDescr->special);
         fpNibbleDescrTable[kNibbleDescrCustom] = *pDescr;
         fpNibbleDescr = &fpNibbleDescrTable[kNibbleDescrCustom];
+
+        /* cached tracks may have been indexed with the old contents */
+        InvalidateNibbleMaps();
     }
 }
 
@@ -362,19 +379,51 @@ DIError DiskImg::OpenImage(const char* pathName, char fssep, bool readOnly)
             goto bail;
 #endif
     } else {
-        GFDFile* pGFDFile = new GFDFile;
+#ifdef HAVE_MMAP
+        /*
+         * Map the file if we can.  Sector and block reads become a
+         * memcpy, and we don't need the block cache.  If it can't be
+         * mapped (e.g. it's a device), fall back on plain file I/O.
+         */
+        GFDMmap* pGFDMmap = new GFDMmap;
 
-        dierr = pGFDFile->Open(pathName, fReadOnly);
-        if (dierr != kDIErrNone) {
-            delete pGFDFile;
-            goto bail;
+        if (pGFDMmap->Open(pathName, fReadOnly) == kDIErrNone) {
+            fpWrapperGFD = pGFDMmap;
+        } else {
+            delete pGFDMmap;
         }
+        pGFDMmap = NULL;
+#endif
 
-        //fImageFileName = new char[strlen(pathName) + 1];
-        //strcpy(fImageFileName, pathName);
+        if (fpWrapperGFD == NULL) {
+            GFDFile* pGFDFile = new GFDFile;
 
-        fpWrapperGFD = pGFDFile;
-        pGFDFile = NULL;
+            dierr = pGFDFile->Open(pathName, fReadOnly);
+            if (dierr != kDIErrNone) {
+                delete pGFDFile;
+                goto bail;
+            }
+
+            //fImageFileName = new char[strlen(pathName) + 1];
+            //strcpy(fImageFileName, pathName);
+
+            fpWrapperGFD = pGFDFile;
+            pGFDFile = NULL;
+        }
+
+        /* identify the file, so AnalyzeImage can use the format cache */
+        if (Global::GetFormatCache() != NULL) {
+            FormatCache::FileId fileId;
+
+            if (FormatCache::IdentifyFile(pathName, fpWrapperGFD,
+                    &fileId) == kDIErrNone)
+            {
+                fHaveFileId = true;
+                fFileIdSize = fileId.size;
+                fFileIdMtime = fileId.mtime;
+                fFileIdHash = fileId.hash;
+            }
+        }
 
         dierr = AnalyzeImageFile(pathName, fssep);
         if (dierr != kDIErrNone)
@@ -468,7 +517,12 @@ DIError DiskImg::OpenImage(DiskImg* pParent, long firstBlock, long numBlocks)
     GFDGFD* pGFDGFD;
 
     pGFDGFD = new GFDGFD;
-    dierr = pGFDGFD->Open(pParent->fpDataGFD, firstBlock * kBlockSize, fReadOnly);
+    {
+        // opening the GFDGFD seeks the parent's GFD
+        DIAutoLock lock(pParent->GetProbeLock());
+        dierr = pGFDGFD->Open(pParent->fpDataGFD, firstBlock * kBlockSize,
+                    fReadOnly);
+    }
     if (dierr != kDIErrNone) {
         delete pGFDGFD;
         return dierr;
@@ -489,6 +543,7 @@ DIError DiskImg::OpenImage(DiskImg* pParent, long firstBlock, long numBlocks)
     fOrder = pParent->fOrder;
 
     fpParentImg = pParent;
+    fParentOffset = (di_off_t) firstBlock * kBlockSize;
 
     return dierr;
 }
@@ -521,8 +576,11 @@ DIError DiskImg::OpenImage(DiskImg* pParent, long firstTrack, long firstSector,
     GFDGFD* pGFDGFD;
 
     pGFDGFD = new GFDGFD;
-    dierr = pGFDGFD->Open(pParent->fpDataGFD,
-                kSectorSize * firstTrack * prntSectPerTrack, fReadOnly);
+    {
+        DIAutoLock lock(pParent->GetProbeLock());
+        dierr = pGFDGFD->Open(pParent->fpDataGFD,
+                    kSectorSize * firstTrack * prntSectPerTrack, fReadOnly);
+    }
     if (dierr != kDIErrNone) {
         delete pGFDGFD;
         return dierr;
@@ -544,6 +602,7 @@ DIError DiskImg::OpenImage(DiskImg* pParent, long firstTrack, long firstSector,
     fOrder = pParent->fOrder;
 
     fpParentImg = pParent;
+    fParentOffset = (di_off_t) kSectorSize * firstTrack * prntSectPerTrack;
 
     return dierr;
 }
@@ -594,6 +653,16 @@ DIError DiskImg::CloseImage(void)
     if (dierr != kDIErrNone)
         return dierr;
 
+    /*
+     * Clean up.  The caches were flushed above, so this just frees them.
+     */
+    FreeNibbleTracks();
+    dierr = FreeBlockCache();
+    if (dierr != kDIErrNone)
+        return dierr;
+    delete fpDirtyMap;
+    fpDirtyMap = NULL;
+
     /*
      * Clean up.  Close GFD, OrigGFD, and OuterGFD.  Delete ImageWrapper
      * and OuterWrapper.
@@ -663,6 +732,26 @@ DIError DiskImg::FlushImage(FlushMode mode)
         return kDIErrNone;
     }
 
+    /*
+     * Step 1: make sure any local caches have been flushed.
+     *
+     * The caches are written back even when a fast flush can't do
+     * anything else, so fpDataGFD is current whenever the wrappers (or
+     * anybody else) read it.  Sub-volumes don't have a block cache; their
+     * changes are held in the topmost image's.  Modified nibble tracks
+     * go through CopyBytesIn, so they're written before the block cache.
+     */
+    dierr = FlushNibbleTracks();
+    if (dierr != kDIErrNone)
+        return dierr;
+    if (fpBlockCache != NULL) {
+        dierr = fpBlockCache->Flush();
+        if (dierr != kDIErrNone) {
+            LOGI(" ERROR: block cache flush failed (err=%d)", dierr);
+            return dierr;
+        }
+    }
+
     if (mode == kFlushFastOnly &&
         ((fpImageWrapper != NULL && !fpImageWrapper->HasFastFlush()) ||
          (fpOuterWrapper != NULL && !fpOuterWrapper->HasFastFlush()) ))
@@ -671,11 +760,6 @@ DIError DiskImg::FlushImage(FlushMode mode)
         return kDIErrNone;
     }
 
-    /*
-     * Step 1: make sure any local caches have been flushed.
-     */
-    /* (none) */
-
     /*
      * Step 2: push changes from fpDataGFD to fpWrapperGFD.  This will
      * cause ImageWrapper to rebuild itself (SHK, DDD, whatever).  In
@@ -696,11 +780,17 @@ DIError DiskImg::FlushImage(FlushMode mode)
         LOGI(" DI flushing data changes to wrapper (fLen=%ld fWrapLen=%ld)",
             (long) fLength, (long) fWrappedLength);
         dierr = fpImageWrapper->Flush(fpWrapperGFD, fpDataGFD, fLength,
-                    &fWrappedLength);
+                    &fWrappedLength, fpDirtyMap);
         if (dierr != kDIErrNone) {
             LOGI(" ERROR: wrapper flush failed (err=%d)", dierr);
             return dierr;
         }
+
+        /* the wrapper is current; start tracking changes from here */
+        if (fpDirtyMap != NULL)
+            fpDirtyMap->ClearAll();
+        else if (fLength > 0)
+            fpDirtyMap = new LinearBitmap((int) ((fLength + 511) / 512));
         /* flush the GFD in case it's a Win32 volume with block caching */
         dierr = fpWrapperGFD->Flush();
     } else {
@@ -782,6 +872,7 @@ DIError DiskImg::AnalyzeImageFile(const char* pathName, char fssep)
     const char* ext = FindExtension(pathName, fssep);
     char* extBuf = NULL;     // uses malloc/free
     bool needExtFromOuter = false;
+    WrapperNuFX* pNuFXWrapper = NULL;   // archive left open by Test
 
     if (ext != NULL) {
         assert(*ext == '.');
@@ -921,7 +1012,8 @@ DIError DiskImg::AnalyzeImageFile(const char* pathName, char fssep)
     {
         DIError dierr2;
         reliableExt = true;
-        dierr2 = WrapperNuFX::Test(fpWrapperGFD, fWrappedLength);
+        dierr2 = WrapperNuFX::Test(fpWrapperGFD, fWrappedLength,
+                    &pNuFXWrapper);
         if (dierr2 == kDIErrNone)
             probableFormat = kFileFormatNuFX;
         else if (dierr2 == kDIErrFileArchive) {
@@ -1017,7 +1109,8 @@ DIError DiskImg::AnalyzeImageFile(const char* pathName, char fssep)
             goto bail;
         } else {
             LOGI(" DI extension '%s' not useful, probing formats", ext);
-            dierr = WrapperNuFX::Test(fpWrapperGFD, fWrappedLength);
+            dierr = WrapperNuFX::Test(fpWrapperGFD, fWrappedLength,
+                        &pNuFXWrapper);
             if (dierr == kDIErrNone) {
                 probableFormat = kFileFormatNuFX;
                 goto gotit;
@@ -1085,7 +1178,12 @@ gotit: ;
         fReadOnly = true;       // writing to FDI not yet supported
         break;
     case kFileFormatNuFX:
-        fpImageWrapper = new WrapperNuFX();
+        if (pNuFXWrapper != NULL) {
+            fpImageWrapper = pNuFXWrapper;
+            pNuFXWrapper = NULL;
+        } else {
+            fpImageWrapper = new WrapperNuFX();
+        }
         ((WrapperNuFX*)fpImageWrapper)->SetCompressType(
                                         (NuThreadFormat) fNuFXCompressType);
         break;
@@ -1122,6 +1220,15 @@ gotit: ;
         goto bail;
     }
 
+    /*
+     * The data matches the file, so nothing is dirty yet.  Track writes
+     * in 512-byte units so the wrapper can tell what needs to be redone
+     * when we flush.
+     */
+    assert(fpDirtyMap == NULL);
+    if (fLength > 0)
+        fpDirtyMap = new LinearBitmap((int) ((fLength + 511) / 512));
+
     /* check for non-fatal checksum failures, e.g. DiskCopy42 */
     if (fpImageWrapper->IsDamaged()) {
         AddNote(kNoteWarning, "File checksum didn't match.");
@@ -1137,6 +1244,7 @@ gotit: ;
     assert(fPhysical != kPhysicalFormatUnknown);
 
 bail:
+    delete pNuFXWrapper;
     free(extBuf);
     return dierr;
 }
@@ -1160,9 +1268,19 @@ bail:
  *  fHasSectors, fHasTracks, and fHasNibbles are set
  *  fFileSysOrder is set
  *  fpNibbleDescr will be set for nibble images
+ *
+ * If the format cache is enabled and has seen this file before, we skip
+ * the nibble analysis and the filesystem probes, and use what we found
+ * last time.
  */
 DIError DiskImg::AnalyzeImage(void)
 {
+    FormatCache* pCache = NULL;
+    FormatCache::Key cacheKey;
+    FormatCache::Result cached;
+    bool useCached = false;
+    bool verify = false;
+
     assert(fLength >= 0);
     assert(fpDataGFD != NULL);
     assert(fFileFormat != kFileFormatUnknown);
@@ -1175,6 +1293,33 @@ DIError DiskImg::AnalyzeImage(void)
     if (fpDataGFD == NULL)
         return kDIErrInternal;
 
+    /*
+     * A custom NibbleDescr can change between runs, so don't trust the
+     * cache for nibble images if one is defined.
+     */
+    if (fHaveFileId && fpParentImg == NULL &&
+        !(IsNibbleFormat(fPhysical) &&
+          fpNibbleDescrTable[kNibbleDescrCustom].numSectors != 0))
+    {
+        pCache = Global::GetFormatCache();
+    }
+    if (pCache != NULL) {
+        cacheKey.file.size = fFileIdSize;
+        cacheKey.file.mtime = fFileIdMtime;
+        cacheKey.file.hash = fFileIdHash;
+        cacheKey.dataLength = fLength;
+        cacheKey.fileFormat = fFileFormat;
+        cacheKey.physical = fPhysical;
+        cacheKey.startOrder = fOrder;
+        cacheKey.sectorPairing = fSectorPairing;
+
+        if (pCache->Lookup(cacheKey, &cached, &verify) && !verify) {
+            useCached = IsCachedFormatUsable(cached.probe, cached.nibbleDescr);
+            if (!useCached)
+                LOGW(" DI ignoring bad format cache entry");
+        }
+    }
+
     /*
      * Figure out how many tracks and sectors the image has.
      *
@@ -1240,7 +1385,12 @@ DIError DiskImg::AnalyzeImage(void)
          * working with a TrackStar or FDI image.
          */
         DIError dierr;
-        dierr = AnalyzeNibbleData();    // sets nibbleDescr and DOS vol num
+        if (useCached) {
+            dierr = SetCachedNibbleDescr(cached.nibbleDescr,
+                        (short) cached.dosVolumeNum);
+        } else {
+            dierr = AnalyzeNibbleData();    // sets nibbleDescr and DOS vol num
+        }
         if (dierr == kDIErrNone) {
             assert(fpNibbleDescr != NULL);
             fNumSectPerTrack = fpNibbleDescr->numSectors;
@@ -1310,7 +1460,36 @@ DIError DiskImg::AnalyzeImage(void)
      * We've got the track/sector/block layout sorted out; now figure out
      * what kind of filesystem we're dealing with.
      */
-    AnalyzeImageFS();
+    if (useCached) {
+        LOGI(" DI format cache hit (probe=%d)", cached.probe);
+        ApplyFSResult(cached.probe, (SectorOrder) cached.order,
+            (FSFormat) cached.format);
+    } else {
+        SectorOrder order;
+        FSFormat format;
+        int winner;
+
+        winner = ProbeFS(&order, &format);
+        if (winner < 0) {
+            order = fOrder;
+            format = kFormatUnknown;
+        }
+        ApplyFSResult(winner, order, format);
+
+        if (pCache != NULL) {
+            FormatCache::Result result;
+
+            result.order = order;
+            result.format = format;
+            result.probe = winner;
+            if (fpNibbleDescr != NULL)
+                result.nibbleDescr = (int) (fpNibbleDescr - fpNibbleDescrTable);
+            else
+                result.nibbleDescr = -1;
+            result.dosVolumeNum = fDOSVolumeNum;
+            pCache->Store(cacheKey, result, verify);
+        }
+    }
 
     LOGI(" DI AnalyzeImage tracks=%ld sectors=%d blocks=%ld fileSysOrder=%d",
         fNumTracks, fNumSectPerTrack, fNumBlocks, fFileSysOrder);
@@ -1320,110 +1499,303 @@ DIError DiskImg::AnalyzeImage(void)
     return kDIErrNone;
 }
 
+/*
+ * Filesystem probes, in priority order.  When more than one succeeds, the
+ * one that appears first wins.
+ *
+ * In some circumstances it would be useful to have a set describing
+ * what filesystems we might expect to find, e.g. we're not likely to
+ * encounter RDOS embedded in a CF card.
+ */
+typedef DIError (*TestFSFunc)(DiskImg* pImg, DiskImg::SectorOrder* pOrder,
+    DiskImg::FSFormat* pFormat, DiskFS::FSLeniency leniency);
+
+enum ProbeFixup {
+    kProbeFixupNone = 0,
+    kProbeFixupDOS3x,       // 13-sector DOS 3.3 is really DOS 3.2
+    kProbeFixupWide,        // 32 sectors per track, half as many tracks
+};
+
+static const struct FSProbe {
+    TestFSFunc      func;
+    const char*     name;
+    ProbeFixup      fixup;
+} kFSProbes[] = {
+    { DiskFSMacPart::TestFS,        "MacPart",          kProbeFixupNone },
+    { DiskFSMicroDrive::TestFS,     "MicroDrive",       kProbeFixupNone },
+    { DiskFSFocusDrive::TestFS,     "FocusDrive",       kProbeFixupNone },
+    // The CFFA format doesn't have a partition map, but we do insist
+    // on finding multiple volumes.  It needs to come after MicroDrive,
+    // because a disk formatted for CFFA then subsequently partitioned
+    // for MicroDrive will still look like valid CFFA unless you zero
+    // out the blocks.
+    { DiskFSCFFA::TestFS,           "CFFA",             kProbeFixupNone },
+    // This is really just a trap to catch CFFA cards that were formatted
+    // for ProDOS and then re-formatted for MSDOS.  As such it needs to
+    // come before the ProDOS test.  It only works on larger volumes,
+    // and can be overridden, so it's pretty safe.
+    { DiskFSFAT::TestFS,            "MSDOS",            kProbeFixupNone },
+    // DOS comes before ProDOS, because sometimes they overlap (e.g. 800K
+    // ProDOS disk with five 160K DOS volumes on it).
+    { DiskFSDOS33::TestFS,          "DOS3.x",           kProbeFixupDOS3x },
+    // Should only succeed on 400K embedded chunks.
+    { DiskFSUNIDOS::TestWideFS,     "'wide' DOS3.3",    kProbeFixupWide },
+    { DiskFSUNIDOS::TestFS,         "UNIDOS",           kProbeFixupWide },
+    { DiskFSOzDOS::TestFS,          "OzDOS",            kProbeFixupWide },
+    { DiskFSProDOS::TestFS,         "ProDOS",           kProbeFixupNone },
+    { DiskFSPascal::TestFS,         "Pascal",           kProbeFixupNone },
+    { DiskFSCPM::TestFS,            "CP/M",             kProbeFixupNone },
+    { DiskFSRDOS::TestFS,           "RDOS 3.3",         kProbeFixupNone },
+    { DiskFSHFS::TestFS,            "HFS",              kProbeFixupNone },
+    { DiskFSGutenberg::TestFS,      "Gutenberg",        kProbeFixupNone },
+};
+static const int kNumFSProbes = NELEM(kFSProbes);
+
+/*
+ * Compute a signature for the probe table.  The format cache stores the
+ * index of the winning probe, so it throws its entries away whenever
+ * probes are added, removed, or rearranged.
+ */
+uint32_t DiskImgLib::GetFSProbeTableSignature(void)
+{
+    uint32_t sig = 2166136261U;     // FNV-1a
+    for (int i = 0; i < kNumFSProbes; i++) {
+        for (const char* cp = kFSProbes[i].name; ; cp++) {
+            sig = (sig ^ (uint8_t) *cp) * 16777619U;
+            if (*cp == '\0')
+                break;
+        }
+        sig = (sig ^ (uint8_t) kFSProbes[i].fixup) * 16777619U;
+    }
+    return sig;
+}
+
 /*
  * Try to figure out what filesystem exists on this disk image.
  *
- * We want to test for DOS before ProDOS, because sometimes they overlap (e.g.
- * 800K ProDOS disk with five 160K DOS volumes on it).
+ * The probes are independent of each other, so on a sector image we run
+ * them on several threads (see ProbeFSParallel).  The result is the same
+ * as running them one at a time in table order.
  *
  * Sets fFormat, fOrder, and fFileSysOrder.
  */
 void DiskImg::AnalyzeImageFS(void)
 {
-    /*
-     * In some circumstances it would be useful to have a set describing
-     * what filesystems we might expect to find, e.g. we're not likely to
-     * encounter RDOS embedded in a CF card.
-     */
-    if (DiskFSMacPart::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        assert(fFormat == kFormatMacPart);
-        LOGI(" DI found MacPart, order=%d", fOrder);
-    } else if (DiskFSMicroDrive::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        assert(fFormat == kFormatMicroDrive);
-        LOGI(" DI found MicroDrive, order=%d", fOrder);
-    } else if (DiskFSFocusDrive::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        assert(fFormat == kFormatFocusDrive);
-        LOGI(" DI found FocusDrive, order=%d", fOrder);
-    } else if (DiskFSCFFA::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        // The CFFA format doesn't have a partition map, but we do insist
-        // on finding multiple volumes.  It needs to come after MicroDrive,
-        // because a disk formatted for CFFA then subsequently partitioned
-        // for MicroDrive will still look like valid CFFA unless you zero
-        // out the blocks.
-        assert(fFormat == kFormatCFFA4 || fFormat == kFormatCFFA8);
-        LOGI(" DI found CFFA, order=%d", fOrder);
-    } else if (DiskFSFAT::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        // This is really just a trap to catch CFFA cards that were formatted
-        // for ProDOS and then re-formatted for MSDOS.  As such it needs to
-        // come before the ProDOS test.  It only works on larger volumes,
-        // and can be overridden, so it's pretty safe.
-        assert(fFormat == kFormatMSDOS);
-        LOGI(" DI found MSDOS, order=%d", fOrder);
-    } else if (DiskFSDOS33::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        assert(fFormat == kFormatDOS32 || fFormat == kFormatDOS33);
-        LOGI(" DI found DOS3.x, order=%d", fOrder);
-        if (fNumSectPerTrack == 13)
-            fFormat = kFormatDOS32;
-    } else if (DiskFSUNIDOS::TestWideFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        // Should only succeed on 400K embedded chunks.
-        assert(fFormat == kFormatDOS33);
-        fNumSectPerTrack = 32;
-        fNumTracks /= 2;
-        LOGI(" DI found 'wide' DOS3.3, order=%d", fOrder);
-    } else if (DiskFSUNIDOS::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        assert(fFormat == kFormatUNIDOS);
-        fNumSectPerTrack = 32;
-        fNumTracks /= 2;
-        LOGI(" DI found UNIDOS, order=%d", fOrder);
-    } else if (DiskFSOzDOS::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        assert(fFormat == kFormatOzDOS);
-        fNumSectPerTrack = 32;
-        fNumTracks /= 2;
-        LOGI(" DI found OzDOS, order=%d", fOrder);
-    } else if (DiskFSProDOS::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        assert(fFormat == kFormatProDOS);
-        LOGI(" DI found ProDOS, order=%d", fOrder);
-    } else if (DiskFSPascal::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        assert(fFormat == kFormatPascal);
-        LOGI(" DI found Pascal, order=%d", fOrder);
-    } else if (DiskFSCPM::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        assert(fFormat == kFormatCPM);
-        LOGI(" DI found CP/M, order=%d", fOrder);
-    } else if (DiskFSRDOS::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        assert(fFormat == kFormatRDOS33 ||
-               fFormat == kFormatRDOS32 ||
-               fFormat == kFormatRDOS3);
-        LOGI(" DI found RDOS 3.3, order=%d", fOrder);
-    } else if (DiskFSHFS::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        assert(fFormat == kFormatMacHFS);
-        LOGI(" DI found HFS, order=%d", fOrder);
-    } else if (DiskFSGutenberg::TestFS(this, &fOrder, &fFormat, DiskFS::kLeniencyNot) == kDIErrNone)
-    {
-        assert(fFormat == kFormatGutenberg);
-        LOGI(" DI found Gutenberg, order=%d", fOrder);
-    } else {
+    SectorOrder order;
+    FSFormat format;
+    int winner;
+
+    winner = ProbeFS(&order, &format);
+    ApplyFSResult(winner, order, format);
+}
+
+/*
+ * Run the filesystem probes.  Returns the index of the winning probe, or
+ * -1 if none succeeded.  On success, "*pOrder" and "*pFormat" hold what
+ * the probe found.
+ */
+int DiskImg::ProbeFS(SectorOrder* pOrder, FSFormat* pFormat)
+{
+    int winner = -1;
+
+    if (!ProbeFSParallel(&winner, pOrder, pFormat)) {
+        for (int i = 0; i < kNumFSProbes; i++) {
+            *pOrder = fOrder;
+            *pFormat = fFormat;
+            if ((*kFSProbes[i].func)(this, pOrder, pFormat,
+                    DiskFS::kLeniencyNot) == kDIErrNone)
+            {
+                winner = i;
+                break;
+            }
+        }
+    }
+
+    return winner;
+}
+
+/*
+ * Set fFormat, fOrder, and fFileSysOrder from the result of ProbeFS (or
+ * from the format cache).  Some filesystems change the disk geometry.
+ */
+void DiskImg::ApplyFSResult(int winner, SectorOrder order, FSFormat format)
+{
+    assert(winner >= -1 && winner < kNumFSProbes);
+
+    if (winner < 0) {
         fFormat = kFormatUnknown;
         LOGI(" DI no recognizeable filesystem found (fOrder=%d)",
             fOrder);
+    } else {
+        fOrder = order;
+        fFormat = format;
+
+        switch (kFSProbes[winner].fixup) {
+        case kProbeFixupDOS3x:
+            assert(fFormat == kFormatDOS32 || fFormat == kFormatDOS33);
+            if (fNumSectPerTrack == 13)
+                fFormat = kFormatDOS32;
+            break;
+        case kProbeFixupWide:
+            assert(fFormat == kFormatDOS33 || fFormat == kFormatUNIDOS ||
+                   fFormat == kFormatOzDOS);
+            fNumSectPerTrack = 32;
+            fNumTracks /= 2;
+            break;
+        default:
+            break;
+        }
+        LOGI(" DI found %s, order=%d", kFSProbes[winner].name, fOrder);
     }
 
     fFileSysOrder = CalcFSSectorOrder();
 }
 
+/*
+ * Sanity-check the indices in a format cache entry.  The probe table or
+ * the NibbleDescr table may have changed since it was written.
+ */
+bool DiskImg::IsCachedFormatUsable(int probe, int nibbleDescr) const
+{
+    if (probe < -1 || probe >= kNumFSProbes)
+        return false;
+    if (!IsNibbleFormat(fPhysical))
+        return true;
+    if (nibbleDescr < -1 || nibbleDescr >= fNumNibbleDescrEntries)
+        return false;
+    if (nibbleDescr >= 0 && fpNibbleDescrTable[nibbleDescr].numSectors == 0)
+        return false;
+    return true;
+}
+
+/*
+ * State shared by the probe threads.
+ */
+typedef struct ProbeWork {
+    DiskImg*            pImg;
+    DiskImg::SectorOrder startOrder;
+    DiskImg::FSFormat   startFormat;
+
+    DIMutex             lock;       // guards "next" and "best"
+    int                 next;       // next probe to hand out
+    int                 best;       // lowest successful probe, or -1
+
+    DiskImg::SectorOrder order[kNumFSProbes];
+    DiskImg::FSFormat   format[kNumFSProbes];
+} ProbeWork;
+
+/*
+ * Probe thread.  Pulls probes off the table until they're gone, or until
+ * the only ones left are lower priority than something that already
+ * succeeded.
+ */
+static void ProbeWorker(void* vwork)
+{
+    ProbeWork* pWork = (ProbeWork*) vwork;
+
+    while (true) {
+        int idx;
+
+        pWork->lock.Lock();
+        idx = pWork->next;
+        if (idx >= kNumFSProbes ||
+            (pWork->best >= 0 && idx > pWork->best))
+        {
+            pWork->lock.Unlock();
+            break;
+        }
+        pWork->next++;
+        pWork->lock.Unlock();
+
+        pWork->order[idx] = pWork->startOrder;
+        pWork->format[idx] = pWork->startFormat;
+        if ((*kFSProbes[idx].func)(pWork->pImg, &pWork->order[idx],
+                &pWork->format[idx], DiskFS::kLeniencyNot) == kDIErrNone)
+        {
+            DIAutoLock lock(&pWork->lock);
+            if (pWork->best < 0 || idx < pWork->best)
+                pWork->best = idx;
+        }
+    }
+}
+
+/*
+ * Run the filesystem probes on several threads.
+ *
+ * The probes only read from the image.  Before starting, we copy the head
+ * of the image (or all of it, if it's floppy-sized) into a snapshot, which
+ * holds the partition maps, boot blocks, and volume directories most of
+ * the probes look at.  Anything outside it is read with a lock held.  If
+ * the data has to be expanded as it's read (e.g. a NuFX disk thread), we
+ * only take the head, so probing doesn't expand the whole disk.
+ *
+ * Nibble images and embedded volumes are probed on the calling thread.  The
+ * former keep per-track state in the DiskImg, and the latter are usually
+ * being probed from a thread already.
+ *
+ * Returns "false" if the probes weren't run, in which case the caller
+ * should run them itself.
+ */
+bool DiskImg::ProbeFSParallel(int* pWinner, SectorOrder* pOrder,
+    FSFormat* pFormat)
+{
+    enum {
+        kSnapshotWholeMax = 1600 * 1024,    // 1.44MB floppies and smaller
+        kSnapshotHeadLen = 64 * kBlockSize,
+    };
+    int numThreads = Global::GetProbeThreads();
+
+    if (numThreads <= 1 || fpParentImg != NULL || fpProbeSnapshot != NULL ||
+        !IsSectorFormat(fPhysical) || fpDataGFD == NULL || fLength <= 0)
+    {
+        return false;
+    }
+    if (numThreads > kNumFSProbes)
+        numThreads = kNumFSProbes;
+
+    ProbeSnapshot* pSnap = new ProbeSnapshot;
+    if (fpDataGFD->GetDirectPointer(0, 1) == NULL) {
+        long snapLen;
+        if (fLength <= kSnapshotWholeMax && fpDataGFD->HasCheapRandomAccess())
+            snapLen = (long) fLength;
+        else
+            snapLen = kSnapshotHeadLen;
+        if (snapLen > fLength)
+            snapLen = (long) fLength;
+
+        pSnap->fBuf = new uint8_t[snapLen];
+        if (CopyBytesOut(pSnap->fBuf, 0, snapLen) != kDIErrNone) {
+            LOGI(" DI unable to read probe snapshot, probing serially");
+            delete pSnap;
+            return false;
+        }
+        pSnap->fLength = snapLen;
+    }
+
+    ProbeWork* pWork = new ProbeWork;
+    pWork->pImg = this;
+    pWork->startOrder = fOrder;
+    pWork->startFormat = fFormat;
+    pWork->next = 0;
+    pWork->best = -1;
+
+    LOGD(" DI probing with %d threads (snapshot=%ld)", numThreads,
+        pSnap->fLength);
+    fpProbeSnapshot = pSnap;
+    DIWorkerGroup::Run(numThreads, ProbeWorker, pWork);
+    fpProbeSnapshot = NULL;
+
+    *pWinner = pWork->best;
+    if (pWork->best >= 0) {
+        *pOrder = pWork->order[pWork->best];
+        *pFormat = pWork->format[pWork->best];
+    }
+
+    delete pWork;
+    delete pSnap;
+    return true;
+}
+
 
 /*
  * Override the format determined by the analyzer.
@@ -2152,7 +2524,17 @@ DIError DiskImg::ReadBlocks(long startBlock, int numBlocks, void* buf)
         goto bail;
     }
 
-    if (!IsLinearBlocks(fOrder, fFileSysOrder)) {
+    if (!IsLinearBlocks(fOrder, fFileSysOrder) && CanGatherTracks()) {
+        /*
+         * Sector image with the "wrong" ordering, e.g. ProDOS blocks from
+         * a ".do" file.  Read whole tracks and unshuffle them in memory.
+         */
+        if (startBlock == 0) {
+            LOGI(" ReadBlocks: nonlinear, gathering tracks");
+        }
+        dierr = TransferTrackBlocks(startBlock, numBlocks, (uint8_t*) buf,
+                    false);
+    } else if (!IsLinearBlocks(fOrder, fFileSysOrder)) {
         /*
          * This isn't a collection of linear blocks, so we need to read it one
          * block at a time with sector swapping.  This almost certainly means
@@ -2181,6 +2563,112 @@ bail:
     return dierr;
 }
 
+/*
+ * Determine whether TransferTrackBlocks can be used.  We need a plain
+ * sector image, where each track is a contiguous run of sectors in the
+ * file.  Paired sectors (OzDOS) spread a track across two, so they're
+ * handled one block at a time.
+ */
+bool DiskImg::CanGatherTracks(void) const
+{
+    return (IsSectorFormat(fPhysical) && fHasSectors && fHasBlocks &&
+            !fSectorPairing &&
+            (fNumSectPerTrack == 16 || fNumSectPerTrack == 32));
+}
+
+/*
+ * Read or write a run of blocks on a sector image whose ordering doesn't
+ * match the filesystem's.
+ *
+ * Instead of two CalcSectorAndOffset lookups and two I/O requests per
+ * block, we move an entire track with one request and do the sector
+ * shuffling in memory.  CalcSectorAndOffset still decides where each
+ * sector lives, so the interleave tables are only in one place.
+ *
+ * When writing a track that isn't completely covered by the request, we
+ * read it first so the sectors we aren't replacing survive.  If the image
+ * ends partway through the last track, only the part that exists is
+ * transferred.
+ *
+ * "buf" isn't modified when "doWrite" is set.
+ */
+DIError DiskImg::TransferTrackBlocks(long startBlock, int numBlocks,
+    uint8_t* buf, bool doWrite)
+{
+    DIError dierr = kDIErrNone;
+    const int blocksPerTrack = fNumSectPerTrack / 2;
+    const int trackLen = fNumSectPerTrack * kSectorSize;
+    uint8_t* trackBuf = NULL;
+    long block = startBlock;
+    long endBlock = startBlock + numBlocks;
+
+    assert(CanGatherTracks());
+
+    trackBuf = new uint8_t[trackLen];
+    if (trackBuf == NULL)
+        return kDIErrMalloc;
+
+    while (block < endBlock) {
+        long track = block / blocksPerTrack;
+        long firstInTrk = block - track * blocksPerTrack;
+        long count = blocksPerTrack - firstInTrk;
+        di_off_t trackOffset = (di_off_t) track * trackLen;
+        int xferLen = trackLen;
+
+        if (count > endBlock - block)
+            count = endBlock - block;
+        if (trackOffset + xferLen > fLength)
+            xferLen = (int) (fLength - trackOffset);
+        if (xferLen <= 0) {
+            dierr = kDIErrDataUnderrun;
+            goto bail;
+        }
+
+        if (!doWrite || count != blocksPerTrack || xferLen != trackLen) {
+            dierr = CopyBytesOut(trackBuf, trackOffset, xferLen);
+            if (dierr != kDIErrNone)
+                goto bail;
+        }
+
+        for (long blk = firstInTrk; blk < firstInTrk + count; blk++) {
+            for (int half = 0; half < 2; half++) {
+                di_off_t offset;
+                int newSector;
+
+                dierr = CalcSectorAndOffset(track, (int) blk*2 + half,
+                            fOrder, fFileSysOrder, &offset, &newSector);
+                if (dierr != kDIErrNone)
+                    goto bail;
+                offset -= trackOffset;
+                assert(offset >= 0 && offset + kSectorSize <= trackLen);
+                if (offset + kSectorSize > xferLen) {
+                    /* sector is past the end of a short image */
+                    dierr = kDIErrDataUnderrun;
+                    goto bail;
+                }
+
+                if (doWrite)
+                    memcpy(trackBuf + offset, buf, kSectorSize);
+                else
+                    memcpy(buf, trackBuf + offset, kSectorSize);
+                buf += kSectorSize;
+            }
+        }
+
+        if (doWrite) {
+            dierr = CopyBytesIn(trackBuf, trackOffset, xferLen);
+            if (dierr != kDIErrNone)
+                goto bail;
+        }
+
+        block += count;
+    }
+
+bail:
+    delete[] trackBuf;
+    return dierr;
+}
+
 /*
  * Check to see if any blocks in a range of blocks show up in the bad
  * block map.  This is primarily useful for 3.5" disk images converted
@@ -2203,6 +2691,39 @@ bool DiskImg::CheckForBadBlocks(long startBlock, int numBlocks)
     return false;
 }
 
+/*
+ * Get a read-only pointer to the contents of a 512-byte block, without
+ * copying it.
+ *
+ * This only works when the block is stored contiguously in a data GFD
+ * that's directly addressable (a memory buffer or a mapped file).  If not,
+ * or if the block is bad or out of range, this returns NULL and the
+ * caller should use ReadBlock instead.
+ *
+ * The pointer is only valid until the next write to the image.
+ */
+const uint8_t* DiskImg::BorrowBlock(long block)
+{
+    if (!fHasBlocks || block < 0 || block >= fNumBlocks)
+        return NULL;
+    if (fHasSectors && !IsLinearBlocks(fOrder, fFileSysOrder))
+        return NULL;
+    if (CheckForBadBlocks(block, 1))
+        return NULL;
+
+    /* embedded volumes get their data from the topmost image */
+    DiskImg* pImg = this;
+    di_off_t offset = (di_off_t) block * kBlockSize;
+    while (pImg->fpParentImg != NULL) {
+        offset += pImg->fParentOffset;
+        pImg = pImg->fpParentImg;
+    }
+    if (pImg->fpDataGFD == NULL)
+        return NULL;
+
+    return pImg->fpDataGFD->GetDirectPointer(offset, kBlockSize);
+}
+
 /*
  * Write a block of data to a DiskImg.
  *
@@ -2262,7 +2783,19 @@ DIError DiskImg::WriteBlocks(long startBlock, int numBlocks, const void* buf)
         return kDIErrInvalidArg;
     }
 
-    if (!IsLinearBlocks(fOrder, fFileSysOrder)) {
+    if (!IsLinearBlocks(fOrder, fFileSysOrder) && CanGatherTracks()) {
+        /*
+         * Sector image with the "wrong" ordering.  Shuffle the blocks into
+         * whole tracks and write each track at once.
+         */
+        if (fReadOnly)
+            return kDIErrAccessDenied;
+        if (startBlock == 0) {
+            LOGI(" WriteBlocks: nonlinear, scattering tracks");
+        }
+        dierr = TransferTrackBlocks(startBlock, numBlocks,
+                    (uint8_t*) const_cast<void*>(buf), true);
+    } else if (!IsLinearBlocks(fOrder, fFileSysOrder)) {
         /*
          * This isn't a collection of linear blocks, so we need to write it
          * one block at a time with sector swapping.  This almost certainly
@@ -2292,15 +2825,162 @@ bail:
 }
 
 
+/*
+ * Set the size of the block cache.
+ *
+ * The cache lives in the topmost image, so we pass the request up.  Any
+ * existing cache is flushed and discarded; a new one will be created at
+ * the requested size the next time we need it.
+ */
+DIError DiskImg::SetBlockCacheSize(long numBlocks)
+{
+    if (numBlocks < 0)
+        return kDIErrInvalidArg;
+    if (fpParentImg != NULL)
+        return fpParentImg->SetBlockCacheSize(numBlocks);
+
+    fBlockCacheSize = numBlocks;
+    return FreeBlockCache();
+}
+
+/*
+ * Get the hit/miss counts from the block cache.  Returns zeroes if there
+ * isn't one.
+ */
+void DiskImg::GetBlockCacheStats(long* pHits, long* pMisses) const
+{
+    const DiskImg* pImg = this;
+
+    while (pImg->fpParentImg != NULL)
+        pImg = pImg->fpParentImg;
+
+    if (pImg->fpBlockCache == NULL) {
+        *pHits = *pMisses = 0;
+    } else {
+        *pHits = pImg->fpBlockCache->GetHits();
+        *pMisses = pImg->fpBlockCache->GetMisses();
+    }
+}
+
+/*
+ * Get the block cache, creating it if necessary.  Returns NULL if caching
+ * is disabled or the cache couldn't be created, in which case the caller
+ * should access fpDataGFD directly.
+ *
+ * There's no point in caching data that's already in memory (GFDBuffer,
+ * GFDMmap), so we don't create a cache for those.
+ *
+ * Only call this on the topmost image.
+ */
+BlockCache* DiskImg::GetBlockCache(void)
+{
+    assert(fpParentImg == NULL);
+
+    if (fpBlockCache == NULL && fBlockCacheSize > 0 && fLength > 0 &&
+        fpDataGFD != NULL && fpDataGFD->GetDirectPointer(0, 1) == NULL)
+    {
+        BlockCache* pCache = new BlockCache;
+        DIError dierr = pCache->Create(fpDataGFD, fLength, fBlockCacheSize);
+        if (dierr != kDIErrNone) {
+            LOGW(" DI unable to create block cache (err=%d)", dierr);
+            delete pCache;
+            fBlockCacheSize = 0;    // don't keep trying
+            return NULL;
+        }
+        fpBlockCache = pCache;
+    }
+
+    return fpBlockCache;
+}
+
+/*
+ * Write back and discard the block cache.
+ */
+DIError DiskImg::FreeBlockCache(void)
+{
+    DIError dierr;
+
+    if (fpBlockCache == NULL)
+        return kDIErrNone;
+
+    LOGD(" DI block cache: %ld hits, %ld misses, %ld write-backs",
+        fpBlockCache->GetHits(), fpBlockCache->GetMisses(),
+        fpBlockCache->GetWriteBacks());
+
+    dierr = fpBlockCache->Flush();
+    if (dierr != kDIErrNone)
+        return dierr;
+
+    delete fpBlockCache;
+    fpBlockCache = NULL;
+    return kDIErrNone;
+}
+
+/*
+ * Return the lock that guards the topmost image's GFD while the filesystem
+ * probes are running in parallel, or NULL if they aren't.
+ */
+DIMutex* DiskImg::GetProbeLock(void)
+{
+    DiskImg* pImg = this;
+    while (pImg->fpParentImg != NULL)
+        pImg = pImg->fpParentImg;
+
+    if (pImg->fpProbeSnapshot == NULL)
+        return NULL;
+    return &pImg->fpProbeSnapshot->fLock;
+}
+
 /*
  * Copy a chunk of bytes out of the disk image.
  *
+ * Embedded volumes forward the request to their parent, so that every
+ * access to the underlying file goes through the topmost image's block
+ * cache.
+ *
+ * While the filesystem probes are running, several threads may be in here
+ * at once.  Direct pointers and the probe snapshot are safe to share; the
+ * block cache and GFD are not, so those are used with the probe lock held.
+ *
  * (This is the lowest-level read routine in this class.)
  */
-DIError DiskImg::CopyBytesOut(void* buf, di_off_t offset, int size) const
+DIError DiskImg::CopyBytesOut(void* buf, di_off_t offset, int size)
+{
+    if (fpParentImg != NULL)
+        return fpParentImg->CopyBytesOut(buf, fParentOffset + offset, size);
+
+    const uint8_t* ptr = fpDataGFD->GetDirectPointer(offset, size);
+    if (ptr != NULL) {
+        memcpy(buf, ptr, size);
+        return kDIErrNone;
+    }
+
+    if (fpProbeSnapshot != NULL) {
+        if (fpProbeSnapshot->fBuf != NULL && offset >= 0 &&
+            offset + size <= fpProbeSnapshot->fLength)
+        {
+            memcpy(buf, fpProbeSnapshot->fBuf + offset, size);
+            return kDIErrNone;
+        }
+
+        DIAutoLock lock(&fpProbeSnapshot->fLock);
+        return ReadDataGFD(buf, offset, size);
+    }
+
+    return ReadDataGFD(buf, offset, size);
+}
+
+/*
+ * Read bytes from the data GFD, through the block cache if we have one.
+ */
+DIError DiskImg::ReadDataGFD(void* buf, di_off_t offset, int size)
 {
     DIError dierr;
 
+    BlockCache* pCache = GetBlockCache();
+    if (pCache != NULL)
+        return pCache->Read(buf, offset, size);
+
     dierr = fpDataGFD->Seek(offset, kSeekSet);
     if (dierr != kDIErrNone) {
         LOGI(" DI seek off=%ld failed (err=%d)", (long) offset, dierr);
@@ -2320,7 +3000,8 @@ DIError DiskImg::CopyBytesOut(void* buf, di_off_t offset, int size) const
 /*
  * Copy a chunk of bytes into the disk image.
  *
- * Sets the "dirty" flag.
+ * Sets the "dirty" flag.  If we have a block cache, the data won't reach
+ * fpDataGFD until the image is flushed.
  *
  * (This is the lowest-level write routine in DiskImg.)
  */
@@ -2333,18 +3014,54 @@ DIError DiskImg::CopyBytesIn(const void* buf, di_off_t offset, int size)
         return kDIErrAccessDenied;
     }
     assert(fpDataGFD != NULL);   // somebody closed the image?
+    assert(fpProbeSnapshot == NULL);    // probes must not write
 
-    dierr = fpDataGFD->Seek(offset, kSeekSet);
-    if (dierr != kDIErrNone) {
-        LOGI(" DI seek off=%ld failed (err=%d)", (long) offset, dierr);
-        return dierr;
+    if (fpParentImg != NULL) {
+        /* parent sets its own dirty flag and those above it */
+        dierr = fpParentImg->CopyBytesIn(buf, fParentOffset + offset, size);
+        if (dierr != kDIErrNone)
+            return dierr;
+        fDirty = true;
+        return kDIErrNone;
     }
 
-    dierr = fpDataGFD->Write(buf, size);
-    if (dierr != kDIErrNone) {
-        LOGI(" DI write off=%ld size=%d failed (err=%d)",
-            (long) offset, size, dierr);
-        return dierr;
+    uint8_t* ptr = NULL;
+    if (!fpDataGFD->GetReadOnly())
+        ptr = fpDataGFD->GetDirectPointer(offset, size);
+
+    /*
+     * When the data is in memory, rewriting what's already there doesn't
+     * count as a change, so filesystems that write back unmodified blocks
+     * don't force the wrapper to be rebuilt.
+     */
+    BlockCache* pCache = GetBlockCache();
+    if (ptr != NULL) {
+        if (memcmp(ptr, buf, size) != 0) {
+            memcpy(ptr, buf, size);
+            MarkDataDirty(offset, size);
+        }
+    } else if (pCache != NULL) {
+        dierr = pCache->Write(buf, offset, size);
+        if (dierr != kDIErrNone) {
+            LOGI(" DI cached write off=%ld size=%d failed (err=%d)",
+                (long) offset, size, dierr);
+            return dierr;
+        }
+        MarkDataDirty(offset, size);
+    } else {
+        dierr = fpDataGFD->Seek(offset, kSeekSet);
+        if (dierr != kDIErrNone) {
+            LOGI(" DI seek off=%ld failed (err=%d)", (long) offset, dierr);
+            return dierr;
+        }
+
+        dierr = fpDataGFD->Write(buf, size);
+        if (dierr != kDIErrNone) {
+            LOGI(" DI write off=%ld size=%d failed (err=%d)",
+                (long) offset, size, dierr);
+            return dierr;
+        }
+        MarkDataDirty(offset, size);
     }
 
     /* set the dirty flag here and everywhere above */
@@ -2358,6 +3075,24 @@ DIError DiskImg::CopyBytesIn(const void* buf, di_off_t offset, int size)
 }
 
 
+/*
+ * Note that the bytes at [offset, offset+size) have changed since the
+ * wrapper was last flushed.
+ *
+ * If we don't have a map, everything is already considered dirty.
+ */
+void DiskImg::MarkDataDirty(di_off_t offset, int size)
+{
+    if (fpDirtyMap == NULL || size <= 0)
+        return;
+
+    int first = (int) (offset / 512);
+    int last = (int) ((offset + size - 1) / 512);
+    assert(last < fpDirtyMap->GetNumBits());
+    fpDirtyMap->SetRange(first, last - first + 1);
+}
+
+
 /*
  * ===========================================================================
  *      Image creation
@@ -3329,7 +4064,7 @@ const char* DiskImgLib::DIStrError(DIError dierr)
      * debug builds, though, as it's helpful to know *which* error is not
      * recognized.
      */
-    static char defaultMsg[32];
+    static DI_THREAD_LOCAL char defaultMsg[32];
 
     switch (dierr) {
     case kDIErrNone:
@@ -163,6 +163,7 @@ const int kTrackLenTrackStar525 = 6525; // max len of data in TS image
 const int kTrackAllocSize = 6656;   // max 5.25 nibble track len; for buffers
 const int kTrackCount525 = 35;      // expected #of tracks on 5.25 img
 const int kMaxNibbleTracks525 = 40; // max #of tracks on 5.25 nibble img
+const int kMaxNibbleSectors = 16;   // max #of sectors on a 5.25 nibble track
 const int kDefaultNibbleVolumeNum = 254;
 const int kBlockSize = 512;         // block size for DiskImg interfaces
 const int kSectorSize = 256;        // sector size (1/2 block)
@@ -184,6 +185,12 @@ class ImageWrapper;
 class CircularBufferAccess;
 class ASPI;
 class LinearBitmap;
+class FileIndex;
+class FileChildList;
+class BlockCache;
+class DIMutex;
+class ProbeSnapshot;
+class FormatCache;
 
 
 /*
@@ -210,17 +217,78 @@ public:
     // shortcut for fpASPI->GetVersion()
     static unsigned long GetASPIVersion(void);
 
+    // Debug message severity, lowest first.
+    typedef enum LogLevel {
+        kLogVerbose = 0,
+        kLogDebug,
+        kLogInfo,
+        kLogWarn,
+        kLogError,
+        kLogNone,           // threshold only; disables everything
+    } LogLevel;
+    // Subsystem that generated a debug message.
+    typedef enum LogTag {
+        kLogTagGeneral = 0,
+        kLogTagWrapper,     // file wrappers and outer wrappers
+        kLogTagNibble,      // nibble encoding and decoding
+        kLogTagFS,          // DiskFS filesystems
+        kLogTagNuFX,        // messages from NufxLib
+        kLogTagMax
+    } LogTag;
+
     // pointer to the debug message handler
     typedef void (*DebugMsgHandler)(const char* file, int line, const char* msg);
     static DebugMsgHandler gDebugMsgHandler;
+    // Leveled handler.  If set, it's used instead of the DebugMsgHandler.
+    typedef void (*LogMsgHandler)(LogTag tag, LogLevel level,
+        const char* file, int line, const char* msg);
 
+    // Handlers are called with a lock held, so messages from different
+    //  threads are delivered one at a time.  Each returns the old handler.
     static DebugMsgHandler SetDebugMsgHandler(DebugMsgHandler handler);
+    static LogMsgHandler SetLogMsgHandler(LogMsgHandler handler);
+
+    // Messages below the threshold are discarded before they're formatted.
+    //  The default is kLogVerbose, i.e. everything the library was built
+    //  with (see DLOG_MIN_LEVEL in DiskImgPriv.h).
+    static void SetLogThreshold(LogLevel level);
+    static void SetLogThreshold(LogTag tag, LogLevel level);
+    static bool IsLogEnabled(LogTag tag, LogLevel level) {
+        return level >= fLogThreshold[tag];
+    }
+
+    static void PrintLogMsg(LogTag tag, LogLevel level, const char* file,
+            int line, const char* fmt, ...)
+        #if defined(__GNUC__)
+            __attribute__ ((format(printf, 5, 6)))
+        #endif
+        ;
+    // Same as PrintLogMsg(kLogTagGeneral, kLogInfo, ...).
     static void PrintDebugMsg(const char* file, int line, const char* fmt, ...)
         #if defined(__GNUC__)
             __attribute__ ((format(printf, 3, 4)))
         #endif
         ;
 
+    // Set the #of threads used to probe for filesystems in AnalyzeImage.
+    // 0 (the default) picks a value based on the processor count; 1 runs
+    // the probes one at a time on the calling thread.
+    static void SetProbeThreads(int numThreads) {
+        fProbeThreads = numThreads < 0 ? 0 : numThreads;
+    }
+    static int GetProbeThreads(void);
+
+    // Enable the persistent format-detection cache, kept in "pathName".
+    // AnalyzeImage uses it to skip the analysis of files it has seen
+    // before.  If "verifyInterval" is nonzero, every Nth cache hit is
+    // re-analyzed anyway, and the entry replaced if it has gone stale.
+    // Pass NULL to disable.  Call before any images are opened.
+    static DIError SetFormatCache(const char* pathName, int verifyInterval);
+    static FormatCache* GetFormatCache(void) { return fpFormatCache; }
+    // get hit/miss/stale counts; all zero if the cache isn't enabled
+    static void GetFormatCacheStats(long* pHits, long* pMisses,
+        long* pStale);
+
 private:
     // no instantiation allowed
     Global(void) {}
@@ -230,6 +298,11 @@ private:
     static bool fAppInitCalled;
 
     static ASPI*    fpASPI;
+
+    static int      fProbeThreads;
+
+    static LogLevel fLogThreshold[kLogTagMax];
+    static FormatCache* fpFormatCache;
 };
 
 extern bool gAllowWritePhys0;   // ugh -- see Win32BlockIO.cpp
@@ -517,6 +590,8 @@ public:
     virtual DIError ReadBlocks(long startBlock, int numBlocks, void* buf);
     // check our virtual bad block map
     bool CheckForBadBlocks(long startBlock, int numBlocks);
+    // get a pointer to a block's data without copying it (may return NULL)
+    const uint8_t* BorrowBlock(long block);
     // write a 512-byte block
     virtual DIError WriteBlock(long block, const void* buf);
     // write multiple blocks
@@ -528,6 +603,9 @@ public:
     // write a track; trackLen must be <= those in image
     virtual DIError WriteNibbleTrack(long track, const uint8_t* buf,
         long trackLen);
+    // decode every sector of a 5.25" nibble image, using several threads
+    DIError DecodeNibbleTracks(uint8_t* buf, long bufLen,
+        DIError* sectorErrs, int* pNumBad, int numThreads = 0);
 
     // save the current image as a 2MG file
     //DIError Write2MG(const char* filename);
@@ -558,6 +636,14 @@ public:
     // must be set before image is opened or created
     void SetNuFXCompressionType(int val) { fNuFXCompressType = val; }
 
+    // Set the size of the block cache, in 512-byte blocks; 0 disables it.
+    // Sub-volumes share the cache of the topmost image, so calls on an
+    // embedded image are passed up.  Flushes the current cache.
+    enum { kDefaultBlockCacheSize = 1024 };
+    DIError SetBlockCacheSize(long numBlocks);
+    // get cache hit/miss counts (from the topmost image)
+    void GetBlockCacheStats(long* pHits, long* pMisses) const;
+
     /*
      * Set up a progress callback to use when scanning a disk volume.  Pass
      * NULL for "func" to disable.
@@ -630,6 +716,31 @@ public:
     static const NibbleDescr* GetStdNibbleDescr(StdNibbleDescr idx);
     // call this once, at DLL initialization time
     static void CalcNibbleInvTables(void);
+
+    /*
+     * Decoders for 5.25" sector data fields.  "Auto" selects the fastest
+     * one available in this build; the others are for testing and
+     * benchmarks.  All of them produce the same results.  SSE2 only
+     * applies to 6&2; 5&3 uses the scalar decoder unless "Table" is
+     * selected.
+     */
+    typedef enum {
+        kNibbleCodecAuto = 0,
+        kNibbleCodecScalar,         // reference, one byte at a time
+        kNibbleCodecTable,          // table-driven, linear passes
+        kNibbleCodecSSE2,           // table-driven plus SSE2
+    } NibbleCodec;
+    static bool IsNibbleCodecAvailable(NibbleCodec codec);
+    // returns false if "codec" isn't available
+    static bool SetNibbleCodec(NibbleCodec codec);
+    static NibbleCodec GetNibbleCodec(void) { return fNibbleCodec; }
+    // #of bytes in a data field, including the checksum byte
+    static int GetNibbleFieldSize(const NibbleDescr* pNibbleDescr);
+    // decode/encode a data field; "field" starts just past the data prolog
+    static DIError DecodeNibbleField(const uint8_t* field, uint8_t* sctBuf,
+        const NibbleDescr* pNibbleDescr);
+    static void EncodeNibbleField(uint8_t* field, const uint8_t* sctBuf,
+        const NibbleDescr* pNibbleDescr);
     // calculate block number from cyl/head/sect on 3.5" disk
     static int CylHeadSect35ToBlock(int cyl, int head, int sect);
     // unpack nibble data from a 3.5" disk track
@@ -723,14 +834,56 @@ private:
     int             fNumSectPerTrack;   // (ditto)
     long            fNumBlocks;     // for 512-byte block-addressable images
 
-    uint8_t*        fNibbleTrackBuf;    // allocated on heap
-    int             fNibbleTrackLoaded; // track currently in buffer
+    BlockCache*     fpBlockCache;   // only in topmost image; lazily created
+    long            fBlockCacheSize;    // max #of blocks in cache (0=off)
+    di_off_t        fParentOffset;  // start of embedded volume in parent
+    ProbeSnapshot*  fpProbeSnapshot;    // non-NULL during parallel FS probe
+
+    /* identifies the source file, for the format cache */
+    bool            fHaveFileId;
+    di_off_t        fFileIdSize;
+    int64_t         fFileIdMtime;
+    uint64_t        fFileIdHash;
+
+    /* where each sector's fields are in the nibble track buffer */
+    typedef struct NibbleSectorAddr {
+        int         dataIdx;        // start of data field, or -1 if missing
+        short       vol;            // address field values
+        short       track;
+        short       chksum;
+    } NibbleSectorAddr;
+
+    /*
+     * One cached nibble track.  Holds the raw track data, the sector map
+     * built from it, and the sector data decoded so far.  Writes are made
+     * to "trackBuf" and reach the image file when the slot is evicted or
+     * the image is flushed.
+     */
+    typedef struct NibbleTrackSlot {
+        long        track;          // track held here, or -1 if empty
+        long        trackLen;
+        uint8_t*    trackBuf;       // kTrackAllocSize bytes
+        bool        dirty;          // trackBuf differs from image file
+        unsigned long lastUse;      // for LRU replacement
+
+        const NibbleDescr* pMapDescr;   // descr used to build map, or NULL
+        NibbleSectorAddr map[kMaxNibbleSectors];
+
+        uint8_t*    sectorBuf;      // decoded data, 256 bytes per sector
+        bool        sectorDecoded[kMaxNibbleSectors];
+        DIError     sectorStatus[kMaxNibbleSectors];
+    } NibbleTrackSlot;
+    enum { kNibbleCacheTracks = kMaxNibbleTracks525 };
+    NibbleTrackSlot* fpNibbleSlots;     // allocated on first use
+    unsigned long   fNibbleUseCounter;
 
     int             fNuFXCompressType;  // used when compressing a NuFX image
 
     char*           fNotes;         // warnings and FYIs about DiskImg/DiskFS
 
     LinearBitmap*   fpBadBlockMap;  // used for 3.5" nibble images
+    LinearBitmap*   fpDirtyMap;     // 512-byte units written since last
+                                    //  wrapper flush; NULL means "all"
 
     int             fDiskFSRefCnt;  // #of DiskFS objects pointing at us
 
@@ -751,8 +904,18 @@ private:
     DIError FormatSectors(GenericFD* pGFD, bool quickFormat) const;
     //DIError FormatBlocks(GenericFD* pGFD) const;
 
-    DIError CopyBytesOut(void* buf, di_off_t offset, int size) const;
+    DIError CopyBytesOut(void* buf, di_off_t offset, int size);
     DIError CopyBytesIn(const void* buf, di_off_t offset, int size);
+    void MarkDataDirty(di_off_t offset, int size);
+    DIError ReadDataGFD(void* buf, di_off_t offset, int size);
+    BlockCache* GetBlockCache(void);
+    DIMutex* GetProbeLock(void);
+    bool ProbeFSParallel(int* pWinner, SectorOrder* pOrder,
+        FSFormat* pFormat);
+    int ProbeFS(SectorOrder* pOrder, FSFormat* pFormat);
+    void ApplyFSResult(int winner, SectorOrder order, FSFormat format);
+    bool IsCachedFormatUsable(int probe, int nibbleDescr) const;
+    DIError FreeBlockCache(void);
     DIError AnalyzeImageFile(const char* pathName, char fssep);
     // Figure out the sector ordering for this filesystem, so we can decide
     //  how the sectors need to be re-arranged when we're reading them.
@@ -761,6 +924,10 @@ private:
     DIError CalcSectorAndOffset(long track, int sector, SectorOrder ImageOrder,
         SectorOrder fsOrder, di_off_t* pOffset, int* pNewSector);
     inline bool IsLinearBlocks(SectorOrder imageOrder, SectorOrder fsOrder);
+    // Move whole tracks for multi-block I/O on non-linear sector images.
+    bool CanGatherTracks(void) const;
+    DIError TransferTrackBlocks(long startBlock, int numBlocks, uint8_t* buf,
+        bool doWrite);
 
     /*
      * Progress update during the filesystem scan.  This only exists in the
@@ -819,10 +986,17 @@ private:
         }
         return GetNibbleTrackFormatLength();
     }
-    DIError LoadNibbleTrack(long track, long* pTrackLen);
-    DIError SaveNibbleTrack(void);
-    int FindNibbleSectorStart(const CircularBufferAccess& buffer,
-        int track, int sector, const NibbleDescr* pNibbleDescr, int* pVol);
+    DIError LoadNibbleTrack(long track, NibbleTrackSlot** ppSlot);
+    DIError SaveNibbleTrack(NibbleTrackSlot* pSlot);
+    DIError FlushNibbleTracks(void);
+    void FreeNibbleTracks(void);
+    void InvalidateNibbleMaps(void);
+    void MarkNibbleTrackDirty(NibbleTrackSlot* pSlot);
+    void IndexNibbleTrack(const CircularBufferAccess& buffer, int track,
+        const NibbleDescr* pNibbleDescr, NibbleSectorAddr* pMap);
+    DIError GetNibbleSectorData(NibbleTrackSlot* pSlot, int sector,
+        const NibbleDescr* pNibbleDescr, const uint8_t** ppData);
+    static void NibbleDecodeWorker(void* vwork);
     void DecodeAddr(const CircularBufferAccess& buffer, int offset,
         short* pVol, short* pTrack, short* pSector, short* pChksum);
     inline uint16_t ConvFrom44(uint8_t val1, uint8_t val2) {
@@ -832,16 +1006,26 @@ private:
         uint8_t* sctBuf, const NibbleDescr* pNibbleDescr);
     void EncodeNibbleData(const CircularBufferAccess& buffer, int idx,
         const uint8_t* sctBuf, const NibbleDescr* pNibbleDescr) const;
-    DIError DecodeNibble62(const CircularBufferAccess& buffer, int idx,
-        uint8_t* sctBuf, const NibbleDescr* pNibbleDescr);
-    void EncodeNibble62(const CircularBufferAccess& buffer, int idx,
-        const uint8_t* sctBuf, const NibbleDescr* pNibbleDescr) const;
-    DIError DecodeNibble53(const CircularBufferAccess& buffer, int idx,
-        uint8_t* sctBuf, const NibbleDescr* pNibbleDescr);
-    void EncodeNibble53(const CircularBufferAccess& buffer, int idx,
-        const uint8_t* sctBuf, const NibbleDescr* pNibbleDescr) const;
+    static bool DecodeNibble62(const uint8_t* field, uint8_t* sctBuf,
+        int* pChksum);
+    static bool DecodeNibble62Table(const uint8_t* field, uint8_t* sctBuf,
+        int* pChksum);
+    static bool DecodeNibble62SSE2(const uint8_t* field, uint8_t* sctBuf,
+        int* pChksum);
+    static void AssembleNibble62(const uint8_t* vals, uint8_t* sctBuf);
+    static void EncodeNibble62(uint8_t* field, const uint8_t* sctBuf,
+        int chksum);
+    static bool DecodeNibble53(const uint8_t* field, uint8_t* sctBuf,
+        int* pChksum);
+    static bool DecodeNibble53Table(const uint8_t* field, uint8_t* sctBuf,
+        int* pChksum);
+    static void AssembleNibble53(const uint8_t* vals, uint8_t* sctBuf);
+    static void EncodeNibble53(uint8_t* field, const uint8_t* sctBuf,
+        int chksum);
     int TestNibbleTrack(int track, const NibbleDescr* pNibbleDescr, int* pVol);
     DIError AnalyzeNibbleData(void);
+    void CalcNibbleNumTracks(void);
+    DIError SetCachedNibbleDescr(int idx, short dosVolumeNum);
     inline uint8_t Conv44(uint16_t val, bool first) const {
         if (first)
             return (val >> 1) | 0xaa;
@@ -871,6 +1055,8 @@ private:
     static uint8_t kInvDiskBytes53[256];
     static uint8_t kInvDiskBytes62[256];
     enum { kInvInvalidValue = 0xff };
+    static NibbleCodec fNibbleCodec;
+    static NibbleCodec fNibbleCodec53;
 
 private:    // some C++ stuff to block behavior we don't support
     DiskImg& operator=(const DiskImg&);
@@ -888,10 +1074,10 @@ private:    // some C++ stuff to block behavior we don't support
  * instantiated.
  *
  * We maintain a linear list of files to make it easy for applications to
- * traverse the full set of files.  Sometimes this makes it hard for us to
- * update internally (especially HFS).  With some minor cleverness it
- * should be possible to switch to a tree structure while retaining the
- * linear "get next" API.  This would be a big help for ProDOS and HFS.
+ * traverse the full set of files.  Each directory also keeps a list of its
+ * children, so hierarchical filesystems (ProDOS, HFS) can find a file's
+ * place in the list, or the end of a subdirectory, without walking
+ * everything that comes before it.
  *
  * NEED: some notification mechanism for changes to files and/or block
  * editing of the disk (especially with regard to open sub-volumes).  If
@@ -1093,9 +1279,17 @@ public:
 
     DiskFS(void) {
         fpA2Head = fpA2Tail = NULL;
+        fpRootFiles = NULL;
+        fFileCount = 0;
+        fpFileIndex = NULL;
+        fpFoldTable = NULL;
+        fFoldCompareFunc = NULL;
         fpSubVolumeHead = fpSubVolumeTail = NULL;
         fpImg = NULL;
         fScanForSubVolumes = kScanSubDisabled;
+        fPendingDirCount = 0;
+        fLazyLoadPending = false;
+        fpInsertAfter = NULL;
 
         fParmTable[kParm_CreateUnique] = 0;
         fParmTable[kParmProDOS_AllowLowerCase] = 1;
@@ -1136,16 +1330,54 @@ public:
      *
      * If "headerOnly" is set, we just do a quick scan of the volume header
      * to get basic information.  The deep file scan is skipped (but can
-     * be done later).  (Sub-classes can choose to ignore the flag and
-     * always do the full scan; this is an optimization.)  Guaranteed to
-     * set the volume name and volume block/sector count.
+     * be done later).  Guaranteed to set the volume name and volume
+     * block/sector count, and GetFreeSpaceCount works if the filesystem
+     * supports it.  The file list may be empty, and GetFSDamaged isn't
+     * meaningful.  Containers open their sub-volumes header-only.
+     *
+     * "kInitLazy" reads the top-level directory and defers everything else
+     * on filesystems that support it (ProDOS, HFS, and DOS 3.x).  A
+     * subdirectory's contents are read the first time somebody asks for
+     * them, through GetChild, GetFileByName, or a walk of the whole list,
+     * and the usage map, damage check, and sub-volume scan happen when
+     * GetVolumeUsageMap, GetFSDamaged, or CompleteLazyLoad is called.
+     * Until then, per-file quality only reflects problems found while
+     * reading the directories, and ProDOS sparse lengths equal the full
+     * lengths.
+     * Filesystems without lazy support do a full scan.
      *
      * If a progress callback is set up, this can return with a "cancelled"
      * result, which should not be treated as a failure.
      */
-    typedef enum { kInitUnknown = 0, kInitHeaderOnly, kInitFull } InitMode;
+    typedef enum {
+        kInitUnknown = 0, kInitHeaderOnly, kInitFull, kInitLazy
+    } InitMode;
     virtual DIError Initialize(DiskImg* pImg, InitMode initMode) = 0;
 
+    /*
+     * Finish the job on a volume opened with kInitLazy: read the rest of
+     * the directories, then build the usage map, check the volume for
+     * damage, and (if enabled) look for sub-volumes.  Does nothing if
+     * there's nothing left to do.  Sub-volumes embedded in the volume
+     * don't appear in GetNextSubVolume until this has been called.
+     *
+     * Progress goes to the DiskImg scan progress callback, and the
+     * callback can cancel the analysis, in which case this returns
+     * kDIErrCancelled and the analysis stays pending.  Calling again picks
+     * up roughly where it stopped.
+     *
+     * This may be run on a worker thread so the UI stays responsive, so
+     * long as nothing else touches this DiskFS, its sub-volumes, or the
+     * DiskImg until it returns.
+     */
+    DIError CompleteLazyLoad(void);
+
+    // Returns "true" if a kInitLazy open still has work left for
+    //  CompleteLazyLoad.  GetFSDamaged isn't meaningful until it's done.
+    bool GetLazyLoadPending(void) const {
+        return fLazyLoadPending || fPendingDirCount != 0;
+    }
+
     /*
      * Format the disk with the appropriate filesystem, creating all filesystem
      * structures and (when appropriate) boot blocks.
@@ -1264,12 +1496,21 @@ public:
     // Get a count of the files and directories on this disk.
     long GetFileCount(void) const;
 
+    // Get the files in directory "pDir", in list order.  Pass NULL for the
+    //  top level (on ProDOS and HFS that's just the volume directory).
+    long GetChildCount(const A2File* pDir) const;
+    A2File* GetChild(const A2File* pDir, long idx) const;
+
     /*
      * Find a file by case-insensitive pathname.  Assumes fssep=':'.  The
      * compare function can be overridden for systems like HFS, where "case
      * insensitive" has a different meaning because of the native
      * character set.
      *
+     * Lookups with the default compare function, or the one the filesystem
+     * registered with SetFileNameFolding(), go through a hash index that's
+     * built the first time it's needed.  Anything else scans the list.
+     *
      * The A2File* returned should not be deleted.
      */
     typedef int (*StringCompareFunc)(const char* str1, const char* str2);
@@ -1300,8 +1541,12 @@ public:
      * Return the volume use map.  This is a non-const function because
      * it might need to do a "just-in-time" usage map update.  It returns
      * const to keep non-DiskFS classes from altering the map.
+     *
+     * Returns NULL if the lazy analysis was cancelled.
      */
     const VolumeUsage* GetVolumeUsageMap(void) {
+        if (CompleteLazyLoad() != kDIErrNone && GetLazyLoadPending())
+            return NULL;
         if (fVolumeUsage.GetInitialized())
             return &fVolumeUsage;
         else
@@ -1389,12 +1634,44 @@ protected:
     void AddFileToList(A2File* pFile);
     // only need for hierarchical filesystems; insert file after pPrev
     void InsertFileInList(A2File* pFile, A2File* pPrev);
-    // delete an entry
+    // delete an entry, and everything in it if it's a directory
     void DeleteFileFromList(A2File* pFile);
+    // get the last file in the subdir, or the subdir itself if it's empty
+    A2File* SkipSubdir(A2File* pSubdir) const;
+
+    // Set the table used to fold pathname characters for the name index,
+    //  and the compare function it's meant for.  Characters that "func"
+    //  considers equal must fold to the same value, and the folding must
+    //  at least ignore ASCII case, because strcasecmp uses the index too.
+    //  The table must outlive the DiskFS.  Call before adding files.
+    void SetFileNameFolding(const uint8_t* foldTable, StringCompareFunc func);
+    // call after changing the pathname of a file that's in the list
+    void InvalidateFileIndex(void);
+    // Filesystem-specific numeric key for the index, e.g. a key block, or
+    //  -1 if the file doesn't have one.
+    virtual long GetFileIndexKey(const A2File* pFile) const { return -1; }
+    // Find the file in "pParent" with the given key.  Returns NULL if the
+    //  index can't give a definite answer; the caller should fall back to
+    //  scanning the list.
+    A2File* GetFileByIndexKey(long key, const A2File* pParent);
 
     // scan for damaged or suspicious files
     void ScanForDamagedFiles(bool* pDamaged, bool* pSuspicious);
 
+    // Lazy loading (kInitLazy).  Initialize marks each subdirectory it
+    //  doesn't read with SetDirPending, and calls SetLazyLoadPending if
+    //  volume-wide work was deferred.  LoadDirectory reads one pending
+    //  directory, using AddFileToList, which puts the entries right after
+    //  the directory in the list.  FinishLazyLoad runs the deferred scans
+    //  after every directory has been read; if it returns kDIErrCancelled
+    //  it will be called again later, and should resume, not restart.
+    //  Directory loads aren't cancellable, so filesystems should ignore
+    //  the progress callback's answer while reading one.
+    void SetDirPending(A2File* pDir);
+    void SetLazyLoadPending(void) { fLazyLoadPending = true; }
+    virtual DIError LoadDirectory(A2File* pDir) { return kDIErrNone; }
+    virtual DIError FinishLazyLoad(void) { return kDIErrNone; }
+
     // pointer to the DiskImg structure underlying this filesystem
     DiskImg*    fpImg;
 
@@ -1403,17 +1680,31 @@ protected:
 
 
 private:
-    A2File* SkipSubdir(A2File* pSubdir);
+    FileChildList* GetChildList(const A2File* pDir, bool create) const;
+    void LinkFileAfter(A2File* pFile, A2File* pPrev);
+    bool BuildFileIndex(void);
     void CopyInheritables(DiskFS* pNewFS);
     void DeleteFileList(void);
     void DeleteSubVolumeList(void);
+    void LoadPendingDir(A2File* pDir);
+    DIError LoadAllPendingDirs(bool canCancel);
+    void LoadPendingPath(const char* pathName, StringCompareFunc func);
+    A2File* FindFileByName(const char* pathName, StringCompareFunc func);
 
     long fParmTable[kParmMax];          // for DiskFSParameter
 
     A2File*     fpA2Head;
     A2File*     fpA2Tail;
+    FileChildList* fpRootFiles;     // files with no parent
+    long        fFileCount;
+    FileIndex*  fpFileIndex;        // NULL until somebody needs it
+    const uint8_t* fpFoldTable;     // NULL means ASCII case folding
+    StringCompareFunc fFoldCompareFunc;
     SubVolume*  fpSubVolumeHead;
     SubVolume*  fpSubVolumeTail;
+    long        fPendingDirCount;   // directories not yet read
+    bool        fLazyLoadPending;   // FinishLazyLoad not yet called
+    A2File*     fpInsertAfter;      // AddFileToList target in LoadDirectory
 
 private:
     DiskFS& operator=(const DiskFS&);
@@ -1452,6 +1743,8 @@ public:
 
     A2File(DiskFS* pDiskFS) : fpDiskFS(pDiskFS) {
         fpPrev = fpNext = NULL;
+        fpChildren = NULL;
+        fDirPending = false;
         fFileQuality = kQualityGood;
     }
     virtual ~A2File(void) {}
@@ -1563,6 +1856,8 @@ private:
 
     A2File*     fpPrev;
     A2File*     fpNext;
+    FileChildList* fpChildren;      // owned by DiskFS; NULL if none
+    bool        fDirPending;        // directory contents not read yet
 
 
 private:
@@ -86,10 +86,14 @@ public:
 private:
     DIError ExtractGzipImage(gzFile gzfp, char** pBuf, di_off_t* pLength);
     DIError CloseGzip(void);
+    static DIError GetTrailerLength(GenericFD* pGFD, di_off_t outerLength,
+        di_off_t* pLength);
 
     // Largest possible ProDOS volume; quite a bit to hold in RAM. Add a
     // little extra for .hdv format.
     enum { kMaxUncompressedSize = kGzipMax +256 };
+    // Read-only images at least this big are inflated on demand.
+    enum { kMinStreamedSize = 2 * 1024 * 1024 };
 
     bool    fWrapperDamaged;
 };
@@ -259,6 +263,7 @@ private:
         kZipFssep       = '/',
         kDefaultVersion = 20,
         kMaxUncompressedSize = kGzipMax +256,
+        kMinStreamedSize = 2 * 1024 * 1024,     // see OuterGzip
     };
     enum {
         kCompressStored     = 0,        // no compression
@@ -271,6 +276,8 @@ private:
         CentralDirEntry* pDirEntry);
     DIError ExtractZipEntry(GenericFD* pOuterGFD, CentralDirEntry* pCDE,
         uint8_t** pBuf, di_off_t* pLength);
+    DIError OpenStreamedEntry(GenericFD* pOuterGFD, CentralDirEntry* pCDE,
+        GenericFD** ppWrapperGFD);
     DIError InflateGFDToBuffer(GenericFD* pGFD, unsigned long compSize,
         unsigned long uncompSize, uint8_t* buf);
     DIError DeflateGFDToGFD(GenericFD* pDst, GenericFD* pSrc, di_off_t length,
@@ -317,9 +324,12 @@ public:
         DiskImg::SectorOrder order, short dosVolumeNum, GenericFD* pWrapperGFD,
         di_off_t* pWrappedLength, GenericFD** pDataFD) = 0;
 
-    // push altered data to the wrapper GFD
+    // push altered data to the wrapper GFD; "pDirtyMap" has a bit set for
+    // each 512-byte unit written since the last flush, or is NULL if
+    // everything should be considered changed
     virtual DIError Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-        di_off_t dataLen, di_off_t* pWrappedLen) = 0;
+        di_off_t dataLen, di_off_t* pWrappedLen,
+        const LinearBitmap* pDirtyMap) = 0;
 
     // set the storage name (used by some formats)
     virtual void SetStorageName(const char* name) {
@@ -388,7 +398,8 @@ public:
         DiskImg::SectorOrder order, short dosVolumeNum, GenericFD* pWrapperGFD,
         di_off_t* pWrappedLength, GenericFD** pDataFD) override;
     virtual DIError Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-        di_off_t dataLen, di_off_t* pWrappedLen) override;
+        di_off_t dataLen, di_off_t* pWrappedLen,
+        const LinearBitmap* pDirtyMap) override;
     virtual bool HasFastFlush(void) const override { return true; }
     //virtual const char* GetComment(void) const { return NULL; }
     // (need to hold TwoImgHeader in the struct, rather than as temp, or
@@ -397,12 +408,15 @@ public:
 
 class WrapperNuFX : public ImageWrapper {
 public:
-    WrapperNuFX(void) : fpArchive(NULL), fThreadIdx(0), fStorageName(NULL),
-        fCompressType(kNuThreadFormatLZW2)
+    WrapperNuFX(void) : fpArchive(NULL), fThreadIdx(0), fThreadLength(-1),
+        fStorageName(NULL), fCompressType(kNuThreadFormatLZW2)
         {}
     virtual ~WrapperNuFX(void) { CloseNuFX(); delete[] fStorageName; }
 
-    static DIError Test(GenericFD* pGFD, di_off_t wrappedLength);
+    // If "ppWrapper" is non-NULL, a successful test hands back a wrapper
+    // that holds the archive open, so Prep doesn't have to open it again.
+    static DIError Test(GenericFD* pGFD, di_off_t wrappedLength,
+        WrapperNuFX** ppWrapper = NULL);
     virtual DIError Prep(GenericFD* pGFD, di_off_t wrappedLength, bool readOnly,
         di_off_t* pLength, DiskImg::PhysicalFormat* pPhysical,
         DiskImg::SectorOrder* pOrder, short* pDiskVolNum,
@@ -411,7 +425,8 @@ public:
         DiskImg::SectorOrder order, short dosVolumeNum, GenericFD* pWrapperGFD,
         di_off_t* pWrappedLength, GenericFD** pDataFD) override;
     virtual DIError Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-        di_off_t dataLen, di_off_t* pWrappedLen) override;
+        di_off_t dataLen, di_off_t* pWrappedLen,
+        const LinearBitmap* pDirtyMap) override;
     virtual bool HasFastFlush(void) const override { return false; }
 
     void SetStorageName(const char* name) {
@@ -437,15 +452,20 @@ private:
 
     NuArchive*      fpArchive;
     NuThreadIdx     fThreadIdx;
+    long            fThreadLength;      // set by Test
     char*           fStorageName;
     NuThreadFormat  fCompressType;
 };
 
 class WrapperDiskCopy42 : public ImageWrapper {
 public:
-    WrapperDiskCopy42(void) : fStorageName(NULL), fBadChecksum(false)
+    WrapperDiskCopy42(void) : fStorageName(NULL), fBadChecksum(false),
+        fpBlockSums(NULL)
         {}
-    virtual ~WrapperDiskCopy42(void) { delete[] fStorageName; }
+    virtual ~WrapperDiskCopy42(void) {
+        delete[] fStorageName;
+        delete[] fpBlockSums;
+    }
 
     static DIError Test(GenericFD* pGFD, di_off_t wrappedLength);
     virtual DIError Prep(GenericFD* pGFD, di_off_t wrappedLength, bool readOnly,
@@ -456,7 +476,8 @@ public:
         DiskImg::SectorOrder order, short dosVolumeNum, GenericFD* pWrapperGFD,
         di_off_t* pWrappedLength, GenericFD** pDataFD) override;
     virtual DIError Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-        di_off_t dataLen, di_off_t* pWrappedLen) override;
+        di_off_t dataLen, di_off_t* pWrappedLen,
+        const LinearBitmap* pDirtyMap) override;
     void SetStorageName(const char* name) {
         delete[] fStorageName;
         if (name != NULL) {
@@ -475,11 +496,12 @@ private:
     void InitHeader(DC42Header* pHeader);
     static int ReadHeader(GenericFD* pGFD, DC42Header* pHeader);
     DIError WriteHeader(GenericFD* pGFD, const DC42Header* pHeader);
-    static DIError ComputeChecksum(GenericFD* pGFD,
-        uint32_t* pChecksum);
+    DIError ComputeChecksum(GenericFD* pGFD, di_off_t dataOffset,
+        long firstBlock, uint32_t* pChecksum);
 
     char*           fStorageName;
     bool            fBadChecksum;
+    uint32_t*       fpBlockSums;    // running checksum at start of each block
 };
 
 class WrapperDDD : public ImageWrapper {
@@ -493,7 +515,8 @@ public:
         DiskImg::SectorOrder order, short dosVolumeNum, GenericFD* pWrapperGFD,
         di_off_t* pWrappedLength, GenericFD** pDataFD) override;
     virtual DIError Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-        di_off_t dataLen, di_off_t* pWrappedLen) override;
+        di_off_t dataLen, di_off_t* pWrappedLen,
+        const LinearBitmap* pDirtyMap) override;
     virtual bool HasFastFlush(void) const override { return false; }
 
     enum {
@@ -538,7 +561,8 @@ public:
         DiskImg::SectorOrder order, short dosVolumeNum, GenericFD* pWrapperGFD,
         di_off_t* pWrappedLength, GenericFD** pDataFD) override;
     virtual DIError Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-        di_off_t dataLen, di_off_t* pWrappedLen) override;
+        di_off_t dataLen, di_off_t* pWrappedLen,
+        const LinearBitmap* pDirtyMap) override;
     virtual bool HasFastFlush(void) const override { return true; }
 };
 
@@ -566,7 +590,8 @@ public:
         DiskImg::SectorOrder order, short dosVolumeNum, GenericFD* pWrapperGFD,
         di_off_t* pWrappedLength, GenericFD** pDataFD) override;
     virtual DIError Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-        di_off_t dataLen, di_off_t* pWrappedLen) override;
+        di_off_t dataLen, di_off_t* pWrappedLen,
+        const LinearBitmap* pDirtyMap) override;
     virtual bool HasFastFlush(void) const override { return false; }
 
     virtual void SetStorageName(const char* name) override
@@ -630,7 +655,8 @@ private:
 
 class WrapperFDI : public ImageWrapper {
 public:
-    WrapperFDI(void) : fHeaderBuf(), fImageTracks(0), fStorageName(NULL) {}
+    WrapperFDI(void) : fHeaderBuf(), fImageTracks(0), fStorageName(NULL),
+        fRandState(0) {}
     virtual ~WrapperFDI(void) {}
 
     static DIError Test(GenericFD* pGFD, di_off_t wrappedLength);
@@ -642,7 +668,8 @@ public:
         DiskImg::SectorOrder order, short dosVolumeNum, GenericFD* pWrapperGFD,
         di_off_t* pWrappedLength, GenericFD** pDataFD) override;
     virtual DIError Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-        di_off_t dataLen, di_off_t* pWrappedLen) override;
+        di_off_t dataLen, di_off_t* pWrappedLen,
+        const LinearBitmap* pDirtyMap) override;
     virtual bool HasFastFlush(void) const override { return false; }
 
     enum {
@@ -788,6 +815,7 @@ private:
 
     int     fImageTracks;
     char*   fStorageName;
+    int     fRandState;     // for MyRand; per-instance so results repeat
 
 
     /*
@@ -834,7 +862,8 @@ public:
         DiskImg::SectorOrder order, short dosVolumeNum, GenericFD* pWrapperGFD,
         di_off_t* pWrappedLength, GenericFD** pDataFD) override;
     virtual DIError Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-        di_off_t dataLen, di_off_t* pWrappedLen) override;
+        di_off_t dataLen, di_off_t* pWrappedLen,
+        const LinearBitmap* pDirtyMap) override;
     virtual bool HasFastFlush(void) const override { return true; }
 };
 
@@ -849,7 +878,8 @@ public:
         DiskImg::SectorOrder order, short dosVolumeNum, GenericFD* pWrapperGFD,
         di_off_t* pWrappedLength, GenericFD** pDataFD) override;
     virtual DIError Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-        di_off_t dataLen, di_off_t* pWrappedLen) override;
+        di_off_t dataLen, di_off_t* pWrappedLen,
+        const LinearBitmap* pDirtyMap) override;
     virtual bool HasFastFlush(void) const override { return true; }
 };
 
@@ -926,6 +956,21 @@ protected:
         const char* partName, const char* partType,
         DiskImg** ppNewImg, DiskFS** ppNewFS);
     virtual void SetVolumeUsageMap(void);
+
+    // A header-only Initialize of a container still finds the sub-volumes,
+    //  but only reads their headers.  Call before opening sub-volumes.
+    void LimitSubVolumeScan(InitMode initMode) {
+        if (initMode == kInitHeaderOnly &&
+            fScanForSubVolumes == kScanSubEnabled)
+        {
+            fScanForSubVolumes = kScanSubContainerOnly;
+        }
+    }
+    // Mode to use when initializing a sub-volume.
+    InitMode GetSubVolumeInitMode(void) const {
+        return (fScanForSubVolumes == kScanSubContainerOnly) ?
+            kInitHeaderOnly : kInitFull;
+    }
 };
 
 /*
@@ -945,6 +990,7 @@ public:
 
     virtual DIError Initialize(DiskImg* pImg, InitMode initMode) override {
         SetDiskImg(pImg);
+        LimitSubVolumeScan(initMode);
         return Initialize();
     }
 
@@ -982,6 +1028,7 @@ public:
 
     virtual DIError Initialize(DiskImg* pImg, InitMode initMode) override {
         SetDiskImg(pImg);
+        LimitSubVolumeScan(initMode);
         return Initialize();
     }
 
@@ -1016,6 +1063,7 @@ public:
 
     virtual DIError Initialize(DiskImg* pImg, InitMode initMode) override {
         SetDiskImg(pImg);
+        LimitSubVolumeScan(initMode);
         return Initialize();
     }
 
@@ -1064,6 +1112,7 @@ public:
 
     virtual DIError Initialize(DiskImg* pImg, InitMode initMode) override {
         SetDiskImg(pImg);
+        LimitSubVolumeScan(initMode);
         return Initialize();
     }
 
@@ -1117,6 +1166,7 @@ public:
 
     virtual DIError Initialize(DiskImg* pImg, InitMode initMode) override {
         SetDiskImg(pImg);
+        LimitSubVolumeScan(initMode);
         return Initialize();
     }
 
@@ -1166,6 +1216,7 @@ public:
 
     virtual DIError Initialize(DiskImg* pImg, InitMode initMode) override {
         SetDiskImg(pImg);
+        LimitSubVolumeScan(initMode);
         return Initialize();
     }
 
@@ -1247,7 +1298,10 @@ public:
         return fDiskVolumeName+3;
     }
     virtual bool GetReadWriteSupported(void) const override { return true; }
-    virtual bool GetFSDamaged(void) const override { return !fDiskIsGood; }
+    virtual bool GetFSDamaged(void) const override {
+        const_cast<DiskFSDOS33*>(this)->CompleteLazyLoad();
+        return !fDiskIsGood;
+    }
     virtual DIError GetFreeSpaceCount(long* pTotalUnits, long* pFreeUnits,
         int* pUnitSize) const override;
     virtual DIError NormalizePath(const char* path, char fssep,
@@ -1288,6 +1342,8 @@ public:
 
 private:
     DIError Initialize(InitMode initMode);
+    virtual DIError FinishLazyLoad(void) override;
+    void FinishVolumeScan(void);
     DIError ReadVTOC(void);
     void UpdateVolumeNum(void);
     void DumpVTOC(void);
@@ -1565,7 +1621,9 @@ public:
         fVolDirFileCount(0),
         fBlockUseMap(NULL),
         fDiskIsGood(false),
-        fEarlyDamage(false)
+        fEarlyDamage(false),
+        fLazyDirs(false),
+        fpUsageScanResume(NULL)
     {}
     virtual ~DiskFSProDOS(void) {
         if (fBlockUseMap != NULL) {
@@ -1602,7 +1660,10 @@ public:
     virtual const char* GetVolumeID(void) const override { return fVolumeID; }
     virtual const char* GetBareVolumeName(void) const override { return fVolumeName; }
     virtual bool GetReadWriteSupported(void) const override { return true; }
-    virtual bool GetFSDamaged(void) const override { return !fDiskIsGood; }
+    virtual bool GetFSDamaged(void) const override {
+        const_cast<DiskFSProDOS*>(this)->CompleteLazyLoad();
+        return !fDiskIsGood;
+    }
     virtual long GetFSNumBlocks(void) const override { return fTotalBlocks; }
     virtual DIError GetFreeSpaceCount(long* pTotalUnits, long* pFreeUnits,
         int* pUnitSize) const override;
@@ -1653,6 +1714,9 @@ private:
         const uint8_t* blkBuf, bool skipFirst, int* pCount,
         const char* basePath, uint16_t thisBlock, int depth);
     DIError ReadExtendedInfo(A2FileProDOS* pFile);
+    virtual DIError LoadDirectory(A2File* pDir) override;
+    virtual DIError FinishLazyLoad(void) override;
+    DIError ScanVolumeUsage(void);
     DIError ScanFileUsage(void);
     void ScanBlockList(long blockCount, uint16_t* blockList,
         long indexCount, uint16_t* indexList, long* pSparseCount);
@@ -1662,6 +1726,7 @@ private:
     void MarkSubVolumeBlocks(long block, long count);
 
     A2File* FindFileByKeyBlock(A2File* pStart, uint16_t keyBlock);
+    virtual long GetFileIndexKey(const A2File* pFile) const override;
     DIError AllocInitialFileStorage(const CreateParms* pParms,
         const char* upperName, uint16_t dirBlock, int dirEntrySlot,
         long* pKeyBlock, int* pBlocksUsed, int* pNewEOF);
@@ -1718,6 +1783,12 @@ private:
 
     /* set if something fixes damage so CheckDiskIsGood can't see it */
     bool            fEarlyDamage;
+
+    /* set for kInitLazy; subdirs are marked pending instead of read */
+    bool            fLazyDirs;
+
+    /* where ScanFileUsage stopped if it was cancelled during a lazy load */
+    A2FileProDOS*   fpUsageScanResume;
 };
 
 /*
@@ -2016,7 +2087,7 @@ public:
 
     virtual DIError Initialize(DiskImg* pImg, InitMode initMode) override {
         SetDiskImg(pImg);
-        return Initialize();
+        return Initialize(initMode);
     }
     virtual DIError Format(DiskImg* pDiskImg, const char* volName) override;
 
@@ -2051,7 +2122,7 @@ public:
     friend class A2FDPascal;
 
 private:
-    DIError Initialize(void);
+    DIError Initialize(InitMode initMode);
     DIError LoadVolHeader(void);
     void SetVolumeID(void);
     void DumpVolHeader(void);
@@ -2259,7 +2330,7 @@ public:
 
     virtual DIError Initialize(DiskImg* pImg, InitMode initMode) override {
         SetDiskImg(pImg);
-        return Initialize();
+        return Initialize(initMode);
     }
 
     virtual const char* GetVolumeName(void) const override { return "CP/M"; }
@@ -2316,7 +2387,7 @@ public:
     }
 
 private:
-    DIError Initialize(void);
+    DIError Initialize(InitMode initMode);
     DIError ReadCatalog(void);
     DIError ScanFileUsage(void);
     void SetBlockUsage(long block, VolumeUsage::ChunkPurpose purpose);
@@ -2471,7 +2542,7 @@ public:
 
     virtual DIError Initialize(DiskImg* pImg, InitMode initMode) override {
         SetDiskImg(pImg);
-        return Initialize();
+        return Initialize(initMode);
     }
 
     virtual const char* GetVolumeName(void) const override { return fVolumeName; }
@@ -2489,7 +2560,7 @@ private:
     static DIError TestCommon(DiskImg* pImg, DiskImg::SectorOrder* pOrder,
         FSLeniency leniency, DiskImg::FSFormat* pFormatFound);
 
-    DIError Initialize(void);
+    DIError Initialize(InitMode initMode);
     DIError ReadCatalog(void);
     DIError ScanFileUsage(void);
     void SetSectorUsage(long track, long sector,
@@ -2631,6 +2702,7 @@ public:
         fTotalBlocks(0),
         fAllocationBlockSize(0),
         fNumAllocationBlocks(0),
+        fNumFreeBlocks(0),
         fCreatedDateTime(0),
         fModifiedDateTime(0),
         fNumFiles(0),
@@ -2640,6 +2712,7 @@ public:
     {
 #ifndef EXCISE_GPL_CODE
         fHfsVol = NULL;
+        fLazyDirs = false;
 #endif
     }
     virtual ~DiskFSHFS(void) {
@@ -2731,6 +2804,7 @@ private:
     void CreateFakeFile(void);
 #else
     DIError RecursiveDirAdd(A2File* pParent, const char* basePath, int depth);
+    virtual DIError LoadDirectory(A2File* pDir) override;
     //void Sanitize(uint8_t* str);
     DIError DoNormalizePath(const char* path, char fssep,
         char** pNormalizedPath);
@@ -2742,6 +2816,9 @@ private:
     static unsigned long LibHFSCB(void* vThis, int op, unsigned long arg1,
         void* arg2);
     hfsvol*         fHfsVol;
+
+    /* set for kInitLazy; subdirs are marked pending instead of read */
+    bool            fLazyDirs;
 #endif
 
 
@@ -2751,6 +2828,7 @@ private:
     uint32_t        fTotalBlocks;
     uint32_t        fAllocationBlockSize;
     uint32_t        fNumAllocationBlocks;
+    uint32_t        fNumFreeBlocks;         // alloc blocks, as of the MDB
     uint32_t        fCreatedDateTime;
     uint32_t        fModifiedDateTime;
     uint32_t        fNumFiles;
@@ -2990,6 +3068,7 @@ public:
 
 private:
     DIError Initialize(InitMode initMode);
+    DIError LoadVolumeName(void);
     DIError ReadCatalog(void);
     DIError ProcessCatalogSector(int catTrack, int catSect,
         const uint8_t* sctBuf);
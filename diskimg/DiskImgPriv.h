@@ -14,7 +14,8 @@
 #include "DiskImgDetail.h"
 #include <errno.h>
 #include <assert.h>
-// "GenericFD.h" included at end
+#include "DIThread.h"
+// "GenericFD.h", "BlockCache.h", and "FormatCache.h" included at end
 
 using namespace DiskImgLib;     // make life easy for all internal code
 
@@ -23,21 +24,52 @@ namespace DiskImgLib {
 /*
  * Debug logging macros.
  *
- * The macro choice implies a severity level, but we don't currently
- * support that in the callback interface, so it's not used.
+ * Messages below DLOG_MIN_LEVEL are compiled out; the arguments are still
+ * type-checked but never evaluated.  Above that, the runtime threshold for
+ * the subsystem (Global::SetLogThreshold) is checked before anything is
+ * formatted.
+ *
+ * The subsystem comes from DLOG_TAG.  A source file can pick a different
+ * one by defining it between StdAfx.h and this header.
  */
-#define DLOG_BASE(file, line, format, ...) \
-        Global::PrintDebugMsg((file), (line), (format), ##__VA_ARGS__)
-
-//#ifdef SHOW_LOGV
-# define LOGV(format, ...) DLOG_BASE(__FILE__, __LINE__, (format), ##__VA_ARGS__)
-//#else
-//# define LOGV(format, ...) ((void) 0)
-//#endif
-#define LOGD(format, ...) DLOG_BASE(__FILE__, __LINE__, (format), ##__VA_ARGS__)
-#define LOGI(format, ...) DLOG_BASE(__FILE__, __LINE__, (format), ##__VA_ARGS__)
-#define LOGW(format, ...) DLOG_BASE(__FILE__, __LINE__, (format), ##__VA_ARGS__)
-#define LOGE(format, ...) DLOG_BASE(__FILE__, __LINE__, (format), ##__VA_ARGS__)
+#ifndef DLOG_MIN_LEVEL
+# if defined(_DEBUG)
+#  define DLOG_MIN_LEVEL Global::kLogVerbose
+# else
+#  define DLOG_MIN_LEVEL Global::kLogInfo
+# endif
+#endif
+#ifndef DLOG_TAG
+# define DLOG_TAG Global::kLogTagGeneral
+#endif
+
+#define DLOG_BASE(level, file, line, format, ...) \
+    do { \
+        if ((level) >= DLOG_MIN_LEVEL && \
+            Global::IsLogEnabled(DLOG_TAG, (level))) \
+        { \
+            Global::PrintLogMsg(DLOG_TAG, (level), (file), (line), \
+                (format), ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOGV(format, ...) \
+    DLOG_BASE(Global::kLogVerbose, __FILE__, __LINE__, (format), ##__VA_ARGS__)
+#define LOGD(format, ...) \
+    DLOG_BASE(Global::kLogDebug, __FILE__, __LINE__, (format), ##__VA_ARGS__)
+#define LOGI(format, ...) \
+    DLOG_BASE(Global::kLogInfo, __FILE__, __LINE__, (format), ##__VA_ARGS__)
+#define LOGW(format, ...) \
+    DLOG_BASE(Global::kLogWarn, __FILE__, __LINE__, (format), ##__VA_ARGS__)
+#define LOGE(format, ...) \
+    DLOG_BASE(Global::kLogError, __FILE__, __LINE__, (format), ##__VA_ARGS__)
+
+/* per-thread storage, for the few statics that need it */
+#if defined(_MSC_VER)
+# define DI_THREAD_LOCAL __declspec(thread)
+#else
+# define DI_THREAD_LOCAL __thread
+#endif
 
 /* put this in to break on interesting events when built debug */
 #if defined(_DEBUG)
@@ -59,6 +91,16 @@ const char* FilenameOnly(const char* pathname, char fssep);
 const char* FindExtension(const char* pathname, char fssep);
 char* StrcpyNew(const char* str);
 
+/* identifies the layout of the filesystem probe table (see DiskImg.cpp) */
+uint32_t GetFSProbeTableSignature(void);
+
+/* thread-safe time conversions; return NULL if "when" can't be converted */
+struct tm* LocalTimeR(const time_t* pWhen, struct tm* pTm);
+struct tm* GmTimeR(const time_t* pWhen, struct tm* pTm);
+// same format as ctime(); "buf" must hold at least kCTimeBufLen chars
+enum { kCTimeBufLen = 26 };
+char* CTimeR(const time_t* pWhen, char* buf);
+
 /* get/set integer values out of a memory buffer */
 uint16_t GetShortLE(const uint8_t* buf);
 uint32_t GetLongLE(const uint8_t* buf);
@@ -117,11 +159,26 @@ public:
         return fBuf[idx];
     }
 
-    //uint8_t* GetPointer(int idx) const {
-    //    while (idx >= fLen)
-    //        idx -= fLen;
-    //    return &fBuf[idx];
-    //}
+    /*
+     * Get a pointer to "len" bytes starting at "idx", or NULL if they
+     * wrap around the end of the buffer.
+     */
+    uint8_t* GetPointer(int idx, int len) const {
+        idx = Normalize(idx);
+        if (idx + len > fLen)
+            return NULL;
+        return &fBuf[idx];
+    }
+
+    /* copy "len" bytes to or from a linear buffer, wrapping as needed */
+    void CopyOut(int idx, uint8_t* buf, int len) const {
+        for (int i = 0; i < len; i++)
+            buf[i] = (*this)[idx + i];
+    }
+    void CopyIn(int idx, const uint8_t* buf, int len) const {
+        for (int i = 0; i < len; i++)
+            (*this)[idx + i] = buf[i];
+    }
 
     int Normalize(int idx) const {
         while (idx >= fLen)
@@ -332,17 +389,198 @@ public:
         fBits[bit >> 3] |= 1 << (bit & 0x07);
     }
 
+    /*
+     * Set bits [first, first+count).
+     */
+    void SetRange(int first, int count) {
+        assert(first >= 0 && count >= 0 && first + count <= fNumBits);
+        while (count--)
+            Set(first++);
+    }
+
+    /*
+     * Clear all bits.
+     */
+    void ClearAll(void) {
+        memset(fBits, 0, (fNumBits + 7) / 8);
+    }
+
+    /*
+     * Return the index of the first set bit, or -1 if none are set.
+     */
+    int FindFirstSet(void) const {
+        for (int i = 0; i < (fNumBits + 7) / 8; i++) {
+            if (fBits[i] != 0) {
+                int bit = i * 8;
+                while (!IsSet(bit))
+                    bit++;
+                return bit;
+            }
+        }
+        return -1;
+    }
+
+    int GetNumBits(void) const { return fNumBits; }
+
 private:
     uint8_t*    fBits;
     int         fNumBits;
 };
 
 
+/*
+ * Read-only copy of the start of a disk image, used while the filesystem
+ * probes run in parallel.  Reads that fall inside the buffer are served
+ * from it without locking; everything else goes to the GFD with "fLock"
+ * held.
+ *
+ * If the data GFD already provides direct access to the whole image,
+ * "fBuf" is NULL and only the lock is used.
+ */
+class ProbeSnapshot {
+public:
+    ProbeSnapshot(void) : fBuf(NULL), fLength(0) {}
+    ~ProbeSnapshot(void) { delete[] fBuf; }
+
+    uint8_t*    fBuf;
+    long        fLength;
+    DIMutex     fLock;
+
+private:
+    ProbeSnapshot& operator=(const ProbeSnapshot&);
+    ProbeSnapshot(const ProbeSnapshot&);
+};
+
+
+/*
+ * Hash index over the files in a DiskFS.  Files can be found by pathname,
+ * hashed through a case-folding table, or by a numeric key that the
+ * filesystem assigns (such as the ProDOS key block).
+ *
+ * The index doesn't own the A2File objects, and doesn't notice when their
+ * names or keys change.  Names are checked with the caller's compare
+ * function, and keys must be checked by the caller.
+ */
+class FileIndex {
+public:
+    // "foldTable" maps each byte to its case-folded equivalent; if NULL,
+    // only ASCII letters are folded.
+    FileIndex(const uint8_t* foldTable);
+    ~FileIndex(void);
+
+    void Add(A2File* pFile, long key);
+    // returns false if the file wasn't found
+    bool Remove(A2File* pFile);
+
+    // Find the file whose pathname matches.  Sets "*pAmbiguous" if there
+    // is more than one.
+    A2File* FindByName(const char* pathName, DiskFS::StringCompareFunc func,
+        bool* pAmbiguous) const;
+    // Step through the files added with "key".  Pass NULL to get the first.
+    A2File* FindByKey(long key, const A2File* pPrev) const;
+
+    long GetNumEntries(void) const { return fNumEntries; }
+
+private:
+    enum { kInitialBuckets = 256 };
+
+    typedef struct Node {
+        A2File*     pFile;
+        uint32_t    nameHash;
+        long        key;
+        Node*       pNameNext;
+        Node*       pKeyNext;
+    } Node;
+
+    uint32_t HashName(const char* str) const;
+    static uint32_t HashKey(long key) {
+        return (uint32_t) key * 0x9e3779b1;
+    }
+    void Grow(void);
+
+    const uint8_t*  fFoldTable;
+    Node**      fNameBuckets;
+    Node**      fKeyBuckets;
+    uint32_t    fNumBuckets;        // power of 2
+    long        fNumEntries;
+
+    FileIndex& operator=(const FileIndex&);
+    FileIndex(const FileIndex&);
+};
+
+
+/*
+ * The files in one directory, in the order they appear in the DiskFS file
+ * list.  Used to find a file's siblings and the end of a subdirectory
+ * without walking the whole list.  Doesn't own the A2File objects.
+ */
+class FileChildList {
+public:
+    FileChildList(void) : fpFiles(NULL), fNumFiles(0), fMaxFiles(0) {}
+    ~FileChildList(void) { delete[] fpFiles; }
+
+    long GetCount(void) const { return fNumFiles; }
+    A2File* GetAt(long idx) const {
+        assert(idx >= 0 && idx < fNumFiles);
+        return fpFiles[idx];
+    }
+    A2File* GetLast(void) const {
+        return (fNumFiles == 0) ? NULL : fpFiles[fNumFiles-1];
+    }
+
+    // Returns -1 if not found.  Searches from the end, since that's where
+    // new files usually go.
+    long IndexOf(const A2File* pFile) const {
+        for (long idx = fNumFiles-1; idx >= 0; idx--) {
+            if (fpFiles[idx] == pFile)
+                return idx;
+        }
+        return -1;
+    }
+
+    void InsertAt(long idx, A2File* pFile) {
+        assert(idx >= 0 && idx <= fNumFiles);
+        if (fNumFiles == fMaxFiles) {
+            long newMax = (fMaxFiles == 0) ? kInitialSize : fMaxFiles * 2;
+            A2File** newFiles = new A2File*[newMax];
+            if (fNumFiles > 0)
+                memcpy(newFiles, fpFiles, fNumFiles * sizeof(A2File*));
+            delete[] fpFiles;
+            fpFiles = newFiles;
+            fMaxFiles = newMax;
+        }
+        memmove(&fpFiles[idx+1], &fpFiles[idx],
+            (fNumFiles - idx) * sizeof(A2File*));
+        fpFiles[idx] = pFile;
+        fNumFiles++;
+    }
+    void Append(A2File* pFile) { InsertAt(fNumFiles, pFile); }
+    void RemoveAt(long idx) {
+        assert(idx >= 0 && idx < fNumFiles);
+        memmove(&fpFiles[idx], &fpFiles[idx+1],
+            (fNumFiles - idx - 1) * sizeof(A2File*));
+        fNumFiles--;
+    }
+
+private:
+    enum { kInitialSize = 8 };
+
+    A2File**    fpFiles;
+    long        fNumFiles;
+    long        fMaxFiles;
+
+    FileChildList& operator=(const FileChildList&);
+    FileChildList(const FileChildList&);
+};
+
+
 }   // namespace DiskImgLib
 
 /*
  * Most of the code needs these.
  */
 #include "GenericFD.h"
+#include "BlockCache.h"
+#include "FormatCache.h"
 
 #endif /*DISKIMG_DISKIMGPRIV_H*/
@@ -11,6 +11,7 @@
  * Master Boot Record or merely a Boot Sector.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
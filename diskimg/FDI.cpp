@@ -21,6 +21,7 @@
  * be easy to explain in the UI.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagWrapper
 #include "DiskImgPriv.h"
 
 
@@ -1070,14 +1071,13 @@ int WrapperFDI::MyRand(void)
 {
     const int kNumStates = 31;
     const int kQuantum = RAND_MAX / (kNumStates+1);
-    static int state = 0;
     int retVal;
 
-    state++;
-    if (state == kNumStates)
-        state = 0;
+    fRandState++;
+    if (fRandState == kNumStates)
+        fRandState = 0;
 
-    retVal = (kQuantum * state) + (kQuantum / 2);
+    retVal = (kQuantum * fRandState) + (kQuantum / 2);
     assert(retVal >= 0 && retVal <= RAND_MAX);
     return retVal;
 }
@@ -9,6 +9,7 @@
  * The format was reverse-engineered by Ranger Harke.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
@@ -218,12 +219,7 @@ DIError DiskFSFocusDrive::OpenSubVolume(long startBlock, long numBlocks,
      * It's important that a failure at this stage doesn't cause the whole
      * thing to fall over.
      */
-    InitMode initMode;
-    if (GetScanForSubVolumes() == kScanSubContainerOnly)
-        initMode = kInitHeaderOnly;
-    else
-        initMode = kInitFull;
-    dierr = pNewFS->Initialize(pNewImg, initMode);
+    dierr = pNewFS->Initialize(pNewImg, GetSubVolumeInitMode());
     if (dierr != kDIErrNone) {
         LOGE(" FocusDriveSub: error %d reading list of files from disk", dierr);
         goto bail;
@@ -0,0 +1,443 @@
+/*
+ * CiderPress
+ * Copyright (C) 2007 by faddenSoft, LLC.  All Rights Reserved.
+ * See the file LICENSE for distribution terms.
+ */
+/*
+ * Persistent format-detection cache.
+ */
+#include "StdAfx.h"
+#include "DiskImgPriv.h"
+#include <sys/stat.h>
+
+static const char* kFileHeader = "# DiskImg format cache v";
+
+
+/*
+ * Load the cache file.
+ *
+ * If the file doesn't exist, it will be created when the first entry is
+ * stored.
+ */
+DIError FormatCache::Open(const char* pathName, int verifyInterval)
+{
+    DIError dierr;
+
+    if (pathName == NULL || pathName[0] == '\0' || verifyInterval < 0)
+        return kDIErrInvalidArg;
+    if (fPathName != NULL)
+        return kDIErrAlreadyOpen;
+
+    fPathName = new char[strlen(pathName) +1];
+    strcpy(fPathName, pathName);
+    fVerifyInterval = verifyInterval;
+
+    GrowTable();
+
+    dierr = LoadFile();
+    if (dierr != kDIErrNone)
+        return dierr;
+
+    LOGI(" FormatCache loaded %ld entries (%ld lines) from '%s'",
+        fNumEntries, fNumLines, fPathName);
+
+    /* squeeze out superseded entries */
+    if (fNeedRewrite || fNumLines > fNumEntries * 2 + 64)
+        (void) RewriteFile();
+
+    return kDIErrNone;
+}
+
+/*
+ * Look up an entry.
+ */
+bool FormatCache::Lookup(const Key& key, Result* pResult, bool* pVerify)
+{
+    DIAutoLock lock(&fLock);
+    long idx;
+
+    *pVerify = false;
+
+    idx = FindEntry(key);
+    if (idx == kNoEntry) {
+        fMisses++;
+        return false;
+    }
+
+    fHits++;
+    *pResult = fEntries[idx].result;
+    if (fVerifyInterval > 0 && (fHitCount++ % fVerifyInterval) == 0)
+        *pVerify = true;
+    return true;
+}
+
+/*
+ * Add an entry, or replace an existing one.
+ */
+void FormatCache::Store(const Key& key, const Result& result, bool verified)
+{
+    DIAutoLock lock(&fLock);
+    long idx;
+
+    idx = FindEntry(key);
+    if (idx != kNoEntry) {
+        if (ResultsMatch(fEntries[idx].result, result)) {
+            if (verified)
+                LOGD(" FormatCache entry verified");
+            return;
+        }
+        LOGW(" FormatCache entry was stale (format %d -> %d, order %d -> %d)",
+            fEntries[idx].result.format, result.format,
+            fEntries[idx].result.order, result.order);
+        fStale++;
+        fEntries[idx].result = result;
+    } else {
+        PutEntry(key, result);
+        idx = FindEntry(key);
+        assert(idx != kNoEntry);
+    }
+
+    AppendEntry(&fEntries[idx]);
+}
+
+/*
+ * Get the hit/miss counts.
+ */
+void FormatCache::GetStats(long* pHits, long* pMisses, long* pStale)
+{
+    DIAutoLock lock(&fLock);
+
+    if (pHits != NULL)
+        *pHits = fHits;
+    if (pMisses != NULL)
+        *pMisses = fMisses;
+    if (pStale != NULL)
+        *pStale = fStale;
+}
+
+/*
+ * Figure out the size, modification date, and content hash for a file.
+ *
+ * The hash is 64-bit FNV-1a over the first and last kHashSpan bytes.
+ * That's enough to notice an image being replaced by a different one of
+ * the same size, without reading all of a large file.
+ *
+ * Returns kDIErrNotSupported for things that aren't regular files.
+ */
+/*static*/ DIError FormatCache::IdentifyFile(const char* pathName,
+    GenericFD* pGFD, FileId* pId)
+{
+    DIError dierr = kDIErrNone;
+    struct stat sb;
+    uint8_t* buf = NULL;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    di_off_t size, start, len;
+
+    if (stat(pathName, &sb) != 0)
+        return kDIErrFileNotFound;
+    if ((sb.st_mode & S_IFMT) != S_IFREG)
+        return kDIErrNotSupported;
+    size = (di_off_t) sb.st_size;
+
+    buf = new uint8_t[kHashSpan];
+    if (buf == NULL)
+        return kDIErrMalloc;
+
+    /* head, then tail; they only overlap when the file is small */
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 0) {
+            start = 0;
+            len = size < kHashSpan ? size : kHashSpan;
+        } else {
+            if (size <= kHashSpan)
+                break;
+            start = size - kHashSpan;
+            if (start < kHashSpan)
+                start = kHashSpan;
+            len = size - start;
+        }
+
+        dierr = pGFD->Seek(start, kSeekSet);
+        if (dierr != kDIErrNone)
+            goto bail;
+        dierr = pGFD->Read(buf, (size_t) len);
+        if (dierr != kDIErrNone)
+            goto bail;
+
+        for (long i = 0; i < (long) len; i++) {
+            hash ^= buf[i];
+            hash *= 0x100000001b3ULL;
+        }
+    }
+
+    pId->size = size;
+    pId->mtime = (int64_t) sb.st_mtime;
+    pId->hash = hash;
+
+bail:
+    delete[] buf;
+    return dierr;
+}
+
+
+/*
+ * Compare two keys.
+ */
+/*static*/ bool FormatCache::KeysMatch(const Key& key1, const Key& key2)
+{
+    return key1.file.hash == key2.file.hash &&
+           key1.file.size == key2.file.size &&
+           key1.file.mtime == key2.file.mtime &&
+           key1.dataLength == key2.dataLength &&
+           key1.fileFormat == key2.fileFormat &&
+           key1.physical == key2.physical &&
+           key1.startOrder == key2.startOrder &&
+           key1.sectorPairing == key2.sectorPairing;
+}
+
+/*
+ * Compare two results.
+ */
+/*static*/ bool FormatCache::ResultsMatch(const Result& res1,
+    const Result& res2)
+{
+    return res1.order == res2.order &&
+           res1.format == res2.format &&
+           res1.probe == res2.probe &&
+           res1.nibbleDescr == res2.nibbleDescr &&
+           res1.dosVolumeNum == res2.dosVolumeNum;
+}
+
+/*
+ * Find the entry for "key".  Returns kNoEntry if there isn't one.
+ */
+long FormatCache::FindEntry(const Key& key) const
+{
+    long idx = fHashTable[HashKey(key)];
+
+    while (idx != kNoEntry) {
+        if (KeysMatch(fEntries[idx].key, key))
+            return idx;
+        idx = fEntries[idx].hashNext;
+    }
+    return kNoEntry;
+}
+
+/*
+ * Add or replace an entry in the in-memory table.
+ */
+void FormatCache::PutEntry(const Key& key, const Result& result)
+{
+    long idx = FindEntry(key);
+
+    if (idx != kNoEntry) {
+        fEntries[idx].result = result;
+        return;
+    }
+
+    if (fNumEntries == fMaxEntries)
+        GrowTable();
+
+    idx = fNumEntries++;
+    fEntries[idx].key = key;
+    fEntries[idx].result = result;
+    fEntries[idx].hashNext = fHashTable[HashKey(key)];
+    fHashTable[HashKey(key)] = idx;
+}
+
+/*
+ * Double the size of the entry array, and rebuild the hash table so it
+ * stays at least twice as big as the array.
+ */
+void FormatCache::GrowTable(void)
+{
+    long newMax = fMaxEntries == 0 ? 64 : fMaxEntries * 2;
+    long hashSize = newMax * 2;
+
+    Entry* newEntries = new Entry[newMax];
+    if (fNumEntries > 0)
+        memcpy(newEntries, fEntries, fNumEntries * sizeof(Entry));
+    delete[] fEntries;
+    fEntries = newEntries;
+    fMaxEntries = newMax;
+
+    delete[] fHashTable;
+    fHashTable = new long[hashSize];
+    fHashMask = hashSize - 1;
+    for (long i = 0; i < hashSize; i++)
+        fHashTable[i] = kNoEntry;
+    for (long i = 0; i < fNumEntries; i++) {
+        long bucket = HashKey(fEntries[i].key);
+        fEntries[i].hashNext = fHashTable[bucket];
+        fHashTable[bucket] = i;
+    }
+}
+
+/*
+ * Read the cache file into memory.  Lines we don't understand are skipped.
+ */
+DIError FormatCache::LoadFile(void)
+{
+    char lineBuf[256];
+    FILE* fp;
+
+    fp = fopen(fPathName, "r");
+    if (fp == NULL) {
+        LOGI(" FormatCache '%s' not found, will create", fPathName);
+        fNeedRewrite = true;
+        return kDIErrNone;
+    }
+
+    /* "probe" values are only meaningful with the same probe table */
+    int version;
+    unsigned long probeSig;
+    if (fgets(lineBuf, sizeof(lineBuf), fp) == NULL ||
+        strncmp(lineBuf, kFileHeader, strlen(kFileHeader)) != 0 ||
+        sscanf(lineBuf + strlen(kFileHeader), "%d probes=%lx",
+            &version, &probeSig) != 2 ||
+        version != kFileVersion ||
+        (uint32_t) probeSig != GetFSProbeTableSignature())
+    {
+        LOGI(" FormatCache '%s' has wrong header, discarding", fPathName);
+        fNeedRewrite = true;
+        fclose(fp);
+        return kDIErrNone;
+    }
+
+    while (fgets(lineBuf, sizeof(lineBuf), fp) != NULL) {
+        Entry entry;
+
+        if (!ParseEntry(lineBuf, &entry))
+            continue;
+        PutEntry(entry.key, entry.result);
+        fNumLines++;
+    }
+
+    fclose(fp);
+    return kDIErrNone;
+}
+
+/*
+ * Write the entire cache out.  We write to a temp file and rename it, so
+ * that a crash part-way through doesn't leave a truncated cache.
+ */
+DIError FormatCache::RewriteFile(void)
+{
+    DIError dierr = kDIErrNone;
+    char lineBuf[256];
+    char* tmpPath = NULL;
+    FILE* fp = NULL;
+
+    tmpPath = new char[strlen(fPathName) + 5];
+    strcpy(tmpPath, fPathName);
+    strcat(tmpPath, ".tmp");
+
+    fp = fopen(tmpPath, "w");
+    if (fp == NULL) {
+        dierr = ErrnoOrGeneric();
+        LOGW(" FormatCache unable to create '%s' (err=%d)", tmpPath, dierr);
+        goto bail;
+    }
+
+    fprintf(fp, "%s%d probes=%08lx\n", kFileHeader, kFileVersion,
+        (unsigned long) GetFSProbeTableSignature());
+    for (long i = 0; i < fNumEntries; i++) {
+        FormatEntry(&fEntries[i], lineBuf, sizeof(lineBuf));
+        fputs(lineBuf, fp);
+    }
+    if (ferror(fp) || fclose(fp) != 0) {
+        fp = NULL;
+        dierr = kDIErrWriteFailed;
+        LOGW(" FormatCache failed writing '%s'", tmpPath);
+        (void) remove(tmpPath);
+        goto bail;
+    }
+    fp = NULL;
+
+#ifdef _WIN32
+    (void) remove(fPathName);   // rename won't replace an existing file
+#endif
+    if (rename(tmpPath, fPathName) != 0) {
+        dierr = ErrnoOrGeneric();
+        LOGW(" FormatCache unable to rename '%s' (err=%d)", tmpPath, dierr);
+        (void) remove(tmpPath);
+        goto bail;
+    }
+
+    fNumLines = fNumEntries;
+    fNeedRewrite = false;
+
+bail:
+    if (fp != NULL)
+        fclose(fp);
+    delete[] tmpPath;
+    return dierr;
+}
+
+/*
+ * Add an entry to the end of the cache file.
+ */
+void FormatCache::AppendEntry(const Entry* pEntry)
+{
+    char lineBuf[256];
+    FILE* fp;
+
+    if (fNeedRewrite) {
+        (void) RewriteFile();
+        return;
+    }
+
+    fp = fopen(fPathName, "a");
+    if (fp == NULL) {
+        LOGW(" FormatCache unable to append to '%s'", fPathName);
+        return;
+    }
+    FormatEntry(pEntry, lineBuf, sizeof(lineBuf));
+    fputs(lineBuf, fp);
+    fclose(fp);
+    fNumLines++;
+}
+
+/*
+ * Convert an entry to a line of text, with a trailing '\n'.
+ */
+/*static*/ void FormatCache::FormatEntry(const Entry* pEntry, char* buf,
+    size_t bufLen)
+{
+    const Key& key = pEntry->key;
+    const Result& res = pEntry->result;
+
+    snprintf(buf, bufLen, "%016llx %lld %lld %lld %d %d %d %d  %d %d %d %d %d\n",
+        (unsigned long long) key.file.hash, (long long) key.file.size,
+        (long long) key.file.mtime, (long long) key.dataLength,
+        key.fileFormat, key.physical, key.startOrder, key.sectorPairing,
+        res.order, res.format, res.probe, res.nibbleDescr, res.dosVolumeNum);
+}
+
+/*
+ * Parse a line of text generated by FormatEntry.
+ */
+/*static*/ bool FormatCache::ParseEntry(const char* line, Entry* pEntry)
+{
+    unsigned long long hash;
+    long long size, mtime, dataLength;
+    Key* pKey = &pEntry->key;
+    Result* pRes = &pEntry->result;
+    int count;
+
+    count = sscanf(line, "%llx %lld %lld %lld %d %d %d %d %d %d %d %d %d",
+        &hash, &size, &mtime, &dataLength,
+        &pKey->fileFormat, &pKey->physical, &pKey->startOrder,
+        &pKey->sectorPairing,
+        &pRes->order, &pRes->format, &pRes->probe, &pRes->nibbleDescr,
+        &pRes->dosVolumeNum);
+    if (count != 13)
+        return false;
+
+    pKey->file.hash = hash;
+    pKey->file.size = (di_off_t) size;
+    pKey->file.mtime = (int64_t) mtime;
+    pKey->dataLength = (di_off_t) dataLength;
+    pEntry->hashNext = kNoEntry;
+    return true;
+}
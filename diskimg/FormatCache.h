@@ -0,0 +1,144 @@
+/*
+ * CiderPress
+ * Copyright (C) 2007 by faddenSoft, LLC.  All Rights Reserved.
+ * See the file LICENSE for distribution terms.
+ */
+/*
+ * Declarations for the persistent format-detection cache.
+ */
+#ifndef DISKIMG_FORMATCACHE_H
+#define DISKIMG_FORMATCACHE_H
+
+namespace DiskImgLib {
+
+/*
+ * Remembers what DiskImg::AnalyzeImage decided about an image file, so that
+ * re-opening the same file doesn't have to run the nibble analysis and the
+ * filesystem probes again.
+ *
+ * Files are identified by their size, modification date, and a hash of the
+ * first and last few KB of their contents.  The key also includes
+ * everything AnalyzeImage takes as input (the wrapper format, the physical
+ * format, and the sector order guessed from the file extension), since the
+ * same file can analyze differently if any of those change.
+ *
+ * The cache lives in a text file, one entry per line.  New entries are
+ * appended as they're found; if the same key appears more than once, the
+ * last one wins.  The file is rewritten when it has accumulated a lot of
+ * superseded lines.
+ *
+ * In "verify" mode, every Nth hit is treated as a miss.  The image is
+ * analyzed from scratch, and if the result doesn't match the cache, the
+ * entry is replaced and counted as stale.
+ *
+ * All public methods are thread-safe.
+ */
+class FormatCache {
+public:
+    FormatCache(void) :
+        fPathName(NULL), fVerifyInterval(0), fEntries(NULL), fNumEntries(0),
+        fMaxEntries(0), fHashTable(NULL), fHashMask(0), fNumLines(0),
+        fNeedRewrite(false), fHits(0), fMisses(0), fStale(0), fHitCount(0)
+        {}
+    ~FormatCache(void) {
+        delete[] fPathName;
+        delete[] fEntries;
+        delete[] fHashTable;
+    }
+
+    /* identifies an image file on disk */
+    typedef struct FileId {
+        di_off_t    size;
+        int64_t     mtime;
+        uint64_t    hash;
+    } FileId;
+
+    typedef struct Key {
+        FileId      file;
+        di_off_t    dataLength;
+        int         fileFormat;
+        int         physical;
+        int         startOrder;
+        int         sectorPairing;
+    } Key;
+
+    typedef struct Result {
+        int         order;
+        int         format;
+        int         probe;          // index of winning FS probe, or -1
+        int         nibbleDescr;    // index into NibbleDescr table, or -1
+        int         dosVolumeNum;
+    } Result;
+
+    // load the cache from "pathName"; a missing file is not an error
+    DIError Open(const char* pathName, int verifyInterval);
+
+    // look up "key"; on a hit, "*pVerify" is set if the caller should
+    // re-analyze the image and pass the result to Store
+    bool Lookup(const Key& key, Result* pResult, bool* pVerify);
+
+    // add or replace an entry; "verified" indicates that the caller
+    // re-analyzed an image after Lookup asked it to
+    void Store(const Key& key, const Result& result, bool verified);
+
+    void GetStats(long* pHits, long* pMisses, long* pStale);
+
+    // identify a file; "pGFD" must be the raw file, unwrapped
+    static DIError IdentifyFile(const char* pathName, GenericFD* pGFD,
+        FileId* pId);
+
+    enum {
+        kHashSpan = 64 * 1024,      // hash this much at each end of the file
+        kFileVersion = 2,           // header also has the probe table sig
+    };
+
+private:
+    enum { kNoEntry = -1 };
+
+    typedef struct Entry {
+        Key         key;
+        Result      result;
+        long        hashNext;
+    } Entry;
+
+    long HashKey(const Key& key) const {
+        return (long) (key.file.hash ^ (key.file.hash >> 32)) & fHashMask;
+    }
+    static bool KeysMatch(const Key& key1, const Key& key2);
+    static bool ResultsMatch(const Result& res1, const Result& res2);
+
+    long FindEntry(const Key& key) const;
+    void PutEntry(const Key& key, const Result& result);
+    void GrowTable(void);
+    DIError LoadFile(void);
+    DIError RewriteFile(void);
+    void AppendEntry(const Entry* pEntry);
+    static void FormatEntry(const Entry* pEntry, char* buf, size_t bufLen);
+    static bool ParseEntry(const char* line, Entry* pEntry);
+
+    char*       fPathName;
+    int         fVerifyInterval;
+
+    Entry*      fEntries;
+    long        fNumEntries;
+    long        fMaxEntries;
+    long*       fHashTable;
+    long        fHashMask;          // hash table size - 1 (power of 2)
+    long        fNumLines;          // entry lines in the file
+    bool        fNeedRewrite;       // file has wrong version or is junk
+
+    long        fHits;
+    long        fMisses;
+    long        fStale;
+    long        fHitCount;          // for picking hits to verify
+
+    DIMutex     fLock;
+
+private:
+    FormatCache& operator=(const FormatCache&);
+    FormatCache(const FormatCache&);
+};
+
+}   // namespace DiskImgLib
+
+#endif /*DISKIMG_FORMATCACHE_H*/
@@ -7,6 +7,7 @@
  * Generic file descriptor class.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagWrapper
 #include "DiskImgPriv.h"
 
 /*
@@ -398,6 +399,252 @@ DIError GFDFile::Close(void)
 #endif /*HAVE_FSEEKO else*/
 
 
+#ifdef HAVE_MMAP
+/*
+ * ===========================================================================
+ *      GFDMmap
+ * ===========================================================================
+ */
+
+/*
+ * Open and map a file.
+ *
+ * We only map regular files.  Devices and the like get kDIErrNotSupported,
+ * and the caller is expected to fall back on GFDFile.
+ */
+DIError GFDMmap::Open(const char* filename, bool readOnly)
+{
+    DIError dierr = kDIErrNone;
+    struct stat sb;
+
+    if (fFd >= 0)
+        return kDIErrAlreadyOpen;
+    if (filename == NULL)
+        return kDIErrInvalidArg;
+    if (filename[0] == '\0')
+        return kDIErrInvalidArg;
+
+    delete[] fPathName;
+    fPathName = new char[strlen(filename) +1];
+    strcpy(fPathName, filename);
+
+    fFd = open(filename, readOnly ? O_RDONLY|O_BINARY : O_RDWR|O_BINARY, 0);
+    if (fFd < 0) {
+        if (errno == EACCES)
+            dierr = kDIErrAccessDenied;
+        else
+            dierr = ErrnoOrGeneric();
+        LOGI("  GFDMmap Open failed opening '%s', ro=%d (err=%d)",
+            filename, readOnly, dierr);
+        return dierr;
+    }
+    fReadOnly = readOnly;
+
+    if (fstat(fFd, &sb) != 0) {
+        dierr = ErrnoOrGeneric();
+        goto bail;
+    }
+    if (!S_ISREG(sb.st_mode)) {
+        dierr = kDIErrNotSupported;
+        goto bail;
+    }
+
+    dierr = MapFile(sb.st_size);
+    if (dierr != kDIErrNone)
+        goto bail;
+    fCurrentOffset = 0;
+
+bail:
+    if (dierr != kDIErrNone) {
+        LOGI("  GFDMmap unable to map '%s' (err=%d)", filename, dierr);
+        ::close(fFd);
+        fFd = -1;
+    }
+    return dierr;
+}
+
+/*
+ * Map the first "length" bytes of the file.  Any previous mapping must
+ * already have been released.
+ */
+DIError GFDMmap::MapFile(di_off_t length)
+{
+    void* base;
+
+    assert(fBase == NULL);
+
+    fLength = length;
+    if (length == 0)
+        return kDIErrNone;      // can't map an empty file
+    if ((di_off_t) (size_t) length != length)
+        return kDIErrNotSupported;  // too big for address space
+
+    base = mmap(NULL, (size_t) length,
+                fReadOnly ? PROT_READ : PROT_READ|PROT_WRITE,
+                MAP_SHARED, fFd, 0);
+    if (base == MAP_FAILED) {
+        DIError dierr = ErrnoOrGeneric();
+        LOGI("  GFDMmap mmap of %ld bytes failed (err=%d)",
+            (long) length, dierr);
+        fLength = 0;
+        return dierr;
+    }
+
+    fBase = (uint8_t*) base;
+    return kDIErrNone;
+}
+
+/*
+ * Change the length of the file, and re-map it.
+ */
+DIError GFDMmap::Resize(di_off_t newLength)
+{
+    DIError dierr;
+
+    assert(!fReadOnly);
+
+    if (fBase != NULL) {
+        munmap(fBase, (size_t) fLength);
+        fBase = NULL;
+    }
+    if (::ftruncate(fFd, newLength) != 0) {
+        dierr = ErrnoOrGeneric();
+        LOGI("  GFDMmap resize to %ld failed (err=%d)",
+            (long) newLength, dierr);
+        (void) MapFile(fLength);    // try to get the old mapping back
+        return dierr;
+    }
+    return MapFile(newLength);
+}
+
+DIError GFDMmap::Read(void* buf, size_t length, size_t* pActual)
+{
+    if (fFd < 0)
+        return kDIErrNotReady;
+
+    if (fCurrentOffset + (di_off_t) length > fLength) {
+        if (pActual == NULL) {
+            LOGW("  GFDMmap underrun off=%ld len=%lu flen=%ld",
+                (long) fCurrentOffset, (unsigned long) length, (long) fLength);
+            return kDIErrDataUnderrun;
+        }
+        if (fCurrentOffset >= fLength)
+            return kDIErrEOF;
+        length = (size_t) (fLength - fCurrentOffset);
+    }
+    if (pActual != NULL)
+        *pActual = length;
+    if (length == 0)
+        return kDIErrNone;
+
+    memcpy(buf, fBase + fCurrentOffset, length);
+    fCurrentOffset += length;
+
+    return kDIErrNone;
+}
+
+DIError GFDMmap::Write(const void* buf, size_t length, size_t* pActual)
+{
+    DIError dierr;
+
+    if (fFd < 0)
+        return kDIErrNotReady;
+    if (fReadOnly)
+        return kDIErrAccessDenied;
+    assert(pActual == NULL);     // not handling this yet
+    if (length == 0)
+        return kDIErrNone;
+
+    if (fCurrentOffset + (di_off_t) length > fLength) {
+        dierr = Resize(fCurrentOffset + length);
+        if (dierr != kDIErrNone)
+            return dierr;
+    }
+
+    memcpy(fBase + fCurrentOffset, buf, length);
+    fCurrentOffset += length;
+
+    return kDIErrNone;
+}
+
+DIError GFDMmap::Seek(di_off_t offset, DIWhence whence)
+{
+    di_off_t newPosn;
+
+    if (fFd < 0)
+        return kDIErrNotReady;
+
+    switch (whence) {
+    case kSeekSet:
+        newPosn = offset;
+        break;
+    case kSeekEnd:
+        newPosn = fLength + offset;
+        break;
+    case kSeekCur:
+        newPosn = fCurrentOffset + offset;
+        break;
+    default:
+        assert(false);
+        return kDIErrInvalidArg;
+    }
+
+    /* like lseek, we allow seeking past the end */
+    if (newPosn < 0)
+        return kDIErrInvalidArg;
+    fCurrentOffset = newPosn;
+    return kDIErrNone;
+}
+
+di_off_t GFDMmap::Tell(void)
+{
+    if (fFd < 0)
+        return (di_off_t) -1;
+    return fCurrentOffset;
+}
+
+DIError GFDMmap::Truncate(void)
+{
+    if (fFd < 0)
+        return kDIErrNotReady;
+    if (fReadOnly)
+        return kDIErrAccessDenied;
+    if (fCurrentOffset == fLength)
+        return kDIErrNone;
+    return Resize(fCurrentOffset);
+}
+
+/*
+ * Push changes out to the file.  The data is already in the page cache,
+ * so this is only needed for crash safety.
+ */
+DIError GFDMmap::Flush(void)
+{
+    if (fBase == NULL || fReadOnly)
+        return kDIErrNone;
+    if (msync(fBase, (size_t) fLength, MS_SYNC) != 0)
+        return ErrnoOrGeneric();
+    return kDIErrNone;
+}
+
+DIError GFDMmap::Close(void)
+{
+    if (fFd < 0)
+        return kDIErrNotReady;
+
+    LOGI("  GFDMmap closing '%s'", fPathName);
+    if (fBase != NULL) {
+        munmap(fBase, (size_t) fLength);
+        fBase = NULL;
+    }
+    ::close(fFd);
+    fFd = -1;
+    fLength = 0;
+    return kDIErrNone;
+}
+#endif /*HAVE_MMAP*/
+
+
 /*
  * ===========================================================================
  *      GFDBuffer
@@ -575,6 +822,769 @@ DIError GFDBuffer::Close(void)
 }
 
 
+/*
+ * ===========================================================================
+ *      GFDInflate
+ * ===========================================================================
+ */
+
+DIError GFDInflate::Open(GenericFD* pGFD, di_off_t dataOffset,
+    di_off_t compLength, bool isGzip, di_off_t length)
+{
+    if (fpZstream != NULL)
+        return kDIErrAlreadyOpen;
+    if (pGFD == NULL || dataOffset < 0 || compLength <= 0 || length <= 0)
+        return kDIErrInvalidArg;
+
+    fpZstream = new z_stream;
+    fInBuf = new uint8_t[kInBufSize];
+    fOutBuf = new uint8_t[kOutBufSize];
+    if (fpZstream == NULL || fInBuf == NULL || fOutBuf == NULL) {
+        Close();
+        return kDIErrMalloc;
+    }
+    memset(fpZstream, 0, sizeof(*fpZstream));
+
+    fpGFD = pGFD;
+    fDataOffset = dataOffset;
+    fCompLength = compLength;
+    fIsGzip = isGzip;
+    fLength = length;
+    fCurrentOffset = 0;
+    fReadOnly = true;
+
+    fRunningCRC = crc32(0L, Z_NULL, 0);
+    fBadChecksum = false;
+    fStreamActive = false;
+    fOutStart = fOutLen = 0;
+    fIndexedOut = 0;
+    fIndexComplete = false;
+
+    LOGD(" GFDInflate open: comp=%ld at +%ld, uncomp=%ld, gzip=%d",
+        (long) compLength, (long) dataOffset, (long) length, isGzip);
+    return kDIErrNone;
+}
+
+DIError GFDInflate::Read(void* buf, size_t length, size_t* pActual)
+{
+    DIError dierr;
+
+    if (fpZstream == NULL)
+        return kDIErrNotReady;
+    if (length == 0)
+        return kDIErrInvalidArg;
+
+    if (fCurrentOffset + (di_off_t) length > fLength) {
+        if (pActual == NULL) {
+            LOGW("  GFDInflate underrun off=%ld len=%lu flen=%ld",
+                (long) fCurrentOffset, (unsigned long) length, (long) fLength);
+            return kDIErrDataUnderrun;
+        } else {
+            /* set *pActual and adjust "length" */
+            assert(fLength >= fCurrentOffset);
+            length = (size_t) (fLength - fCurrentOffset);
+            *pActual = length;
+
+            if (length == 0)
+                return kDIErrEOF;
+        }
+    }
+    if (pActual != NULL)
+        *pActual = length;
+
+    dierr = ReadAt(fCurrentOffset, (uint8_t*) buf, length);
+    if (dierr != kDIErrNone)
+        return dierr;
+    fCurrentOffset += length;
+
+    return kDIErrNone;
+}
+
+DIError GFDInflate::Seek(di_off_t offset, DIWhence whence)
+{
+    if (fpZstream == NULL)
+        return kDIErrNotReady;
+
+    switch (whence) {
+    case kSeekSet:
+        if (offset < 0 || offset >= fLength)
+            return kDIErrInvalidArg;
+        fCurrentOffset = offset;
+        break;
+    case kSeekEnd:
+        if (offset > 0 || offset < -fLength)
+            return kDIErrInvalidArg;
+        fCurrentOffset = fLength + offset;
+        break;
+    case kSeekCur:
+        if (offset < -fCurrentOffset ||
+            offset >= (fLength - fCurrentOffset))
+        {
+            return kDIErrInvalidArg;
+        }
+        fCurrentOffset += offset;
+        break;
+    default:
+        assert(false);
+        return kDIErrInvalidArg;
+    }
+
+    assert(fCurrentOffset >= 0 && fCurrentOffset <= fLength);
+    return kDIErrNone;
+}
+
+di_off_t GFDInflate::Tell(void)
+{
+    if (fpZstream == NULL)
+        return (di_off_t) -1;
+    return fCurrentOffset;
+}
+
+DIError GFDInflate::Close(void)
+{
+    if (fpZstream == NULL)
+        return kDIErrNone;
+
+    LOGD("  GFDInflate closing (%d checkpoints)", fNumCheckpoints);
+    if (fStreamActive)
+        inflateEnd(fpZstream);
+    fStreamActive = false;
+    delete fpZstream;
+    fpZstream = NULL;
+
+    delete[] fInBuf;
+    fInBuf = NULL;
+    delete[] fOutBuf;
+    fOutBuf = NULL;
+
+    for (int i = 0; i < fNumCheckpoints; i++)
+        delete[] fCheckpoints[i].window;
+    delete[] fCheckpoints;
+    fCheckpoints = NULL;
+    fNumCheckpoints = fMaxCheckpoints = 0;
+
+    fpGFD = NULL;
+    return kDIErrNone;
+}
+
+/*
+ * Copy "length" bytes of uncompressed data, starting at "offset", into
+ * "buf".  The caller has already checked the range.
+ *
+ * If the first pass finds a bad CRC, the read that got there fails with
+ * kDIErrBadChecksum.  Later reads aren't affected.
+ */
+DIError GFDInflate::ReadAt(di_off_t offset, uint8_t* buf, size_t length)
+{
+    DIError dierr;
+
+    while (length > 0) {
+        if (offset >= fOutStart && offset < fOutStart + fOutLen) {
+            size_t chunk = (size_t) (fOutStart + fOutLen - offset);
+            if (chunk > length)
+                chunk = length;
+            memcpy(buf, fOutBuf + (offset - fOutStart), chunk);
+            buf += chunk;
+            offset += chunk;
+            length -= chunk;
+            continue;
+        }
+
+        dierr = PositionStream(offset);
+        if (dierr != kDIErrNone)
+            return dierr;
+        dierr = InflateChunk();
+        if (dierr != kDIErrNone)
+            return dierr;
+        if (fBadChecksum) {
+            fBadChecksum = false;
+            return kDIErrBadChecksum;
+        }
+    }
+
+    return kDIErrNone;
+}
+
+/*
+ * Find the last checkpoint at or before "offset".  Returns NULL if there
+ * isn't one.
+ */
+const GFDInflate::Checkpoint* GFDInflate::FindCheckpoint(di_off_t offset) const
+{
+    int lo = 0, hi = fNumCheckpoints - 1;
+    const Checkpoint* pBest = NULL;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (fCheckpoints[mid].out <= offset) {
+            pBest = &fCheckpoints[mid];
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return pBest;
+}
+
+/*
+ * Get the stream into a state where inflating forward will eventually
+ * produce the byte at "offset".
+ *
+ * If the stream is already behind "offset" we just keep going, unless
+ * there's a checkpoint that would let us skip a good chunk of the work.
+ */
+DIError GFDInflate::PositionStream(di_off_t offset)
+{
+    const Checkpoint* pCheckpoint = FindCheckpoint(offset);
+
+    if (fStreamActive && offset >= fStreamOut) {
+        if (pCheckpoint == NULL ||
+            pCheckpoint->out < fStreamOut + kOutBufSize * 2)
+        {
+            return kDIErrNone;
+        }
+    }
+
+    return StartStream(pCheckpoint);
+}
+
+/*
+ * (Re-)start the inflater, either at the very beginning or at a checkpoint.
+ */
+DIError GFDInflate::StartStream(const Checkpoint* pCheckpoint)
+{
+    DIError dierr;
+    z_stream* pZ = fpZstream;
+    int windowBits;
+    int zerr;
+
+    /*
+     * Checkpoints always resume in the middle of a deflate stream, so
+     * there's never a header to parse.  The "+16" tells zlib to expect
+     * a gzip header and trailer; negative window bits mean raw deflate.
+     */
+    if (pCheckpoint == NULL) {
+        windowBits = fIsGzip ? MAX_WBITS + 16 : -MAX_WBITS;
+        fStreamRaw = !fIsGzip;
+        fStreamIn = 0;
+        fStreamOut = 0;
+    } else {
+        windowBits = -MAX_WBITS;
+        fStreamRaw = true;
+        fStreamIn = pCheckpoint->in;
+        fStreamOut = pCheckpoint->out;
+    }
+
+    /* reuse the existing stream (and its window allocation) if we can */
+    if (fStreamActive) {
+        zerr = inflateReset2(pZ, windowBits);
+    } else {
+        memset(pZ, 0, sizeof(*pZ));
+        pZ->zalloc = Z_NULL;
+        pZ->zfree = Z_NULL;
+        pZ->opaque = Z_NULL;
+        zerr = inflateInit2(pZ, windowBits);
+    }
+    pZ->next_in = NULL;
+    pZ->avail_in = 0;
+    if (zerr != Z_OK) {
+        if (zerr == Z_VERSION_ERROR) {
+            LOGI("Installed zlib is not compatible with linked version (%s)",
+                ZLIB_VERSION);
+        } else {
+            LOGI("Call to inflateInit2 failed (zerr=%d)", zerr);
+        }
+        if (fStreamActive) {
+            inflateEnd(pZ);
+            fStreamActive = false;
+        }
+        return kDIErrInternal;
+    }
+    fStreamActive = true;
+    fStreamEnd = false;
+    fStreamError = false;
+
+    if (pCheckpoint != NULL) {
+        LOGV("  GFDInflate resuming at out=%ld in=%ld bits=%d",
+            (long) pCheckpoint->out, (long) pCheckpoint->in,
+            pCheckpoint->bits);
+        if (pCheckpoint->bits != 0) {
+            uint8_t partial;
+
+            dierr = fpGFD->Seek(fDataOffset + pCheckpoint->in - 1, kSeekSet);
+            if (dierr != kDIErrNone)
+                return dierr;
+            dierr = fpGFD->Read(&partial, 1);
+            if (dierr != kDIErrNone)
+                return dierr;
+            inflatePrime(pZ, pCheckpoint->bits,
+                partial >> (8 - pCheckpoint->bits));
+        }
+        if (pCheckpoint->windowLen != 0) {
+            zerr = inflateSetDictionary(pZ, pCheckpoint->window,
+                        pCheckpoint->windowLen);
+            if (zerr != Z_OK) {
+                LOGI("inflateSetDictionary failed (zerr=%d)", zerr);
+                return kDIErrInternal;
+            }
+        }
+    }
+
+    return kDIErrNone;
+}
+
+/*
+ * Inflate the next chunk of data into fOutBuf.
+ *
+ * If the stream goes bad after producing some data, we hand back what
+ * we got, and fail on the next call.
+ */
+DIError GFDInflate::InflateChunk(void)
+{
+    DIError dierr = kDIErrNone;
+    z_stream* pZ = fpZstream;
+    di_off_t chunkStart = fStreamOut;
+    int zerr;
+
+    assert(fStreamActive);
+    if (fStreamEnd || fStreamError) {
+        LOGI("  GFDInflate ran out of data at %ld (len=%ld)",
+            (long) fStreamOut, (long) fLength);
+        return kDIErrBadCompressedData;
+    }
+
+    /* the old chunk is about to be overwritten */
+    fOutStart = chunkStart;
+    fOutLen = 0;
+    pZ->next_out = fOutBuf;
+    pZ->avail_out = kOutBufSize;
+    if (fLength - fStreamOut < kOutBufSize)
+        pZ->avail_out = (uInt) (fLength - fStreamOut);
+
+    /*
+     * Fill the buffer.  If this is the first pass and we've reached the
+     * expected length, keep going until zlib reports the end of the
+     * stream (with no room for output), so we get to check the CRC.
+     */
+    while (pZ->avail_out != 0 ||
+        (!fIndexComplete && fStreamOut == fLength && fStreamOut == fIndexedOut))
+    {
+        if (pZ->avail_in == 0 && fStreamIn < fCompLength) {
+            di_off_t remaining = fCompLength - fStreamIn;
+            size_t getSize;
+
+            getSize = (remaining > kInBufSize) ?
+                        kInBufSize : (size_t) remaining;
+            dierr = fpGFD->Seek(fDataOffset + fStreamIn, kSeekSet);
+            if (dierr != kDIErrNone)
+                goto bail;
+            dierr = fpGFD->Read(fInBuf, getSize);
+            if (dierr != kDIErrNone)
+                goto bail;
+            pZ->next_in = fInBuf;
+            pZ->avail_in = (uInt) getSize;
+            fStreamIn += getSize;
+        }
+
+        /*
+         * Z_BLOCK makes inflate return at the end of each deflate block,
+         * which is the only place we can drop a checkpoint.
+         */
+        uint8_t* outStart = pZ->next_out;
+        zerr = inflate(pZ, Z_BLOCK);
+        if (zerr != Z_OK && zerr != Z_STREAM_END && zerr != Z_BUF_ERROR) {
+            LOGI("  GFDInflate inflate failed at out=%ld (zerr=%d '%s')",
+                (long) fStreamOut, zerr, pZ->msg == NULL ? "" : pZ->msg);
+            dierr = kDIErrBadCompressedData;
+            if (zerr == Z_DATA_ERROR && fStreamOut == fLength &&
+                !fIndexComplete && fStreamOut == fIndexedOut)
+            {
+                /* all the data came out, so it must be the gzip trailer */
+                fIndexComplete = true;
+                fBadChecksum = true;
+                fStreamEnd = true;
+                dierr = kDIErrNone;
+            }
+            goto bail;
+        }
+        if (zerr == Z_BUF_ERROR) {
+            /* no progress possible; zlib may have had bits left over */
+            if (pZ->avail_in == 0 && fStreamIn >= fCompLength) {
+                LOGI("  GFDInflate compressed data ended early");
+                dierr = kDIErrBadCompressedData;
+                goto bail;
+            } else if (pZ->avail_in != 0 && pZ->avail_out == 0) {
+                /* wants to produce more than we were told to expect */
+                LOGW("  GFDInflate stream is longer than %ld", (long) fLength);
+                fIndexComplete = true;
+                break;
+            }
+        }
+        NoteProgress(outStart, fStreamOut, pZ->next_out - outStart);
+        fStreamOut += pZ->next_out - outStart;
+
+        if (zerr == Z_STREAM_END) {
+            bool found = false;
+
+            if (fIsGzip) {
+                dierr = NextGzipMember(&found);
+                if (dierr != kDIErrNone)
+                    goto bail;
+            }
+            if (!found) {
+                fStreamEnd = true;
+                if (!fIndexComplete && fStreamOut == fIndexedOut) {
+                    fIndexComplete = true;
+                    LOGD("  GFDInflate first pass done, %ld bytes, %d checkpoints",
+                        (long) fStreamOut, fNumCheckpoints);
+                    if (fStreamOut != fLength) {
+                        LOGW("  GFDInflate length mismatch: got %ld, expected %ld",
+                            (long) fStreamOut, (long) fLength);
+                    }
+                    if (fCheckCRC && fRunningCRC != fExpectedCRC) {
+                        LOGI("ZIP CRC mismatch: inflated crc32=0x%08x, stored=0x%08x",
+                            fRunningCRC, fExpectedCRC);
+                        fBadChecksum = true;
+                    }
+                }
+                break;
+            }
+            continue;
+        }
+
+        if ((pZ->data_type & 128) != 0 && (pZ->data_type & 64) == 0 &&
+            !fIndexComplete && fStreamOut == fIndexedOut &&
+            fStreamOut - (fNumCheckpoints == 0 ?
+                0 : fCheckpoints[fNumCheckpoints-1].out) >= kCheckpointSpan)
+        {
+            dierr = AddCheckpoint();
+            if (dierr != kDIErrNone)
+                goto bail;
+        }
+    }
+
+bail:
+    fOutLen = (long) (fStreamOut - chunkStart);
+    if (dierr != kDIErrNone && fOutLen > 0) {
+        fStreamError = true;
+        dierr = kDIErrNone;
+    }
+    return dierr;
+}
+
+/*
+ * Account for "len" bytes of freshly-inflated data at "start".  Anything
+ * past the point the first pass has reached gets added to the CRC.
+ */
+void GFDInflate::NoteProgress(const uint8_t* data, di_off_t start, size_t len)
+{
+    di_off_t end = start + len;
+
+    if (fIndexComplete || end <= fIndexedOut)
+        return;
+    assert(start <= fIndexedOut);
+
+    size_t skip = (size_t) (fIndexedOut - start);
+    fRunningCRC = crc32(fRunningCRC, data + skip, (uInt) (len - skip));
+    fIndexedOut = end;
+}
+
+/*
+ * Record a checkpoint at the current position.  The stream must be
+ * sitting on a deflate block boundary.
+ */
+DIError GFDInflate::AddCheckpoint(void)
+{
+    z_stream* pZ = fpZstream;
+    Checkpoint* pCheckpoint;
+
+    if (fNumCheckpoints == fMaxCheckpoints) {
+        Checkpoint* newList = new Checkpoint[fMaxCheckpoints + 16];
+        if (newList == NULL)
+            return kDIErrMalloc;
+        if (fNumCheckpoints != 0)
+            memcpy(newList, fCheckpoints, fNumCheckpoints * sizeof(Checkpoint));
+        delete[] fCheckpoints;
+        fCheckpoints = newList;
+        fMaxCheckpoints += 16;
+    }
+
+    pCheckpoint = &fCheckpoints[fNumCheckpoints];
+    pCheckpoint->window = new uint8_t[kWindowSize];
+    if (pCheckpoint->window == NULL)
+        return kDIErrMalloc;
+
+    uInt windowLen = 0;
+    if (inflateGetDictionary(pZ, pCheckpoint->window, &windowLen) != Z_OK) {
+        delete[] pCheckpoint->window;
+        return kDIErrInternal;
+    }
+    assert(windowLen <= kWindowSize);
+    pCheckpoint->windowLen = windowLen;
+    pCheckpoint->out = fStreamOut;
+    pCheckpoint->in = fStreamIn - pZ->avail_in;
+    pCheckpoint->bits = pZ->data_type & 7;
+    fNumCheckpoints++;
+
+    LOGV("  GFDInflate checkpoint %d: out=%ld in=%ld bits=%d",
+        fNumCheckpoints, (long) pCheckpoint->out, (long) pCheckpoint->in,
+        pCheckpoint->bits);
+    return kDIErrNone;
+}
+
+/*
+ * We've hit the end of a gzip member.  gzip allows several members to be
+ * concatenated, so see if another one follows; anything else is junk
+ * at the end of the file, which we ignore.
+ *
+ * If we restarted from a checkpoint, zlib is in raw mode and didn't look
+ * at the trailer, so we check the CRC ourselves.
+ */
+DIError GFDInflate::NextGzipMember(bool* pFound)
+{
+    DIError dierr;
+    z_stream* pZ = fpZstream;
+    di_off_t memberEnd = fStreamIn - pZ->avail_in;
+    bool atFrontier = (!fIndexComplete && fStreamOut == fIndexedOut);
+    uint8_t buf[8];
+
+    *pFound = false;
+
+    if (fStreamRaw) {
+        if (memberEnd + 8 > fCompLength) {
+            LOGI("  GFDInflate gzip trailer is missing");
+            return kDIErrBadCompressedData;
+        }
+        dierr = fpGFD->Seek(fDataOffset + memberEnd, kSeekSet);
+        if (dierr != kDIErrNone)
+            return dierr;
+        dierr = fpGFD->Read(buf, 8);
+        if (dierr != kDIErrNone)
+            return dierr;
+        if (atFrontier && GetLongLE(buf) != fRunningCRC) {
+            LOGI("gzip CRC mismatch: inflated crc32=0x%08x, stored=0x%08x",
+                fRunningCRC, GetLongLE(buf));
+            fBadChecksum = true;
+        }
+        memberEnd += 8;
+    }
+
+    if (memberEnd + 2 > fCompLength)
+        return kDIErrNone;
+    dierr = fpGFD->Seek(fDataOffset + memberEnd, kSeekSet);
+    if (dierr != kDIErrNone)
+        return dierr;
+    dierr = fpGFD->Read(buf, 2);
+    if (dierr != kDIErrNone)
+        return dierr;
+    if (buf[0] != 0x1f || buf[1] != 0x8b) {
+        LOGI("  GFDInflate ignoring %ld bytes after gzip data",
+            (long) (fCompLength - memberEnd));
+        return kDIErrNone;
+    }
+
+    if (inflateReset2(pZ, MAX_WBITS + 16) != Z_OK)
+        return kDIErrInternal;
+    pZ->next_in = NULL;
+    pZ->avail_in = 0;
+    fStreamIn = memberEnd;
+    fStreamRaw = false;
+    if (atFrontier)
+        fRunningCRC = crc32(0L, Z_NULL, 0);
+
+    *pFound = true;
+    return kDIErrNone;
+}
+
+
+/*
+ * ===========================================================================
+ *      GFDNuFX
+ * ===========================================================================
+ */
+
+DIError GFDNuFX::Open(NuArchive* pArchive, NuThreadIdx threadIdx,
+    di_off_t length)
+{
+    NuError nerr;
+
+    if (fpReader != NULL)
+        return kDIErrAlreadyOpen;
+    if (pArchive == NULL || length <= 0)
+        return kDIErrInvalidArg;
+
+    nerr = NuCreateThreadReader(pArchive, threadIdx, &fpReader);
+    if (nerr != kNuErrNone) {
+        LOGI(" GFDNuFX unable to create reader (nerr=%d)", nerr);
+        fpReader = NULL;
+        if (nerr == kNuErrBadFormat || nerr == kNuErrUnsupFeature)
+            return kDIErrUnsupportedCompression;
+        return kDIErrGeneric;
+    }
+
+    fCacheBuf = new uint8_t[kNumCacheChunks * kNuThreadChunkSize];
+    if (fCacheBuf == NULL) {
+        Close();
+        return kDIErrMalloc;
+    }
+    for (int i = 0; i < kNumCacheChunks; i++) {
+        fCacheChunk[i] = -1;
+        fCacheUsed[i] = 0;
+    }
+    fCacheClock = 0;
+
+    fLength = length;
+    fCurrentOffset = 0;
+    fReadOnly = true;
+
+    LOGD(" GFDNuFX open: threadIdx=%d len=%ld", threadIdx, (long) length);
+    return kDIErrNone;
+}
+
+DIError GFDNuFX::Read(void* buf, size_t length, size_t* pActual)
+{
+    DIError dierr;
+    uint8_t* outPtr = (uint8_t*) buf;
+
+    if (fpReader == NULL)
+        return kDIErrNotReady;
+    if (length == 0)
+        return kDIErrInvalidArg;
+
+    if (fCurrentOffset + (di_off_t) length > fLength) {
+        if (pActual == NULL) {
+            LOGW("  GFDNuFX underrun off=%ld len=%lu flen=%ld",
+                (long) fCurrentOffset, (unsigned long) length, (long) fLength);
+            return kDIErrDataUnderrun;
+        } else {
+            /* set *pActual and adjust "length" */
+            assert(fLength >= fCurrentOffset);
+            length = (size_t) (fLength - fCurrentOffset);
+            *pActual = length;
+
+            if (length == 0)
+                return kDIErrEOF;
+        }
+    }
+    if (pActual != NULL)
+        *pActual = length;
+
+    while (length > 0) {
+        const uint8_t* chunkData;
+        uint32_t chunkIdx = (uint32_t) (fCurrentOffset / kNuThreadChunkSize);
+        size_t chunkOff = (size_t) (fCurrentOffset % kNuThreadChunkSize);
+        size_t copyLen = kNuThreadChunkSize - chunkOff;
+        if (copyLen > length)
+            copyLen = length;
+
+        dierr = GetChunk(chunkIdx, &chunkData);
+        if (dierr != kDIErrNone)
+            return dierr;
+        memcpy(outPtr, chunkData + chunkOff, copyLen);
+        outPtr += copyLen;
+        fCurrentOffset += copyLen;
+        length -= copyLen;
+    }
+
+    return kDIErrNone;
+}
+
+DIError GFDNuFX::Seek(di_off_t offset, DIWhence whence)
+{
+    if (fpReader == NULL)
+        return kDIErrNotReady;
+
+    switch (whence) {
+    case kSeekSet:
+        if (offset < 0 || offset >= fLength)
+            return kDIErrInvalidArg;
+        fCurrentOffset = offset;
+        break;
+    case kSeekEnd:
+        if (offset > 0 || offset < -fLength)
+            return kDIErrInvalidArg;
+        fCurrentOffset = fLength + offset;
+        break;
+    case kSeekCur:
+        if (offset < -fCurrentOffset ||
+            offset >= (fLength - fCurrentOffset))
+        {
+            return kDIErrInvalidArg;
+        }
+        fCurrentOffset += offset;
+        break;
+    default:
+        assert(false);
+        return kDIErrInvalidArg;
+    }
+
+    assert(fCurrentOffset >= 0 && fCurrentOffset <= fLength);
+    return kDIErrNone;
+}
+
+di_off_t GFDNuFX::Tell(void)
+{
+    if (fpReader == NULL)
+        return (di_off_t) -1;
+    return fCurrentOffset;
+}
+
+DIError GFDNuFX::Close(void)
+{
+    if (fpReader == NULL)
+        return kDIErrNone;
+
+    LOGD("  GFDNuFX closing");
+    NuFreeThreadReader(fpReader);
+    fpReader = NULL;
+    delete[] fCacheBuf;
+    fCacheBuf = NULL;
+
+    return kDIErrNone;
+}
+
+/*
+ * Get a pointer to the expanded contents of chunk "chunkIdx", pulling it
+ * into the cache if it's not already there.
+ */
+DIError GFDNuFX::GetChunk(uint32_t chunkIdx, const uint8_t** ppData)
+{
+    NuError nerr;
+    int slot, oldest = 0;
+
+    for (slot = 0; slot < kNumCacheChunks; slot++) {
+        if (fCacheChunk[slot] == (long) chunkIdx) {
+            fCacheUsed[slot] = ++fCacheClock;
+            *ppData = fCacheBuf + slot * kNuThreadChunkSize;
+            return kDIErrNone;
+        }
+        if (fCacheUsed[slot] < fCacheUsed[oldest])
+            oldest = slot;
+    }
+
+    slot = oldest;
+    fCacheChunk[slot] = -1;
+    nerr = NuReadThreadChunk(fpReader, chunkIdx,
+            fCacheBuf + slot * kNuThreadChunkSize);
+    if (nerr != kNuErrNone) {
+        LOGI(" GFDNuFX failed reading chunk %u (nerr=%d)", chunkIdx, nerr);
+        if (nerr == kNuErrBadDataCRC || nerr == kNuErrBadThreadCRC) {
+            /* NufxLib only checks once, so the chunk can be read again */
+            return kDIErrBadChecksum;
+        } else if (nerr == kNuErrBadData) {
+            return kDIErrBadCompressedData;
+        } else {
+            return kDIErrReadFailed;
+        }
+    }
+
+    fCacheChunk[slot] = chunkIdx;
+    fCacheUsed[slot] = ++fCacheClock;
+    *ppData = fCacheBuf + slot * kNuThreadChunkSize;
+    return kDIErrNone;
+}
+
+
 #ifdef _WIN32
 /*
  * ===========================================================================
@@ -112,6 +112,20 @@ public:
     // Flush-data call, only needed for physical devices
     virtual DIError Flush(void) { return kDIErrNone; }
 
+    // If the data is directly addressable (memory buffer, mapped file),
+    // return a pointer to "length" bytes at "offset".  Returns NULL if
+    // that isn't possible.  The pointer is only good until the next
+    // Write, Truncate, or Close call.
+    virtual uint8_t* GetDirectPointer(di_off_t offset, size_t length) {
+        return NULL;
+    }
+
+    // Returns "false" if reading an arbitrary piece of the data may cost
+    // far more than the piece itself, e.g. because it has to be expanded
+    // from a compressed stream.  Callers should avoid reading more than
+    // they need from such sources.
+    virtual bool HasCheapRandomAccess(void) const { return true; }
+
     // Utility functions.
     virtual DIError Rewind(void) { return Seek(0, kSeekSet); }
 
@@ -172,6 +186,64 @@ private:
 #endif
 };
 
+#ifdef HAVE_MMAP
+/*
+ * Memory-mapped file.  Reads and writes are just memcpy, and
+ * GetDirectPointer lets callers look at the data in place.
+ *
+ * Read-write files are mapped MAP_SHARED, so changes go straight to the
+ * page cache.  Writing past the end or truncating resizes the file and
+ * re-maps it, which invalidates pointers handed out earlier.
+ *
+ * If somebody else truncates the file while we have it mapped, accessing
+ * the missing pages will raise SIGBUS.  Disk images aren't usually
+ * modified out from under us, so we accept that.
+ */
+class GFDMmap : public GenericFD {
+public:
+    GFDMmap(void) :
+        fPathName(NULL),
+        fFd(-1),
+        fBase(NULL),
+        fLength(0),
+        fCurrentOffset(0)
+    {}
+    virtual ~GFDMmap(void) { Close(); delete[] fPathName; }
+
+    // fails with kDIErrNotSupported on things that can't be mapped
+    virtual DIError Open(const char* filename, bool readOnly);
+    virtual DIError Read(void* buf, size_t length,
+        size_t* pActual = NULL);
+    virtual DIError Write(const void* buf, size_t length,
+        size_t* pActual = NULL);
+    virtual DIError Seek(di_off_t offset, DIWhence whence);
+    virtual di_off_t Tell(void);
+    virtual DIError Truncate(void);
+    virtual DIError Close(void);
+    virtual const char* GetPathName(void) const { return fPathName; }
+
+    virtual DIError Flush(void);
+    virtual uint8_t* GetDirectPointer(di_off_t offset, size_t length) {
+        if (fBase == NULL || offset < 0 ||
+            offset + (di_off_t) length > fLength)
+        {
+            return NULL;
+        }
+        return fBase + offset;
+    }
+
+private:
+    DIError MapFile(di_off_t length);
+    DIError Resize(di_off_t newLength);
+
+    char*       fPathName;
+    int         fFd;
+    uint8_t*    fBase;          // NULL if file is empty
+    di_off_t    fLength;
+    di_off_t    fCurrentOffset;
+};
+#endif
+
 #ifdef _WIN32
 class GFDWinVolume : public GenericFD {
 public:
@@ -240,6 +312,14 @@ public:
     }
     virtual DIError Close(void);
     virtual const char* GetPathName(void) const { return NULL; }
+    virtual uint8_t* GetDirectPointer(di_off_t offset, size_t length) {
+        if (fBuffer == NULL || offset < 0 ||
+            offset + (di_off_t) length > fLength)
+        {
+            return NULL;
+        }
+        return (uint8_t*) fBuffer + offset;
+    }
 
     // Back door; try not to use this.
     void* GetBuffer(void) const { return fBuffer; }
@@ -254,6 +334,198 @@ private:
     di_off_t    fCurrentOffset; // actually limited to (long)
 };
 
+/*
+ * Read-only view of deflate-compressed data held in another GFD.
+ *
+ * Nothing is inflated until somebody asks for it.  The first time we work
+ * our way forward through the stream we drop a checkpoint roughly every
+ * kCheckpointSpan bytes, at a deflate block boundary, recording the
+ * compressed position and the 32KB window that precedes it.  Seeking
+ * backward (or a long way forward) restarts zlib from the nearest
+ * checkpoint, using the same trick as "zran.c" in the zlib examples.
+ * The most recently inflated chunk is kept around, so reads that walk
+ * through the data in small pieces don't keep restarting the stream.
+ *
+ * "isGzip" selects a gzip stream (header and trailer, possibly several
+ * members), otherwise it's raw deflate as found in a ZIP archive.  The
+ * caller must supply the uncompressed length.
+ *
+ * The underlying GFD is not owned by us, and must remain open.  We seek
+ * it around freely, so nobody else should be depending on its position.
+ */
+class GFDInflate : public GenericFD {
+public:
+    GFDInflate(void) :
+        fpGFD(NULL),
+        fDataOffset(0),
+        fCompLength(0),
+        fIsGzip(false),
+        fLength(-1),
+        fCurrentOffset(0),
+        fCheckCRC(false),
+        fExpectedCRC(0),
+        fRunningCRC(0),
+        fBadChecksum(false),
+        fpZstream(NULL),
+        fStreamActive(false),
+        fStreamRaw(false),
+        fStreamEnd(false),
+        fStreamError(false),
+        fStreamIn(0),
+        fStreamOut(0),
+        fInBuf(NULL),
+        fOutBuf(NULL),
+        fOutStart(0),
+        fOutLen(0),
+        fIndexedOut(0),
+        fIndexComplete(false),
+        fCheckpoints(NULL),
+        fNumCheckpoints(0),
+        fMaxCheckpoints(0)
+    {}
+    virtual ~GFDInflate(void) { Close(); }
+
+    virtual DIError Open(GenericFD* pGFD, di_off_t dataOffset,
+        di_off_t compLength, bool isGzip, di_off_t length);
+    virtual DIError Read(void* buf, size_t length,
+        size_t* pActual = NULL);
+    virtual DIError Write(const void* buf, size_t length,
+        size_t* pActual = NULL)
+    {
+        return kDIErrAccessDenied;
+    }
+    virtual DIError Seek(di_off_t offset, DIWhence whence);
+    virtual di_off_t Tell(void);
+    virtual DIError Truncate(void) { return kDIErrAccessDenied; }
+    virtual DIError Close(void);
+    virtual const char* GetPathName(void) const { return NULL; }
+    virtual bool HasCheapRandomAccess(void) const { return false; }
+
+    // ZIP archives keep the CRC32 of the uncompressed data in the central
+    // directory; gzip has it in the trailer.  Either way it can only be
+    // checked when the first pass over the data reaches the end.  If it
+    // doesn't match, that read fails with kDIErrBadChecksum, and later
+    // reads get the data as inflated.
+    void SetExpectedCRC(uint32_t crc) {
+        fCheckCRC = true;
+        fExpectedCRC = crc;
+    }
+
+private:
+    enum {
+        kInBufSize = 32768,
+        kOutBufSize = 32768,
+        kWindowSize = 32768,                // max deflate window
+        kCheckpointSpan = 256 * 1024,       // 1/8 of the data in windows
+    };
+    typedef struct Checkpoint {
+        di_off_t    out;        // uncompressed offset
+        di_off_t    in;         // compressed offset of first full byte
+        int         bits;       // #of bits used from the byte before "in"
+        unsigned int windowLen;
+        uint8_t*    window;     // kWindowSize bytes
+    } Checkpoint;
+
+    DIError ReadAt(di_off_t offset, uint8_t* buf, size_t length);
+    DIError PositionStream(di_off_t offset);
+    DIError StartStream(const Checkpoint* pCheckpoint);
+    DIError InflateChunk(void);
+    DIError NextGzipMember(bool* pFound);
+    DIError AddCheckpoint(void);
+    void NoteProgress(const uint8_t* data, di_off_t start, size_t len);
+    const Checkpoint* FindCheckpoint(di_off_t offset) const;
+
+    GenericFD*  fpGFD;          // compressed data; not owned by us
+    di_off_t    fDataOffset;    // start of compressed data in fpGFD
+    di_off_t    fCompLength;    // length of compressed data
+    bool        fIsGzip;
+    di_off_t    fLength;        // uncompressed length
+    di_off_t    fCurrentOffset;
+
+    bool        fCheckCRC;
+    uint32_t    fExpectedCRC;
+    uint32_t    fRunningCRC;    // CRC of current member up to fIndexedOut
+    bool        fBadChecksum;   // CRC mismatch not yet reported
+
+    z_stream*   fpZstream;
+    bool        fStreamActive;  // zstream is initialized and positioned
+    bool        fStreamRaw;     // restarted from checkpoint, no gz header
+    bool        fStreamEnd;     // hit the end of the last member
+    bool        fStreamError;   // stream went bad after producing data
+    di_off_t    fStreamIn;      // compressed offset of next fill
+    di_off_t    fStreamOut;     // uncompressed offset of next byte out
+
+    uint8_t*    fInBuf;
+    uint8_t*    fOutBuf;        // most recently inflated chunk
+    di_off_t    fOutStart;
+    long        fOutLen;
+
+    di_off_t    fIndexedOut;    // first pass has gotten this far
+    bool        fIndexComplete;
+    Checkpoint* fCheckpoints;
+    int         fNumCheckpoints;
+    int         fMaxCheckpoints;
+};
+
+/*
+ * Read-only view of a disk image thread in a NuFX archive.
+ *
+ * NufxLib expands the thread 4K at a time as we ask for it, so opening an
+ * archive doesn't require expanding the whole disk.  The last few chunks
+ * are kept in a small LRU cache, which covers the usual pattern of reading
+ * a block and then the one next to it.  Reading backward through LZW/2
+ * data is expensive, because the expander has to restart from the last
+ * point where the string table was cleared.
+ *
+ * The archive is not owned by us, must remain open, and must not be
+ * modified while we're using it.  The thread CRC is checked if the data
+ * is read from start to finish.  If it's bad, the read of the last chunk
+ * fails with kDIErrBadChecksum; reading it again gets the data.
+ */
+class GFDNuFX : public GenericFD {
+public:
+    GFDNuFX(void) :
+        fpReader(NULL),
+        fLength(-1),
+        fCurrentOffset(0),
+        fCacheBuf(NULL),
+        fCacheClock(0)
+    {}
+    virtual ~GFDNuFX(void) { Close(); }
+
+    // Returns kDIErrUnsupportedCompression if NufxLib can't do random
+    // access on this thread's format.
+    virtual DIError Open(NuArchive* pArchive, NuThreadIdx threadIdx,
+        di_off_t length);
+    virtual DIError Read(void* buf, size_t length,
+        size_t* pActual = NULL);
+    virtual DIError Write(const void* buf, size_t length,
+        size_t* pActual = NULL)
+    {
+        return kDIErrAccessDenied;
+    }
+    virtual DIError Seek(di_off_t offset, DIWhence whence);
+    virtual di_off_t Tell(void);
+    virtual DIError Truncate(void) { return kDIErrAccessDenied; }
+    virtual DIError Close(void);
+    virtual const char* GetPathName(void) const { return NULL; }
+    virtual bool HasCheapRandomAccess(void) const { return false; }
+
+private:
+    enum { kNumCacheChunks = 8 };
+
+    DIError GetChunk(uint32_t chunkIdx, const uint8_t** ppData);
+
+    NuThreadReader* fpReader;
+    di_off_t    fLength;
+    di_off_t    fCurrentOffset;
+
+    uint8_t*    fCacheBuf;      // kNumCacheChunks * kNuThreadChunkSize
+    long        fCacheChunk[kNumCacheChunks];   // -1 if slot is empty
+    uint32_t    fCacheUsed[kNumCacheChunks];    // LRU timestamp
+    uint32_t    fCacheClock;
+};
+
 #if 0
 class GFDEmbedded : public GenericFD {
 public:
@@ -317,6 +589,12 @@ public:
         return kDIErrNone;
     }
     virtual const char* GetPathName(void) const { return fpGFD->GetPathName(); }
+    virtual uint8_t* GetDirectPointer(di_off_t offset, size_t length) {
+        return fpGFD->GetDirectPointer(offset + fOffset, length);
+    }
+    virtual bool HasCheapRandomAccess(void) const {
+        return fpGFD->HasCheapRandomAccess();
+    }
 
 private:
     GenericFD*  fpGFD;
@@ -14,6 +14,10 @@
 
 /*static*/ ASPI* Global::fpASPI = NULL;
 
+/*static*/ int Global::fProbeThreads = 0;
+
+/*static*/ FormatCache* Global::fpFormatCache = NULL;
+
 /* global constant */
 const char* DiskImgLib::kASPIDev = "ASPI:";
 
@@ -92,6 +96,8 @@ const char* DiskImgLib::kASPIDev = "ASPI:";
 {
     LOGI("DiskImgLib cleanup");
     delete fpASPI;
+    delete fpFormatCache;
+    fpFormatCache = NULL;
     return kDIErrNone;
 }
 
@@ -136,15 +142,78 @@ const char* DiskImgLib::kASPIDev = "ASPI:";
 
 
 /*
- * Pointer to debug message handler function.
+ * Return the #of threads to use when probing for filesystems.
+ *
+ * The probes don't do much I/O, so there's no point in going wide.
+ */
+/*static*/ int Global::GetProbeThreads(void)
+{
+    enum { kMaxAutoProbeThreads = 4 };
+
+    if (fProbeThreads > 0)
+        return fProbeThreads;
+
+    int numThreads = DIWorkerGroup::GetProcessorCount();
+    if (numThreads > kMaxAutoProbeThreads)
+        numThreads = kMaxAutoProbeThreads;
+    return numThreads;
+}
+
+
+/*
+ * Enable or disable the format-detection cache.
+ */
+/*static*/ DIError Global::SetFormatCache(const char* pathName,
+    int verifyInterval)
+{
+    DIError dierr;
+
+    delete fpFormatCache;
+    fpFormatCache = NULL;
+
+    if (pathName == NULL)
+        return kDIErrNone;
+
+    FormatCache* pCache = new FormatCache;
+    dierr = pCache->Open(pathName, verifyInterval);
+    if (dierr != kDIErrNone) {
+        LOGW("Unable to open format cache '%s' (err=%d)", pathName, dierr);
+        delete pCache;
+        return dierr;
+    }
+
+    fpFormatCache = pCache;
+    return kDIErrNone;
+}
+
+/*static*/ void Global::GetFormatCacheStats(long* pHits, long* pMisses,
+    long* pStale)
+{
+    if (fpFormatCache == NULL) {
+        *pHits = *pMisses = *pStale = 0;
+        return;
+    }
+    fpFormatCache->GetStats(pHits, pMisses, pStale);
+}
+
+
+/*
+ * Debug message handlers and per-subsystem thresholds.  The lock protects
+ * the handler pointers and serializes calls to them.
  */
 /*static*/ Global::DebugMsgHandler Global::gDebugMsgHandler = NULL;
+/*static*/ Global::LogLevel Global::fLogThreshold[kLogTagMax] = {
+    kLogVerbose, kLogVerbose, kLogVerbose, kLogVerbose, kLogVerbose
+};
+static Global::LogMsgHandler gLogMsgHandler = NULL;
+static DIMutex gLogLock;
 
 /*
  * Change the debug message handler.  The previous handler is returned.
  */
 Global::DebugMsgHandler Global::SetDebugMsgHandler(DebugMsgHandler handler)
 {
+    DIAutoLock lock(&gLogLock);
     DebugMsgHandler oldHandler;
 
     oldHandler = gDebugMsgHandler;
@@ -153,14 +222,42 @@ Global::DebugMsgHandler Global::SetDebugMsgHandler(DebugMsgHandler handler)
 }
 
 /*
- * Send a debug message to the debug message handler.
+ * Change the leveled message handler.  The previous handler is returned.
+ */
+Global::LogMsgHandler Global::SetLogMsgHandler(LogMsgHandler handler)
+{
+    DIAutoLock lock(&gLogLock);
+    LogMsgHandler oldHandler;
+
+    oldHandler = gLogMsgHandler;
+    gLogMsgHandler = handler;
+    return oldHandler;
+}
+
+/*
+ * Set the threshold for all subsystems, or for one.
  *
- * Even if _DEBUG_MSGS is disabled we can still get here from the NuFX error
- * handler.
+ * These are read without the lock; a message racing with the change may
+ * be filtered by either the old or the new value.
  */
-/*static*/ void Global::PrintDebugMsg(const char* file, int line, const char* fmt, ...)
+/*static*/ void Global::SetLogThreshold(LogLevel level)
+{
+    for (int i = 0; i < kLogTagMax; i++)
+        fLogThreshold[i] = level;
+}
+/*static*/ void Global::SetLogThreshold(LogTag tag, LogLevel level)
+{
+    assert(tag >= 0 && tag < kLogTagMax);
+    fLogThreshold[tag] = level;
+}
+
+/*
+ * Format a message and hand it to the handler.
+ */
+static void DeliverLogMsg(Global::LogTag tag, Global::LogLevel level,
+    const char* file, int line, const char* fmt, va_list args)
 {
-    if (gDebugMsgHandler == NULL) {
+    if (Global::gDebugMsgHandler == NULL && gLogMsgHandler == NULL) {
         /*
          * This can happen if the app decides to bail with an exit()
          * call.  I'm not sure what's zapping the pointer.
@@ -173,9 +270,7 @@ Global::DebugMsgHandler Global::SetDebugMsgHandler(DebugMsgHandler handler)
     }
 
     char buf[512];
-    va_list args;
 
-    va_start(args, fmt);
 #if defined(HAVE_VSNPRINTF)
     (void) vsnprintf(buf, sizeof(buf), fmt, args);
 #elif defined(HAVE__VSNPRINTF)
@@ -183,9 +278,44 @@ Global::DebugMsgHandler Global::SetDebugMsgHandler(DebugMsgHandler handler)
 #else
 # error "hosed"
 #endif
-    va_end(args);
 
     buf[sizeof(buf)-1] = '\0';
 
-    (*gDebugMsgHandler)(file, line, buf);
+    DIAutoLock lock(&gLogLock);
+    if (gLogMsgHandler != NULL)
+        (*gLogMsgHandler)(tag, level, file, line, buf);
+    else if (Global::gDebugMsgHandler != NULL)
+        (*Global::gDebugMsgHandler)(file, line, buf);
+}
+
+/*
+ * Send a debug message to the debug message handler.  The LOGx macros
+ * have already checked the threshold.
+ */
+/*static*/ void Global::PrintLogMsg(LogTag tag, LogLevel level,
+    const char* file, int line, const char* fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    DeliverLogMsg(tag, level, file, line, fmt, args);
+    va_end(args);
+}
+
+/*
+ * Send an informational message to the debug message handler.
+ *
+ * Even if _DEBUG_MSGS is disabled we can still get here from the NuFX error
+ * handler.
+ */
+/*static*/ void Global::PrintDebugMsg(const char* file, int line, const char* fmt, ...)
+{
+    if (!IsLogEnabled(kLogTagGeneral, kLogInfo))
+        return;
+
+    va_list args;
+
+    va_start(args, fmt);
+    DeliverLogMsg(kLogTagGeneral, kLogInfo, file, line, fmt, args);
+    va_end(args);
 }
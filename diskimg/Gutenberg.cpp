@@ -8,6 +8,7 @@
  * Gutenberg Jr. word processors).
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
@@ -207,6 +208,12 @@ DIError DiskFSGutenberg::Initialize(InitMode initMode)
 
     fVolumeUsage.Create(fpImg->GetNumTracks(), fpImg->GetNumSectPerTrack());
 
+    if (initMode == kInitHeaderOnly) {
+        LOGI(" Gutenberg - headerOnly set, skipping file load");
+        dierr = LoadVolumeName();
+        goto bail;
+    }
+
     /* read the contents of the catalog, creating our A2File list */
     dierr = ReadCatalog();
     if (dierr != kDIErrNone)
@@ -239,6 +246,27 @@ DIError DiskFSGutenberg::GetFreeSpaceCount(long* pTotalUnits, long* pFreeUnits,
     return kDIErrNone;
 }
 
+/*
+ * Get the volume name from the first catalog sector, without reading the
+ * rest of the catalog.
+ */
+DIError DiskFSGutenberg::LoadVolumeName(void)
+{
+    DIError dierr;
+    uint8_t sctBuf[kSctSize];
+
+    dierr = fpImg->ReadTrackSector(kVTOCTrack, kVTOCSector, sctBuf);
+    if (dierr != kDIErrNone)
+        return dierr;
+    memcpy(fDiskVolumeName, &sctBuf[6], kMaxVolNameLen);
+    fDiskVolumeName[kMaxVolNameLen] = 0x00;
+    DiskFSGutenberg::LowerASCII((uint8_t*)fDiskVolumeName, kMaxVolNameLen);
+    A2FileGutenberg::TrimTrailingSpaces(fDiskVolumeName);
+
+    sprintf(fDiskVolumeID, "Gutenberg: %s", fDiskVolumeName);
+    return kDIErrNone;
+}
+
 /*
  * Read the disk's catalog.
  */
@@ -19,6 +19,7 @@
  * images.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
@@ -216,18 +217,15 @@ DIError DiskFSHFS::LoadVolHeader(void)
     uint8_t blkBuf[kBlkSize];
 
     if (fLocalTimeOffset == -1) {
-        struct tm* ptm;
+        struct tm tmLocal;
         struct tm tmWhen;
         time_t when;
-        int isDst;
 
         when = time(NULL);
-        isDst = localtime(&when)->tm_isdst;
-
-        ptm = gmtime(&when);
-        if (ptm != NULL) {
-            tmWhen = *ptm;  // make a copy -- static buffers in time functions
-            tmWhen.tm_isdst = isDst;
+        if (LocalTimeR(&when, &tmLocal) != NULL &&
+            GmTimeR(&when, &tmWhen) != NULL)
+        {
+            tmWhen.tm_isdst = tmLocal.tm_isdst;
 
             fLocalTimeOffset = (long) (when - mktime(&tmWhen));
         } else
@@ -257,6 +255,7 @@ DIError DiskFSHFS::LoadVolHeader(void)
     assert((mdb.drAlBlkSiz % kBlkSize) == 0);
     fNumAllocationBlocks = mdb.drNmAlBlks;
     fAllocationBlockSize = mdb.drAlBlkSiz;
+    fNumFreeBlocks = mdb.drFreeBks;
     fTotalBlocks = fpImg->GetNumBlocks();
 
     uint32_t minBlocks;
@@ -351,10 +350,11 @@ void DiskFSHFS::DumpVolHeader(void)
     LOGI("  num directories=%d, num files=%d",
         fNumDirectories, fNumFiles);
     time_t when;
+    char timeBuf[kCTimeBufLen];
     when = (time_t) (fCreatedDateTime - kDateTimeOffset - fLocalTimeOffset);
-    LOGI("  cre date=0x%08x %.24s", fCreatedDateTime, ctime(&when));
+    LOGI("  cre date=0x%08x %.24s", fCreatedDateTime, CTimeR(&when, timeBuf));
     when = (time_t) (fModifiedDateTime - kDateTimeOffset - fLocalTimeOffset);
-    LOGI("  mod date=0x%08x %.24s", fModifiedDateTime, ctime(&when));
+    LOGI("  mod date=0x%08x %.24s", fModifiedDateTime, CTimeR(&when, timeBuf));
 }
 
 
@@ -372,6 +372,9 @@ DIError DiskFSHFS::Initialize(InitMode initMode)
     DIError dierr = kDIErrNone;
     char msg[kMaxVolumeName + 32];
 
+    /* HFS filenames are compared with the Mac OS Roman ordering */
+    SetFileNameFolding(hfs_charorder, CompareMacFileNames);
+
     dierr = LoadVolHeader();
     if (dierr != kDIErrNone)
         goto bail;
@@ -409,6 +412,11 @@ DIError DiskFSHFS::Initialize(InitMode initMode)
     A2FileHFS* pVolumeDir;
     pVolumeDir = (A2FileHFS*) GetNextFile(NULL);
 
+    /*
+     * In lazy mode only the root dir is read here.  The usage map doesn't
+     * depend on the file list, so there's nothing else to defer.
+     */
+    fLazyDirs = (initMode == kInitLazy);
     dierr = RecursiveDirAdd(pVolumeDir, ":", 0);
     if (dierr != kDIErrNone)
         goto bail;
@@ -483,11 +491,21 @@ unsigned long DiskFSHFS::LibHFSCB(void* vThis, int op, unsigned long arg1, void*
 
 /*
  * Determine the amount of free space on the disk.
+ *
+ * After a header-only Initialize the volume isn't open in libhfs, so we
+ * use the counts from the master directory block.  They're what hfs_vstat
+ * reports anyway, but libhfs keeps its copy current as files change.
  */
 DIError DiskFSHFS::GetFreeSpaceCount(long* pTotalUnits, long* pFreeUnits,
     int* pUnitSize) const
 {
-    assert(fHfsVol != NULL);
+    if (fHfsVol == NULL) {
+        long blocksPerAlloc = fAllocationBlockSize / kBlkSize;
+        *pTotalUnits = fNumAllocationBlocks * blocksPerAlloc;
+        *pFreeUnits = fNumFreeBlocks * blocksPerAlloc;
+        *pUnitSize = kBlkSize;
+        return kDIErrNone;
+    }
 
     hfsvolent volEnt;
     if (hfs_vstat(fHfsVol, &volEnt) != 0)
@@ -550,13 +568,16 @@ DIError DiskFSHFS::RecursiveDirAdd(A2File* pParent, const char* basePath, int de
         pFile->SetParent(pParent);
         AddFileToList(pFile);
 
-        if (!fpImg->UpdateScanProgress(NULL)) {
+        /* lazy loads read a whole directory or nothing */
+        if (!fpImg->UpdateScanProgress(NULL) && !fLazyDirs) {
             LOGI(" HFS cancelled by user");
             dierr = kDIErrCancelled;
             goto bail;
         }
 
-        if (dirEntry.flags & HFS_ISDIR) {
+        if ((dirEntry.flags & HFS_ISDIR) && fLazyDirs) {
+            SetDirPending(pFile);
+        } else if (dirEntry.flags & HFS_ISDIR) {
             strcpy(pathBuf + nameOffset, dirEntry.name);
             dierr = RecursiveDirAdd(pFile, pathBuf, depth+1);
             if (dierr != kDIErrNone)
@@ -569,6 +590,28 @@ bail:
     return dierr;
 }
 
+/*
+ * Read the entries of a subdirectory that was skipped by a lazy
+ * Initialize.
+ */
+DIError DiskFSHFS::LoadDirectory(A2File* pDir)
+{
+    DIError dierr;
+    char* pathName;
+    int depth = 0;
+
+    for (A2File* pParent = pDir->GetParent(); pParent != NULL;
+        pParent = pParent->GetParent())
+    {
+        depth++;
+    }
+
+    pathName = ((A2FileHFS*) pDir)->GetLibHFSPathName();
+    dierr = RecursiveDirAdd(pDir, pathName, depth);
+    delete[] pathName;
+    return dierr;
+}
+
 /*
  * Initialize an A2FileHFS structure from the stuff in an hfsdirent.
  */
@@ -1158,6 +1201,12 @@ DIError DiskFSHFS::CreateFile(const CreateParms* pParms, A2File** ppNewFile)
         goto bail;
     }
 
+    /*
+     * If the subdir hasn't been read yet (lazy init), read it before we
+     * add anything, or the new file would show up twice.
+     */
+    (void) GetChildCount(pSubdir);
+
     /*
      * Figure out file type.
      */
@@ -1235,36 +1284,29 @@ DIError DiskFSHFS::CreateFile(const CreateParms* pParms, A2File** ppNewFile)
      * putting it in the wrong place and it jumps around when the disk image
      * is reopened.
      *
-     * All files in a subdir appear in the list after that subdir, but there
-     * might be intervening entries from deeper directories.  So we have to
-     * chase through some or all of the file list to find the right place.
-     * Not great, but we don't have enough files or do adds often enough to
-     * make this worth optimizing.
+     * We only need to look at the files in the current directory;
+     * InsertFileInList takes care of skipping past the contents of a
+     * subdirectory if we end up after one.
      */
     A2File* pLastSubdirFile;
-    A2File* pPrevFile;
-    A2File* pNextFile;
-
-    pPrevFile = pLastSubdirFile = pSubdir;
-    pNextFile = GetNextFile(pPrevFile);
-    while (pNextFile != NULL) {
-        if (pNextFile->GetParent() == pNewFile->GetParent()) {
-            /* in same subdir, compare names */
-            if (CompareMacFileNames(pNextFile->GetPathName(),
-                pNewFile->GetPathName()) > 0)
-            {
-                /* passed it; insert new after previous file */
-                pLastSubdirFile = pPrevFile;
-                LOGI("  HFS Found '%s' > cur(%s)", pNextFile->GetPathName(),
-                    pNewFile->GetPathName());
-                break;
-            }
-
-            /* still too early; save in case it's last one in dir */
-            pLastSubdirFile = pNextFile;
+    A2File* pChild;
+    long numChildren, idx;
+
+    pLastSubdirFile = pSubdir;
+    numChildren = GetChildCount(pSubdir);
+    for (idx = 0; idx < numChildren; idx++) {
+        pChild = GetChild(pSubdir, idx);
+        if (CompareMacFileNames(pChild->GetPathName(),
+            pNewFile->GetPathName()) > 0)
+        {
+            /* passed it; insert new after previous file */
+            LOGI("  HFS Found '%s' > cur(%s)", pChild->GetPathName(),
+                pNewFile->GetPathName());
+            break;
         }
-        pPrevFile = pNextFile;
-        pNextFile = GetNextFile(pNextFile);
+
+        /* still too early; save in case it's last one in dir */
+        pLastSubdirFile = pChild;
     }
 
     /* insert us after last file we saw that was part of the same subdir */
@@ -1420,15 +1462,19 @@ DIError DiskFSHFS::RenameFile(A2File* pGenericFile, const char* newName)
      */
     A2File* pCur;
     if (pFile->IsDirectory()) {
-        /* do all files that come after us */
+        /* do us and everything inside us */
+        A2File* pLast = SkipSubdir(pFile);
         pCur = pFile;
-        while (pCur != NULL) {
+        while (true) {
             RegeneratePathName((A2FileHFS*) pCur);
+            if (pCur == pLast)
+                break;
             pCur = GetNextFile(pCur);
         }
     } else {
         RegeneratePathName(pFile);
     }
+    InvalidateFileIndex();
 
 bail:
     delete[] colonOldName;
@@ -1540,6 +1586,7 @@ DIError DiskFSHFS::RenameVolume(const char* newName)
     SetVolumeID();
     strcpy(pFile->fFileName, newName);
     pFile->SetPathName("", newName);
+    InvalidateFileIndex();
 
 bail:
     delete[] oldNameColon;
@@ -2097,13 +2144,14 @@ void DiskFSHFS::CreateFakeFile(void)
     char dateBuf[32];
     long capacity;
     const char* timeStr;
+    char timeBuf[kCTimeBufLen];
 
     capacity = (fAllocationBlockSize / kBlkSize) * fNumAllocationBlocks;
 
     /* get the mod time, format it, and remove the trailing '\n' */
     time_t when =
         (time_t) (fModifiedDateTime - kDateTimeOffset - fLocalTimeOffset);
-    timeStr = ctime(&when);
+    timeStr = CTimeR(&when, timeBuf);
     if (timeStr == NULL) {
         LOGI("Invalid date %ld (orig=%ld)", when, fModifiedDateTime);
         strcpy(dateBuf, "<no date>");
@@ -26,6 +26,7 @@
  * able to re-compress the image file when we're done with it.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagWrapper
 #include "DiskImgPriv.h"
 #include "TwoImg.h"
 
@@ -183,7 +184,7 @@ DIError Wrapper2MG::Create(di_off_t length, DiskImg::PhysicalFormat physical,
  * don't even deal with that.
  */
 DIError Wrapper2MG::Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-    di_off_t dataLen, di_off_t* pWrappedLen)
+    di_off_t dataLen, di_off_t* pWrappedLen, const LinearBitmap* pDirtyMap)
 {
     return kDIErrNone;
 }
@@ -207,18 +208,40 @@ DIError Wrapper2MG::Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
     void* vErrorMessage)
 {
     const NuErrorMessage* pErrorMessage = (const NuErrorMessage*) vErrorMessage;
+    Global::LogLevel level =
+        pErrorMessage->isDebug ? Global::kLogDebug : Global::kLogInfo;
+
+    if (!Global::IsLogEnabled(Global::kLogTagNuFX, level))
+        return kNuOK;
 
     if (pErrorMessage->isDebug) {
-        Global::PrintDebugMsg(pErrorMessage->file, pErrorMessage->line,
-            "[D] %s\n", pErrorMessage->message);
+        Global::PrintLogMsg(Global::kLogTagNuFX, level, pErrorMessage->file,
+            pErrorMessage->line, "[D] %s\n", pErrorMessage->message);
     } else {
-        Global::PrintDebugMsg(pErrorMessage->file, pErrorMessage->line,
-            "%s\n", pErrorMessage->message);
+        Global::PrintLogMsg(Global::kLogTagNuFX, level, pErrorMessage->file,
+            pErrorMessage->line, "%s\n", pErrorMessage->message);
     }
 
     return kNuOK;
 }
 
+/*
+ * Let NufxLib spread LZW work for big disk images across the processors.
+ * Failure isn't fatal; it just means we do it the slow way.
+ */
+static void SetNuFXCodecThreads(NuArchive* pArchive)
+{
+    int numThreads = DIWorkerGroup::GetProcessorCount();
+    if (numThreads > kNuMaxCodecThreads)
+        numThreads = kNuMaxCodecThreads;
+
+    NuError nerr = NuSetValue(pArchive, kNuValueCodecThreads, numThreads);
+    if (nerr != kNuErrNone) {
+        LOGI(" NuFX unable to set codec threads to %d (err=%d)",
+            numThreads, nerr);
+    }
+}
+
 /*
  * Open a NuFX archive, and verify that it holds exactly one disk archive.
  *
@@ -267,6 +290,7 @@ DIError Wrapper2MG::Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
     }
 
     NuSetErrorMessageHandler(pArchive, ErrMsgHandler);
+    SetNuFXCodecThreads(pArchive);
 
     nerr = NuGetAttr(pArchive, kNuAttrNumRecords, &attr);
     if (nerr != kNuErrNone) {
@@ -410,8 +434,12 @@ bail:
 /*
  * Test to see if this is a single-record NuFX archive with a disk archive
  * in it.
+ *
+ * Opening the archive means reading the whole record table, so if the
+ * caller wants it we hang on to the open archive in a new WrapperNuFX.
  */
-/*static*/ DIError WrapperNuFX::Test(GenericFD* pGFD, di_off_t wrappedLength)
+/*static*/ DIError WrapperNuFX::Test(GenericFD* pGFD, di_off_t wrappedLength,
+    WrapperNuFX** ppWrapper)
 {
     DIError dierr;
     NuArchive* pArchive = NULL;
@@ -428,16 +456,28 @@ bail:
     dierr = OpenNuFX(imagePath, &pArchive, &threadIdx, &length, true);
     if (dierr != kDIErrNone)
         return dierr;
-
-    /* success; throw away state in case they don't like us anyway */
     assert(pArchive != NULL);
-    NuClose(pArchive);
-    
+
+    if (ppWrapper != NULL) {
+        WrapperNuFX* pWrapper = new WrapperNuFX;
+        pWrapper->fpArchive = pArchive;
+        pWrapper->fThreadIdx = threadIdx;
+        pWrapper->fThreadLength = length;
+        *ppWrapper = pWrapper;
+    } else {
+        /* success; throw away state in case they don't like us anyway */
+        NuClose(pArchive);
+    }
+
     return kDIErrNone;
 }
 
 /*
- * Open the archive, extract the disk image into a memory buffer.
+ * Open the archive, and set up access to the disk image.
+ *
+ * For read-only access the thread is expanded as it's read.  Otherwise,
+ * or if NufxLib can't do random access on the compression format, the
+ * disk image is extracted into a memory buffer.
  */
 DIError WrapperNuFX::Prep(GenericFD* pGFD, di_off_t wrappedLength, bool readOnly,
     di_off_t* pLength, DiskImg::PhysicalFormat* pPhysical,
@@ -446,7 +486,7 @@ DIError WrapperNuFX::Prep(GenericFD* pGFD, di_off_t wrappedLength, bool readOnly
 {
     DIError dierr = kDIErrNone;
     NuThreadIdx threadIdx;
-    GFDBuffer* pNewGFD = NULL;
+    GenericFD* pNewGFD = NULL;
     char* buf = NULL;
     long length = -1;
     const char* imagePath;
@@ -457,19 +497,46 @@ DIError WrapperNuFX::Prep(GenericFD* pGFD, di_off_t wrappedLength, bool readOnly
         return kDIErrNotSupported;
     }
     pGFD->Close();      // don't hold the file open
-    dierr = OpenNuFX(imagePath, &fpArchive, &threadIdx, &length, readOnly);
-    if (dierr != kDIErrNone)
-        goto bail;
 
-    dierr = GetNuFXDiskImage(fpArchive, threadIdx, length, &buf);
-    if (dierr != kDIErrNone)
-        goto bail;
+    if (fpArchive != NULL && !readOnly) {
+        /* Test opened it read-only; start over */
+        NuClose(fpArchive);
+        fpArchive = NULL;
+    }
+    if (fpArchive != NULL) {
+        threadIdx = fThreadIdx;
+        length = fThreadLength;
+    } else {
+        dierr = OpenNuFX(imagePath, &fpArchive, &threadIdx, &length, readOnly);
+        if (dierr != kDIErrNone)
+            goto bail;
+    }
 
-    pNewGFD = new GFDBuffer;
-    dierr = pNewGFD->Open(buf, length, true, false, readOnly);
-    if (dierr != kDIErrNone)
-        goto bail;
-    buf = NULL;      // now owned by pNewGFD;
+    if (readOnly) {
+        GFDNuFX* pNuFXGFD = new GFDNuFX;
+        dierr = pNuFXGFD->Open(fpArchive, threadIdx, length);
+        if (dierr == kDIErrNone) {
+            pNewGFD = pNuFXGFD;
+        } else {
+            delete pNuFXGFD;
+            if (dierr != kDIErrUnsupportedCompression)
+                goto bail;
+            dierr = kDIErrNone;
+        }
+    }
+
+    if (pNewGFD == NULL) {
+        dierr = GetNuFXDiskImage(fpArchive, threadIdx, length, &buf);
+        if (dierr != kDIErrNone)
+            goto bail;
+
+        GFDBuffer* pBufferGFD = new GFDBuffer;
+        pNewGFD = pBufferGFD;
+        dierr = pBufferGFD->Open(buf, length, true, false, readOnly);
+        if (dierr != kDIErrNone)
+            goto bail;
+        buf = NULL;      // now owned by pNewGFD;
+    }
 
     /*
      * Success!
@@ -579,6 +646,7 @@ DIError WrapperNuFX::Create(di_off_t length, DiskImg::PhysicalFormat physical,
         dierr = kDIErrGeneric;
         goto bail;
     }
+    SetNuFXCodecThreads(pArchive);
 
     /*
      * Create a blank chunk of memory for the image.
@@ -640,7 +708,7 @@ DIError WrapperNuFX::CloseNuFX(void)
  * updating it.
  */
 DIError WrapperNuFX::Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-    di_off_t dataLen, di_off_t* pWrappedLen)
+    di_off_t dataLen, di_off_t* pWrappedLen, const LinearBitmap* pDirtyMap)
 {
     NuError nerr = kNuErrNone;
     NuFileDetails fileDetails;
@@ -648,6 +716,17 @@ DIError WrapperNuFX::Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
     NuThreadIdx threadIdx;
     NuDataSource* pDataSource = NULL;
 
+    /*
+     * Recompressing the disk is expensive.  If nothing has changed since
+     * the record was last written, leave it alone.
+     */
+    if (fThreadIdx != 0 && pDirtyMap != NULL &&
+        pDirtyMap->FindFirstSet() < 0)
+    {
+        LOGI(" NuFX disk image unchanged, not recompressing");
+        return kDIErrNone;
+    }
+
     if (fThreadIdx != 0) {
         /*
          * Mark the old record for deletion.
@@ -760,12 +839,17 @@ bail:
  */
 void WrapperNuFX::UNIXTimeToDateTime(const time_t* pWhen, NuDateTime *pDateTime)
 {
+    struct tm tmWhen;
     struct tm* ptm;
 
     assert(pWhen != NULL);
     assert(pDateTime != NULL);
 
-    ptm = localtime(pWhen);
+    ptm = LocalTimeR(pWhen, &tmWhen);
+    if (ptm == NULL) {
+        memset(pDateTime, 0, sizeof(*pDateTime));
+        return;
+    }
     pDateTime->second = ptm->tm_sec;
     pDateTime->minute = ptm->tm_min;
     pDateTime->hour = ptm->tm_hour;
@@ -1005,7 +1089,7 @@ bail:
  * Compress the disk image.
  */
 DIError WrapperDDD::Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-    di_off_t dataLen, di_off_t* pWrappedLen)
+    di_off_t dataLen, di_off_t* pWrappedLen, const LinearBitmap* pDirtyMap)
 {
     DIError dierr;
 
@@ -1041,6 +1125,7 @@ const int kDC42ChecksumOffset = 72;     // where the checksum lives
 const int kDC42DataOffset = 84;         // header is always this long
 const int kDC42PrivateMagic = 0x100;
 const int kDC42FakeTagLen = 19200;      // add a "fake" tag to match Mac
+const int kDC42DataBlocks = 1600;       // 800K of 512-byte blocks
 
 typedef struct DiskImgLib::DC42Header {
     char        diskName[kDC42NameLen+1];   // from pascal string
@@ -1187,45 +1272,89 @@ DIError WrapperDiskCopy42::WriteHeader(GenericFD* pGFD, const DC42Header* pHeade
 }
 
 /*
- * Compute the funky DiskCopy checksum.
+ * Run one 512-byte block through the funky DiskCopy checksum.
+ */
+static uint32_t DC42ChecksumBlock(const uint8_t* buf, uint32_t checksum)
+{
+    for (int i = 0; i < 512; i += 2) {
+        uint16_t val = GetShortBE(buf+i);
+
+        checksum += val;
+        if (checksum & 0x01)
+            checksum = checksum >> 1 | 0x80000000;
+        else
+            checksum = checksum >> 1;
+    }
+    return checksum;
+}
+
+/*
+ * Compute the funky DiskCopy checksum.  The data starts at "dataOffset"
+ * in "pGFD".
  *
- * Position "pGFD" at the start of data.
+ * Each step depends on the running total, so a change can't be patched
+ * in.  Instead, we remember the total at the start of every block, and
+ * start over from "firstBlock" (the first block that changed).  If the
+ * data is in memory it's used in place; otherwise it's read in chunks.
  */
-/*static*/ DIError WrapperDiskCopy42::ComputeChecksum(GenericFD* pGFD, uint32_t* pChecksum)
+DIError WrapperDiskCopy42::ComputeChecksum(GenericFD* pGFD,
+    di_off_t dataOffset, long firstBlock, uint32_t* pChecksum)
 {
+    const int kChunkBlocks = 32;
     DIError dierr = kDIErrNone;
-    uint8_t buf[512];
-    long dataRem = 800 * 1024 /*pHeader->dataSize*/;
+    const uint8_t* dataPtr;
+    uint8_t* chunkBuf = NULL;
     uint32_t checksum;
+    long block;
 
-    assert(dataRem % sizeof(buf) == 0);
-    assert((sizeof(buf) & 0x01) == 0);  // we take it two bytes at a time
-
-    checksum = 0;
-    while (dataRem) {
-        int i;
+    assert(firstBlock >= 0 && firstBlock < kDC42DataBlocks);
+    if (fpBlockSums == NULL) {
+        fpBlockSums = new uint32_t[kDC42DataBlocks + 1];
+        firstBlock = 0;
+    }
+    fpBlockSums[0] = 0;
+    checksum = fpBlockSums[firstBlock];
 
-        dierr = pGFD->Read(buf, sizeof(buf));
-        if (dierr != kDIErrNone) {
-            LOGI(" DC42 read failed, dataRem=%ld (err=%d)", dataRem, dierr);
-            return dierr;
+    dataPtr = pGFD->GetDirectPointer(dataOffset, kDC42DataBlocks * 512);
+    if (dataPtr != NULL) {
+        for (block = firstBlock; block < kDC42DataBlocks; block++) {
+            checksum = DC42ChecksumBlock(dataPtr + block * 512, checksum);
+            fpBlockSums[block+1] = checksum;
         }
+    } else {
+        dierr = pGFD->Seek(dataOffset + firstBlock * 512, kSeekSet);
+        if (dierr != kDIErrNone)
+            goto bail;
 
-        for (i = 0; i < (int) sizeof(buf); i += 2) {
-            uint16_t val = GetShortBE(buf+i);
+        chunkBuf = new uint8_t[kChunkBlocks * 512];
+        block = firstBlock;
+        while (block < kDC42DataBlocks) {
+            int count = kDC42DataBlocks - block;
+            if (count > kChunkBlocks)
+                count = kChunkBlocks;
 
-            checksum += val;
-            if (checksum & 0x01)
-                checksum = checksum >> 1 | 0x80000000;
-            else
-                checksum = checksum >> 1;
-        }
+            dierr = pGFD->Read(chunkBuf, count * 512);
+            if (dierr != kDIErrNone) {
+                LOGI(" DC42 read failed, block=%ld (err=%d)", block, dierr);
+                goto bail;
+            }
 
-        dataRem -= sizeof(buf);
+            for (int i = 0; i < count; i++, block++) {
+                checksum = DC42ChecksumBlock(chunkBuf + i * 512, checksum);
+                fpBlockSums[block+1] = checksum;
+            }
+        }
     }
 
     *pChecksum = checksum;
 
+bail:
+    if (dierr != kDIErrNone) {
+        /* the saved totals may be incomplete */
+        delete[] fpBlockSums;
+        fpBlockSums = NULL;
+    }
+    delete[] chunkBuf;
     return dierr;
 }
 
@@ -1246,10 +1375,10 @@ DIError WrapperDiskCopy42::Prep(GenericFD* pGFD, di_off_t wrappedLength,
         return kDIErrGeneric;
 
     /*
-     * Verify checksum.  File should already be seeked to appropriate place.
+     * Verify checksum.
      */
     uint32_t checksum;
-    dierr = ComputeChecksum(pGFD, &checksum);
+    dierr = ComputeChecksum(pGFD, kDC42DataOffset, 0, &checksum);
     if (dierr != kDIErrNone)
         return dierr;
 
@@ -1303,22 +1432,33 @@ DIError WrapperDiskCopy42::Create(di_off_t length, DiskImg::PhysicalFormat physi
 /*
  * We only use GFDGFD, so there's no data to write.  However, we do need
  * to update the checksum, and append our "fake" tag section.
+ *
+ * The checksum is only recomputed from the first block that changed.
  */
 DIError WrapperDiskCopy42::Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-    di_off_t dataLen, di_off_t* pWrappedLen)
+    di_off_t dataLen, di_off_t* pWrappedLen, const LinearBitmap* pDirtyMap)
 {
     DIError dierr;
     uint32_t checksum;
+    long firstBlock = 0;
 
-    /* compute the data checksum */
-    dierr = pWrapperGFD->Seek(kDC42DataOffset, kSeekSet);
-    if (dierr != kDIErrNone)
-        goto bail;
+    if (fpBlockSums != NULL && pDirtyMap != NULL) {
+        firstBlock = pDirtyMap->FindFirstSet();
+        if (firstBlock < 0 || firstBlock > kDC42DataBlocks)
+            firstBlock = kDC42DataBlocks;
+    }
 
-    dierr = ComputeChecksum(pWrapperGFD, &checksum);
-    if (dierr != kDIErrNone) {
-        LOGI(" DC42 failed while computing checksum (err=%d)", dierr);
-        goto bail;
+    /* compute the data checksum */
+    if (firstBlock == kDC42DataBlocks) {
+        LOGD(" DC42 data unchanged, reusing checksum");
+        checksum = fpBlockSums[kDC42DataBlocks];
+    } else {
+        LOGD(" DC42 computing checksum from block %ld", firstBlock);
+        dierr = ComputeChecksum(pDataGFD, 0, firstBlock, &checksum);
+        if (dierr != kDIErrNone) {
+            LOGI(" DC42 failed while computing checksum (err=%d)", dierr);
+            goto bail;
+        }
     }
 
     /* write it into the wrapper */
@@ -1461,7 +1601,7 @@ DIError WrapperSim2eHDV::Create(di_off_t length, DiskImg::PhysicalFormat physica
  * We only use GFDGFD, so there's nothing to do here.
  */
 DIError WrapperSim2eHDV::Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-    di_off_t dataLen, di_off_t* pWrappedLen)
+    di_off_t dataLen, di_off_t* pWrappedLen, const LinearBitmap* pDirtyMap)
 {
     return kDIErrNone;
 }
@@ -1790,7 +1930,7 @@ bail:
  * We need to create the new file in "pWrapperGFD".
  */
 DIError WrapperTrackStar::Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-    di_off_t dataLen, di_off_t* pWrappedLen)
+    di_off_t dataLen, di_off_t* pWrappedLen, const LinearBitmap* pDirtyMap)
 {
     DIError dierr = kDIErrNone;
 
@@ -2225,7 +2365,7 @@ bail:
  * We need to create the new file in "pWrapperGFD".
  */
 DIError WrapperFDI::Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-    di_off_t dataLen, di_off_t* pWrappedLen)
+    di_off_t dataLen, di_off_t* pWrappedLen, const LinearBitmap* pDirtyMap)
 {
     DIError dierr = kDIErrGeneric;      // not yet
 
@@ -2399,7 +2539,7 @@ DIError WrapperUnadornedNibble::Create(di_off_t length,
  * We only use GFDGFD, so there's nothing to do here.
  */
 DIError WrapperUnadornedNibble::Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-    di_off_t dataLen, di_off_t* pWrappedLen)
+    di_off_t dataLen, di_off_t* pWrappedLen, const LinearBitmap* pDirtyMap)
 {
     return kDIErrNone;
 }
@@ -2470,7 +2610,7 @@ DIError WrapperUnadornedSector::Create(di_off_t length, DiskImg::PhysicalFormat
  * We only use GFDGFD, so there's nothing to do here.
  */
 DIError WrapperUnadornedSector::Flush(GenericFD* pWrapperGFD, GenericFD* pDataGFD,
-    di_off_t dataLen, di_off_t* pWrappedLen)
+    di_off_t dataLen, di_off_t* pWrappedLen, const LinearBitmap* pDirtyMap)
 {
     return kDIErrNone;
 }
@@ -9,6 +9,7 @@
  * drive or CD-ROM.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
@@ -351,12 +352,7 @@ DIError DiskFSMacPart::OpenSubVolume(const PartitionMap* pMap)
      * It's important that a failure at this stage doesn't cause the whole
      * thing to fall over.
      */
-    InitMode initMode;
-    if (GetScanForSubVolumes() == kScanSubContainerOnly)
-        initMode = kInitHeaderOnly;
-    else
-        initMode = kInitFull;
-    dierr = pNewFS->Initialize(pNewImg, initMode);
+    dierr = pNewFS->Initialize(pNewImg, GetSubVolumeInitMode());
     if (dierr != kDIErrNone) {
         LOGI(" MacPartSub: error %d reading list of files from disk", dierr);
         goto bail;
@@ -10,6 +10,7 @@
  * MicroDrive card for the Apple II.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
@@ -261,12 +262,7 @@ DIError DiskFSMicroDrive::OpenSubVolume(long startBlock, long numBlocks)
      * It's important that a failure at this stage doesn't cause the whole
      * thing to fall over.
      */
-    InitMode initMode;
-    if (GetScanForSubVolumes() == kScanSubContainerOnly)
-        initMode = kInitHeaderOnly;
-    else
-        initMode = kInitFull;
-    dierr = pNewFS->Initialize(pNewImg, initMode);
+    dierr = pNewFS->Initialize(pNewImg, GetSubVolumeInitMode());
     if (dierr != kDIErrNone) {
         LOGI(" MicroDriveSub: error %d reading list of files from disk", dierr);
         goto bail;
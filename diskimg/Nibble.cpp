@@ -7,11 +7,19 @@
  * DiskImg nibblized read/write functions.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagNibble
 #include "DiskImgPriv.h"
 
 /* define this for verbose output */
 //#define NIB_VERBOSE_DEBUG
 
+/* SSE2 is always there on x64, and on x86 if the compiler was told so */
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define NIB_HAVE_SSE2
+# include <emmintrin.h>
+#endif
+
 
 /*
  * ===========================================================================
@@ -37,6 +45,8 @@
 };
 /*static*/ uint8_t DiskImg::kInvDiskBytes53[256]; // all values are 0-31
 /*static*/ uint8_t DiskImg::kInvDiskBytes62[256]; // all values are 0-63
+/*static*/ DiskImg::NibbleCodec DiskImg::fNibbleCodec = kNibbleCodecScalar;
+/*static*/ DiskImg::NibbleCodec DiskImg::fNibbleCodec53 = kNibbleCodecScalar;
 
 /*
  * Compute tables to convert disk bytes back to values.
@@ -58,24 +68,32 @@
         assert(kDiskBytes62[i] >= 0x96);
         kInvDiskBytes62[kDiskBytes62[i]] = i;
     }
+
+    (void) SetNibbleCodec(kNibbleCodecAuto);
 }
 
 /*
- * Find the start of the data field of a sector in nibblized data.
+ * Walk through a nibble track once, and record where the data field for
+ * each sector starts.
  *
- * Returns the index start on success or -1 on failure.
+ * For each sector we keep the first address field (in buffer order) that
+ * passes the checks called for by "pNibbleDescr" and is followed closely
+ * by a data prolog.  The track buffer is circular, so fields that wrap
+ * around the end are found.
+ *
+ * Sectors that weren't found have "dataIdx" set to -1.
  */
-int DiskImg::FindNibbleSectorStart(const CircularBufferAccess& buffer, int track,
-    int sector, const NibbleDescr* pNibbleDescr, int* pVol)
+void DiskImg::IndexNibbleTrack(const CircularBufferAccess& buffer, int track,
+    const NibbleDescr* pNibbleDescr, NibbleSectorAddr* pMap)
 {
     const int kMaxDataReach = 48;       // fairly arbitrary
-    //DIError dierr;
     long trackLen = buffer.GetSize();
-
-    assert(sector >= 0 && sector < 16);
-
+    int numFound = 0;
     int i;
 
+    for (i = 0; i < kMaxNibbleSectors; i++)
+        pMap[i].dataIdx = -1;
+
     for (i = 0; i < trackLen; i++) {
         bool foundAddr = false;
 
@@ -113,9 +131,8 @@ int DiskImg::FindNibbleSectorStart(const CircularBufferAccess& buffer, int track
                 if ((pNibbleDescr->addrChecksumSeed ^
                     hdrVol ^ hdrTrack ^ hdrSector ^ hdrChksum) != 0)
                 {
-                    LOGW("   Addr checksum mismatch (want T=%d,S=%d, got "
-                          "T=%d,S=%d)",
-                        track, sector, hdrTrack, hdrSector);
+                    LOGW("   Addr checksum mismatch (T=%d, got T=%d,S=%d)",
+                        track, hdrTrack, hdrSector);
                     continue;
                 }
             }
@@ -134,8 +151,7 @@ int DiskImg::FindNibbleSectorStart(const CircularBufferAccess& buffer, int track
                 continue;
 
 #ifdef NIB_VERBOSE_DEBUG
-            LOGI("    Good header, T=%d,S=%d (looking for T=%d,S=%d)",
-                hdrTrack, hdrSector, track, sector);
+            LOGI("    Good header, T=%d,S=%d", hdrTrack, hdrSector);
 #endif
 
             if (pNibbleDescr->special == kNibbleSpecialMuse) {
@@ -147,8 +163,12 @@ int DiskImg::FindNibbleSectorStart(const CircularBufferAccess& buffer, int track
                 }
             }
 
-            if (sector != hdrSector)
+            /* keep the first good one we see for each sector */
+            if (hdrSector < 0 || hdrSector >= kMaxNibbleSectors ||
+                pMap[hdrSector].dataIdx >= 0)
+            {
                 continue;
+            }
 
             /*
              * Scan forward and look for data prolog.  We want to limit
@@ -160,17 +180,24 @@ int DiskImg::FindNibbleSectorStart(const CircularBufferAccess& buffer, int track
                     buffer[i + j +1] == pNibbleDescr->dataProlog[1] &&
                     buffer[i + j +2] == pNibbleDescr->dataProlog[2])
                 {
-                    *pVol = hdrVol;
-                    return buffer.Normalize(i + j + 3);
+                    NibbleSectorAddr* pAddr = &pMap[hdrSector];
+                    pAddr->dataIdx = buffer.Normalize(i + j + 3);
+                    pAddr->vol = hdrVol;
+                    pAddr->track = hdrTrack;
+                    pAddr->chksum = hdrChksum;
+                    numFound++;
+                    break;
                 }
             }
         }
     }
 
 #ifdef NIB_VERBOSE_DEBUG
-    LOGI("   Couldn't find T=%d,S=%d", track, sector);
+    LOGI("   Indexed T=%d with '%s': %d sectors",
+        track, pNibbleDescr->description, numFound);
+#else
+    (void) numFound;
 #endif
-    return -1;
 }
 
 /*
@@ -191,19 +218,29 @@ void DiskImg::DecodeAddr(const CircularBufferAccess& buffer, int offset,
  * Decode the sector pointed to by "pData" and described by "pNibbleDescr".
  * This invokes the appropriate function (e.g. 5&3 or 6&2) to decode the
  * data into a 256-byte sector.
+ *
+ * The decoders want the field in one piece, so if it wraps around the end
+ * of the track we copy it out first.
  */
 DIError DiskImg::DecodeNibbleData(const CircularBufferAccess& buffer, int idx,
     uint8_t* sctBuf, const NibbleDescr* pNibbleDescr)
 {
-    switch (pNibbleDescr->encoding) {
-    case kNibbleEnc62:
-        return DecodeNibble62(buffer, idx, sctBuf, pNibbleDescr);
-    case kNibbleEnc53:
-        return DecodeNibble53(buffer, idx, sctBuf, pNibbleDescr);
-    default:
+    uint8_t scratch[kDataSize53];
+    int fieldLen = GetNibbleFieldSize(pNibbleDescr);
+    const uint8_t* field;
+
+    if (fieldLen < 0) {
         assert(false);
         return kDIErrInternal;
     }
+
+    field = buffer.GetPointer(idx, fieldLen);
+    if (field == NULL) {
+        buffer.CopyOut(idx, scratch, fieldLen);
+        field = scratch;
+    }
+
+    return DecodeNibbleField(field, sctBuf, pNibbleDescr);
 }
 
 /*
@@ -213,13 +250,99 @@ DIError DiskImg::DecodeNibbleData(const CircularBufferAccess& buffer, int idx,
  */
 void DiskImg::EncodeNibbleData(const CircularBufferAccess& buffer, int idx,
     const uint8_t* sctBuf, const NibbleDescr* pNibbleDescr) const
+{
+    uint8_t scratch[kDataSize53];
+    int fieldLen = GetNibbleFieldSize(pNibbleDescr);
+    uint8_t* field;
+
+    if (fieldLen < 0) {
+        assert(false);
+        return;
+    }
+
+    field = buffer.GetPointer(idx, fieldLen);
+    if (field != NULL) {
+        EncodeNibbleField(field, sctBuf, pNibbleDescr);
+    } else {
+        EncodeNibbleField(scratch, sctBuf, pNibbleDescr);
+        buffer.CopyIn(idx, scratch, fieldLen);
+    }
+}
+
+/*
+ * Return the size of a data field, or -1 if the encoding isn't one we
+ * handle.
+ */
+/*static*/ int DiskImg::GetNibbleFieldSize(const NibbleDescr* pNibbleDescr)
+{
+    switch (pNibbleDescr->encoding) {
+    case kNibbleEnc62:
+        return kDataSize62;
+    case kNibbleEnc53:
+        return kDataSize53;
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Decode a data field, using the current codec.
+ */
+/*static*/ DIError DiskImg::DecodeNibbleField(const uint8_t* field,
+    uint8_t* sctBuf, const NibbleDescr* pNibbleDescr)
+{
+    int chksum = pNibbleDescr->dataChecksumSeed;
+    bool ok;
+
+    switch (pNibbleDescr->encoding) {
+    case kNibbleEnc62:
+        switch (fNibbleCodec) {
+        case kNibbleCodecTable:
+            ok = DecodeNibble62Table(field, sctBuf, &chksum);
+            break;
+        case kNibbleCodecSSE2:
+            ok = DecodeNibble62SSE2(field, sctBuf, &chksum);
+            break;
+        default:
+            ok = DecodeNibble62(field, sctBuf, &chksum);
+            break;
+        }
+        break;
+    case kNibbleEnc53:
+        if (fNibbleCodec53 == kNibbleCodecTable)
+            ok = DecodeNibble53Table(field, sctBuf, &chksum);
+        else
+            ok = DecodeNibble53(field, sctBuf, &chksum);
+        break;
+    default:
+        assert(false);
+        return kDIErrInternal;
+    }
+
+    if (!ok)
+        return kDIErrInvalidDiskByte;
+
+    if (pNibbleDescr->dataVerifyChecksum && chksum != 0) {
+        LOGI("    NIB bad data checksum (0x%02x)", chksum);
+        return kDIErrBadChecksum;
+    }
+    return kDIErrNone;
+}
+
+/*
+ * Encode a data field.  There's only one encoder; the work is dominated by
+ * splitting the sector up, which doesn't gain much from the tricks that
+ * help the decoders.
+ */
+/*static*/ void DiskImg::EncodeNibbleField(uint8_t* field,
+    const uint8_t* sctBuf, const NibbleDescr* pNibbleDescr)
 {
     switch (pNibbleDescr->encoding) {
     case kNibbleEnc62:
-        EncodeNibble62(buffer, idx, sctBuf, pNibbleDescr);
+        EncodeNibble62(field, sctBuf, pNibbleDescr->dataChecksumSeed);
         break;
     case kNibbleEnc53:
-        EncodeNibble53(buffer, idx, sctBuf, pNibbleDescr);
+        EncodeNibble53(field, sctBuf, pNibbleDescr->dataChecksumSeed);
         break;
     default:
         assert(false);
@@ -227,14 +350,76 @@ void DiskImg::EncodeNibbleData(const CircularBufferAccess& buffer, int idx,
     }
 }
 
+/*
+ * Is "codec" compiled into this build?
+ */
+/*static*/ bool DiskImg::IsNibbleCodecAvailable(NibbleCodec codec)
+{
+    switch (codec) {
+    case kNibbleCodecAuto:
+    case kNibbleCodecScalar:
+    case kNibbleCodecTable:
+        return true;
+    case kNibbleCodecSSE2:
+#ifdef NIB_HAVE_SSE2
+        return true;
+#else
+        return false;
+#endif
+    default:
+        return false;
+    }
+}
+
+/*
+ * Select the codec used by DecodeNibbleField.
+ *
+ * There's no SSE2 decoder for 5&3, and the table decoder isn't reliably
+ * faster than the scalar one, so 5&3 only uses the table decoder when
+ * it's asked for by name.
+ *
+ * This is a process-wide setting, so it shouldn't be changed while other
+ * threads are reading nibble images.
+ */
+/*static*/ bool DiskImg::SetNibbleCodec(NibbleCodec codec)
+{
+    if (!IsNibbleCodecAvailable(codec))
+        return false;
+
+    if (codec == kNibbleCodecAuto) {
+        if (IsNibbleCodecAvailable(kNibbleCodecSSE2))
+            codec = kNibbleCodecSSE2;
+        else
+            codec = kNibbleCodecTable;
+        fNibbleCodec53 = kNibbleCodecScalar;
+    } else if (codec == kNibbleCodecTable) {
+        fNibbleCodec53 = kNibbleCodecTable;
+    } else {
+        fNibbleCodec53 = kNibbleCodecScalar;
+    }
+    fNibbleCodec = codec;
+    return true;
+}
+
+
+/*
+ * Bits 0 and 1 of a 6&2 "twos" value are swapped relative to the data
+ * byte they belong to.
+ */
+static const uint8_t kSwapBits2[4] = { 0x00, 0x02, 0x01, 0x03 };
+
 /*
  * Decode 6&2 encoding.
+ *
+ * This is the reference implementation.  On entry, "*pChksum" holds the
+ * checksum seed; on exit, it holds the checksum, which is zero if the
+ * field is intact.  Returns false if an invalid disk byte is found.
  */
-DIError DiskImg::DecodeNibble62(const CircularBufferAccess& buffer, int idx,
-    uint8_t* sctBuf, const NibbleDescr* pNibbleDescr)
+/*static*/ bool DiskImg::DecodeNibble62(const uint8_t* field,
+    uint8_t* sctBuf, int* pChksum)
 {
     uint8_t twos[kChunkSize62 * 3];   // 258
-    int chksum = pNibbleDescr->dataChecksumSeed;
+    int chksum = *pChksum;
     uint8_t decodedVal;
     int i;
 
@@ -243,9 +428,9 @@ DIError DiskImg::DecodeNibble62(const CircularBufferAccess& buffer, int idx,
      * values, and arrange them into a DOS-like pair of buffers.
      */
     for (i = 0; i < kChunkSize62; i++) {
-        decodedVal = kInvDiskBytes62[buffer[idx++]];
+        decodedVal = kInvDiskBytes62[*field++];
         if (decodedVal == kInvInvalidValue)
-            return kDIErrInvalidDiskByte;
+            return false;
         assert(decodedVal < sizeof(kDiskBytes62));
 
         chksum ^= decodedVal;
@@ -258,9 +443,9 @@ DIError DiskImg::DecodeNibble62(const CircularBufferAccess& buffer, int idx,
     }
 
     for (i = 0; i < 256; i++) {
-        decodedVal = kInvDiskBytes62[buffer[idx++]];
+        decodedVal = kInvDiskBytes62[*field++];
         if (decodedVal == kInvInvalidValue)
-            return kDIErrInvalidDiskByte;
+            return false;
         assert(decodedVal < sizeof(kDiskBytes62));
 
         chksum ^= decodedVal;
@@ -271,25 +456,159 @@ DIError DiskImg::DecodeNibble62(const CircularBufferAccess& buffer, int idx,
      * Grab the 343rd byte (the checksum byte) and see if we did this
      * right.
      */
-    //printf("Dec checksum value is 0x%02x\n", chksum);
-    decodedVal = kInvDiskBytes62[buffer[idx++]];
+    decodedVal = kInvDiskBytes62[*field++];
     if (decodedVal == kInvInvalidValue)
-        return kDIErrInvalidDiskByte;
+        return false;
     assert(decodedVal < sizeof(kDiskBytes62));
     chksum ^= decodedVal;
 
-    if (pNibbleDescr->dataVerifyChecksum && chksum != 0) {
-        LOGI("    NIB bad data checksum");
-        return kDIErrBadChecksum;
+    *pChksum = chksum;
+    return true;
+}
+
+/*
+ * Convert "len" disk bytes with "invTable", and run the checksum chain over
+ * the results, leaving the chain values in "vals".
+ *
+ * Invalid disk bytes are checked for once at the end instead of on every
+ * byte, which keeps the loop short.
+ */
+static bool TranslateChain(const uint8_t* field, int len,
+    const uint8_t* invTable, uint8_t* vals, int* pChksum)
+{
+    uint8_t bad = 0;
+    uint8_t chksum = *pChksum;
+
+    for (int i = 0; i < len; i++) {
+        uint8_t val = invTable[field[i]];
+        bad |= val;
+        chksum ^= val;
+        vals[i] = chksum;
     }
-    return kDIErrNone;
+
+    /* kInvInvalidValue is the only value with the high bit set */
+    if (bad & 0x80)
+        return false;
+
+    *pChksum = chksum;
+    return true;
+}
+
+/*
+ * Decode 6&2 encoding, in two passes: one to translate the disk bytes and
+ * run the checksum chain, one to put the bytes together.
+ */
+/*static*/ bool DiskImg::DecodeNibble62Table(const uint8_t* field,
+    uint8_t* sctBuf, int* pChksum)
+{
+    uint8_t vals[kDataSize62];
+
+    if (!TranslateChain(field, kDataSize62, kInvDiskBytes62, vals, pChksum))
+        return false;
+
+    AssembleNibble62(vals, sctBuf);
+    return true;
+}
+
+/*
+ * Put together a 6&2 sector from the checksum chain values.  The low two
+ * bits of byte N come from value N mod 86, bits (N / 86) * 2 and up; the
+ * top six come from value 86 + N.
+ *
+ * We work on eight bytes at a time in a 64-bit integer.  Bits that shift
+ * across byte boundaries are always masked off, so this works the same
+ * on big- and little-endian machines.
+ */
+/*static*/ void DiskImg::AssembleNibble62(const uint8_t* vals, uint8_t* sctBuf)
+{
+    const uint64_t kTopMask = 0xfcfcfcfcfcfcfcfcULL;
+    const uint64_t kBit1Mask = 0x0202020202020202ULL;
+    const uint64_t kBit0Mask = 0x0101010101010101ULL;
+    const uint8_t* top = vals + kChunkSize62;
+
+    for (int section = 0; section < 3; section++) {
+        int start = section * kChunkSize62;
+        int end = start + kChunkSize62;
+        int shift = section * 2;
+        int i;
+        if (end > 256)
+            end = 256;
+
+        for (i = start; i + 8 <= end; i += 8) {
+            uint64_t topVal, twosVal, result;
+
+            memcpy(&topVal, top + i, 8);
+            memcpy(&twosVal, vals + i - start, 8);
+            twosVal >>= shift;
+            result = ((topVal << 2) & kTopMask) |
+                     ((twosVal << 1) & kBit1Mask) |
+                     ((twosVal >> 1) & kBit0Mask);
+            memcpy(sctBuf + i, &result, 8);
+        }
+        for ( ; i < end; i++) {
+            sctBuf[i] = (top[i] << 2) |
+                kSwapBits2[(vals[i - start] >> shift) & 0x03];
+        }
+    }
+}
+
+/*
+ * Decode 6&2 encoding, using SSE2 to put the bytes together sixteen at
+ * a time.  The translation has to be done with table lookups, which SSE2
+ * can't do, and it turns out to be cheapest to run the checksum chain in
+ * the same loop.
+ */
+/*static*/ bool DiskImg::DecodeNibble62SSE2(const uint8_t* field,
+    uint8_t* sctBuf, int* pChksum)
+{
+#ifdef NIB_HAVE_SSE2
+    uint8_t vals[kDataSize62];
+
+    if (!TranslateChain(field, kDataSize62, kInvDiskBytes62, vals, pChksum))
+        return false;
+
+    const __m128i topMask = _mm_set1_epi8((char) 0xfc);
+    const __m128i bit0 = _mm_set1_epi8(0x01);
+    const __m128i bit1 = _mm_set1_epi8(0x02);
+    int section, i;
+
+    for (section = 0; section < 3; section++) {
+        int start = section * kChunkSize62;
+        int end = start + kChunkSize62;
+        if (end > 256)
+            end = 256;
+        const __m128i shift = _mm_cvtsi32_si128(section * 2);
+
+        for (i = start; i + 16 <= end; i += 16) {
+            __m128i top = _mm_loadu_si128(
+                (const __m128i*) (vals + kChunkSize62 + i));
+            __m128i twos = _mm_loadu_si128(
+                (const __m128i*) (vals + i - start));
+
+            top = _mm_and_si128(_mm_slli_epi16(top, 2), topMask);
+            twos = _mm_srl_epi16(twos, shift);
+            twos = _mm_or_si128(
+                _mm_and_si128(_mm_slli_epi16(twos, 1), bit1),
+                _mm_and_si128(_mm_srli_epi16(twos, 1), bit0));
+            _mm_storeu_si128((__m128i*) (sctBuf + i),
+                _mm_or_si128(top, twos));
+        }
+        for ( ; i < end; i++) {
+            sctBuf[i] = (vals[kChunkSize62 + i] << 2) |
+                kSwapBits2[(vals[i - start] >> (section * 2)) & 0x03];
+        }
+    }
+    return true;
+#else
+    return DecodeNibble62Table(field, sctBuf, pChksum);
+#endif
 }
 
 /*
  * Encode 6&2 encoding.
  */
-void DiskImg::EncodeNibble62(const CircularBufferAccess& buffer, int idx,
-    const uint8_t* sctBuf, const NibbleDescr* pNibbleDescr) const
+/*static*/ void DiskImg::EncodeNibble62(uint8_t* field, const uint8_t* sctBuf,
+    int chksum)
 {
     uint8_t top[256];
     uint8_t twos[kChunkSize62];
@@ -311,32 +630,33 @@ void DiskImg::EncodeNibble62(const CircularBufferAccess& buffer, int idx,
         twoPosn--;
     }
 
-    int chksum = pNibbleDescr->dataChecksumSeed;
     for (i = kChunkSize62-1; i >= 0; i--) {
         assert(twos[i] < sizeof(kDiskBytes62));
-        buffer[idx++] = kDiskBytes62[twos[i] ^ chksum];
+        *field++ = kDiskBytes62[twos[i] ^ chksum];
         chksum = twos[i];
     }
 
     for (i = 0; i < 256; i++) {
         assert(top[i] < sizeof(kDiskBytes62));
-        buffer[idx++] = kDiskBytes62[top[i] ^ chksum];
+        *field++ = kDiskBytes62[top[i] ^ chksum];
         chksum = top[i];
     }
 
-    //printf("Enc checksum value is 0x%02x\n", chksum);
-    buffer[idx++] = kDiskBytes62[chksum];
+    *field++ = kDiskBytes62[chksum];
 }
 
 /*
  * Decode 5&3 encoding.
+ *
+ * This is the reference implementation.  Arguments are the same as for
+ * DecodeNibble62.
  */
-DIError DiskImg::DecodeNibble53(const CircularBufferAccess& buffer, int idx,
-    uint8_t* sctBuf, const NibbleDescr* pNibbleDescr)
+/*static*/ bool DiskImg::DecodeNibble53(const uint8_t* field,
+    uint8_t* sctBuf, int* pChksum)
 {
     uint8_t base[256];
     uint8_t threes[kThreeSize];
-    int chksum = pNibbleDescr->dataChecksumSeed;
+    int chksum = *pChksum;
     uint8_t decodedVal;
     int i;
 
@@ -345,9 +665,9 @@ DIError DiskImg::DecodeNibble53(const CircularBufferAccess& buffer, int idx,
      * values, and arrange them into a DOS-like pair of buffers.
      */
     for (i = kThreeSize-1; i >= 0; i--) {
-        decodedVal = kInvDiskBytes53[buffer[idx++]];
+        decodedVal = kInvDiskBytes53[*field++];
         if (decodedVal == kInvInvalidValue)
-            return kDIErrInvalidDiskByte;
+            return false;
         assert(decodedVal < sizeof(kDiskBytes53));
 
         chksum ^= decodedVal;
@@ -355,9 +675,9 @@ DIError DiskImg::DecodeNibble53(const CircularBufferAccess& buffer, int idx,
     }
 
     for (i = 0; i < 256; i++) {
-        decodedVal = kInvDiskBytes53[buffer[idx++]];
+        decodedVal = kInvDiskBytes53[*field++];
         if (decodedVal == kInvInvalidValue)
-            return kDIErrInvalidDiskByte;
+            return false;
         assert(decodedVal < sizeof(kDiskBytes53));
 
         chksum ^= decodedVal;
@@ -365,21 +685,14 @@ DIError DiskImg::DecodeNibble53(const CircularBufferAccess& buffer, int idx,
     }
 
     /*
-     * Grab the 411th byte (the checksum byte) and see if we did this
-     * right.
+     * Grab the 411th byte (the checksum byte).
      */
-    //printf("Dec checksum value is 0x%02x\n", chksum);
-    decodedVal = kInvDiskBytes53[buffer[idx++]];
+    decodedVal = kInvDiskBytes53[*field++];
     if (decodedVal == kInvInvalidValue)
-        return kDIErrInvalidDiskByte;
+        return false;
     assert(decodedVal < sizeof(kDiskBytes53));
     chksum ^= decodedVal;
 
-    if (pNibbleDescr->dataVerifyChecksum && chksum != 0) {
-        LOGI("    NIB bad data checksum (0x%02x)", chksum);
-        return kDIErrBadChecksum;
-    }
-
     /*
      * Convert this pile of stuff into 256 data bytes.
      */
@@ -408,14 +721,61 @@ DIError DiskImg::DecodeNibble53(const CircularBufferAccess& buffer, int idx,
      */
     *bufPtr = base[255] | (threes[kThreeSize-1] & 0x07);
 
-    return kDIErrNone;
+    *pChksum = chksum;
+    return true;
+}
+
+/*
+ * Decode 5&3 encoding, in two passes.  See DecodeNibble62Table.
+ */
+/*static*/ bool DiskImg::DecodeNibble53Table(const uint8_t* field,
+    uint8_t* sctBuf, int* pChksum)
+{
+    uint8_t vals[kDataSize53];
+
+    if (!TranslateChain(field, kDataSize53, kInvDiskBytes53, vals, pChksum))
+        return false;
+
+    AssembleNibble53(vals, sctBuf);
+    return true;
+}
+
+/*
+ * Put together a 5&3 sector from the checksum chain values.  The first
+ * kThreeSize values hold the low three bits, in reverse order; the next
+ * 256 hold the high five bits.
+ */
+/*static*/ void DiskImg::AssembleNibble53(const uint8_t* vals, uint8_t* sctBuf)
+{
+    const uint8_t* base = vals + kThreeSize;
+    const uint8_t* threesEnd = vals + kThreeSize-1;     // threes[0]
+    int i;
+
+    for (i = kChunkSize53-1; i >= 0; i--) {
+        int three1, three2, three3, three4, three5;
+
+        three1 = *(threesEnd - i);
+        three2 = *(threesEnd - (kChunkSize53 + i));
+        three3 = *(threesEnd - (kChunkSize53*2 + i));
+        three4 = (three1 & 0x02) << 1 | (three2 & 0x02) | (three3 & 0x02) >> 1;
+        three5 = (three1 & 0x01) << 2 | (three2 & 0x01) << 1 | (three3 & 0x01);
+
+        sctBuf[0] = (base[i] << 3) | ((three1 >> 2) & 0x07);
+        sctBuf[1] = (base[kChunkSize53 + i] << 3) | ((three2 >> 2) & 0x07);
+        sctBuf[2] = (base[kChunkSize53*2 + i] << 3) | ((three3 >> 2) & 0x07);
+        sctBuf[3] = (base[kChunkSize53*3 + i] << 3) | (three4 & 0x07);
+        sctBuf[4] = (base[kChunkSize53*4 + i] << 3) | (three5 & 0x07);
+        sctBuf += 5;
+    }
+
+    sctBuf[0] = (base[255] << 3) | (vals[0] & 0x07);
 }
 
 /*
  * Encode 5&3 encoding.
  */
-void DiskImg::EncodeNibble53(const CircularBufferAccess& buffer, int idx,
-    const uint8_t* sctBuf, const NibbleDescr* pNibbleDescr) const
+/*static*/ void DiskImg::EncodeNibble53(uint8_t* field, const uint8_t* sctBuf,
+    int chksum)
 {
     uint8_t top[kChunkSize53 * 5 +1];     // (255 / 0xff) +1
     uint8_t threes[kChunkSize53 * 3 +1];  // (153 / 0x99) +1
@@ -462,21 +822,19 @@ void DiskImg::EncodeNibble53(const CircularBufferAccess& buffer, int idx,
     /*
      * Write the bytes.
      */
-    int chksum = pNibbleDescr->dataChecksumSeed;
     for (i = sizeof(threes)-1; i >= 0; i--) {
         assert(threes[i] < sizeof(kDiskBytes53));
-        buffer[idx++] = kDiskBytes53[threes[i] ^ chksum];
+        *field++ = kDiskBytes53[threes[i] ^ chksum];
         chksum = threes[i];
     }
 
     for (i = 0; i < 256; i++) {
         assert(top[i] < sizeof(kDiskBytes53));
-        buffer[idx++] = kDiskBytes53[top[i] ^ chksum];
+        *field++ = kDiskBytes53[top[i] ^ chksum];
         chksum = top[i];
     }
 
-    //printf("Enc checksum value is 0x%02x\n", chksum);
-    buffer[idx++] = kDiskBytes53[chksum];
+    *field++ = kDiskBytes53[chksum];
 }
 
 
@@ -546,70 +904,241 @@ void DiskImg::DumpNibbleDescr(const NibbleDescr* pNibDescr) const
 
 
 /*
- * Load a nibble track into our track buffer.
+ * Find the cache slot holding "track", reading the track from the image
+ * if it isn't already there.
+ *
+ * If the track isn't cached, it goes into an empty slot, or replaces the
+ * least-recently-used track.  A modified track is written back to the
+ * image before its slot is reused.
  */
-DIError DiskImg::LoadNibbleTrack(long track, long* pTrackLen)
+DIError DiskImg::LoadNibbleTrack(long track, NibbleTrackSlot** ppSlot)
 {
     DIError dierr = kDIErrNone;
-    long offset;
+    NibbleTrackSlot* pSlot = NULL;
+    long trackLen, offset;
+    int i;
+
     assert(track >= 0 && track < kMaxNibbleTracks525);
 
-    *pTrackLen = GetNibbleTrackLength(track);
-    offset = GetNibbleTrackOffset(track);
-    assert(*pTrackLen > 0);
-    assert(offset >= 0);
+    if (fpNibbleSlots == NULL) {
+        fpNibbleSlots = new NibbleTrackSlot[kNibbleCacheTracks];
+        if (fpNibbleSlots == NULL)
+            return kDIErrMalloc;
+        for (i = 0; i < kNibbleCacheTracks; i++) {
+            fpNibbleSlots[i].track = -1;
+            fpNibbleSlots[i].trackLen = 0;
+            fpNibbleSlots[i].trackBuf = NULL;
+            fpNibbleSlots[i].dirty = false;
+            fpNibbleSlots[i].lastUse = 0;
+            fpNibbleSlots[i].pMapDescr = NULL;
+            fpNibbleSlots[i].sectorBuf = NULL;
+        }
+    }
 
-    if (track == fNibbleTrackLoaded) {
+    for (i = 0; i < kNibbleCacheTracks; i++) {
+        if (fpNibbleSlots[i].track == track) {
 #ifdef NIB_VERBOSE_DEBUG
-        LOGI("  DI track %d already loaded", track);
+            LOGI("  DI track %d already loaded", track);
 #endif
-        return kDIErrNone;
-    } else {
-        LOGI("  DI loading track %ld", track);
+            fpNibbleSlots[i].lastUse = ++fNibbleUseCounter;
+            *ppSlot = &fpNibbleSlots[i];
+            return kDIErrNone;
+        }
+    }
+
+    /* use an empty slot if there is one, otherwise the oldest */
+    for (i = 0; i < kNibbleCacheTracks; i++) {
+        if (fpNibbleSlots[i].track < 0) {
+            pSlot = &fpNibbleSlots[i];
+            break;
+        }
+        if (pSlot == NULL || fpNibbleSlots[i].lastUse < pSlot->lastUse)
+            pSlot = &fpNibbleSlots[i];
     }
+    assert(pSlot != NULL);
+
+    if (pSlot->dirty) {
+        dierr = SaveNibbleTrack(pSlot);
+        if (dierr != kDIErrNone)
+            return dierr;
+    }
+
+    LOGD("  DI loading track %ld", track);
+
+    trackLen = GetNibbleTrackLength(track);
+    offset = GetNibbleTrackOffset(track);
+    assert(trackLen > 0);
+    assert(offset >= 0);
 
     /* invalidate in case we fail with partial read */
-    fNibbleTrackLoaded = -1;
+    pSlot->track = -1;
+    pSlot->pMapDescr = NULL;
 
     /* alloc track buffer if needed */
-    if (fNibbleTrackBuf == NULL) {
-        fNibbleTrackBuf = new uint8_t[kTrackAllocSize];
-        if (fNibbleTrackBuf == NULL)
+    if (pSlot->trackBuf == NULL) {
+        pSlot->trackBuf = new uint8_t[kTrackAllocSize];
+        if (pSlot->trackBuf == NULL)
             return kDIErrMalloc;
     }
 
     /*
      * Read the entire track into memory.
      */
-    dierr = CopyBytesOut(fNibbleTrackBuf, offset, *pTrackLen);
+    dierr = CopyBytesOut(pSlot->trackBuf, offset, trackLen);
     if (dierr != kDIErrNone)
         return dierr;
 
-    fNibbleTrackLoaded = track;
+    pSlot->track = track;
+    pSlot->trackLen = trackLen;
+    pSlot->lastUse = ++fNibbleUseCounter;
+    *ppSlot = pSlot;
 
     return dierr;
 }
 
 /*
- * Save the track buffer back to disk.
+ * Write a cached track back to the image.
  */
-DIError DiskImg::SaveNibbleTrack(void)
+DIError DiskImg::SaveNibbleTrack(NibbleTrackSlot* pSlot)
 {
-    if (fNibbleTrackLoaded < 0) {
+    if (pSlot->track < 0) {
         LOGI("ERROR: tried to save track without loading it first");
         return kDIErrInternal;
     }
-    assert(fNibbleTrackBuf != NULL);
+    assert(pSlot->trackBuf != NULL);
 
     DIError dierr = kDIErrNone;
-    long trackLen = GetNibbleTrackLength(fNibbleTrackLoaded);
-    long offset = GetNibbleTrackOffset(fNibbleTrackLoaded);
+    long trackLen = GetNibbleTrackLength(pSlot->track);
+    long offset = GetNibbleTrackOffset(pSlot->track);
 
     /* write the track to fpDataGFD */
-    dierr = CopyBytesIn(fNibbleTrackBuf, offset, trackLen);
+    dierr = CopyBytesIn(pSlot->trackBuf, offset, trackLen);
+    if (dierr != kDIErrNone)
+        return dierr;
+
+    pSlot->dirty = false;
     return dierr;
 }
 
+/*
+ * Write all modified tracks back to the image.
+ */
+DIError DiskImg::FlushNibbleTracks(void)
+{
+    DIError dierr;
+
+    if (fpNibbleSlots == NULL)
+        return kDIErrNone;
+
+    for (int i = 0; i < kNibbleCacheTracks; i++) {
+        if (fpNibbleSlots[i].dirty) {
+            dierr = SaveNibbleTrack(&fpNibbleSlots[i]);
+            if (dierr != kDIErrNone) {
+                LOGI(" DI nibble track %ld write-back failed (err=%d)",
+                    fpNibbleSlots[i].track, dierr);
+                return dierr;
+            }
+        }
+    }
+
+    return kDIErrNone;
+}
+
+/*
+ * Discard the track cache.  Call FlushNibbleTracks first, or any changes
+ * still in the cache will be lost.
+ */
+void DiskImg::FreeNibbleTracks(void)
+{
+    if (fpNibbleSlots == NULL)
+        return;
+
+    for (int i = 0; i < kNibbleCacheTracks; i++) {
+        if (fpNibbleSlots[i].dirty) {
+            LOGW(" DI discarding modified nibble track %ld",
+                fpNibbleSlots[i].track);
+        }
+        delete[] fpNibbleSlots[i].trackBuf;
+        delete[] fpNibbleSlots[i].sectorBuf;
+    }
+    delete[] fpNibbleSlots;
+    fpNibbleSlots = NULL;
+}
+
+/*
+ * Forget the sector maps and decoded sectors of all cached tracks.  Used
+ * when a NibbleDescr they were built with is changed in place.
+ */
+void DiskImg::InvalidateNibbleMaps(void)
+{
+    if (fpNibbleSlots == NULL)
+        return;
+
+    for (int i = 0; i < kNibbleCacheTracks; i++)
+        fpNibbleSlots[i].pMapDescr = NULL;
+}
+
+/*
+ * Note that a cached track has been modified.
+ *
+ * The data doesn't reach the image until the track is saved, but we set
+ * the "dirty" flags here and above right away, so a flush won't be
+ * skipped.
+ */
+void DiskImg::MarkNibbleTrackDirty(NibbleTrackSlot* pSlot)
+{
+    pSlot->dirty = true;
+
+    DiskImg* pImg = this;
+    while (pImg != NULL) {
+        pImg->fDirty = true;
+        pImg = pImg->fpParentImg;
+    }
+}
+
+/*
+ * Get the decoded contents of a sector on a cached track.
+ *
+ * The sector map is rebuilt if it was made with a different NibbleDescr,
+ * and each sector is decoded the first time it's asked for.  After that,
+ * the data and the result of the decode come from the cache.  As with
+ * DecodeNibbleData, the data is returned even when the checksum doesn't
+ * match.
+ */
+DIError DiskImg::GetNibbleSectorData(NibbleTrackSlot* pSlot, int sector,
+    const NibbleDescr* pNibbleDescr, const uint8_t** ppData)
+{
+    assert(pSlot->track >= 0);
+    assert(sector >= 0 && sector < kMaxNibbleSectors);
+
+    if (pSlot->pMapDescr != pNibbleDescr) {
+        CircularBufferAccess buffer(pSlot->trackBuf, pSlot->trackLen);
+        IndexNibbleTrack(buffer, pSlot->track, pNibbleDescr, pSlot->map);
+        pSlot->pMapDescr = pNibbleDescr;
+        memset(pSlot->sectorDecoded, 0, sizeof(pSlot->sectorDecoded));
+    }
+
+    if (pSlot->map[sector].dataIdx < 0)
+        return kDIErrSectorUnreadable;
+
+    if (pSlot->sectorBuf == NULL) {
+        pSlot->sectorBuf = new uint8_t[kMaxNibbleSectors * 256];
+        if (pSlot->sectorBuf == NULL)
+            return kDIErrMalloc;
+    }
+
+    uint8_t* sctBuf = pSlot->sectorBuf + sector * 256;
+    if (!pSlot->sectorDecoded[sector]) {
+        CircularBufferAccess buffer(pSlot->trackBuf, pSlot->trackLen);
+        pSlot->sectorStatus[sector] = DecodeNibbleData(buffer,
+            pSlot->map[sector].dataIdx, sctBuf, pNibbleDescr);
+        pSlot->sectorDecoded[sector] = true;
+    }
+
+    *ppData = sctBuf;
+    return pSlot->sectorStatus[sector];
+}
+
 
 /*
  * Count up the number of readable sectors found on this track, and
@@ -619,29 +1148,27 @@ DIError DiskImg::SaveNibbleTrack(void)
 int DiskImg::TestNibbleTrack(int track, const NibbleDescr* pNibbleDescr,
     int* pVol)
 {
-    long trackLen;
+    NibbleTrackSlot* pSlot;
     int count = 0;
 
     assert(track >= 0 && track < kTrackCount525);
     assert(pNibbleDescr != NULL);
 
-    if (LoadNibbleTrack(track, &trackLen) != kDIErrNone) {
-        LOGI("   DI FindNibbleSectorStart: LoadNibbleTrack failed");
+    if (LoadNibbleTrack(track, &pSlot) != kDIErrNone) {
+        LOGI("   DI TestNibbleTrack: LoadNibbleTrack failed");
         return 0;
     }
 
-    CircularBufferAccess buffer(fNibbleTrackBuf, trackLen);
-
-    int i, sectorIdx;
+    int i;
     for (i = 0; i < pNibbleDescr->numSectors; i++) {
-        int vol;
-        sectorIdx = FindNibbleSectorStart(buffer, track, i, pNibbleDescr, &vol);
-        if (sectorIdx >= 0) {
-            if (pVol != NULL)
-                *pVol = vol;
+        const uint8_t* sctData;
+        DIError dierr;
 
-            uint8_t sctBuf[256];
-            if (DecodeNibbleData(buffer, sectorIdx, sctBuf, pNibbleDescr) == kDIErrNone)
+        dierr = GetNibbleSectorData(pSlot, i, pNibbleDescr, &sctData);
+        if (dierr != kDIErrSectorUnreadable) {
+            if (pVol != NULL)
+                *pVol = pSlot->map[i].vol;
+            if (dierr == kDIErrNone)
                 count++;
         }
     }
@@ -652,6 +1179,21 @@ int DiskImg::TestNibbleTrack(int track, const NibbleDescr* pNibbleDescr,
     return count;
 }
 
+/*
+ * Set fNumTracks for a nibble image.
+ */
+void DiskImg::CalcNibbleNumTracks(void)
+{
+    if (fPhysical == kPhysicalFormatNib525_Var) {
+        /* TrackStar can have up to 40 */
+        fNumTracks = fpImageWrapper->GetNibbleNumTracks();
+        assert(fNumTracks > 0);
+    } else {
+        /* fixed-length formats (.nib, .nb2) are always 35 tracks */
+        fNumTracks = kTrackCount525;
+    }
+}
+
 /*
  * Analyze the nibblized track data.
  *
@@ -667,14 +1209,7 @@ DIError DiskImg::AnalyzeNibbleData(void)
 {
     assert(IsNibbleFormat(fPhysical));
 
-    if (fPhysical == kPhysicalFormatNib525_Var) {
-        /* TrackStar can have up to 40 */
-        fNumTracks = fpImageWrapper->GetNibbleNumTracks();
-        assert(fNumTracks > 0);
-    } else {
-        /* fixed-length formats (.nib, .nb2) are always 35 tracks */
-        fNumTracks = kTrackCount525;
-    }
+    CalcNibbleNumTracks();
 
     /*
      * Try to read sectors from tracks 1, 16, 17, and 26.  If we can get
@@ -723,6 +1258,28 @@ DIError DiskImg::AnalyzeNibbleData(void)
     return kDIErrNone;
 }
 
+/*
+ * Do what AnalyzeNibbleData would have done, using the NibbleDescr index
+ * and volume number it came up with last time (from the format cache).
+ * An index of -1 means no NibbleDescr matched.
+ */
+DIError DiskImg::SetCachedNibbleDescr(int idx, short dosVolumeNum)
+{
+    assert(IsNibbleFormat(fPhysical));
+    assert(idx >= -1 && idx < fNumNibbleDescrEntries);
+
+    CalcNibbleNumTracks();
+
+    if (idx < 0)
+        return kDIErrBadNibbleSectors;
+
+    fpNibbleDescr = &fpNibbleDescrTable[idx];
+    fDOSVolumeNum = dosVolumeNum;
+    LOGI("  Cached nibble format '%s' (%d-sector), vol=%d",
+        fpNibbleDescr->description, fpNibbleDescr->numSectors, dosVolumeNum);
+    return kDIErrNone;
+}
+
 /*
  * Read a sector from a nibble image.
  *
@@ -749,24 +1306,20 @@ DIError DiskImg::ReadNibbleSector(long track, int sector, void* buf,
     assert(sector >= 0 && sector < pNibbleDescr->numSectors);
 
     DIError dierr = kDIErrNone;
-    long trackLen;
-    int sectorIdx, vol;
+    NibbleTrackSlot* pSlot;
+    const uint8_t* sctData;
 
-    dierr = LoadNibbleTrack(track, &trackLen);
+    dierr = LoadNibbleTrack(track, &pSlot);
     if (dierr != kDIErrNone) {
         LOGI("   DI ReadNibbleSector: LoadNibbleTrack %ld failed", track);
         return dierr;
     }
 
-    CircularBufferAccess buffer(fNibbleTrackBuf, trackLen);
-    sectorIdx = FindNibbleSectorStart(buffer, track, sector, pNibbleDescr,
-                    &vol);
-    if (sectorIdx < 0)
-        return kDIErrSectorUnreadable;
-
-    dierr = DecodeNibbleData(buffer, sectorIdx, (uint8_t*) buf,
-                pNibbleDescr);
+    dierr = GetNibbleSectorData(pSlot, sector, pNibbleDescr, &sctData);
+    if (dierr == kDIErrSectorUnreadable || dierr == kDIErrMalloc)
+        return dierr;
 
+    memcpy(buf, sctData, 256);
     return dierr;
 }
 
@@ -783,30 +1336,34 @@ DIError DiskImg::WriteNibbleSector(long track, int sector, const void* buf,
     assert(!fReadOnly);
 
     DIError dierr = kDIErrNone;
-    long trackLen;
-    int sectorIdx, vol;
+    NibbleTrackSlot* pSlot;
+    const uint8_t* sctData;
 
-    dierr = LoadNibbleTrack(track, &trackLen);
+    dierr = LoadNibbleTrack(track, &pSlot);
     if (dierr != kDIErrNone) {
-        LOGI("   DI ReadNibbleSector: LoadNibbleTrack %ld failed", track);
+        LOGI("   DI WriteNibbleSector: LoadNibbleTrack %ld failed", track);
         return dierr;
     }
 
-    CircularBufferAccess buffer(fNibbleTrackBuf, trackLen);
-    sectorIdx = FindNibbleSectorStart(buffer, track, sector, pNibbleDescr,
-                    &vol);
-    if (sectorIdx < 0)
-        return kDIErrSectorUnreadable;
+    /* make sure the map is current; we don't care if the old data is bad */
+    dierr = GetNibbleSectorData(pSlot, sector, pNibbleDescr, &sctData);
+    if (dierr == kDIErrSectorUnreadable || dierr == kDIErrMalloc)
+        return dierr;
 
-    EncodeNibbleData(buffer, sectorIdx, (uint8_t*) buf, pNibbleDescr);
+    /*
+     * Encoding only replaces the bytes of the data field, so the map
+     * stays valid after the write.  The decoded copy is replaced with
+     * what we just wrote, which is what decoding the new field would give.
+     */
+    CircularBufferAccess buffer(pSlot->trackBuf, pSlot->trackLen);
+    EncodeNibbleData(buffer, pSlot->map[sector].dataIdx, (uint8_t*) buf,
+        pNibbleDescr);
+    memcpy(pSlot->sectorBuf + sector * 256, buf, 256);
+    pSlot->sectorStatus[sector] = kDIErrNone;
 
-    dierr = SaveNibbleTrack();
-    if (dierr != kDIErrNone) {
-        LOGI("   DI ReadNibbleSector: SaveNibbleTrack %ld failed", track);
-        return dierr;
-    }
+    MarkNibbleTrackDirty(pSlot);
 
-    return dierr;
+    return kDIErrNone;
 }
 
 /*
@@ -817,14 +1374,16 @@ DIError DiskImg::WriteNibbleSector(long track, int sector, const void* buf,
 DIError DiskImg::ReadNibbleTrack(long track, uint8_t* buf, long* pTrackLen)
 {
     DIError dierr;
+    NibbleTrackSlot* pSlot;
 
-    dierr = LoadNibbleTrack(track, pTrackLen);
+    dierr = LoadNibbleTrack(track, &pSlot);
     if (dierr != kDIErrNone) {
         LOGI("   DI ReadNibbleTrack: LoadNibbleTrack %ld failed", track);
         return dierr;
     }
 
-    memcpy(buf, fNibbleTrackBuf, *pTrackLen);
+    *pTrackLen = pSlot->trackLen;
+    memcpy(buf, pSlot->trackBuf, *pTrackLen);
     return kDIErrNone;
 }
 
@@ -838,10 +1397,10 @@ DIError DiskImg::ReadNibbleTrack(long track, uint8_t* buf, long* pTrackLen)
 DIError DiskImg::WriteNibbleTrack(long track, const uint8_t* buf, long trackLen)
 {
     DIError dierr;
-    long oldTrackLen;
+    NibbleTrackSlot* pSlot;
 
-    /* load the track to set the "current track" stuff */
-    dierr = LoadNibbleTrack(track, &oldTrackLen);
+    /* get the track into the cache; it's written back later */
+    dierr = LoadNibbleTrack(track, &pSlot);
     if (dierr != kDIErrNone) {
         LOGI("   DI WriteNibbleTrack: LoadNibbleTrack %ld failed", track);
         return dierr;
@@ -853,20 +1412,177 @@ DIError DiskImg::WriteNibbleTrack(long track, const uint8_t* buf, long trackLen)
         return kDIErrInvalidArg;
     }
 
-    if (trackLen < oldTrackLen)     // pad out any extra space
-        memset(fNibbleTrackBuf, 0xff, oldTrackLen);
-    memcpy(fNibbleTrackBuf, buf, trackLen);
+    if (trackLen < pSlot->trackLen)     // pad out any extra space
+        memset(pSlot->trackBuf, 0xff, pSlot->trackLen);
+    memcpy(pSlot->trackBuf, buf, trackLen);
     fpImageWrapper->SetNibbleTrackLength(track, trackLen);
+    pSlot->trackLen = GetNibbleTrackLength(track);
+    pSlot->pMapDescr = NULL;
 
-    dierr = SaveNibbleTrack();
-    if (dierr != kDIErrNone) {
-        LOGI("   DI ReadNibbleSector: SaveNibbleTrack %ld failed", track);
-        return dierr;
-    }
+    MarkNibbleTrackDirty(pSlot);
 
     return kDIErrNone;
 }
 
+/*
+ * State shared by the track decoding threads.
+ */
+typedef struct NibbleDecodeWork {
+    DiskImg*    pImg;
+    const DiskImg::NibbleDescr* pNibbleDescr;
+    int         numTracks;
+    int         slotIdx[kMaxNibbleTracks525];   // cache slot for each track
+
+    DIMutex     lock;       // guards "next"
+    int         next;       // next track to hand out
+} NibbleDecodeWork;
+
+/*
+ * Track decoding thread.  Pulls tracks off the list and decodes all of
+ * their sectors into the track cache.  Each track has its own cache slot,
+ * so the list is all the threads share.
+ */
+/*static*/ void DiskImg::NibbleDecodeWorker(void* vwork)
+{
+    NibbleDecodeWork* pWork = (NibbleDecodeWork*) vwork;
+    DiskImg* pImg = pWork->pImg;
+
+    while (true) {
+        int track;
+
+        pWork->lock.Lock();
+        track = pWork->next;
+        if (track < pWork->numTracks)
+            pWork->next++;
+        pWork->lock.Unlock();
+        if (track >= pWork->numTracks)
+            break;
+
+        NibbleTrackSlot* pSlot = &pImg->fpNibbleSlots[pWork->slotIdx[track]];
+        for (int sector = 0; sector < pWork->pNibbleDescr->numSectors;
+            sector++)
+        {
+            const uint8_t* sctData;
+            (void) pImg->GetNibbleSectorData(pSlot, sector,
+                pWork->pNibbleDescr, &sctData);
+        }
+    }
+}
+
+/*
+ * Decode every sector on a 5.25" nibble image into "buf", spreading the
+ * tracks across "numThreads" threads (0 means one per processor).
+ *
+ * The sectors come out in the order ReadTrackSector would return them,
+ * GetNumSectPerTrack() per track, so "buf" must hold GetNumTracks() *
+ * GetNumSectPerTrack() * kSectorSize bytes.  Sectors that can't be read
+ * are zero-filled and counted in "*pNumBad".  If "sectorErrs" isn't NULL,
+ * it gets the result of reading each sector.
+ *
+ * The tracks are read from the image on the calling thread, so only the
+ * decoding happens in parallel.  The decoded data stays in the track
+ * cache, so reading sectors afterward is cheap.
+ *
+ * Returns an error only if the image itself couldn't be read.
+ */
+DIError DiskImg::DecodeNibbleTracks(uint8_t* buf, long bufLen,
+    DIError* sectorErrs, int* pNumBad, int numThreads)
+{
+    DIError dierr = kDIErrNone;
+    NibbleDecodeWork* pWork = NULL;
+    int numBad = 0;
+    int track, sector;
+
+    if (!IsNibbleFormat(fPhysical) || !fHasSectors)
+        return kDIErrUnsupportedAccess;
+    if (bufLen < (long) fNumTracks * fNumSectPerTrack * kSectorSize)
+        return kDIErrInvalidArg;
+    assert(fNumTracks <= kNibbleCacheTracks);
+
+    pWork = new NibbleDecodeWork;
+    if (pWork == NULL)
+        return kDIErrMalloc;
+
+    if (fpNibbleDescr != NULL) {
+        /*
+         * Get all tracks into the cache.  There's room for all of them,
+         * so nothing we load here gets pushed out.
+         */
+        for (track = 0; track < fNumTracks; track++) {
+            NibbleTrackSlot* pSlot;
+
+            dierr = LoadNibbleTrack(track, &pSlot);
+            if (dierr != kDIErrNone) {
+                LOGI("   DI DecodeNibbleTracks: LoadNibbleTrack %d failed",
+                    track);
+                goto bail;
+            }
+            pWork->slotIdx[track] = (int) (pSlot - fpNibbleSlots);
+        }
+
+        if (numThreads <= 0)
+            numThreads = DIWorkerGroup::GetProcessorCount();
+        if (numThreads > fNumTracks)
+            numThreads = (int) fNumTracks;
+
+        pWork->pImg = this;
+        pWork->pNibbleDescr = fpNibbleDescr;
+        pWork->numTracks = (int) fNumTracks;
+        pWork->next = 0;
+
+        LOGD(" DI decoding %ld nibble tracks with %d threads", fNumTracks,
+            numThreads);
+        DIWorkerGroup::Run(numThreads, NibbleDecodeWorker, pWork);
+    }
+
+    /*
+     * Gather up the sectors, applying the same sector ordering that
+     * ReadTrackSector does.  Everything has been decoded, so this just
+     * copies data out of the cache.
+     */
+    for (track = 0; track < fNumTracks; track++) {
+        for (sector = 0; sector < fNumSectPerTrack; sector++) {
+            uint8_t* sctBuf = buf +
+                ((long) track * fNumSectPerTrack + sector) * kSectorSize;
+            const uint8_t* sctData;
+            di_off_t offset;
+            int newSector = -1;
+            DIError sctErr;
+
+            sctErr = CalcSectorAndOffset(track, sector, fOrder,
+                        fFileSysOrder, &offset, &newSector);
+            if (sctErr != kDIErrNone) {
+                /* shouldn't happen */
+            } else if (fpNibbleDescr == NULL) {
+                sctErr = kDIErrBadNibbleSectors;
+            } else if (newSector >= fpNibbleDescr->numSectors) {
+                sctErr = kDIErrInvalidSector;
+            } else {
+                NibbleTrackSlot* pSlot =
+                    &fpNibbleSlots[pWork->slotIdx[track]];
+                sctErr = GetNibbleSectorData(pSlot, newSector,
+                            fpNibbleDescr, &sctData);
+                if (sctErr == kDIErrNone)
+                    memcpy(sctBuf, sctData, kSectorSize);
+            }
+
+            if (sctErr != kDIErrNone) {
+                memset(sctBuf, 0, kSectorSize);
+                numBad++;
+            }
+            if (sectorErrs != NULL)
+                sectorErrs[track * fNumSectPerTrack + sector] = sctErr;
+        }
+    }
+
+    if (pNumBad != NULL)
+        *pNumBad = numBad;
+
+bail:
+    delete pWork;
+    return dierr;
+}
+
 /*
  * Create a blank nibble image, using fpNibbleDescr as the template.
  * Sets "fLength".
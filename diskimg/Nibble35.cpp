@@ -17,6 +17,7 @@
  * interface for the nibble track viewer.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagNibble
 #include "DiskImgPriv.h"
 
 /*
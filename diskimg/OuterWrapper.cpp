@@ -13,6 +13,7 @@
  * written to disk.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagWrapper
 #include "DiskImgPriv.h"
 #define DEF_MEM_LEVEL 8     // normally in zutil.h
 
@@ -216,8 +217,53 @@ bail:
     return dierr;
 }
 
+/*
+ * Get the uncompressed length from the gzip trailer.
+ *
+ * The trailer only has the length (mod 2^32) of the last member, and
+ * we may be looking at junk tacked onto the end of the file, so we
+ * don't believe it unless it's in a plausible range for the amount of
+ * compressed data we have.  Deflate can't expand data by more than a
+ * sliver, and can't do better than about 1032:1.
+ */
+/*static*/ DIError OuterGzip::GetTrailerLength(GenericFD* pGFD,
+    di_off_t outerLength, di_off_t* pLength)
+{
+    DIError dierr;
+    uint8_t buf[4];
+    di_off_t length;
+
+    if (outerLength < 18)       // 10-byte header, 8-byte trailer
+        return kDIErrGeneric;
+
+    dierr = pGFD->Seek(outerLength - 4, kSeekSet);
+    if (dierr != kDIErrNone)
+        return dierr;
+    dierr = pGFD->Read(buf, 4);
+    if (dierr != kDIErrNone)
+        return dierr;
+    length = GetLongLE(buf);
+
+    if (length < 512 || length > kMaxUncompressedSize ||
+        outerLength > length + length / 256 + 64 ||
+        length / 1032 > outerLength)
+    {
+        LOGI("  GZ trailer length %ld doesn't look right (outer=%ld)",
+            (long) length, (long) outerLength);
+        return kDIErrGeneric;
+    }
+
+    *pLength = length;
+    return kDIErrNone;
+}
+
 /*
  * Open the archive, and extract the disk image into a memory buffer.
+ *
+ * Large images opened read-only are inflated on demand instead, so that
+ * we don't have to unpack (or find room for) 32MB of data just to look
+ * at the volume directory.  Floppy images are small, and get poked at
+ * all over during format analysis, so we just unpack those.
  */
 DIError OuterGzip::Load(GenericFD* pOuterGFD, di_off_t outerLength, bool readOnly,
     di_off_t* pWrapperLength, GenericFD** ppWrapperGFD)
@@ -235,6 +281,25 @@ DIError OuterGzip::Load(GenericFD* pOuterGFD, di_off_t outerLength, bool readOnl
         return kDIErrNotSupported;
     }
 
+    if (readOnly &&
+        GetTrailerLength(pOuterGFD, outerLength, &length) == kDIErrNone &&
+        length >= kMinStreamedSize)
+    {
+        GFDInflate* pInflateGFD = new GFDInflate;
+        if (pInflateGFD == NULL)
+            return kDIErrMalloc;
+        dierr = pInflateGFD->Open(pOuterGFD, 0, outerLength, true, length);
+        if (dierr != kDIErrNone) {
+            delete pInflateGFD;
+            return dierr;
+        }
+
+        LOGI("  GZ streaming %ld bytes", (long) length);
+        *ppWrapperGFD = pInflateGFD;
+        *pWrapperLength = length;
+        return kDIErrNone;
+    }
+
     gzfp = gzopen(imagePath, "rb");        // use "readOnly" here
     if (gzfp == NULL) { // DON'T retry RO -- should be done at higher level?
         LOGI("gzopen failed, errno=%d", errno);
@@ -403,6 +468,9 @@ bail:
 
 /*
  * Open the archive, and extract the disk image into a memory buffer.
+ *
+ * As with gzip, large deflated images opened read-only are inflated on
+ * demand instead.
  */
 DIError OuterZip::Load(GenericFD* pOuterGFD, di_off_t outerLength, bool readOnly,
     di_off_t* pWrapperLength, GenericFD** ppWrapperGFD)
@@ -430,6 +498,15 @@ DIError OuterZip::Load(GenericFD* pOuterGFD, di_off_t outerLength, bool readOnly
         SetStoredFileName((const char*) cde.fFileName);
     }
 
+    if (readOnly && cde.fCompressionMethod == kCompressDeflated &&
+        cde.fUncompressedSize >= kMinStreamedSize)
+    {
+        dierr = OpenStreamedEntry(pOuterGFD, &cde, ppWrapperGFD);
+        if (dierr == kDIErrNone)
+            *pWrapperLength = cde.fUncompressedSize;
+        goto bail;
+    }
+
     dierr = ExtractZipEntry(pOuterGFD, &cde, &buf, &length);
     if (dierr != kDIErrNone)
         goto bail;
@@ -830,6 +907,48 @@ bail:
     return dierr;
 }
 
+/*
+ * Create a GFD that inflates the entry on demand.  The CRC can't be
+ * checked until somebody has read all the way through.
+ */
+DIError OuterZip::OpenStreamedEntry(GenericFD* pOuterGFD, CentralDirEntry* pCDE,
+    GenericFD** ppWrapperGFD)
+{
+    DIError dierr = kDIErrNone;
+    LocalFileHeader lfh;
+    GFDInflate* pNewGFD = NULL;
+    di_off_t dataOffset;
+
+    /* skip past the local header, as in ExtractZipEntry */
+    dierr = pOuterGFD->Seek(pCDE->fLocalHeaderRelOffset, kSeekSet);
+    if (dierr != kDIErrNone)
+        goto bail;
+    dierr = lfh.Read(pOuterGFD);
+    if (dierr != kDIErrNone)
+        goto bail;
+    dataOffset = pOuterGFD->Tell();
+
+    pNewGFD = new GFDInflate;
+    if (pNewGFD == NULL) {
+        dierr = kDIErrMalloc;
+        goto bail;
+    }
+    dierr = pNewGFD->Open(pOuterGFD, dataOffset, pCDE->fCompressedSize,
+                false, pCDE->fUncompressedSize);
+    if (dierr != kDIErrNone)
+        goto bail;
+    pNewGFD->SetExpectedCRC(pCDE->fCRC32);
+
+    LOGI("  ZIP streaming %u bytes from +%ld", pCDE->fUncompressedSize,
+        (long) dataOffset);
+    *ppWrapperGFD = pNewGFD;
+    pNewGFD = NULL;
+
+bail:
+    delete pNewGFD;
+    return dierr;
+}
+
 /*
  * Uncompress data from "pOuterGFD" to "buf".
  *
@@ -965,13 +1084,16 @@ void OuterZip::DOSTime(time_t when, uint16_t* pDate, uint16_t* pTime)
 
     *pDate = *pTime = 0;
 
+    struct tm tmWhen;
     struct tm* ptm;
 
     /* round up to an even number of seconds */
     even = (time_t)(((unsigned long)(when) + 1) & (~1));
 
     /* expand */
-    ptm = localtime(&even);
+    ptm = LocalTimeR(&even, &tmWhen);
+    if (ptm == NULL)
+        return;
 
     int year;
     year = ptm->tm_year;
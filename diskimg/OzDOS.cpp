@@ -11,6 +11,7 @@
  * but unfortunately that's not going to happen.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
@@ -294,7 +295,7 @@ DIError DiskFSOzDOS::OpenSubVolume(int idx)
     }
 
     /* load the files from the sub-image */
-    dierr = pNewFS->Initialize(pNewImg, kInitFull);
+    dierr = pNewFS->Initialize(pNewImg, GetSubVolumeInitMode());
     if (dierr != kDIErrNone) {
         LOGE(" OzSub: error %d reading list of files from disk", dierr);
         goto bail;
@@ -9,6 +9,7 @@
  * Currently each file may only be open once.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
@@ -93,7 +94,7 @@ bail:
  * on out must be handled somehow, possibly by claiming that the disk is
  * completely full and has no files on it.
  */
-DIError DiskFSPascal::Initialize(void)
+DIError DiskFSPascal::Initialize(InitMode initMode)
 {
     DIError dierr = kDIErrNone;
 
@@ -107,10 +108,20 @@ DIError DiskFSPascal::Initialize(void)
         goto bail;
     DumpVolHeader();
 
+    /*
+     * The catalog doubles as the allocation map -- files are contiguous,
+     * and the gaps between them are the free space -- so we need it even
+     * for a header-only scan.  It's only a few blocks long.
+     */
     dierr = ProcessCatalog();
     if (dierr != kDIErrNone)
         goto bail;
 
+    if (initMode == kInitHeaderOnly) {
+        LOGI(" Pascal - headerOnly set, skipping usage scan");
+        goto bail;
+    }
+
     dierr = ScanFileUsage();
     if (dierr != kDIErrNone) {
         /* this might not be fatal; just means that *some* files are bad */
@@ -214,8 +225,9 @@ void DiskFSPascal::DumpVolHeader(void)
 
     access = A2FilePascal::ConvertPascalDate(fAccessWhen);
     dateSet = A2FilePascal::ConvertPascalDate(fDateSetWhen);
-    LOGI("   -->access %.24s", ctime(&access));
-    LOGI("   -->dateSet %.24s", ctime(&dateSet));
+    char timeBuf[kCTimeBufLen];
+    LOGI("   -->access %.24s", CTimeR(&access, timeBuf));
+    LOGI("   -->dateSet %.24s", CTimeR(&dateSet, timeBuf));
 
     //LOGI("Unconvert access=0x%04x dateSet=0x%04x",
     //  A2FilePascal::ConvertPascalDate(access),
@@ -1258,6 +1270,7 @@ DIError DiskFSPascal::RenameFile(A2File* pGenericFile, const char* newName)
     pEntry[0x06] = (uint8_t)strlen(normalName);
     memcpy(&pEntry[0x07], normalName, A2FilePascal::kMaxFileName);
     strcpy(pFile->fFileName, normalName);
+    InvalidateFileIndex();
 
     dierr = SaveCatalog();
     if (dierr != kDIErrNone)
@@ -1494,12 +1507,13 @@ uint32_t A2FilePascal::GetFileType(void) const
 /*static*/ A2FilePascal::PascalDate A2FilePascal::ConvertPascalDate(time_t unixDate)
 {
     uint32_t date, year;
+    struct tm tmWhen;
     struct tm* ptm;
 
     if (unixDate == 0 || unixDate == -1 || unixDate == -2)
         return 0;
 
-    ptm = localtime(&unixDate);
+    ptm = LocalTimeR(&unixDate, &tmWhen);
     if (ptm == NULL)
         return 0;       // must've been invalid or unspecified
 
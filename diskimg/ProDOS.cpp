@@ -12,6 +12,7 @@
  * BUG: does not keep VolumeUsage up to date.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 // disable Y2K+ dates when testing w/ProSel-16 vol rep (newer ProSel is OK)
@@ -169,12 +170,35 @@ DIError DiskFSProDOS::Initialize(InitMode initMode)
     A2FileProDOS* pVolumeDir;
     pVolumeDir = (A2FileProDOS*) GetNextFile(NULL);
 
+    fLazyDirs = (initMode == kInitLazy);
     dierr = RecursiveDirAdd(pVolumeDir, kVolHeaderBlock, "", 0);
     if (dierr != kDIErrNone) {
         LOGI(" ProDOS RecursiveDirAdd failed");
         goto bail;
     }
 
+    if (fLazyDirs) {
+        LOGI(" ProDOS - lazy init, deferring subdirs and usage scan");
+        SetLazyLoadPending();
+        goto bail;
+    }
+
+    dierr = ScanVolumeUsage();
+
+bail:
+    return dierr;
+}
+
+/*
+ * Build the volume usage map, decide whether the disk is good enough to
+ * write to, and look for embedded sub-volumes.  Every directory must have
+ * been read.
+ */
+DIError DiskFSProDOS::ScanVolumeUsage(void)
+{
+    DIError dierr;
+    char msg[kMaxVolumeName + 32];
+
     sprintf(msg, "Processing %s", fVolumeName);
     if (!fpImg->UpdateScanProgress(msg)) {
         LOGI(" ProDOS cancelled by user");
@@ -440,8 +464,9 @@ void DiskFSProDOS::DumpVolHeader(void)
         fCreateWhen, fAccess, fBitMapPointer, fTotalBlocks);
 
     time_t when;
+    char timeBuf[kCTimeBufLen];
     when = A2FileProDOS::ConvertProDate(fCreateWhen);
-    LOGI("  CreateWhen is %.24s", ctime(&when));
+    LOGI("  CreateWhen is %.24s", CTimeR(&when, timeBuf));
 
     //LOGI("  prev=%d next=%d bitmap=%d total=%d",
     //  fPrevBlock, fNextBlock, fBitMapPointer, fTotalBlocks);
@@ -950,17 +975,35 @@ DIError DiskFSProDOS::SlurpEntries(A2File* pParent, const DirHeader* pHeader,
             }
         }
 
+        /*
+         * The usage scan works out the sparse lengths.  A lazy load puts
+         * that off, so use the full lengths until then.
+         */
+        if (fLazyDirs && pFile->GetQuality() != A2File::kQualityDamaged) {
+            if (pEntry->storageType == A2FileProDOS::kStorageExtended) {
+                pFile->fSparseDataEof = pFile->fExtData.eof;
+                pFile->fSparseRsrcEof = pFile->fExtRsrc.eof;
+            } else {
+                pFile->fSparseDataEof = pEntry->eof;
+            }
+        }
+
         //pFile->Dump();
         AddFileToList(pFile);
         (*pCount)++;
 
-        if (!fpImg->UpdateScanProgress(NULL)) {
+        /* lazy loads read a whole directory or nothing */
+        if (!fpImg->UpdateScanProgress(NULL) && !fLazyDirs) {
             LOGI(" ProDOS cancelled by user");
             dierr = kDIErrCancelled;
             goto bail;
         }
 
-        if (pEntry->storageType == A2FileProDOS::kStorageDirectory) {
+        if (pEntry->storageType == A2FileProDOS::kStorageDirectory &&
+            fLazyDirs)
+        {
+            SetDirPending(pFile);
+        } else if (pEntry->storageType == A2FileProDOS::kStorageDirectory) {
             // don't need to check for kStorageVolumeDirHeader here
             dierr = RecursiveDirAdd(pFile, pEntry->keyPointer,
                         pFile->GetPathName(), depth+1);
@@ -979,6 +1022,34 @@ bail:
     return dierr;
 }
 
+/*
+ * Read the entries of a subdirectory that was skipped by a lazy
+ * Initialize.  Its own subdirs are marked pending in turn.
+ */
+DIError DiskFSProDOS::LoadDirectory(A2File* pDir)
+{
+    A2FileProDOS* pFile = (A2FileProDOS*) pDir;
+    int depth = 0;
+
+    for (A2File* pParent = pDir->GetParent(); pParent != NULL;
+        pParent = pParent->GetParent())
+    {
+        depth++;
+    }
+
+    return RecursiveDirAdd(pFile, pFile->fDirEntry.keyPointer,
+                pFile->GetPathName(), depth);
+}
+
+/*
+ * Every directory has been read; do the volume-wide scans that a lazy
+ * Initialize skipped.
+ */
+DIError DiskFSProDOS::FinishLazyLoad(void)
+{
+    return ScanVolumeUsage();
+}
+
 /*
  * Pull the directory header out of the first block of a directory.
  */
@@ -1076,10 +1147,16 @@ DIError DiskFSProDOS::ScanFileUsage(void)
     uint16_t* blockList = NULL;
     uint16_t* indexList = NULL;
 
-    pFile = (A2FileProDOS*) GetNextFile(NULL);
+    /* pick up where we left off if a lazy analysis was cancelled */
+    if (fpUsageScanResume != NULL)
+        pFile = fpUsageScanResume;
+    else
+        pFile = (A2FileProDOS*) GetNextFile(NULL);
+    fpUsageScanResume = NULL;
     while (pFile != NULL) {
         if (!fpImg->UpdateScanProgress(NULL)) {
             LOGI(" ProDOS cancelled by user");
+            fpUsageScanResume = pFile;
             dierr = kDIErrCancelled;
             goto bail;
         }
@@ -1799,6 +1876,7 @@ DIError DiskFSProDOS::CreateFile(const CreateParms* pParms, A2File** ppNewFile)
 
     if (fpImg->GetReadOnly())
         return kDIErrAccessDenied;
+    (void) CompleteLazyLoad();
     if (!fDiskIsGood)
         return kDIErrBadDiskImage;
 
@@ -2173,23 +2251,36 @@ bail:
 }
 
 /*
- * Run through the DiskFS file list, looking for an entry with a matching
- * key block.
+ * Find the file in directory "pStart" with a matching key block.
+ *
+ * We ask the file index first.  If it can't help, run through the files
+ * in the directory.
  */
 A2File* DiskFSProDOS::FindFileByKeyBlock(A2File* pStart, uint16_t keyBlock)
 {
-    while (pStart != NULL) {
-        A2FileProDOS* pPro = (A2FileProDOS*) pStart;
+    A2File* pFile = GetFileByIndexKey(keyBlock, pStart);
+    if (pFile != NULL)
+        return pFile;
 
-        if (pPro->fDirEntry.keyPointer == keyBlock)
-            return pStart;
+    long numChildren = GetChildCount(pStart);
+    for (long idx = 0; idx < numChildren; idx++) {
+        A2FileProDOS* pPro = (A2FileProDOS*) GetChild(pStart, idx);
 
-        pStart = GetNextFile(pStart);
+        if (pPro->fDirEntry.keyPointer == keyBlock)
+            return pPro;
     }
 
     return NULL;
 }
 
+/*
+ * Files are indexed by key block, for FindFileByKeyBlock.
+ */
+long DiskFSProDOS::GetFileIndexKey(const A2File* pFile) const
+{
+    return ((const A2FileProDOS*) pFile)->fDirEntry.keyPointer;
+}
+
 /*
  * Allocate the initial storage (key blocks, directory header) for a new file.
  *
@@ -3165,6 +3256,7 @@ DIError DiskFSProDOS::DeleteFile(A2File* pGenericFile)
 
     if (fpImg->GetReadOnly())
         return kDIErrAccessDenied;
+    (void) CompleteLazyLoad();
     if (!fDiskIsGood)
         return kDIErrBadDiskImage;
     if (pGenericFile->IsFileOpen())
@@ -3422,6 +3514,7 @@ DIError DiskFSProDOS::RenameFile(A2File* pGenericFile, const char* newName)
         return kDIErrInvalidArg;
     if (fpImg->GetReadOnly())
         return kDIErrAccessDenied;
+    (void) CompleteLazyLoad();
     if (!fDiskIsGood)
         return kDIErrBadDiskImage;
 
@@ -3563,15 +3656,19 @@ DIError DiskFSProDOS::RenameFile(A2File* pGenericFile, const char* newName)
     assert(pFile->fDirEntry.fileName[A2FileProDOS::kMaxFileName] == '\0');
 
     if (pFile->IsDirectory()) {
-        /* do all files that come after us */
+        /* do us and everything inside us */
+        A2File* pLast = SkipSubdir(pFile);
         pCur = pFile;
-        while (pCur != NULL) {
+        while (true) {
             RegeneratePathName((A2FileProDOS*) pCur);
+            if (pCur == pLast)
+                break;
             pCur = GetNextFile(pCur);
         }
     } else {
         RegeneratePathName(pFile);
     }
+    InvalidateFileIndex();
 
     LOGI("Okay!");
 
@@ -3801,6 +3898,7 @@ DIError DiskFSProDOS::RenameVolume(const char* newName)
 
     /* update the entry in the linear file list */
     pFile->SetPathName(":", fVolumeName);
+    InvalidateFileIndex();
 
 bail:
     return dierr;
@@ -3872,13 +3970,14 @@ bail:
 {
     ProDate proDate;
     uint32_t prodosDate, prodosTime;
+    struct tm tmWhen;
     struct tm* ptm;
     int year;
 
     if (unixDate == 0 || unixDate == -1 || unixDate == -2)
         return 0;
 
-    ptm = localtime(&unixDate);
+    ptm = LocalTimeR(&unixDate, &tmWhen);
     if (ptm == NULL)
         return 0;       // must've been invalid or unspecified
 
@@ -4450,7 +4549,9 @@ DIError A2FDProDOS::Read(void* buf, size_t len, size_t* pActual)
     long incrLen = len;
 
     DIError dierr = kDIErrNone;
+    DiskImg* pDiskImg = fpFile->GetDiskFS()->GetDiskImg();
     uint8_t blkBuf[kBlkSize];
+    const uint8_t* blkPtr;
     long blockIndex = (long) (fOffset / kBlkSize);
     int bufOffset = (int) (fOffset % kBlkSize);     // (& 0x01ff)
     size_t thisCount;
@@ -4469,21 +4570,27 @@ DIError A2FDProDOS::Read(void* buf, size_t len, size_t* pActual)
         if (fBlockList[blockIndex] == 0) {
             //LOGI(" ProDOS sparse index %d", blockIndex);
             memset(blkBuf, 0, sizeof(blkBuf));
+            blkPtr = blkBuf;
         } else {
             //LOGI(" ProDOS non-sparse index %d", blockIndex);
-            dierr = fpFile->GetDiskFS()->GetDiskImg()->ReadBlock(fBlockList[blockIndex],
-                        blkBuf);
-            if (dierr != kDIErrNone) {
-                LOGI(" ProDOS error reading block [%ld]=%d of '%s'",
-                    blockIndex, fBlockList[blockIndex], fpFile->GetPathName());
-                return dierr;
+            /* copy straight out of the image if we can */
+            blkPtr = pDiskImg->BorrowBlock(fBlockList[blockIndex]);
+            if (blkPtr == NULL) {
+                dierr = pDiskImg->ReadBlock(fBlockList[blockIndex], blkBuf);
+                if (dierr != kDIErrNone) {
+                    LOGI(" ProDOS error reading block [%ld]=%d of '%s'",
+                        blockIndex, fBlockList[blockIndex],
+                        fpFile->GetPathName());
+                    return dierr;
+                }
+                blkPtr = blkBuf;
             }
         }
         thisCount = kBlkSize - bufOffset;
         if (thisCount > len)
             thisCount = len;
 
-        memcpy(buf, blkBuf + bufOffset, thisCount);
+        memcpy(buf, blkPtr + bufOffset, thisCount);
         len -= thisCount;
         buf = (char*)buf + thisCount;
 
@@ -7,6 +7,7 @@
  * Implementation of DiskFSRDOS class.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
@@ -254,7 +255,7 @@ bail:
  * on out must be handled somehow, possibly by claiming that the disk is
  * completely full and has no files on it.
  */
-DIError DiskFSRDOS::Initialize(void)
+DIError DiskFSRDOS::Initialize(InitMode initMode)
 {
     DIError dierr = kDIErrNone;
     const char* volStr;
@@ -279,6 +280,12 @@ DIError DiskFSRDOS::Initialize(void)
     assert(strlen(volStr) < sizeof(fVolumeName));
     strcpy(fVolumeName, volStr);
 
+    /* the volume name is fixed, and we don't report free space */
+    if (initMode == kInitHeaderOnly) {
+        LOGI(" RDOS - headerOnly set, skipping file load");
+        goto bail;
+    }
+
     dierr = ReadCatalog();
     if (dierr != kDIErrNone)
         goto bail;
@@ -22,12 +22,15 @@
 #include <sys/time.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define O_BINARY 0
 
 #define HAVE_VSNPRINTF
 #define HAVE_FSEEKO
 #define HAVE_FTRUNCATE
+#define HAVE_MMAP
 
 // gcc wants special compile options; just ignore this for now
 #define override
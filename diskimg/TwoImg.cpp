@@ -10,6 +10,7 @@
  * to hook into private DiskImg state.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagWrapper
 #include "TwoImg.h"
 #include "DiskImgPriv.h"
 
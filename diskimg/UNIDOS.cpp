@@ -15,6 +15,7 @@
  * is still in a state where it believes it has 16 sectors per track.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
@@ -333,7 +334,7 @@ DIError DiskFSUNIDOS::OpenSubVolume(int idx)
     }
 
     /* load the files from the sub-image */
-    dierr = pNewFS->Initialize(pNewImg, kInitFull);
+    dierr = pNewFS->Initialize(pNewImg, GetSubVolumeInitMode());
     if (dierr != kDIErrNone) {
         LOGE(" UNISub: error %d reading list of files from disk", dierr);
         goto bail;
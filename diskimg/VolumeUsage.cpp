@@ -7,6 +7,7 @@
  * Support for the VolumeUsage sub-class in DiskFS.
  */
 #include "StdAfx.h"
+#define DLOG_TAG Global::kLogTagFS
 #include "DiskImgPriv.h"
 
 
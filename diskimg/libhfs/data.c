@@ -30,6 +30,11 @@
 #  include <sys/time.h>
 # endif
 
+# ifndef _WIN32
+#  include <pthread.h>
+#  define TZDIFF_ONCE
+# endif
+
 # include "data.h"
 
 # define TIMEDIFF  2082844800UL
@@ -37,6 +42,11 @@
 static
 time_t tzdiff = -1;
 
+# ifdef TZDIFF_ONCE
+static
+pthread_once_t tzdiffonce = PTHREAD_ONCE_INIT;
+# endif
+
 const
 unsigned char hfs_charorder[256] = {
   0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
@@ -435,18 +445,19 @@ void calctzdiff(void)
 # ifdef HAVE_MKTIME
 
   time_t t;
-  int isdst;
-  struct tm tm;
-  const struct tm *tmp;
+  struct tm ltm, tm;
+  int ok;
 
   time(&t);
-  isdst = localtime(&t)->tm_isdst;
+# ifdef _WIN32
+  ok = (localtime_s(&ltm, &t) == 0 && gmtime_s(&tm, &t) == 0);
+# else
+  ok = (localtime_r(&t, &ltm) != 0 && gmtime_r(&t, &tm) != 0);
+# endif
 
-  tmp = gmtime(&t);
-  if (tmp)
+  if (ok)
     {
-      tm = *tmp;
-      tm.tm_isdst = isdst;
+      tm.tm_isdst = ltm.tm_isdst;
 
       tzdiff = t - mktime(&tm);
     }
@@ -461,15 +472,30 @@ void calctzdiff(void)
 }
 
 /*
- * NAME:	data->ltime()
- * DESCRIPTION:	convert MacOS time to local time
+ * NAME:	gettzdiff()
+ * DESCRIPTION:	return the timezone difference, calculating it on first use
  */
-time_t d_ltime(unsigned long mtime)
+static
+time_t gettzdiff(void)
 {
+  /* volumes can be opened on several threads at once */
+# ifdef TZDIFF_ONCE
+  pthread_once(&tzdiffonce, calctzdiff);
+# else
   if (tzdiff == -1)
     calctzdiff();
+# endif
+
+  return tzdiff;
+}
 
-  return (time_t) (mtime - TIMEDIFF) - tzdiff;
+/*
+ * NAME:	data->ltime()
+ * DESCRIPTION:	convert MacOS time to local time
+ */
+time_t d_ltime(unsigned long mtime)
+{
+  return (time_t) (mtime - TIMEDIFF) - gettzdiff();
 }
 
 /*
@@ -478,8 +504,5 @@ time_t d_ltime(unsigned long mtime)
  */
 unsigned long d_mtime(time_t ltime)
 {
-  if (tzdiff == -1)
-    calctzdiff();
-
-  return (unsigned long) (ltime + tzdiff) + TIMEDIFF;
+  return (unsigned long) (ltime + gettzdiff()) + TIMEDIFF;
 }
@@ -40,7 +40,7 @@
 # include "record.h"
 # include "volume.h"
 
-/* should be CP_NO_STATIC, but it's harmless (albeit useless with MT) */
+HFS_THREAD_LOCAL
 const char *hfs_error = "no error";	/* static error string */
 
 #ifdef CP_NO_STATIC
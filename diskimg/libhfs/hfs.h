@@ -118,7 +118,14 @@ typedef struct {
 # define HFS_FNDR_ISINVISIBLE		(1 << 14)
 # define HFS_FNDR_ISALIAS		(1 << 15)
 
-extern const char *hfs_error;
+/* per-thread, so concurrent volumes don't trample each other's errors */
+# if defined(_MSC_VER)
+#  define HFS_THREAD_LOCAL __declspec(thread)
+# else
+#  define HFS_THREAD_LOCAL __thread
+# endif
+
+extern HFS_THREAD_LOCAL const char *hfs_error;
 extern const unsigned char hfs_charorder[];
 
 # define HFS_MODE_RDONLY	0
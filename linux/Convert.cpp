@@ -64,6 +64,9 @@ Convert(const char* infile, const char* outfile)
     DIError dierr = kDIErrNone;
     DiskImg srcImg, dstImg;
     const char* storageName = nil;
+    unsigned char* nibSectors = nil;
+    DIError* nibErrs = nil;
+    int srcSectPerTrack;
 
     printf("Converting in='%s' out='%s'\n", infile, outfile);
 
@@ -376,6 +379,29 @@ Convert(const char* infile, const char* outfile)
         goto bail;
     }
 
+    /*
+     * Nibble images are decoded all at once, on all available cores,
+     * into a flat sector image in ProDOS order.  Unreadable sectors come
+     * back zeroed, with their errors in "nibErrs".
+     */
+    srcSectPerTrack = srcImg.GetNumSectPerTrack();
+    if (DiskImg::IsNibbleFormat(srcImg.GetPhysicalFormat())) {
+        long nibLen = srcImg.GetNumTracks() * srcSectPerTrack * 256;
+        int numBad = 0;
+
+        nibSectors = new unsigned char[nibLen];
+        nibErrs = new DIError[srcImg.GetNumTracks() * srcSectPerTrack];
+        dierr = srcImg.DecodeNibbleTracks(nibSectors, nibLen, nibErrs,
+                    &numBad);
+        if (dierr != kDIErrNone) {
+            fprintf(stderr, "ERROR: DecodeNibbleTracks failed (err=%d)\n",
+                dierr);
+            goto bail;
+        }
+        printf("Decoded %ld nibble tracks, %d bad sectors\n",
+            srcImg.GetNumTracks(), numBad);
+    }
+
     /*
      * Copy blocks or sectors from source to destination.
      */
@@ -388,7 +414,14 @@ Convert(const char* infile, const char* outfile)
 
         unsigned char blkBuf[512];
         for (int block = 0; block < numBlocks; block++) {
-            dierr = srcImg.ReadBlock(block, blkBuf);
+            if (nibSectors != nil && srcSectPerTrack == 16) {
+                memcpy(blkBuf, nibSectors + block * 512, sizeof(blkBuf));
+                dierr = nibErrs[block * 2];
+                if (dierr == kDIErrNone)
+                    dierr = nibErrs[block * 2 + 1];
+            } else {
+                dierr = srcImg.ReadBlock(block, blkBuf);
+            }
             if (dierr != kDIErrNone) {
                 fprintf(stderr, "ERROR: ReadBlock failed (err=%d)\n", dierr);
                 goto bail;
@@ -412,7 +445,13 @@ Convert(const char* infile, const char* outfile)
         unsigned char sctBuf[256];
         for (int track = 0; track < numTracks; track++) {
             for (int sector = 0; sector < numSectPerTrack; sector++) {
-                dierr = srcImg.ReadTrackSector(track, sector, sctBuf);
+                if (nibSectors != nil) {
+                    int idx = track * srcSectPerTrack + sector;
+                    memcpy(sctBuf, nibSectors + idx * 256, sizeof(sctBuf));
+                    dierr = nibErrs[idx];
+                } else {
+                    dierr = srcImg.ReadTrackSector(track, sector, sctBuf);
+                }
                 if (dierr != kDIErrNone) {
                     fprintf(stderr,
                         "WARNING: ReadTrackSector failed on T=%d S=%d (err=%d)\n",
@@ -445,6 +484,8 @@ Convert(const char* infile, const char* outfile)
 
     assert(dierr == kDIErrNone);
 bail:
+    delete[] nibSectors;
+    delete[] nibErrs;
     return dierr;
 }
 
@@ -15,6 +15,7 @@
 #include <sys/types.h>
 #include <limits.h>
 #include <errno.h>
+#include <pthread.h>
 #include "zlib.h"
 #include "../diskimg/DiskImg.h"
 #include "../nufxlib/NufxLib.h"
@@ -62,8 +63,19 @@ struct Stats {
     long    goodDiskImages;
 } gStats = { 0 };
 
+struct ScanQueue;
+
+typedef enum OutputFormat {
+    kOutputText = 0,        // human-readable tables
+    kOutputNDJSON,          // one JSON object per line
+    kOutputCSV,             // one row per record, fixed columns
+} OutputFormat;
+
 typedef struct ScanOpts {
     FILE*   outfp;
+    OutputFormat format;
+    bool    summary;        // "--summary": volume headers only, no files
+    ScanQueue* pQueue;      // non-nil when scanning with "-j"
 } ScanOpts;
 
 typedef enum RecordKind {
@@ -93,10 +105,12 @@ FormatDate(time_t when, char* buf)
     } else if (when == kDateInvalid) {
         strcpy(buf, "<invalid>");
     } else {
-        struct tm* ptm;
+        struct tm tmWhen;
 
-        ptm = localtime(&when);
-        strftime(buf, 64, "%d-%b-%y %H:%M", ptm);
+        if (localtime_r(&when, &tmWhen) == nil)
+            strcpy(buf, "<invalid>");
+        else
+            strftime(buf, 64, "%d-%b-%y %H:%M", &tmWhen);
     }
 }
 
@@ -308,6 +322,534 @@ MacSanitize(char* str)
     }
 }   
 
+/*
+ * Compute the size of the image in kbytes.
+ */
+static int
+GetImageKBytes(DiskImg* pDiskImg)
+{
+    if (pDiskImg->GetHasBlocks())
+        return pDiskImg->GetNumBlocks() / 2;
+    else if (pDiskImg->GetHasSectors())
+        return (pDiskImg->GetNumTracks() * pDiskImg->GetNumSectPerTrack()) / 4;
+    else
+        return 0;
+}
+
+/*
+ * Print the name, size, and free space of a volume and its sub-volumes,
+ * one per line.  Used for "--summary".
+ */
+static void
+PrintVolumeSummary(DiskFS* pDiskFS, int depth, ScanOpts* pScanOpts)
+{
+    long totalUnits, freeUnits;
+    int unitSize;
+
+    fprintf(pScanOpts->outfp, "%*sDisk: %s (%dKB)", depth * 2, "",
+        pDiskFS->GetVolumeID(), GetImageKBytes(pDiskFS->GetDiskImg()));
+    if (pDiskFS->GetFreeSpaceCount(&totalUnits, &freeUnits, &unitSize) ==
+        kDIErrNone)
+    {
+        fprintf(pScanOpts->outfp, ", %ldKB free",
+            (long) ((int64_t) freeUnits * unitSize / 1024));
+    }
+    fprintf(pScanOpts->outfp, "\n");
+
+    DiskFS::SubVolume* pSubVol = pDiskFS->GetNextSubVolume(nil);
+    while (pSubVol != nil) {
+        PrintVolumeSummary(pSubVol->GetDiskFS(), depth + 1, pScanOpts);
+        pSubVol = pDiskFS->GetNextSubVolume(pSubVol);
+    }
+}
+
+
+
+/*
+ * ===========================================================================
+ *      Machine-readable export ("-f ndjson", "-f csv")
+ * ===========================================================================
+ */
+
+/*
+ * Each image produces one "image" record with the detection results and
+ * the time spent in each phase, followed by one "file" record per file.
+ * Both kinds share a single set of columns, so the CSV output can use one
+ * header; NDJSON objects only include the columns that apply to the kind.
+ */
+typedef enum ExportColumn {
+    kColRecord = 0,
+    kColImage,
+    /* image records */
+    kColStatus,
+    kColError,
+    kColOuterFormat,
+    kColFileFormat,
+    kColPhysicalFormat,
+    kColSectorOrder,
+    kColFSFormat,
+    kColVolume,
+    kColFSDamaged,
+    kColKBytes,
+    kColTotalUnits,
+    kColFreeUnits,
+    kColUnitSize,
+    kColOpenMsec,
+    kColAnalyzeMsec,
+    kColInitMsec,
+    /* file records */
+    kColSubVolume,
+    kColName,
+    kColFileType,
+    kColAuxType,
+    kColAccess,
+    kColDirectory,
+    kColCreated,
+    kColModified,
+    kColDataLen,
+    kColDataSparseLen,
+    kColRsrcLen,
+    kColRsrcSparseLen,
+    kColQuality,
+    kColMax
+} ExportColumn;
+
+static const char* gExportColumnNames[kColMax] = {
+    "record", "image",
+    "status", "error", "outer_format", "file_format", "physical_format",
+    "sector_order", "fs_format", "volume", "fs_damaged", "kbytes",
+    "total_units", "free_units", "unit_size",
+    "open_ms", "analyze_ms", "init_ms",
+    "subvol", "name", "type", "auxtype", "access", "directory",
+    "created", "modified", "data_len", "data_sparse_len", "rsrc_len",
+    "rsrc_sparse_len", "quality",
+};
+
+typedef enum ExportValueKind {
+    kValueUnset = 0,        // not part of this kind of record
+    kValueNull,             // part of the record, but has no value
+    kValueRaw,              // number or boolean; written without quotes
+    kValueString,           // written quoted and escaped
+} ExportValueKind;
+
+typedef struct ExportRecord {
+    ExportValueKind kind[kColMax];
+    const char*     value[kColMax];
+    char            rawBuf[kColMax][32];    // storage for formatted numbers
+} ExportRecord;
+
+static void
+ExportInit(ExportRecord* pRec, const char* recordKind, const char* imagePath)
+{
+    memset(pRec->kind, 0, sizeof(pRec->kind));
+    pRec->kind[kColRecord] = kValueString;
+    pRec->value[kColRecord] = recordKind;
+    pRec->kind[kColImage] = kValueString;
+    pRec->value[kColImage] = imagePath;
+}
+
+/* "str" must remain valid until the record is written */
+static void
+ExportSetString(ExportRecord* pRec, ExportColumn col, const char* str)
+{
+    if (str == nil) {
+        pRec->kind[col] = kValueNull;
+    } else {
+        pRec->kind[col] = kValueString;
+        pRec->value[col] = str;
+    }
+}
+
+static void
+ExportSetNull(ExportRecord* pRec, ExportColumn col)
+{
+    pRec->kind[col] = kValueNull;
+}
+
+static void
+ExportSetLong(ExportRecord* pRec, ExportColumn col, long long val)
+{
+    snprintf(pRec->rawBuf[col], sizeof(pRec->rawBuf[col]), "%lld", val);
+    pRec->kind[col] = kValueRaw;
+    pRec->value[col] = pRec->rawBuf[col];
+}
+
+static void
+ExportSetBool(ExportRecord* pRec, ExportColumn col, bool val)
+{
+    pRec->kind[col] = kValueRaw;
+    pRec->value[col] = val ? "true" : "false";
+}
+
+static void
+ExportSetMsec(ExportRecord* pRec, ExportColumn col, double msec)
+{
+    snprintf(pRec->rawBuf[col], sizeof(pRec->rawBuf[col]), "%.3f", msec);
+    pRec->kind[col] = kValueRaw;
+    pRec->value[col] = pRec->rawBuf[col];
+}
+
+/*
+ * Dates are written as the wall-clock time recorded on the disk, without
+ * a zone, e.g. "1991-04-28T13:05:00".  Missing or unparseable dates are
+ * null.
+ */
+static void
+ExportSetDate(ExportRecord* pRec, ExportColumn col, time_t when)
+{
+    struct tm tmWhen;
+
+    if (when == 0 || when == kDateNone || when == kDateInvalid ||
+        localtime_r(&when, &tmWhen) == nil)
+    {
+        pRec->kind[col] = kValueNull;
+        return;
+    }
+    strftime(pRec->rawBuf[col], sizeof(pRec->rawBuf[col]),
+        "%Y-%m-%dT%H:%M:%S", &tmWhen);
+    pRec->kind[col] = kValueString;
+    pRec->value[col] = pRec->rawBuf[col];
+}
+
+/*
+ * Write a string as a JSON string literal.  The input must be UTF-8.
+ */
+static void
+ExportWriteJSONString(FILE* fp, const char* str)
+{
+    putc('"', fp);
+    for ( ; *str != '\0'; str++) {
+        unsigned char uch = (unsigned char) *str;
+        if (uch == '"' || uch == '\\')
+            fprintf(fp, "\\%c", uch);
+        else if (uch < 0x20)
+            fprintf(fp, "\\u%04x", uch);
+        else
+            putc(uch, fp);
+    }
+    putc('"', fp);
+}
+
+/*
+ * Write a CSV field, quoting it if it has anything that needs it.
+ */
+static void
+ExportWriteCSVString(FILE* fp, const char* str)
+{
+    if (strpbrk(str, ",\"\r\n") == nil) {
+        fputs(str, fp);
+        return;
+    }
+    putc('"', fp);
+    for ( ; *str != '\0'; str++) {
+        if (*str == '"')
+            putc('"', fp);
+        putc(*str, fp);
+    }
+    putc('"', fp);
+}
+
+static void
+ExportWriteRecord(const ExportRecord* pRec, ScanOpts* pScanOpts)
+{
+    FILE* fp = pScanOpts->outfp;
+    bool first = true;
+
+    if (pScanOpts->format == kOutputNDJSON) {
+        putc('{', fp);
+        for (int col = 0; col < kColMax; col++) {
+            if (pRec->kind[col] == kValueUnset)
+                continue;
+            if (!first)
+                putc(',', fp);
+            first = false;
+            fprintf(fp, "\"%s\":", gExportColumnNames[col]);
+            if (pRec->kind[col] == kValueNull)
+                fputs("null", fp);
+            else if (pRec->kind[col] == kValueRaw)
+                fputs(pRec->value[col], fp);
+            else
+                ExportWriteJSONString(fp, pRec->value[col]);
+        }
+        fputs("}\n", fp);
+    } else {
+        ASSERT(pScanOpts->format == kOutputCSV);
+        for (int col = 0; col < kColMax; col++) {
+            if (col != 0)
+                putc(',', fp);
+            if (pRec->kind[col] == kValueRaw)
+                fputs(pRec->value[col], fp);
+            else if (pRec->kind[col] == kValueString)
+                ExportWriteCSVString(fp, pRec->value[col]);
+        }
+        putc('\n', fp);
+    }
+}
+
+/*
+ * Write the CSV column header.  Nothing to do for NDJSON.
+ */
+static void
+ExportWriteHeader(ScanOpts* pScanOpts)
+{
+    if (pScanOpts->format != kOutputCSV)
+        return;
+    for (int col = 0; col < kColMax; col++) {
+        if (col != 0)
+            putc(',', pScanOpts->outfp);
+        fputs(gExportColumnNames[col], pScanOpts->outfp);
+    }
+    putc('\n', pScanOpts->outfp);
+}
+
+/*
+ * Convert a filename from the disk image to UTF-8.  The names are Mac OS
+ * Roman (which is plain ASCII on everything but HFS).
+ */
+static char*
+ExportCopyName(const char* name)
+{
+    size_t len = NuConvertMORToUNI(name, nil, 0);
+    char* buf = new char[len];
+    NuConvertMORToUNI(name, buf, len);
+    return buf;
+}
+
+static const char*
+ExportQualityString(A2File::FileQuality quality)
+{
+    switch (quality) {
+    case A2File::kQualityGood:          return "good";
+    case A2File::kQualitySuspicious:    return "suspicious";
+    case A2File::kQualityDamaged:       return "damaged";
+    default:                            return "unknown";
+    }
+}
+
+/*
+ * Fill in the free space columns, or leave them null if the filesystem
+ * can't tell us.
+ */
+static void
+ExportSetFreeSpace(ExportRecord* pRec, DiskFS* pDiskFS)
+{
+    long totalUnits, freeUnits;
+    int unitSize;
+
+    if (pDiskFS->GetFreeSpaceCount(&totalUnits, &freeUnits, &unitSize) ==
+        kDIErrNone)
+    {
+        ExportSetLong(pRec, kColTotalUnits, totalUnits);
+        ExportSetLong(pRec, kColFreeUnits, freeUnits);
+        ExportSetLong(pRec, kColUnitSize, unitSize);
+    } else {
+        ExportSetNull(pRec, kColTotalUnits);
+        ExportSetNull(pRec, kColFreeUnits);
+        ExportSetNull(pRec, kColUnitSize);
+    }
+}
+
+/*
+ * Write a "volume" record for a sub-volume.
+ */
+static void
+ExportVolumeRecord(DiskFS* pDiskFS, const char* imagePath,
+    const char* subVolPath, ScanOpts* pScanOpts)
+{
+    ExportRecord rec;
+    char* volumeID = ExportCopyName(pDiskFS->GetVolumeID());
+
+    ExportInit(&rec, "volume", imagePath);
+    ExportSetString(&rec, kColSubVolume, subVolPath);
+    ExportSetString(&rec, kColVolume, volumeID);
+    ExportSetString(&rec, kColFSFormat,
+        DiskImg::ToString(pDiskFS->GetDiskImg()->GetFSFormat()));
+    if (pScanOpts->summary)
+        ExportSetNull(&rec, kColFSDamaged);     // not known without a scan
+    else
+        ExportSetBool(&rec, kColFSDamaged, pDiskFS->GetFSDamaged());
+    ExportSetLong(&rec, kColKBytes, GetImageKBytes(pDiskFS->GetDiskImg()));
+    ExportSetFreeSpace(&rec, pDiskFS);
+    ExportWriteRecord(&rec, pScanOpts);
+
+    delete[] volumeID;
+}
+
+/*
+ * Write one record per file in the DiskFS, then do the same for each
+ * sub-volume.  "subVolPath" holds the names of the enclosing sub-volumes,
+ * separated by ':', or is empty for the outermost volume.  In summary
+ * mode, a "volume" record is written for each sub-volume instead of its
+ * files.
+ */
+int
+ExportDiskFSContents(DiskFS* pDiskFS, const char* imagePath,
+    const char* subVolPath, ScanOpts* pScanOpts)
+{
+    DiskFS::SubVolume* pSubVol;
+    A2File* pFile;
+
+    ASSERT(pDiskFS != nil);
+    pFile = pScanOpts->summary ? nil : pDiskFS->GetNextFile(nil);
+    for ( ; pFile != nil; pFile = pDiskFS->GetNextFile(pFile)) {
+        if (pFile->IsVolumeDirectory())
+            continue;
+
+        ExportRecord rec;
+        char* name = ExportCopyName(pFile->GetPathName());
+
+        ExportInit(&rec, "file", imagePath);
+        ExportSetString(&rec, kColSubVolume, subVolPath);
+        ExportSetString(&rec, kColName, name);
+        ExportSetLong(&rec, kColFileType, pFile->GetFileType());
+        ExportSetLong(&rec, kColAuxType, pFile->GetAuxType());
+        ExportSetLong(&rec, kColAccess, pFile->GetAccess());
+        ExportSetBool(&rec, kColDirectory, pFile->IsDirectory());
+        ExportSetDate(&rec, kColCreated, pFile->GetCreateWhen());
+        ExportSetDate(&rec, kColModified, pFile->GetModWhen());
+        ExportSetLong(&rec, kColDataLen, pFile->GetDataLength());
+        ExportSetLong(&rec, kColDataSparseLen, pFile->GetDataSparseLength());
+        if (pFile->GetRsrcLength() >= 0) {
+            ExportSetLong(&rec, kColRsrcLen, pFile->GetRsrcLength());
+            ExportSetLong(&rec, kColRsrcSparseLen,
+                pFile->GetRsrcSparseLength());
+        } else {
+            ExportSetNull(&rec, kColRsrcLen);
+            ExportSetNull(&rec, kColRsrcSparseLen);
+        }
+        ExportSetString(&rec, kColQuality,
+            ExportQualityString(pFile->GetQuality()));
+        ExportWriteRecord(&rec, pScanOpts);
+
+        delete[] name;
+    }
+
+    for (pSubVol = pDiskFS->GetNextSubVolume(nil); pSubVol != nil;
+        pSubVol = pDiskFS->GetNextSubVolume(pSubVol))
+    {
+        const char* subVolName = pSubVol->GetDiskFS()->GetVolumeName();
+        if (subVolName == nil)
+            subVolName = "+++";
+
+        char* uniName = ExportCopyName(subVolName);
+        size_t len = strlen(subVolPath) + strlen(uniName) + 2;
+        char* newPath = new char[len];
+        if (subVolPath[0] == '\0')
+            snprintf(newPath, len, "%s", uniName);
+        else
+            snprintf(newPath, len, "%s:%s", subVolPath, uniName);
+
+        if (pScanOpts->summary) {
+            ExportVolumeRecord(pSubVol->GetDiskFS(), imagePath, newPath,
+                pScanOpts);
+        }
+        int ret = ExportDiskFSContents(pSubVol->GetDiskFS(), imagePath,
+                    newPath, pScanOpts);
+        delete[] newPath;
+        delete[] uniName;
+        if (ret != 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Get the current time, in milliseconds, from an arbitrary starting point.
+ */
+static double
+GetMsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+ * Time spent in each phase of opening an image.  Phases that weren't
+ * reached are left negative.
+ */
+typedef struct ImageTimes {
+    double  openMsec;           // DiskImg::OpenImage
+    double  analyzeMsec;        // DiskImg::AnalyzeImage
+    double  initMsec;           // create DiskFS and Initialize
+} ImageTimes;
+
+/*
+ * Write the "image" record.  If "analyzed" is set, the format fields in
+ * the DiskImg are valid.  "pDiskFS" is nil unless Initialize succeeded.
+ */
+static void
+ExportImageRecord(const char* pathName, DiskImg* pDiskImg, bool analyzed,
+    DiskFS* pDiskFS, const char* errMsg, const ImageTimes* pTimes,
+    ScanOpts* pScanOpts)
+{
+    ExportRecord rec;
+    char* volumeID = nil;
+
+    ExportInit(&rec, "image", pathName);
+    if (errMsg[0] == '\0') {
+        ExportSetString(&rec, kColStatus, "ok");
+        ExportSetNull(&rec, kColError);
+    } else {
+        ExportSetString(&rec, kColStatus, "error");
+        ExportSetString(&rec, kColError, errMsg);
+    }
+
+    if (analyzed) {
+        ExportSetString(&rec, kColOuterFormat,
+            DiskImg::ToString(pDiskImg->GetOuterFormat()));
+        ExportSetString(&rec, kColFileFormat,
+            DiskImg::ToString(pDiskImg->GetFileFormat()));
+        ExportSetString(&rec, kColPhysicalFormat,
+            DiskImg::ToString(pDiskImg->GetPhysicalFormat()));
+        ExportSetString(&rec, kColSectorOrder,
+            DiskImg::ToString(pDiskImg->GetSectorOrder()));
+        ExportSetString(&rec, kColFSFormat,
+            DiskImg::ToString(pDiskImg->GetFSFormat()));
+        ExportSetLong(&rec, kColKBytes, GetImageKBytes(pDiskImg));
+    } else {
+        ExportSetNull(&rec, kColOuterFormat);
+        ExportSetNull(&rec, kColFileFormat);
+        ExportSetNull(&rec, kColPhysicalFormat);
+        ExportSetNull(&rec, kColSectorOrder);
+        ExportSetNull(&rec, kColFSFormat);
+        ExportSetNull(&rec, kColKBytes);
+    }
+    if (pDiskFS != nil) {
+        volumeID = ExportCopyName(pDiskFS->GetVolumeID());
+        ExportSetString(&rec, kColVolume, volumeID);
+        if (pScanOpts->summary)
+            ExportSetNull(&rec, kColFSDamaged);
+        else
+            ExportSetBool(&rec, kColFSDamaged, pDiskFS->GetFSDamaged());
+        ExportSetFreeSpace(&rec, pDiskFS);
+    } else {
+        ExportSetNull(&rec, kColVolume);
+        ExportSetNull(&rec, kColFSDamaged);
+        ExportSetNull(&rec, kColTotalUnits);
+        ExportSetNull(&rec, kColFreeUnits);
+        ExportSetNull(&rec, kColUnitSize);
+    }
+
+    if (pTimes->openMsec >= 0)
+        ExportSetMsec(&rec, kColOpenMsec, pTimes->openMsec);
+    else
+        ExportSetNull(&rec, kColOpenMsec);
+    if (pTimes->analyzeMsec >= 0)
+        ExportSetMsec(&rec, kColAnalyzeMsec, pTimes->analyzeMsec);
+    else
+        ExportSetNull(&rec, kColAnalyzeMsec);
+    if (pTimes->initMsec >= 0)
+        ExportSetMsec(&rec, kColInitMsec, pTimes->initMsec);
+    else
+        ExportSetNull(&rec, kColInitMsec);
+
+    ExportWriteRecord(&rec, pScanOpts);
+    delete[] volumeID;
+}
+
 
 /*
  * Load the contents of a DiskFS.
@@ -543,20 +1085,28 @@ ScanDiskImage(const char* pathName, ScanOpts* pScanOpts)
     char errMsg[256] = "";
     DiskImg diskImg;
     DiskFS* pDiskFS = nil;
+    ImageTimes times = { -1.0, -1.0, -1.0 };
+    bool analyzed = false;
+    double startMsec;
 
+    startMsec = GetMsec();
     dierr = diskImg.OpenImage(pathName, '/', true);
+    times.openMsec = GetMsec() - startMsec;
     if (dierr != kDIErrNone) {
         snprintf(errMsg, sizeof(errMsg), "Unable to open '%s': %s",
             pathName, DIStrError(dierr));
         goto bail;
     }
 
+    startMsec = GetMsec();
     dierr = diskImg.AnalyzeImage();
+    times.analyzeMsec = GetMsec() - startMsec;
     if (dierr != kDIErrNone) {
         snprintf(errMsg, sizeof(errMsg), "Analysis of '%s' failed: %s",
             pathName, DIStrError(dierr));
         goto bail;
     }
+    analyzed = true;
 
     if (diskImg.GetFSFormat() == DiskImg::kFormatUnknown ||
         diskImg.GetSectorOrder() == DiskImg::kSectorOrderUnknown)
@@ -567,6 +1117,7 @@ ScanDiskImage(const char* pathName, ScanOpts* pScanOpts)
     }
 
     /* create an appropriate DiskFS object */
+    startMsec = GetMsec();
     pDiskFS = diskImg.OpenAppropriateDiskFS();
     if (pDiskFS == nil) {
         /* unknown FS should've been caught above! */
@@ -579,25 +1130,36 @@ ScanDiskImage(const char* pathName, ScanOpts* pScanOpts)
     pDiskFS->SetScanForSubVolumes(DiskFS::kScanSubEnabled);
 
     /* object created; prep it */
-    dierr = pDiskFS->Initialize(&diskImg, DiskFS::kInitFull);
+    /* in summary mode, just read the volume headers and bitmaps */
+    DiskFS::InitMode initMode;
+    if (pScanOpts->summary)
+        initMode = DiskFS::kInitHeaderOnly;
+    else
+        initMode = DiskFS::kInitFull;
+    dierr = pDiskFS->Initialize(&diskImg, initMode);
+    times.initMsec = GetMsec() - startMsec;
     if (dierr != kDIErrNone) {
         snprintf(errMsg, sizeof(errMsg),
             "Error reading list of files from disk: %s", DIStrError(dierr));
+        delete pDiskFS;     // don't report on a half-initialized DiskFS
+        pDiskFS = nil;
         goto bail;
     }
 
+    if (pScanOpts->format != kOutputText)
+        goto bail;      // records are written below
+
     fprintf(pScanOpts->outfp, "File: %s\n", pathName);
 
-    int kbytes;
-    if (pDiskFS->GetDiskImg()->GetHasBlocks())
-        kbytes = pDiskFS->GetDiskImg()->GetNumBlocks() / 2;
-    else if (pDiskFS->GetDiskImg()->GetHasSectors())
-        kbytes = (pDiskFS->GetDiskImg()->GetNumTracks() *
-                pDiskFS->GetDiskImg()->GetNumSectPerTrack()) / 4;
-    else
-        kbytes = 0;
+    if (pScanOpts->summary) {
+        PrintVolumeSummary(pDiskFS, 0, pScanOpts);
+        fprintf(pScanOpts->outfp, "\n");
+        goto bail;
+    }
+
     fprintf(pScanOpts->outfp, "Disk: %s%s (%dKB)\n", pDiskFS->GetVolumeID(),
-        pDiskFS->GetFSDamaged() ? " [*]" : "", kbytes);
+        pDiskFS->GetFSDamaged() ? " [*]" : "",
+        GetImageKBytes(pDiskFS->GetDiskImg()));
 
     fprintf(pScanOpts->outfp,
         " Name                             Type Auxtyp Modified"
@@ -614,9 +1176,16 @@ ScanDiskImage(const char* pathName, ScanOpts* pScanOpts)
         "------------------------------------------------------"
         "------------------------\n\n");
 
-    gStats.goodDiskImages++;
-
 bail:
+    if (pScanOpts->format != kOutputText) {
+        ExportImageRecord(pathName, &diskImg, analyzed, pDiskFS, errMsg,
+            &times, pScanOpts);
+        if (errMsg[0] == '\0')
+            (void) ExportDiskFSContents(pDiskFS, pathName, "", pScanOpts);
+        delete pDiskFS;
+        return (errMsg[0] != '\0') ? -1 : 0;
+    }
+
     delete pDiskFS;
 
     if (errMsg[0] != '\0') {
@@ -629,6 +1198,210 @@ bail:
 }
 
 
+
+/*
+ * Parallel scanning ("-j N").
+ *
+ * The main thread walks the directory tree as usual, but instead of
+ * scanning each image it adds the path to a ring of jobs.  Worker threads
+ * take jobs in order, scan the image into a memory buffer, and mark the job
+ * done.  The main thread writes finished jobs out in the order they were
+ * queued, so the output matches a serial run.  When the ring is full, the
+ * main thread waits for the oldest job, which keeps memory use bounded no
+ * matter how many files there are.
+ */
+typedef struct ScanJob {
+    char*   pathName;
+    char*   output;         // from open_memstream; nil until done
+    size_t  outputLen;
+    bool    done;
+    bool    goodImage;
+} ScanJob;
+
+typedef struct ScanQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t  jobQueued;  // new job, or shutting down
+    pthread_cond_t  jobDone;
+
+    ScanJob*    jobs;
+    long        numSlots;
+    long        head;           // oldest job not yet written out
+    long        next;           // next job for a worker to take
+    long        tail;           // where the next new job goes
+    bool        shutdown;
+
+    ScanOpts    opts;           // copied into each job; outfp is the real one
+    int         numThreads;
+    pthread_t*  threads;
+} ScanQueue;
+
+enum { kJobsPerThread = 4 };
+
+/*
+ * Worker thread: scan images until the queue shuts down.
+ */
+static void*
+ScanWorker(void* vpQueue)
+{
+    ScanQueue* pQueue = (ScanQueue*) vpQueue;
+
+    pthread_mutex_lock(&pQueue->lock);
+    while (true) {
+        while (pQueue->next == pQueue->tail && !pQueue->shutdown)
+            pthread_cond_wait(&pQueue->jobQueued, &pQueue->lock);
+        if (pQueue->next == pQueue->tail)
+            break;      // shutting down, and nothing left to do
+
+        ScanJob* pJob = &pQueue->jobs[pQueue->next % pQueue->numSlots];
+        pQueue->next++;
+        pthread_mutex_unlock(&pQueue->lock);
+
+        char* output = nil;
+        size_t outputLen = 0;
+        bool good = false;
+        FILE* memfp = open_memstream(&output, &outputLen);
+        if (memfp == nil) {
+            fprintf(stderr, "ERROR: open_memstream failed: %s\n",
+                strerror(errno));
+        } else {
+            ScanOpts jobOpts = pQueue->opts;
+            jobOpts.outfp = memfp;
+            good = (ScanDiskImage(pJob->pathName, &jobOpts) == 0);
+            fclose(memfp);
+        }
+
+        pthread_mutex_lock(&pQueue->lock);
+        pJob->output = output;
+        pJob->outputLen = outputLen;
+        pJob->goodImage = good;
+        pJob->done = true;
+        pthread_cond_broadcast(&pQueue->jobDone);
+    }
+    pthread_mutex_unlock(&pQueue->lock);
+
+    return nil;
+}
+
+/*
+ * Create the queue and start the workers.
+ */
+ScanQueue*
+ScanQueueCreate(int numThreads, const ScanOpts* pScanOpts)
+{
+    ScanQueue* pQueue = new ScanQueue;
+
+    pthread_mutex_init(&pQueue->lock, nil);
+    pthread_cond_init(&pQueue->jobQueued, nil);
+    pthread_cond_init(&pQueue->jobDone, nil);
+    pQueue->numSlots = numThreads * kJobsPerThread;
+    pQueue->jobs = new ScanJob[pQueue->numSlots];
+    pQueue->head = pQueue->next = pQueue->tail = 0;
+    pQueue->shutdown = false;
+    pQueue->opts = *pScanOpts;
+    pQueue->opts.pQueue = nil;
+    pQueue->threads = new pthread_t[numThreads];
+    pQueue->numThreads = 0;
+
+    for (int i = 0; i < numThreads; i++) {
+        if (pthread_create(&pQueue->threads[i], nil, ScanWorker, pQueue) != 0)
+            break;
+        pQueue->numThreads++;
+    }
+    if (pQueue->numThreads == 0) {
+        /* can't go parallel; fall back to scanning on this thread */
+        fprintf(stderr, "WARNING: unable to create threads\n");
+        delete[] pQueue->threads;
+        delete[] pQueue->jobs;
+        delete pQueue;
+        return nil;
+    }
+
+    return pQueue;
+}
+
+/*
+ * Write out the oldest job.  Call with the lock held, after checking that
+ * the job is done.
+ */
+static void
+ScanQueueEmitHead(ScanQueue* pQueue)
+{
+    ScanJob* pJob = &pQueue->jobs[pQueue->head % pQueue->numSlots];
+
+    ASSERT(pJob->done);
+    if (pJob->output != nil)
+        fwrite(pJob->output, 1, pJob->outputLen, pQueue->opts.outfp);
+    if (pJob->goodImage)
+        gStats.goodDiskImages++;
+
+    free(pJob->output);
+    free(pJob->pathName);
+    pQueue->head++;
+}
+
+/*
+ * Add an image to the queue.  Blocks while the queue is full, writing out
+ * finished jobs as they become available.
+ */
+void
+ScanQueueAdd(ScanQueue* pQueue, const char* pathName)
+{
+    pthread_mutex_lock(&pQueue->lock);
+
+    /* write out anything that's done, and make room if we need it */
+    while (true) {
+        if (pQueue->head != pQueue->tail &&
+            pQueue->jobs[pQueue->head % pQueue->numSlots].done)
+        {
+            ScanQueueEmitHead(pQueue);
+        } else if (pQueue->tail - pQueue->head == pQueue->numSlots) {
+            pthread_cond_wait(&pQueue->jobDone, &pQueue->lock);
+        } else {
+            break;
+        }
+    }
+
+    ScanJob* pJob = &pQueue->jobs[pQueue->tail % pQueue->numSlots];
+    pJob->pathName = strdup(pathName);
+    pJob->output = nil;
+    pJob->outputLen = 0;
+    pJob->done = false;
+    pJob->goodImage = false;
+    pQueue->tail++;
+    pthread_cond_signal(&pQueue->jobQueued);
+
+    pthread_mutex_unlock(&pQueue->lock);
+}
+
+/*
+ * Wait for everything to finish, write it out, and free the queue.
+ */
+void
+ScanQueueFinish(ScanQueue* pQueue)
+{
+    pthread_mutex_lock(&pQueue->lock);
+    pQueue->shutdown = true;
+    pthread_cond_broadcast(&pQueue->jobQueued);
+    while (pQueue->head != pQueue->tail) {
+        if (pQueue->jobs[pQueue->head % pQueue->numSlots].done)
+            ScanQueueEmitHead(pQueue);
+        else
+            pthread_cond_wait(&pQueue->jobDone, &pQueue->lock);
+    }
+    pthread_mutex_unlock(&pQueue->lock);
+
+    for (int i = 0; i < pQueue->numThreads; i++)
+        pthread_join(pQueue->threads[i], nil);
+
+    pthread_cond_destroy(&pQueue->jobDone);
+    pthread_cond_destroy(&pQueue->jobQueued);
+    pthread_mutex_destroy(&pQueue->lock);
+    delete[] pQueue->threads;
+    delete[] pQueue->jobs;
+    delete pQueue;
+}
+
+
 /*
  * Check a file's status.
  *
@@ -782,8 +1555,15 @@ ProcessFile(const char* pathname, ScanOpts* pScanOpts)
     if (isDir) {
         result = ProcessDirectory(pathname, pScanOpts);
         gStats.numDirectories++;
+    } else if (pScanOpts->pQueue != nil) {
+        /* results are counted when the job is written out */
+        ScanQueueAdd(pScanOpts->pQueue, pathname);
+        gStats.numFiles++;
+        result = 0;
     } else {
         result = ScanDiskImage(pathname, pScanOpts);
+        if (result == 0)
+            gStats.goodDiskImages++;
         gStats.numFiles++;
     }
 
@@ -833,6 +1613,11 @@ main(int argc, char** argv)
 {
     ScanOpts scanOpts;
     scanOpts.outfp = stdout;
+    scanOpts.format = kOutputText;
+    scanOpts.summary = false;
+    scanOpts.pQueue = nil;
+    int numThreads = 1;
+    FILE* infofp = stdout;      // banner and totals
 
 #ifdef _DEBUG
     const char* kLogFile = "mdc-log.txt";
@@ -843,44 +1628,107 @@ main(int argc, char** argv)
     }
 #endif
 
+    /*
+     * Options:
+     *  "-j N" or "-jN" sets the number of scanning threads
+     *  "-f FMT" or "-fFMT" selects the output format (text, ndjson, csv)
+     *  "--summary" shows only the volume name, size, and free space
+     */
+    while (argc > 1 && argv[1][0] == '-' &&
+        (argv[1][1] == 'j' || argv[1][1] == 'f' ||
+         strcmp(argv[1], "--summary") == 0))
+    {
+        if (argv[1][1] == '-') {
+            scanOpts.summary = true;
+            argc--;
+            argv++;
+            continue;
+        }
+
+        char opt = argv[1][1];
+        const char* optArg = argv[1] + 2;
+        if (*optArg == '\0' && argc > 2) {
+            optArg = argv[2];
+            argc--;
+            argv++;
+        }
+        argc--;
+        argv++;
+
+        if (opt == 'j') {
+            numThreads = atoi(optArg);
+            if (numThreads < 1) {
+                fprintf(stderr, "Invalid thread count '%s'\n", optArg);
+                goto done;
+            }
+        } else {
+            if (strcmp(optArg, "text") == 0)
+                scanOpts.format = kOutputText;
+            else if (strcmp(optArg, "ndjson") == 0)
+                scanOpts.format = kOutputNDJSON;
+            else if (strcmp(optArg, "csv") == 0)
+                scanOpts.format = kOutputCSV;
+            else {
+                fprintf(stderr, "Invalid output format '%s'\n", optArg);
+                goto done;
+            }
+        }
+    }
+
+    /* keep stdout clean for the records */
+    if (scanOpts.format != kOutputText)
+        infofp = stderr;
+
     int32_t major, minor, bug;
     Global::GetVersion(&major, &minor, &bug);
 
-    printf("MDC for Linux v3.0.0 (DiskImg library v%d.%d.%d)\n",
+    fprintf(infofp, "MDC for Linux v3.0.0 (DiskImg library v%d.%d.%d)\n",
         major, minor, bug);
-    printf("Copyright (C) 2006 by faddenSoft, LLC.  All rights reserved.\n");
-    printf("MDC is part of CiderPress, available from http://www.faddensoft.com/.\n");
+    fprintf(infofp, "Copyright (C) 2006 by faddenSoft, LLC.  All rights reserved.\n");
+    fprintf(infofp, "MDC is part of CiderPress, available from http://www.faddensoft.com/.\n");
     NuGetVersion(&major, &minor, &bug, nil, nil);
-    printf("Linked against NufxLib v%d.%d.%d and zlib version %s.\n",
+    fprintf(infofp, "Linked against NufxLib v%d.%d.%d and zlib version %s.\n",
         major, minor, bug, zlibVersion());
 
     if (argc == 1) {
-        fprintf(stderr, "\nUsage: mdc file ...\n");
+        fprintf(stderr,
+            "\nUsage: mdc [-j threads] [-f text|ndjson|csv] [--summary]"
+            " file ...\n");
         goto done;
     }
 
 #ifdef _DEBUG
-    printf("Log file is '%s'\n", kLogFile);
+    fprintf(infofp, "Log file is '%s'\n", kLogFile);
 #endif
-    printf("\n");
+    fprintf(infofp, "\n");
 
     Global::SetDebugMsgHandler(MsgHandler);
     Global::AppInit();
 
     NuSetGlobalErrorMessageHandler(NufxErrorMsgHandler);
 
+    if (numThreads > 1) {
+        /* the images are the parallel part; probe each one serially */
+        Global::SetProbeThreads(1);
+        scanOpts.pQueue = ScanQueueCreate(numThreads, &scanOpts);
+    }
+
     time_t start;
     start = time(NULL);
-    printf("Run started at %.24s\n\n", ctime(&start));
+    fprintf(infofp, "Run started at %.24s\n\n", ctime(&start));
+    ExportWriteHeader(&scanOpts);
 
     while (--argc) {
         ProcessFile(*++argv, &scanOpts);
     }
-
-    printf("Scan completed in %ld seconds:\n", time(NULL) - start);
-    printf("  Directories : %ld\n", gStats.numDirectories);
-    printf("  Files       : %ld (%ld good disk images)\n", gStats.numFiles,
-        gStats.goodDiskImages);
+    if (scanOpts.pQueue != nil)
+        ScanQueueFinish(scanOpts.pQueue);
+
+    fflush(scanOpts.outfp);
+    fprintf(infofp, "Scan completed in %ld seconds:\n", time(NULL) - start);
+    fprintf(infofp, "  Directories : %ld\n", gStats.numDirectories);
+    fprintf(infofp, "  Files       : %ld (%ld good disk images)\n",
+        gStats.numFiles, gStats.goodDiskImages);
 
     Global::AppCleanup();
 
@@ -0,0 +1,385 @@
+/*
+ * CiderPress
+ * Copyright (C) 2007 by faddenSoft, LLC.  All Rights Reserved.
+ * See the file LICENSE for distribution terms.
+ */
+/*
+ * Benchmark the 5.25" nibble decoders.
+ *
+ * Pulls the sector data fields out of one or more nibble images (.nib or
+ * .nb2), then times each of the DiskImg decoders as it works through all
+ * of them.  The output of every decoder is checked against the reference
+ * implementation.  With no files, a set of randomly filled sectors is
+ * encoded and used instead.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+#include "../diskimg/DiskImg.h"
+
+using namespace DiskImgLib;
+
+#define NELEM(x) (sizeof(x) / sizeof((x)[0]))
+
+const int kMaxFieldLen = 411;       // 5&3 data field, with checksum
+const int kMaxFields = 16384;
+const int kDefaultReps = 200;
+const int kNumTrials = 3;           // report the fastest of this many
+
+bool gVerbose = false;
+
+/*
+ * One data field from the corpus.
+ */
+typedef struct Field {
+    const DiskImg::NibbleDescr* pDescr;
+    uint8_t     data[kMaxFieldLen];
+    uint8_t     expected[256];      // output of reference decoder
+    DIError     expectedErr;
+} Field;
+
+Field* gFields = NULL;
+int gNumFields = 0;
+
+static const struct {
+    DiskImg::NibbleCodec codec;
+    const char* name;
+} kCodecs[] = {
+    { DiskImg::kNibbleCodecScalar,  "scalar" },
+    { DiskImg::kNibbleCodecTable,   "table" },
+    { DiskImg::kNibbleCodecSSE2,    "sse2" },
+};
+
+
+/*
+ * Show (or don't show) DiskImg library debug messages.
+ */
+void MsgHandler(const char* file, int line, const char* msg)
+{
+    if (gVerbose)
+        fprintf(stderr, "%s:%d %s\n", file, line, msg);
+}
+
+/*
+ * Get a monotonic timestamp, in nanoseconds.
+ */
+static double NowNsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1.0e9 + ts.tv_nsec;
+}
+
+/*
+ * Add a field to the corpus, decoding it with the reference decoder.
+ */
+static void AddField(const uint8_t* data, const DiskImg::NibbleDescr* pDescr)
+{
+    if (gNumFields == kMaxFields)
+        return;
+
+    Field* pField = &gFields[gNumFields++];
+    pField->pDescr = pDescr;
+    memcpy(pField->data, data, DiskImg::GetNibbleFieldSize(pDescr));
+
+    DiskImg::SetNibbleCodec(DiskImg::kNibbleCodecScalar);
+    pField->expectedErr = DiskImg::DecodeNibbleField(pField->data,
+                            pField->expected, pDescr);
+}
+
+/*
+ * Find the data fields on every track of a nibble image.
+ *
+ * We look for the data prolog, then see if what follows decodes cleanly
+ * as 6&2 or 5&3.  Address fields are ignored, so this works on anything
+ * with standard data fields.
+ */
+static int LoadImage(const char* fileName)
+{
+    const DiskImg::NibbleDescr* pDescr62 =
+        DiskImg::GetStdNibbleDescr(DiskImg::kNibbleDescrDOS33Std);
+    const DiskImg::NibbleDescr* pDescr53 =
+        DiskImg::GetStdNibbleDescr(DiskImg::kNibbleDescrDOS32Std);
+    uint8_t* fileBuf = NULL;
+    uint8_t* trackBuf = NULL;
+    long fileLen, trackLen;
+    int startCount = gNumFields;
+    int result = -1;
+    FILE* fp;
+
+    fp = fopen(fileName, "rb");
+    if (fp == NULL) {
+        perror(fileName);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    fileLen = ftell(fp);
+    rewind(fp);
+
+    if (fileLen > 0 && fileLen % 6656 == 0)
+        trackLen = 6656;
+    else if (fileLen > 0 && fileLen % 6384 == 0)
+        trackLen = 6384;
+    else {
+        fprintf(stderr, "%s: not a .nib or .nb2 image\n", fileName);
+        goto bail;
+    }
+
+    fileBuf = new uint8_t[fileLen];
+    trackBuf = new uint8_t[trackLen * 2];
+    if (fread(fileBuf, fileLen, 1, fp) != 1) {
+        fprintf(stderr, "%s: read failed\n", fileName);
+        goto bail;
+    }
+
+    for (long offset = 0; offset < fileLen; offset += trackLen) {
+        /* double it up, so fields that wrap around are contiguous */
+        memcpy(trackBuf, fileBuf + offset, trackLen);
+        memcpy(trackBuf + trackLen, fileBuf + offset, trackLen);
+
+        for (long posn = 0; posn < trackLen; posn++) {
+            const uint8_t* ptr = trackBuf + posn;
+            if (ptr[0] != 0xd5 || ptr[1] != 0xaa || ptr[2] != 0xad)
+                continue;
+
+            uint8_t sctBuf[256];
+            if (DiskImg::DecodeNibbleField(ptr + 3, sctBuf, pDescr62) ==
+                    kDIErrNone)
+                AddField(ptr + 3, pDescr62);
+            else if (DiskImg::DecodeNibbleField(ptr + 3, sctBuf, pDescr53) ==
+                    kDIErrNone)
+                AddField(ptr + 3, pDescr53);
+        }
+    }
+
+    printf("%s: %d data fields\n", fileName, gNumFields - startCount);
+    result = 0;
+
+bail:
+    delete[] fileBuf;
+    delete[] trackBuf;
+    fclose(fp);
+    return result;
+}
+
+/*
+ * Generate fields from random sector data.  A few of them get a damaged
+ * byte, so the error paths are compared too.
+ */
+static void MakeRandomCorpus(void)
+{
+    const DiskImg::NibbleDescr* pDescr62 =
+        DiskImg::GetStdNibbleDescr(DiskImg::kNibbleDescrDOS33Std);
+    const DiskImg::NibbleDescr* pDescr53 =
+        DiskImg::GetStdNibbleDescr(DiskImg::kNibbleDescrDOS32Std);
+    uint8_t sctBuf[256];
+    uint8_t field[kMaxFieldLen];
+
+    srand(1);
+    for (int i = 0; i < 35 * 16 + 35 * 13; i++) {
+        const DiskImg::NibbleDescr* pDescr =
+            (i < 35 * 16) ? pDescr62 : pDescr53;
+
+        for (int j = 0; j < 256; j++)
+            sctBuf[j] = rand() & 0xff;
+        DiskImg::EncodeNibbleField(field, sctBuf, pDescr);
+        if ((i % 50) == 49)
+            field[rand() % DiskImg::GetNibbleFieldSize(pDescr)] = 0xd5;
+        else if ((i % 50) == 48)
+            field[rand() % DiskImg::GetNibbleFieldSize(pDescr)] ^= 0x01;
+        AddField(field, pDescr);
+    }
+
+    printf("generated %d random data fields\n", gNumFields);
+}
+
+/*
+ * Run every field with encoding "enc" through the current decoder "reps"
+ * times, kNumTrials times over.  Returns the best time per field in
+ * nanoseconds, or -1 if a result didn't match the reference.
+ */
+static double TimeDecoder(DiskImg::NibbleEnc enc, int reps, int* pCount)
+{
+    uint8_t sctBuf[256];
+    int count = 0;
+    int i;
+
+    /* check results on the first pass */
+    for (i = 0; i < gNumFields; i++) {
+        Field* pField = &gFields[i];
+        if (pField->pDescr->encoding != enc)
+            continue;
+        count++;
+
+        DIError dierr = DiskImg::DecodeNibbleField(pField->data, sctBuf,
+                            pField->pDescr);
+        if (dierr != pField->expectedErr ||
+            (dierr == kDIErrNone &&
+             memcmp(sctBuf, pField->expected, sizeof(sctBuf)) != 0))
+        {
+            fprintf(stderr, "MISMATCH on field %d (err=%d expected=%d)\n",
+                i, dierr, pField->expectedErr);
+            return -1.0;
+        }
+    }
+    *pCount = count;
+    if (count == 0)
+        return 0.0;
+
+    double best = -1.0;
+    for (int trial = 0; trial < kNumTrials; trial++) {
+        double start = NowNsec();
+        for (int rep = 0; rep < reps; rep++) {
+            for (i = 0; i < gNumFields; i++) {
+                if (gFields[i].pDescr->encoding != enc)
+                    continue;
+                (void) DiskImg::DecodeNibbleField(gFields[i].data, sctBuf,
+                        gFields[i].pDescr);
+            }
+        }
+        double elapsed = NowNsec() - start;
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return best / ((double) count * reps);
+}
+
+/*
+ * Time the encoder on the fields' sector data.
+ */
+static double TimeEncoder(DiskImg::NibbleEnc enc, int reps)
+{
+    uint8_t field[kMaxFieldLen];
+    int count = 0;
+    int i;
+
+    double start = NowNsec();
+    for (int rep = 0; rep < reps; rep++) {
+        for (i = 0; i < gNumFields; i++) {
+            if (gFields[i].pDescr->encoding != enc)
+                continue;
+            DiskImg::EncodeNibbleField(field, gFields[i].expected,
+                gFields[i].pDescr);
+            count++;
+        }
+    }
+    double elapsed = NowNsec() - start;
+
+    return count == 0 ? 0.0 : elapsed / count;
+}
+
+/*
+ * Time every available decoder on each encoding.  Returns 0 if all of
+ * them agreed with the reference.
+ */
+static int RunBenchmark(int reps)
+{
+    static const struct {
+        DiskImg::NibbleEnc enc;
+        const char* name;
+    } kEncodings[] = {
+        { DiskImg::kNibbleEnc62, "6&2" },
+        { DiskImg::kNibbleEnc53, "5&3" },
+    };
+    int result = 0;
+
+    for (int e = 0; e < (int) NELEM(kEncodings); e++) {
+        double refTime = 0.0;
+        int count = 0;
+
+        for (int c = 0; c < (int) NELEM(kCodecs); c++) {
+            // there's no SSE2 decoder for 5&3
+            if (kEncodings[e].enc == DiskImg::kNibbleEnc53 &&
+                kCodecs[c].codec == DiskImg::kNibbleCodecSSE2)
+            {
+                continue;
+            }
+            if (!DiskImg::SetNibbleCodec(kCodecs[c].codec)) {
+                printf("  %s %-7s: not available\n", kEncodings[e].name,
+                    kCodecs[c].name);
+                continue;
+            }
+
+            double nsec = TimeDecoder(kEncodings[e].enc, reps, &count);
+            if (nsec < 0) {
+                printf("  %s %-7s: FAILED\n", kEncodings[e].name,
+                    kCodecs[c].name);
+                result = -1;
+                continue;
+            }
+            if (count == 0)
+                break;
+            if (kCodecs[c].codec == DiskImg::kNibbleCodecScalar)
+                refTime = nsec;
+
+            printf("  %s %-7s: %8.1f ns/sector  %6.1f MB/s  x%.2f\n",
+                kEncodings[e].name, kCodecs[c].name, nsec,
+                256.0 * 1000.0 / nsec, refTime / nsec);
+        }
+        if (count == 0) {
+            printf("  %s: no fields\n", kEncodings[e].name);
+            continue;
+        }
+
+        double nsec = TimeEncoder(kEncodings[e].enc, reps);
+        printf("  %s %-7s: %8.1f ns/sector  %6.1f MB/s\n",
+            kEncodings[e].name, "encode", nsec, 256.0 * 1000.0 / nsec);
+    }
+
+    return result;
+}
+
+/*
+ * Process every argument.
+ */
+int main(int argc, char** argv)
+{
+    int reps = kDefaultReps;
+    int result = 0;
+    int ic;
+
+    while ((ic = getopt(argc, argv, "n:v")) != -1) {
+        switch (ic) {
+        case 'n':
+            reps = atoi(optarg);
+            break;
+        case 'v':
+            gVerbose = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n reps] [-v] [file.nib ...]\n",
+                argv[0]);
+            exit(2);
+        }
+    }
+    if (reps <= 0)
+        reps = 1;
+
+    Global::SetDebugMsgHandler(MsgHandler);
+    Global::AppInit();
+
+    gFields = new Field[kMaxFields];
+
+    if (optind == argc) {
+        MakeRandomCorpus();
+    } else {
+        for (int i = optind; i < argc; i++) {
+            if (LoadImage(argv[i]) != 0)
+                result = 1;
+        }
+    }
+
+    printf("%d fields, %d reps\n", gNumFields, reps);
+    if (RunBenchmark(reps) != 0)
+        result = 1;
+
+    DiskImg::SetNibbleCodec(DiskImg::kNibbleCodecAuto);
+    delete[] gFields;
+    Global::AppCleanup();
+
+    exit(result);
+}
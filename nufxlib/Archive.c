@@ -95,6 +95,8 @@ static NuError Nu_NuArchiveNew(NuArchive** ppArchive)
     (*ppArchive)->valJunkSkipMax = kDefaultJunkSkipMax;
     (*ppArchive)->valIgnoreLZW2Len = false;
     (*ppArchive)->valHandleBadMac = false;
+    (*ppArchive)->valCodecThreads = 1;
+    (*ppArchive)->valAppendInPlace = false;
 
     (*ppArchive)->messageHandlerFunc = gNuGlobalErrorMessageHandler;
 
@@ -8,6 +8,11 @@
  */
 #include "NufxLibPriv.h"
 
+#if !defined(_WIN32) && defined(HAVE_PTHREAD)
+# include <pthread.h>
+# define NU_UNICODE_TABLE_ONCE
+#endif
+
 /*
  * Convert Mac OS Roman to Unicode.  Mapping comes from:
  *
@@ -286,17 +291,29 @@ static const uint16_t gMORToUnicode[256] = {
  * allow; so it makes more sense to treat it as illegal.)
  */
 static uint8_t gUnicodeToMOR[65536] = { 0xff /*indicates not initialized*/ };
+#ifdef NU_UNICODE_TABLE_ONCE
+static pthread_once_t gUnicodeToMOROnce = PTHREAD_ONCE_INIT;
+#endif
 
 static void Nu_GenerateUnicodeToMOR(void)
 {
-    memset(gUnicodeToMOR, 0, sizeof(gUnicodeToMOR));
-
+    /*
+     * The rest of the table is already zero, so we only fill in the
+     * entries we have, and clear the "not initialized" flag in entry 0
+     * last.  (No MOR character maps to 0x0000.)
+     *
+     * Conversions can happen on several threads at once, so this runs
+     * under pthread_once where we have it.  Without it there's no barrier
+     * between the table and the flag, and we're relying on the library
+     * not being used from more than one thread.
+     */
     int i;
     for (i = 0; i < 256; i++) {
         int codePoint = gMORToUnicode[i];
-        Assert(codePoint >= 0 && codePoint < 65536);
+        Assert(codePoint > 0 && codePoint < 65536);
         gUnicodeToMOR[codePoint] = i;
     }
+    gUnicodeToMOR[0] = 0;
 }
 
 
@@ -484,10 +501,13 @@ size_t Nu_ConvertUNIToMOR(const UNICHAR* stringUNI, char* bufMOR,
      * a valid conversion (either because it's not in the table, or the
      * UTF-8 code is damaged) we just insert an ASCII '?'.
      */
-    if (gUnicodeToMOR[0] == 0xff) {
+#ifdef NU_UNICODE_TABLE_ONCE
+    pthread_once(&gUnicodeToMOROnce, Nu_GenerateUnicodeToMOR);
+#else
+    if (gUnicodeToMOR[0] == 0xff)
         Nu_GenerateUnicodeToMOR();
-        Assert(gUnicodeToMOR[0] != 0xff);
-    }
+#endif
+    Assert(gUnicodeToMOR[0] != 0xff);
 
     uint32_t codePoint;
     size_t morLen = 0;
@@ -1695,6 +1695,75 @@ bail:
     return err;
 }
 
+/*
+ * Remove deleted records from the original archive by sliding everything
+ * after the first one down over the gap.  Records ahead of the first
+ * deletion aren't touched, so deleting something near the end of a large
+ * archive is cheap.  The file offsets in the "copy" set are updated to
+ * match.
+ *
+ * This must come after Nu_UpdateInOriginal, which works with the original
+ * offsets.  Unlike the other in-place updates, a failure here leaves the
+ * archive damaged.
+ *
+ * On exit, pArchive->archiveFp will point at the (new) archive EOF.
+ */
+static NuError Nu_CompactInOriginal(NuArchive* pArchive)
+{
+    NuError err = kNuErrNone;
+    const NuRecord* pOrigRecord;
+    NuRecord* pRecord;
+    long nextOffset, recordLen, offsetAdjust;
+    int i;
+
+    if (!Nu_RecordSet_GetLoaded(&pArchive->copyRecordSet) ||
+        Nu_RecordSet_GetNumRecords(&pArchive->copyRecordSet) ==
+        Nu_RecordSet_GetNumRecords(&pArchive->origRecordSet))
+    {
+        /* nothing was deleted; Nu_UpdateInOriginal left us at EOF */
+        goto bail;
+    }
+    Assert(Nu_RecordSet_GetNumRecords(&pArchive->copyRecordSet) <
+        Nu_RecordSet_GetNumRecords(&pArchive->origRecordSet));
+
+    /* records are packed end to end, starting at the first one */
+    pOrigRecord = Nu_RecordSet_GetListHead(&pArchive->origRecordSet);
+    Assert(pOrigRecord != NULL);
+    nextOffset = pOrigRecord->fileOffset;
+
+    pRecord = Nu_RecordSet_GetListHead(&pArchive->copyRecordSet);
+    while (pRecord != NULL) {
+        recordLen = pRecord->recHeaderLength + pRecord->totalCompLength;
+        offsetAdjust = nextOffset - pRecord->fileOffset;
+        Assert(offsetAdjust <= 0);
+
+        if (offsetAdjust != 0) {
+            DBUG(("--- Moving record '%s' (off=%ld adj=%ld)\n",
+                pRecord->filenameMOR, pRecord->fileOffset, offsetAdjust));
+            err = Nu_MoveFileSection(pArchive, pArchive->archiveFp,
+                    nextOffset, pRecord->fileOffset, recordLen);
+            BailError(err);
+
+            pRecord->fileOffset += offsetAdjust;
+            for (i = 0; i < (int)pRecord->recTotalThreads; i++) {
+                NuThread* pThread = Nu_GetThread(pRecord, i);
+
+                pThread->fileOffset += offsetAdjust;
+            }
+        }
+
+        nextOffset += recordLen;
+        pRecord = pRecord->pNext;
+    }
+
+    DBUG(("--- Compacted archive EOF is now %ld\n", nextOffset));
+    err = Nu_FSeek(pArchive->archiveFp, nextOffset, SEEK_SET);
+    BailError(err);
+
+bail:
+    return err;
+}
+
 
 /*
  * Create new records for all items in the "new" list, writing them to
@@ -1748,8 +1817,14 @@ bail:
  *
  * If the "copy" record set hasn't been loaded, we're done.  If it has
  * been loaded, we scan through the list for thread mods other than updates
- * to pre-sized fields.  We also have to check to see if any records were
- * deleted.
+ * to pre-sized fields.
+ *
+ * Deleted records don't count, because Nu_CompactInOriginal can close
+ * up the holes they leave without a temp file.  (You can't add to the
+ * "copy" set, so deletions only ever shrink the archive.)  That's only
+ * true if no new records are pending, though.  Once the records have
+ * been moved there's no going back, so if adding the new records failed
+ * we'd be left with neither the old archive nor the new one.
  *
  * At present, a "dirtyHeader" flag is not of itself cause to rebuild
  * the archive, so we don't test for it here.
@@ -1763,14 +1838,9 @@ static Boolean Nu_NoHeavyUpdates(NuArchive* pArchive)
     if (!Nu_RecordSet_GetLoaded(&pArchive->copyRecordSet))
         return true;
 
-    /*
-     * You can't add to "copy" set, so any deletions are visible by the
-     * reduced record count.  The function that deletes records from
-     * which all threads have been removed should be called before we
-     * get here.
-     */
     if (Nu_RecordSet_GetNumRecords(&pArchive->copyRecordSet) !=
-        Nu_RecordSet_GetNumRecords(&pArchive->origRecordSet))
+            Nu_RecordSet_GetNumRecords(&pArchive->origRecordSet) &&
+        !Nu_RecordSet_IsEmpty(&pArchive->newRecordSet))
     {
         return false;
     }
@@ -1851,15 +1921,13 @@ bail:
 
 /*
  * Update the "new" master header block with the contents of the modified
- * archive, and write it to the file.
+ * archive.  This doesn't write it to the file; use Nu_WriteMasterHeader
+ * for that.
  *
- * Pass in a correctly positioned "fp" and the total length of the archive
- * file.
+ * Pass in the total length of the archive file.
  */
-static NuError Nu_UpdateMasterHeader(NuArchive* pArchive, FILE* fp,
-    long archiveEOF)
+static NuError Nu_UpdateMasterHeader(NuArchive* pArchive, long archiveEOF)
 {
-    NuError err;
     long numRecords;
 
     Nu_MasterHeaderCopy(pArchive, &pArchive->newMasterHeader,
@@ -1876,8 +1944,7 @@ static NuError Nu_UpdateMasterHeader(NuArchive* pArchive, FILE* fp,
     if (numRecords == 0) {
         /* don't allow empty archives */
         DBUG(("--- UpdateMasterHeader didn't find any records\n"));
-        err = kNuErrNoRecords;
-        goto bail;
+        return kNuErrNoRecords;
     }
     #endif
 
@@ -1886,10 +1953,45 @@ static NuError Nu_UpdateMasterHeader(NuArchive* pArchive, FILE* fp,
     pArchive->newMasterHeader.mhMasterVersion = kNuOurMHVersion;
     Nu_SetCurrentDateTime(&pArchive->newMasterHeader.mhArchiveModWhen);
 
-    err = Nu_WriteMasterHeader(pArchive, fp, &pArchive->newMasterHeader);
+    return kNuErrNone;
+}
+
+/*
+ * Write a master header (and wrapper) that matches the original archive
+ * after Nu_CompactInOriginal has closed up the holes.  Until we do, the
+ * header still has the old record count and EOF, which no longer match
+ * what's in the file.
+ *
+ * "archiveFp" should be positioned at the new archive EOF, and will be
+ * left there.  The "new" master header is reset, so the usual one can
+ * be written later.
+ */
+static NuError Nu_WriteCompactedHeader(NuArchive* pArchive)
+{
+    NuError err;
+    long archiveEOF;
+
+    err = Nu_FTell(pArchive->archiveFp, &archiveEOF);
+    BailError(err);
+    err = Nu_UpdateMasterHeader(pArchive,
+            archiveEOF - pArchive->headerOffset);
+    BailError(err);
+
+    err = Nu_FSeek(pArchive->archiveFp, pArchive->headerOffset, SEEK_SET);
+    BailError(err);
+    err = Nu_WriteMasterHeader(pArchive, pArchive->archiveFp,
+            &pArchive->newMasterHeader);
+    BailError(err);
+    if (pArchive->headerOffset) {
+        err = Nu_UpdateWrapper(pArchive, pArchive->archiveFp);
+        BailError(err);
+    }
+
+    err = Nu_FSeek(pArchive->archiveFp, archiveEOF, SEEK_SET);
     BailError(err);
 
 bail:
+    pArchive->newMasterHeader.isValid = false;
     return err;
 }
 
@@ -2111,7 +2213,8 @@ bail:
  */
 
 /*
- * Force all deferred changes to occur.
+ * Force all deferred changes to occur.  If "rewrite" is set, the archive
+ * is rebuilt in the temp file even if nothing has changed.
  *
  * If the flush fails, the archive state may be aborted or even placed
  * into read-only mode to prevent problems from compounding.
@@ -2119,7 +2222,8 @@ bail:
  * If the things this function is doing aren't making any sense at all,
  * read "NOTES.txt" for an introduction.
  */
-NuError Nu_Flush(NuArchive* pArchive, uint32_t* pStatusFlags)
+static NuError Nu_FlushChanges(NuArchive* pArchive, uint32_t* pStatusFlags,
+    Boolean rewrite)
 {
     NuError err = kNuErrNone;
     Boolean canAbort = true;
@@ -2127,7 +2231,7 @@ NuError Nu_Flush(NuArchive* pArchive, uint32_t* pStatusFlags)
     Boolean deleteAll = false;
     long initialEOF, finalOffset;
 
-    DBUG(("--- FLUSH\n"));
+    DBUG(("--- FLUSH (rewrite=%d)\n", rewrite));
 
     if (pStatusFlags == NULL)
         return kNuErrInvalidArg;
@@ -2140,6 +2244,14 @@ NuError Nu_Flush(NuArchive* pArchive, uint32_t* pStatusFlags)
     err = Nu_GetFileLength(pArchive, pArchive->archiveFp, &initialEOF);
     BailError(err);
 
+    if (rewrite) {
+        /* need the TOC to copy the records, and nothing to do w/o records */
+        err = Nu_GetTOCIfNeeded(pArchive);
+        BailError(err);
+        if (Nu_RecordSet_IsEmpty(&pArchive->origRecordSet))
+            rewrite = false;
+    }
+
     /*
      * Step 1: figure out if we have anything to do.  If the "copy" and "new"
      * lists are empty, then there's nothing for us to do.
@@ -2185,7 +2297,7 @@ NuError Nu_Flush(NuArchive* pArchive, uint32_t* pStatusFlags)
              */
             deleteAll = true;
             #endif
-        } else {
+        } else if (!rewrite) {
             DBUG(("--- Nothing pending\n"));
             goto flushed;
         }
@@ -2208,7 +2320,7 @@ NuError Nu_Flush(NuArchive* pArchive, uint32_t* pStatusFlags)
     /* we checked delete-all actions above, so just check for empty */
     if (Nu_RecordSet_IsEmpty(&pArchive->copyRecordSet) &&
         Nu_RecordSet_IsEmpty(&pArchive->newRecordSet) &&
-        !deleteAll)
+        !deleteAll && !rewrite)
     {
         DBUG(("--- Nothing pending after purge\n"));
         goto flushed;
@@ -2226,23 +2338,46 @@ NuError Nu_Flush(NuArchive* pArchive, uint32_t* pStatusFlags)
 
     /*
      * Step 4: decide if we want to make changes in place, or write to
-     * a temp file.  Any deletions or additions to existing records will
-     * require writing to a temp file.  Additions of new records and
-     * updates to pre-sized threads can be done in place.
+     * a temp file.  Any additions to existing records will require
+     * writing to a temp file.  Additions of new records, deletions of
+     * whole records, and updates to pre-sized threads can be done in
+     * place if the application allows us to modify the original.
+     *
+     * If the only changes are new records, and the application asked
+     * for it, we can append them to the original without putting the
+     * existing records at risk: if something goes wrong before the master
+     * header is rewritten, we just truncate the file back.
      */
     writeToTemp = true;
-    if (pArchive->valModifyOrig && Nu_NoHeavyUpdates(pArchive))
+    if (rewrite) {
+        DBUG(("--- Rewriting archive\n"));
+    } else if (pArchive->valModifyOrig && Nu_NoHeavyUpdates(pArchive)) {
         writeToTemp = false;
+    } else if (pArchive->valAppendInPlace && !pArchive->valDiscardWrapper &&
+        !Nu_RecordSet_GetLoaded(&pArchive->copyRecordSet))
+    {
+        DBUG(("--- Only new records, appending in place\n"));
+        writeToTemp = false;
+    }
     /* discard the wrapper, if desired */
     if (writeToTemp && pArchive->valDiscardWrapper)
         pArchive->headerOffset = 0;
 
+    /*
+     * The steps below replace thread lists and filenames in the "copy" and
+     * "new" records, so any lookup indexes on those sets go stale.  Nothing
+     * searches them while we're in here, so just throw them away.
+     */
+    Nu_RecordSet_InvalidateIndex(&pArchive->copyRecordSet);
+    Nu_RecordSet_InvalidateIndex(&pArchive->newRecordSet);
+
     /*
      * Step 5: handle updates to existing records.
      */
     if (!writeToTemp) {
         /*
-         * Step 5a: modifying in place, process all UPDATE ThreadMods now.
+         * Step 5a: modifying in place, process all UPDATE ThreadMods now,
+         * then close up any holes left by deleted records.
          */
         DBUG(("--- No heavy updates found, updating in place\n"));
         if (Nu_RecordSet_GetLoaded(&pArchive->copyRecordSet))
@@ -2255,6 +2390,31 @@ NuError Nu_Flush(NuArchive* pArchive, uint32_t* pStatusFlags)
             Nu_ReportError(NU_BLOB, err, "update to original failed");
             goto bail;
         }
+
+        err = Nu_CompactInOriginal(pArchive);
+        if (err != kNuErrNone) {
+            *pStatusFlags |= kNuFlushCorrupted;
+            Nu_ReportError(NU_BLOB, err, "removal of deleted records failed");
+            goto bail;
+        }
+
+        /*
+         * If records were removed, get the master header in line with
+         * the file right away, so a failure in a later step doesn't
+         * leave it describing records that have moved.
+         */
+        if (Nu_RecordSet_GetLoaded(&pArchive->copyRecordSet) &&
+            Nu_RecordSet_GetNumRecords(&pArchive->copyRecordSet) !=
+            Nu_RecordSet_GetNumRecords(&pArchive->origRecordSet))
+        {
+            err = Nu_WriteCompactedHeader(pArchive);
+            if (err != kNuErrNone) {
+                *pStatusFlags |= kNuFlushCorrupted;
+                Nu_ReportError(NU_BLOB, err,
+                    "failed writing master header after removal");
+                goto bail;
+            }
+        }
     } else {
         /*
          * Step 5b: not modifying in place, reconstruct the appropriate
@@ -2306,24 +2466,13 @@ NuError Nu_Flush(NuArchive* pArchive, uint32_t* pStatusFlags)
     }
 
     /*
-     * Step 8: create an updated master header, and write it to the
-     * appropriate file.  The "newMasterHeader" field in pArchive will
-     * hold the new header.
+     * Step 8: create an updated master header.  The "newMasterHeader"
+     * field in pArchive will hold the new header.  It isn't written until
+     * the wrapper has been updated (step 10).
      */
     Assert(!pArchive->newMasterHeader.isValid);
-    if (writeToTemp) {
-        err = Nu_FSeek(pArchive->tmpFp, pArchive->headerOffset, SEEK_SET);
-        BailError(err);
-        err = Nu_UpdateMasterHeader(pArchive, pArchive->tmpFp,
-                finalOffset - pArchive->headerOffset);
-        /* fall through with err */
-    } else {
-        err = Nu_FSeek(pArchive->archiveFp, pArchive->headerOffset, SEEK_SET);
-        BailError(err);
-        err = Nu_UpdateMasterHeader(pArchive, pArchive->archiveFp,
-                finalOffset - pArchive->headerOffset);
-        /* fall through with err */
-    }
+    err = Nu_UpdateMasterHeader(pArchive,
+            finalOffset - pArchive->headerOffset);
     if (err == kNuErrNoRecords && !deleteAll) {
         /*
          * Somehow we ended up without any records at all.  If we managed
@@ -2333,7 +2482,7 @@ NuError Nu_Flush(NuArchive* pArchive, uint32_t* pStatusFlags)
         Nu_ReportError(NU_BLOB, kNuErrNone, "no records in this archive");
         goto bail;
     } else if (err != kNuErrNone) {
-        Nu_ReportError(NU_BLOB, err, "failed writing master header");
+        Nu_ReportError(NU_BLOB, err, "failed updating master header");
         goto bail;
     }
     Assert(pArchive->newMasterHeader.isValid);
@@ -2374,7 +2523,32 @@ NuError Nu_Flush(NuArchive* pArchive, uint32_t* pStatusFlags)
     }
 
     /*
-     * Step 10: if necessary, remove the original file and rename the
+     * Step 10: write the new master header to the appropriate file.
+     *
+     * When appending in place, this is the point of no return: until the
+     * header is rewritten, the original still describes only the old
+     * records, and truncating it back to its initial EOF restores it.
+     * Doing this after the wrapper update means a failure there can't
+     * leave a header that points past the end of the truncated file.
+     */
+    if (writeToTemp) {
+        err = Nu_FSeek(pArchive->tmpFp, pArchive->headerOffset, SEEK_SET);
+        BailError(err);
+        err = Nu_WriteMasterHeader(pArchive, pArchive->tmpFp,
+                &pArchive->newMasterHeader);
+    } else {
+        err = Nu_FSeek(pArchive->archiveFp, pArchive->headerOffset, SEEK_SET);
+        BailError(err);
+        err = Nu_WriteMasterHeader(pArchive, pArchive->archiveFp,
+                &pArchive->newMasterHeader);
+    }
+    if (err != kNuErrNone) {
+        Nu_ReportError(NU_BLOB, err, "failed writing master header");
+        goto bail;
+    }
+
+    /*
+     * Step 11: if necessary, remove the original file and rename the
      * temp file over it.
      *
      * I'm not messing with access permissions on the archive file here,
@@ -2449,7 +2623,7 @@ bail_reopen:
     Assert(canAbort == false);
 
     /*
-     * Step 11: clean up data structures.  If we have a "copy" list, then
+     * Step 12: clean up data structures.  If we have a "copy" list, then
      * throw out the "orig" list and move the "copy" list over it.  Append
      * anything in the "new" list to it.  Move the "new" master header
      * over the original.
@@ -2472,7 +2646,7 @@ bail_reopen:
 
 flushed:
     /*
-     * Step 12: reset the "copy" and "new" lists, and reset the temp file.
+     * Step 13: reset the "copy" and "new" lists, and reset the temp file.
      * Clear out the "new" master header copy.
      */
     err = Nu_RecordSet_FreeAllRecords(pArchive, &pArchive->copyRecordSet);
@@ -2534,6 +2708,29 @@ bail:
 }
 
 
+/*
+ * Force all deferred changes to occur.
+ */
+NuError Nu_Flush(NuArchive* pArchive, uint32_t* pStatusFlags)
+{
+    return Nu_FlushChanges(pArchive, pStatusFlags, false);
+}
+
+/*
+ * Flush any deferred changes, and rebuild the archive through the temp
+ * file whether or not there were any.
+ *
+ * Appending and deleting in place can leave unused space behind, e.g.
+ * junk past the end of the archive on systems where we can't truncate
+ * the file, or when a crash interrupted an append.  This squeezes it out,
+ * and drops the wrapper if kNuValueDiscardWrapper is set.
+ */
+NuError Nu_Compact(NuArchive* pArchive, uint32_t* pStatusFlags)
+{
+    return Nu_FlushChanges(pArchive, pStatusFlags, true);
+}
+
+
 /*
  * Abort any pending changes.
  */
@@ -258,6 +258,53 @@ NUFXLIB_API NuError NuGetRecordIdxByPosition(NuArchive* pArchive, uint32_t posit
     return err;
 }
 
+NUFXLIB_API NuError NuCreateThreadReader(NuArchive* pArchive,
+    NuThreadIdx threadIdx, NuThreadReader** ppReader)
+{
+    NuError err;
+
+#ifdef ENABLE_LZW
+    if ((err = Nu_ValidateNuArchive(pArchive)) == kNuErrNone) {
+        Nu_SetBusy(pArchive);
+        err = Nu_ThreadReader_New(pArchive, threadIdx, ppReader);
+        Nu_ClearBusy(pArchive);
+    }
+#else
+    err = kNuErrUnsupFeature;
+#endif
+
+    return err;
+}
+
+NUFXLIB_API NuError NuReadThreadChunk(NuThreadReader* pReader,
+    uint32_t chunkIdx, uint8_t* buf)
+{
+    NuError err;
+
+#ifdef ENABLE_LZW
+    if (pReader == NULL)
+        return kNuErrInvalidArg;
+    if ((err = Nu_ValidateNuArchive(pReader->pArchive)) == kNuErrNone) {
+        Nu_SetBusy(pReader->pArchive);
+        err = Nu_ThreadReader_Read(pReader, chunkIdx, buf);
+        Nu_ClearBusy(pReader->pArchive);
+    }
+#else
+    err = kNuErrUnsupFeature;
+#endif
+
+    return err;
+}
+
+NUFXLIB_API NuError NuFreeThreadReader(NuThreadReader* pReader)
+{
+#ifdef ENABLE_LZW
+    return Nu_ThreadReader_Free(pReader);
+#else
+    return kNuErrUnsupFeature;
+#endif
+}
+
 
 /*
  * ===========================================================================
@@ -289,6 +336,19 @@ NUFXLIB_API NuError NuFlush(NuArchive* pArchive, uint32_t* pStatusFlags)
     return err;
 }
 
+NUFXLIB_API NuError NuCompact(NuArchive* pArchive, uint32_t* pStatusFlags)
+{
+    NuError err;
+
+    if ((err = Nu_ValidateNuArchive(pArchive)) == kNuErrNone) {
+        Nu_SetBusy(pArchive);
+        err = Nu_Compact(pArchive, pStatusFlags);
+        Nu_ClearBusy(pArchive);
+    }
+
+    return err;
+}
+
 NUFXLIB_API NuError NuAbort(NuArchive* pArchive)
 {
     NuError err;
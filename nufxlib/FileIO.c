@@ -1422,6 +1422,55 @@ bail:
     return err;
 }
 
+/*
+ * Move a section of a file toward the start of the same file.  The regions
+ * may overlap, which is why the destination must come first.
+ */
+NuError Nu_MoveFileSection(NuArchive* pArchive, FILE* fp, long dstOffset,
+    long srcOffset, long length)
+{
+    NuError err;
+    long readLen;
+
+    Assert(pArchive != NULL);
+    Assert(fp != NULL);
+    Assert(dstOffset <= srcOffset);
+    Assert(length >= 0);
+
+    err = Nu_AllocCompressionBufferIFN(pArchive);
+    BailError(err);
+
+    DBUG(("+++ Moving %ld bytes from %ld to %ld\n",
+        length, srcOffset, dstOffset));
+
+    /* we have to seek between the read and the write on a stdio stream */
+    while (length) {
+        readLen = length > kNuGenCompBufSize ?  kNuGenCompBufSize : length;
+
+        err = Nu_FSeek(fp, srcOffset, SEEK_SET);
+        BailError(err);
+        err = Nu_FRead(fp, pArchive->compBuf, readLen);
+        if (err != kNuErrNone) {
+            Nu_ReportError(NU_BLOB, err,
+                "Nu_FRead failed while moving file section "
+                "(srcOffset=%ld, readLen=%ld, length=%ld)",
+                srcOffset, readLen, length);
+            goto bail;
+        }
+        err = Nu_FSeek(fp, dstOffset, SEEK_SET);
+        BailError(err);
+        err = Nu_FWrite(fp, pArchive->compBuf, readLen);
+        BailError(err);
+
+        srcOffset += readLen;
+        dstOffset += readLen;
+        length -= readLen;
+    }
+
+bail:
+    return err;
+}
+
 
 /*
  * Find the length of an open file.
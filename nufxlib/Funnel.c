@@ -310,6 +310,30 @@ void Nu_FunnelSetMaxOutput(NuFunnel* pFunnel, uint32_t maxBytes)
 #endif
 
 
+/*
+ * The text conversion code works on eight bytes at a time where it can.
+ * These are the usual "SWAR" tricks: kNuWordHasZero(x) is nonzero if any
+ * byte in "x" is zero.  It can flag a byte above a zero byte by mistake,
+ * but never misses one, and never flags anything if there are no zero
+ * bytes, so we just use it to find the word and then look at the bytes.
+ */
+#define kNuWordSize         8
+#define kNuWordOnes         ((uint64_t) 0x0101010101010101ULL)
+#define kNuWordHighBits     ((uint64_t) 0x8080808080808080ULL)
+#define kNuWordLowBits      ((uint64_t) 0x7f7f7f7f7f7f7f7fULL)
+#define kNuWordHasZero(_x)  (((_x) - kNuWordOnes) & ~(_x) & kNuWordHighBits)
+
+/*
+ * Load 8 bytes from a possibly unaligned address.  The byte order doesn't
+ * matter for anything we do with it.
+ */
+static inline uint64_t Nu_LoadWord(const uint8_t* ptr)
+{
+    uint64_t word;
+    memcpy(&word, ptr, sizeof(word));
+    return word;
+}
+
 /*
  * Check to see if this is a high-ASCII file.  To qualify, EVERY
  * character must have its high bit set, except for spaces (0x20).
@@ -318,23 +342,31 @@ void Nu_FunnelSetMaxOutput(NuFunnel* pFunnel, uint32_t maxBytes)
 static Boolean Nu_CheckHighASCII(const NuFunnel* pFunnel, const uint8_t* buffer,
     uint32_t count)
 {
-    Boolean isHighASCII;
+    int i;
 
     Assert(buffer != NULL);
     Assert(count != 0);
     Assert(pFunnel->checkStripHighASCII);
 
-    isHighASCII = true;
-    while (count--) {
-        if ((*buffer & 0x80) == 0 && *buffer != 0x20) {
-            isHighASCII = false;
-            break;
+    /* only look at individual bytes when a word has a high bit clear */
+    while (count >= kNuWordSize) {
+        if ((Nu_LoadWord(buffer) & kNuWordHighBits) != kNuWordHighBits) {
+            for (i = 0; i < kNuWordSize; i++) {
+                if ((buffer[i] & 0x80) == 0 && buffer[i] != 0x20)
+                    return false;
+            }
         }
-        
+        buffer += kNuWordSize;
+        count -= kNuWordSize;
+    }
+
+    while (count--) {
+        if ((*buffer & 0x80) == 0 && *buffer != 0x20)
+            return false;
         buffer++;
     }
 
-    return isHighASCII;
+    return true;
 }
 
 /*
@@ -398,9 +430,10 @@ static const char gNuIsBinary[256] = {
 static NuValue Nu_DetermineConversion(NuFunnel* pFunnel, const uint8_t* buffer,
     uint32_t count)
 {
+    uint32_t histogram[256];
     uint32_t bufCount, numBinary, numLF, numCR;
     Boolean isHighASCII;
-    uint8_t val;
+    int val;
 
     if (count < kNuMinConvThreshold)
         return kNuConvertOff;
@@ -417,19 +450,28 @@ static NuValue Nu_DetermineConversion(NuFunnel* pFunnel, const uint8_t* buffer,
         DBUG(("+++ not even checking isHighASCII\n"));
     }
 
+    /*
+     * Count up the byte values, then total up the interesting ones.  This
+     * is much cheaper than testing every byte three different ways.
+     */
+    memset(histogram, 0, sizeof(histogram));
     bufCount = count;
-    numBinary = numLF = numCR = 0;
-    while (bufCount--) {
-        val = *buffer++;
-        if (isHighASCII)
-            val &= 0x7f;
+    while (bufCount--)
+        histogram[*buffer++]++;
+    if (isHighASCII) {
+        for (val = 0; val < 128; val++) {
+            histogram[val] += histogram[val | 0x80];
+            histogram[val | 0x80] = 0;
+        }
+    }
+
+    numBinary = 0;
+    for (val = 0; val < 256; val++) {
         if (gNuIsBinary[val])
-            numBinary++;
-        if (val == kNuCharLF)
-            numLF++;
-        if (val == kNuCharCR)
-            numCR++;
+            numBinary += histogram[val];
     }
+    numLF = histogram[kNuCharLF];
+    numCR = histogram[kNuCharCR];
 
     /* if #found is > #allowed, it's a binary file */
     if (count < 100) {
@@ -503,24 +545,78 @@ static inline void Nu_FunnelPutBlock(NuFunnel* pFunnel, const uint8_t* buf,
  */
 static inline void Nu_PutEOL(NuFunnel* pFunnel)
 {
-    uint8_t ch;
+    static const uint8_t kEOLChars[2] = { kNuCharCR, kNuCharLF };
 
     if (pFunnel->convertEOLTo == kNuEOLCR) {
-        ch = kNuCharCR;
-        Nu_FunnelPutBlock(pFunnel, &ch, 1);
+        Nu_FunnelPutBlock(pFunnel, &kEOLChars[0], 1);
     } else if (pFunnel->convertEOLTo == kNuEOLLF) {
-        ch = kNuCharLF;
-        Nu_FunnelPutBlock(pFunnel, &ch, 1);
+        Nu_FunnelPutBlock(pFunnel, &kEOLChars[1], 1);
     } else if (pFunnel->convertEOLTo == kNuEOLCRLF) {
-        ch = kNuCharCR;
-        Nu_FunnelPutBlock(pFunnel, &ch, 1);
-        ch = kNuCharLF;
-        Nu_FunnelPutBlock(pFunnel, &ch, 1);
+        Nu_FunnelPutBlock(pFunnel, kEOLChars, 2);
     } else {
         Assert(0);
     }
 }
 
+/*
+ * Return the number of bytes at the start of "buffer" that aren't CR or
+ * LF.  If "stripHigh" is set, the high bits are ignored, so 0x8d and 0x8a
+ * count as EOL characters too.
+ */
+static uint32_t Nu_FindEOL(const uint8_t* buffer, uint32_t count,
+    Boolean stripHigh)
+{
+    const uint64_t crWord = kNuWordOnes * kNuCharCR;
+    const uint64_t lfWord = kNuWordOnes * kNuCharLF;
+    uint8_t mask = stripHigh ? 0x7f : 0xff;
+    uint32_t pos = 0;
+    uint8_t uch;
+
+    while (count - pos >= kNuWordSize) {
+        uint64_t word = Nu_LoadWord(buffer + pos);
+        if (stripHigh)
+            word &= kNuWordLowBits;
+        if (kNuWordHasZero(word ^ crWord) | kNuWordHasZero(word ^ lfWord))
+            break;
+        pos += kNuWordSize;
+    }
+
+    while (pos < count) {
+        uch = buffer[pos] & mask;
+        if (uch == kNuCharCR || uch == kNuCharLF)
+            break;
+        pos++;
+    }
+
+    return pos;
+}
+
+/*
+ * Write a run of non-EOL bytes with the high bits stripped off.  The
+ * input may not be ours to modify, so we go through a small buffer.
+ */
+static void Nu_FunnelPutStripped(NuFunnel* pFunnel, const uint8_t* buffer,
+    uint32_t count)
+{
+    uint8_t stripBuf[1024];
+    uint32_t chunkLen, pos;
+
+    while (count) {
+        chunkLen = (count > sizeof(stripBuf)) ? sizeof(stripBuf) : count;
+
+        for (pos = 0; chunkLen - pos >= kNuWordSize; pos += kNuWordSize) {
+            uint64_t word = Nu_LoadWord(buffer + pos) & kNuWordLowBits;
+            memcpy(stripBuf + pos, &word, kNuWordSize);
+        }
+        for ( ; pos < chunkLen; pos++)
+            stripBuf[pos] = buffer[pos] & 0x7f;
+
+        Nu_FunnelPutBlock(pFunnel, stripBuf, chunkLen);
+        buffer += chunkLen;
+        count -= chunkLen;
+    }
+}
+
 /*
  * Write a buffer of data, using the EOL conversion associated with the
  * funnel (if any).
@@ -578,33 +674,40 @@ static NuError Nu_FunnelWriteConvert(NuFunnel* pFunnel, const uint8_t* buffer,
     } else {
         /* do the EOL conversion and optional high-bit stripping */
         Boolean lastCR = pFunnel->lastCR;   /* make local copy */
+        Boolean stripHigh = pFunnel->doStripHighASCII;
+        uint32_t runLen;
         uint8_t uch;
-        int mask;
-
-        if (pFunnel->doStripHighASCII)
-            mask = 0x7f;
-        else
-            mask = 0xff;
 
         /*
-         * We could get a significant speed improvement here by writing
-         * non-EOL chars as a larger block instead of single bytes.
+         * Write everything up to the next EOL char as a single block,
+         * then deal with the EOL.
          */
-        while (count--) {
-            uch = (*buffer) & mask;
+        while (count) {
+            runLen = Nu_FindEOL(buffer, count, stripHigh);
+            if (runLen) {
+                if (stripHigh)
+                    Nu_FunnelPutStripped(pFunnel, buffer, runLen);
+                else
+                    Nu_FunnelPutBlock(pFunnel, buffer, runLen);
+                lastCR = false;
+                buffer += runLen;
+                count -= runLen;
+                if (!count)
+                    break;
+            }
 
+            uch = *buffer & 0x7f;   /* we know it's CR or LF */
             if (uch == kNuCharCR) {
                 Nu_PutEOL(pFunnel);
                 lastCR = true;
-            } else if (uch == kNuCharLF) {
+            } else {
+                Assert(uch == kNuCharLF);
                 if (!lastCR)
                     Nu_PutEOL(pFunnel);
                 lastCR = false;
-            } else {
-                Nu_FunnelPutBlock(pFunnel, &uch, 1);
-                lastCR = false;
             }
             buffer++;
+            count--;
         }
         pFunnel->lastCR = lastCR;   /* save copy */
 
@@ -44,6 +44,16 @@
 #define kNuLZWClearCode     0x0100
 #define kNuLZWFirstCode     0x0101
 
+/*
+ * When using worker threads, each one gets a segment of this many chunks
+ * at a time.  LZW/2 starts each segment with an empty table, which costs
+ * some compression, so it uses bigger segments.
+ */
+#define kNuLZW1SegmentChunks    16
+#define kNuLZW2SegmentChunks    64
+#define Nu_LZWSegmentChunks(isType2) \
+    ((isType2) ? kNuLZW2SegmentChunks : kNuLZW1SegmentChunks)
+
 
 /* sometimes we want to get *really* verbose rather late in a large archive */
 #ifdef DEBUG_LZW
@@ -128,6 +138,7 @@ typedef struct LZWCompressState {
     uint8_t         inputBuf[kNuLZWBlockSize];      /* 4K of raw input */
     uint8_t         rleBuf[kNuLZWBlockSize*2 + kNuSafetyPadding];
     uint8_t         lzwBuf[(kNuLZWBlockSize * 3) / 2 + kNuSafetyPadding];
+    int             lzwLastBits;    /* bits used in last byte; 0 means 8 */
 
     uint16_t        chunkCrc;                   /* CRC for LZW/1 */
 
@@ -531,6 +542,7 @@ static NuError Nu_CompressLZWBlock(LZWCompressState* lzwState,
     Assert(inputBuf == inputEnd);
 
     *pOutputCount = outBuf - lzwState->lzwBuf;
+    lzwState->lzwLastBits = atBit;
 
     /*
     if (*pOutputCount < inputCount) {
@@ -543,6 +555,361 @@ static NuError Nu_CompressLZWBlock(LZWCompressState* lzwState,
     return kNuErrNone;
 }
 
+/*
+ * Write one chunk, header first.  If "keepLzw" is set, "data" holds
+ * "lzwSize" bytes of LZW output; otherwise it holds "rleSize" bytes of
+ * RLE output (or raw input, if "rleSize" is 4K).
+ */
+static NuError Nu_WriteLZWChunk(FILE* fp, Boolean isType2, Boolean keepLzw,
+    uint32_t rleSize, uint32_t lzwSize, const uint8_t* data,
+    long* pCompressedLen)
+{
+    NuError err;
+
+    if (keepLzw) {
+        /*
+         * LZW succeeded.
+         */
+        if (isType2)
+            rleSize |= 0x8000;      /* for LZW/2, set "LZW used" flag */
+
+        putc(rleSize & 0xff, fp);   /* size after RLE */
+        putc(rleSize >> 8, fp);
+        *pCompressedLen += 2;
+
+        if (isType2) {
+            /* write compressed LZW len (+4 for header bytes) */
+            putc((lzwSize+4) & 0xff, fp);
+            putc((lzwSize+4) >> 8, fp);
+            *pCompressedLen += 2;
+        } else {
+            /* set LZW/1 "LZW used" flag */
+            putc(1, fp);
+            (*pCompressedLen)++;
+        }
+
+        /* write data from LZW buffer */
+        err = Nu_FWrite(fp, data, lzwSize);
+        BailError(err);
+        *pCompressedLen += lzwSize;
+    } else {
+        /*
+         * LZW failed.
+         */
+        putc(rleSize & 0xff, fp);   /* size after RLE */
+        putc(rleSize >> 8, fp);
+        *pCompressedLen += 2;
+
+        if (!isType2) {
+            /* set LZW/1 "LZW not used" flag */
+            putc(0, fp);
+            (*pCompressedLen)++;
+        }
+
+        /* write data from RLE or plain-input buffer */
+        err = Nu_FWrite(fp, data, rleSize);
+        BailError(err);
+        *pCompressedLen += rleSize;
+    }
+
+bail:
+    return err;
+}
+
+
+/*
+ * Compressing with worker threads.
+ *
+ * LZW/1 chunks are independent of each other, so we can hand them out
+ * in any order and get exactly the same output we'd get on one thread.
+ *
+ * LZW/2 carries the table from one chunk to the next, so we have to cut
+ * the input into segments and start each segment with an empty table.
+ * The decoder doesn't know about segments, so when we join them back
+ * together we put a table clear in front of each segment that doesn't
+ * follow an empty table.  The output is a perfectly ordinary LZW/2
+ * stream, but it's a little larger than what we'd get from a single
+ * thread, and it won't match GSHK byte for byte.
+ */
+
+/* each chunk gets an output slot big enough for RLE data plus a clear */
+#define kNuLZWOutSlotSize   (kNuLZWBlockSize + kNuSafetyPadding)
+
+typedef struct LZWCompressChunk {
+    uint32_t        inLen;              /* real data in the 4K input */
+    uint32_t        rleSize;
+    uint32_t        lzwSize;
+    int             lzwLastBits;
+    Boolean         keepLzw;
+} LZWCompressChunk;
+
+typedef struct LZWCompressSegment {
+    /* LZW/2 state at the end of the segment */
+    int             nextFree;
+    int             codeBits;
+    Boolean         initialClear;
+
+    /* CRCs of just this segment's input, zero-seeded */
+    uint16_t        threadCrc;
+    uint16_t        chunkCrc;
+    uint32_t        inLen;
+} LZWCompressSegment;
+
+typedef struct LZWCompressBatch {
+    Boolean             isType2;
+    int                 numWorkers;
+    int                 numChunks;
+    LZWCompressState*   workerState;    /* one per worker */
+    uint8_t*            inBuf;          /* 4K of input per chunk */
+    uint8_t*            outBuf;         /* one output slot per chunk */
+    LZWCompressChunk*   chunks;
+    LZWCompressSegment* segs;
+} LZWCompressBatch;
+
+/*
+ * Compress every segment that belongs to "workerIdx".
+ */
+static void Nu_CompressLZWWorker(void* arg, int workerIdx)
+{
+    LZWCompressBatch* pBatch = (LZWCompressBatch*) arg;
+    LZWCompressState* lzwState = &pBatch->workerState[workerIdx];
+    int segChunks = Nu_LZWSegmentChunks(pBatch->isType2);
+    int numSegs, seg, idx, endIdx;
+
+    numSegs = (pBatch->numChunks + segChunks - 1) / segChunks;
+
+    for (seg = workerIdx; seg < numSegs; seg += pBatch->numWorkers) {
+        LZWCompressSegment* pSeg = &pBatch->segs[seg];
+
+        Nu_ClearLZWTable(lzwState);
+        pSeg->threadCrc = pSeg->chunkCrc = 0;
+        pSeg->inLen = 0;
+
+        idx = seg * segChunks;
+        endIdx = idx + segChunks;
+        if (endIdx > pBatch->numChunks)
+            endIdx = pBatch->numChunks;
+
+        for ( ; idx < endIdx; idx++) {
+            LZWCompressChunk* pChunk = &pBatch->chunks[idx];
+            uint8_t* outPtr = pBatch->outBuf + idx * kNuLZWOutSlotSize;
+            const uint8_t* lzwInputBuf;
+            int rleSize, lzwSize;
+
+            memcpy(lzwState->inputBuf, pBatch->inBuf + idx * kNuLZWBlockSize,
+                kNuLZWBlockSize);
+
+            /* see Nu_CompressLZW for why there are two */
+            pSeg->threadCrc = Nu_CalcCRC16(pSeg->threadCrc,
+                                lzwState->inputBuf, pChunk->inLen);
+            if (!pBatch->isType2) {
+                pSeg->chunkCrc = Nu_CalcCRC16(pSeg->chunkCrc,
+                                    lzwState->inputBuf, kNuLZWBlockSize);
+            }
+            pSeg->inLen += pChunk->inLen;
+
+            /* neither of these can fail */
+            (void) Nu_CompressBlockRLE(lzwState, &rleSize);
+            if (rleSize < kNuLZWBlockSize) {
+                lzwInputBuf = lzwState->rleBuf;
+            } else {
+                lzwInputBuf = lzwState->inputBuf;
+                rleSize = kNuLZWBlockSize;
+            }
+
+            if (!pBatch->isType2)
+                Nu_ClearLZWTable(lzwState);
+            (void) Nu_CompressLZWBlock(lzwState, lzwInputBuf, rleSize,
+                    &lzwSize);
+
+            /*
+             * LZW/1 uses the same rule as the single-threaded code.  For
+             * LZW/2 we leave room for the table clear we might have to
+             * add, which is never more than two bytes.
+             */
+            if (pBatch->isType2)
+                pChunk->keepLzw = (lzwSize +4 < rleSize);
+            else
+                pChunk->keepLzw = (lzwSize < rleSize);
+
+            pChunk->rleSize = rleSize;
+            pChunk->lzwSize = lzwSize;
+            if (pChunk->keepLzw) {
+                memcpy(outPtr, lzwState->lzwBuf, lzwSize);
+                pChunk->lzwLastBits = lzwState->lzwLastBits;
+            } else {
+                memcpy(outPtr, lzwInputBuf, rleSize);
+                if (pBatch->isType2)
+                    Nu_ClearLZWTable(lzwState);
+            }
+        }
+
+        pSeg->nextFree = lzwState->nextFree;
+        pSeg->codeBits = lzwState->codeBits;
+        pSeg->initialClear = lzwState->initialClear;
+    }
+}
+
+/*
+ * Put a table clear, "codeBits" wide, in front of "lzwSize" bytes of LZW
+ * output.  The buffer must have room for two more bytes.  Returns the
+ * new size.
+ */
+static uint32_t Nu_LZWPrependClear(uint8_t* buf, uint32_t lzwSize,
+    int lzwLastBits, int codeBits)
+{
+    uint32_t numBits, newSize, idx, val;
+    int shift = codeBits - 8;   /* the low byte of the clear code is zero */
+
+    Assert(shift >= 1 && shift <= 4);
+
+    if (lzwLastBits)
+        numBits = (lzwSize - 1) * 8 + lzwLastBits;
+    else
+        numBits = lzwSize * 8;
+    newSize = (numBits + codeBits + 7) / 8;
+    Assert(newSize <= lzwSize + 2);
+
+    /* work backward so we don't stomp on anything we still need */
+    for (idx = newSize - 1; idx > 0; idx--) {
+        val = 0;
+        if (idx - 1 < lzwSize)
+            val = buf[idx - 1] << shift;
+        if (idx >= 2)
+            val |= buf[idx - 2] >> (8 - shift);
+        buf[idx] = (uint8_t) val;
+    }
+    buf[1] |= kNuLZWClearCode >> 8;
+    buf[0] = kNuLZWClearCode & 0xff;
+
+    return newSize;
+}
+
+/*
+ * Compress "srcLen" bytes using "numWorkers" threads, writing chunks to
+ * "fp".  This replaces the main loop in Nu_CompressLZW, and leaves the
+ * CRCs and the output length in the same state it would.
+ */
+static NuError Nu_CompressLZWParallel(NuArchive* pArchive, NuStraw* pStraw,
+    FILE* fp, uint32_t srcLen, long* pCompressedLen, uint16_t* pThreadCrc,
+    Boolean isType2, int numWorkers)
+{
+    NuError err = kNuErrNone;
+    LZWCompressState* lzwState = pArchive->lzwCompressState;
+    LZWCompressBatch batch;
+    LZWCompressSegment prevSeg;
+    uint32_t blockSize;
+    int segChunks = Nu_LZWSegmentChunks(isType2);
+    int maxChunks, numSegs, idx;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.isType2 = isType2;
+    maxChunks = numWorkers * segChunks;
+
+    batch.workerState = Nu_Malloc(pArchive,
+                            numWorkers * sizeof(LZWCompressState));
+    BailAlloc(batch.workerState);
+    batch.inBuf = Nu_Malloc(pArchive, maxChunks * kNuLZWBlockSize);
+    BailAlloc(batch.inBuf);
+    batch.outBuf = Nu_Malloc(pArchive, maxChunks * kNuLZWOutSlotSize);
+    BailAlloc(batch.outBuf);
+    batch.chunks = Nu_Malloc(pArchive, maxChunks * sizeof(LZWCompressChunk));
+    BailAlloc(batch.chunks);
+    batch.segs = Nu_Malloc(pArchive, numWorkers * sizeof(LZWCompressSegment));
+    BailAlloc(batch.segs);
+
+    for (idx = 0; idx < numWorkers; idx++) {
+        batch.workerState[idx].pArchive = pArchive;
+        memcpy(batch.workerState[idx].hashFunc, lzwState->hashFunc,
+            sizeof(lzwState->hashFunc));
+    }
+
+    /* the stream starts with an empty table */
+    prevSeg.nextFree = kNuLZWFirstCode;
+    prevSeg.codeBits = 9;
+    prevSeg.initialClear = false;
+
+    while (srcLen) {
+        /*
+         * Read as much as the workers can handle.  The workers compute
+         * the CRCs of their own segments, which we join up below.
+         */
+        batch.numChunks = 0;
+        while (srcLen && batch.numChunks < maxChunks) {
+            uint8_t* inPtr = batch.inBuf + batch.numChunks * kNuLZWBlockSize;
+
+            blockSize = (srcLen > kNuLZWBlockSize) ? kNuLZWBlockSize : srcLen;
+
+            err = Nu_StrawRead(pArchive, pStraw, inPtr, blockSize);
+            if (err != kNuErrNone) {
+                Nu_ReportError(NU_BLOB, err, "compression read failed");
+                goto bail;
+            }
+            if (blockSize < kNuLZWBlockSize)
+                memset(inPtr + blockSize, 0, kNuLZWBlockSize - blockSize);
+
+            batch.chunks[batch.numChunks].inLen = blockSize;
+            batch.numChunks++;
+            srcLen -= blockSize;
+        }
+
+        numSegs = (batch.numChunks + segChunks - 1) / segChunks;
+        batch.numWorkers = (numSegs < numWorkers) ? numSegs : numWorkers;
+        Nu_RunWorkers(batch.numWorkers, Nu_CompressLZWWorker, &batch);
+
+        for (idx = 0; idx < numSegs; idx++) {
+            const LZWCompressSegment* pSeg = &batch.segs[idx];
+            uint32_t segChunkLen;
+
+            *pThreadCrc = Nu_CombineCRC16(*pThreadCrc, pSeg->threadCrc,
+                            pSeg->inLen);
+            if (!isType2) {
+                segChunkLen = (idx == numSegs-1) ?
+                    (batch.numChunks - idx * segChunks) : segChunks;
+                lzwState->chunkCrc = Nu_CombineCRC16(lzwState->chunkCrc,
+                    pSeg->chunkCrc, segChunkLen * kNuLZWBlockSize);
+            }
+        }
+
+        /*
+         * Write the chunks in order.  An LZW/2 segment that starts with
+         * compressed data needs a table clear unless the table was
+         * already empty.
+         */
+        for (idx = 0; idx < batch.numChunks; idx++) {
+            LZWCompressChunk* pChunk = &batch.chunks[idx];
+            uint8_t* outPtr = batch.outBuf + idx * kNuLZWOutSlotSize;
+
+            if (isType2 && (idx % segChunks) == 0 &&
+                pChunk->keepLzw &&
+                (prevSeg.nextFree != kNuLZWFirstCode || prevSeg.initialClear))
+            {
+                pChunk->lzwSize = Nu_LZWPrependClear(outPtr, pChunk->lzwSize,
+                                    pChunk->lzwLastBits, prevSeg.codeBits);
+                Assert(pChunk->lzwSize +2 < pChunk->rleSize);
+            }
+
+            err = Nu_WriteLZWChunk(fp, isType2, pChunk->keepLzw,
+                    pChunk->rleSize, pChunk->lzwSize, outPtr, pCompressedLen);
+            BailError(err);
+
+            if ((idx % segChunks) == segChunks-1 ||
+                idx == batch.numChunks-1)
+            {
+                prevSeg = batch.segs[idx / segChunks];
+            }
+        }
+    }
+
+bail:
+    Nu_Free(pArchive, batch.workerState);
+    Nu_Free(pArchive, batch.inBuf);
+    Nu_Free(pArchive, batch.outBuf);
+    Nu_Free(pArchive, batch.chunks);
+    Nu_Free(pArchive, batch.segs);
+    return err;
+}
+
 /*
  * Compress ShrinkIt-style "LZW/1" and "LZW/2".
  *
@@ -621,6 +988,22 @@ static NuError Nu_CompressLZW(NuArchive* pArchive, NuStraw* pStraw, FILE* fp,
     if (isType2)
         Nu_ClearLZWTable(lzwState);
 
+    /*
+     * Large threads can be handed to worker threads.  LZW/2 output from
+     * the workers differs from what GSHK would produce, so don't do that
+     * if we're trying to mimic it.
+     */
+    if (pArchive->valCodecThreads > 1 &&
+        srcLen > kNuLZWBlockSize * Nu_LZWSegmentChunks(isType2) &&
+        !(isType2 && pArchive->valMimicSHK))
+    {
+        err = Nu_CompressLZWParallel(pArchive, pStraw, fp, srcLen,
+                &compressedLen, pThreadCrc, isType2,
+                (int) pArchive->valCodecThreads);
+        BailError(err);
+        srcLen = 0;
+    }
+
     while (srcLen) {
         /*
          * Fill up the input buffer.
@@ -688,56 +1071,14 @@ static NuError Nu_CompressLZW(NuArchive* pArchive, NuStraw* pStraw, FILE* fp,
         }
 
         /*
-         * Write the compressed (or not) chunk.
+         * Write the compressed (or not) chunk.  If LZW/2 failed, clear the
+         * table; we can't use it next time.
          */
-        if (keepLzw) {
-            /*
-             * LZW succeeded.
-             */
-            if (isType2)
-                rleSize |= 0x8000;      /* for LZW/2, set "LZW used" flag */
-
-            putc(rleSize & 0xff, fp);   /* size after RLE */
-            putc(rleSize >> 8, fp);
-            compressedLen += 2;
-
-            if (isType2) {
-                /* write compressed LZW len (+4 for header bytes) */
-                putc((lzwSize+4) & 0xff, fp);
-                putc((lzwSize+4) >> 8, fp);
-                compressedLen += 2;
-            } else {
-                /* set LZW/1 "LZW used" flag */
-                putc(1, fp);
-                compressedLen++;
-            }
-        
-            /* write data from LZW buffer */
-            err = Nu_FWrite(fp, lzwState->lzwBuf, lzwSize);
-            BailError(err);
-            compressedLen += lzwSize;
-        } else {
-            /*
-             * LZW failed.
-             */
-            putc(rleSize & 0xff, fp);   /* size after RLE */
-            putc(rleSize >> 8, fp);
-            compressedLen += 2;
-
-            if (isType2) {
-                /* clear LZW/2 table; we can't use it next time */
-                Nu_ClearLZWTable(lzwState);
-            } else {
-                /* set LZW/1 "LZW not used" flag */
-                putc(0, fp);
-                compressedLen++;
-            }
-
-            /* write data from RLE or plain-input buffer */
-            err = Nu_FWrite(fp, lzwInputBuf, rleSize);
-            BailError(err);
-            compressedLen += rleSize;
-        }
+        if (isType2 && !keepLzw)
+            Nu_ClearLZWTable(lzwState);
+        err = Nu_WriteLZWChunk(fp, isType2, keepLzw, rleSize, lzwSize,
+                keepLzw ? lzwState->lzwBuf : lzwInputBuf, &compressedLen);
+        BailError(err);
 
 
         /*
@@ -846,6 +1187,7 @@ typedef struct LZWExpandState {
 
     uint8_t         diskVol;            /* disk volume # */
     uint8_t         rleEscape;          /* RLE escape char, usually 0xdb */
+    Boolean         quiet;              /* worker thread; don't report */
 
     uint32_t        dataInBuffer;       /* #of bytes in compBuf */
     uint8_t*        dataPtr;            /* current data offset */
@@ -873,6 +1215,7 @@ static NuError Nu_AllocLZWExpandState(NuArchive* pArchive)
     pArchive->lzwExpandState = Nu_Malloc(pArchive, sizeof(LZWExpandState));
     if (pArchive->lzwExpandState == NULL)
         return kNuErrMalloc;
+    ((LZWExpandState*) pArchive->lzwExpandState)->quiet = false;
     return kNuErrNone;
 }
 
@@ -998,7 +1341,10 @@ static NuError Nu_ExpandLZW1(LZWExpandState* lzwState, uint32_t expectedLen)
     Assert(incode <= 0xff);
     if (incode > 0xff) {
         err = kNuErrBadData;
-        Nu_ReportError(lzwState->NU_BLOB, err, "invalid initial LZW symbol");
+        if (!lzwState->quiet) {
+            Nu_ReportError(lzwState->NU_BLOB, err,
+                "invalid initial LZW symbol");
+        }
         goto bail;
     }
 
@@ -1045,7 +1391,8 @@ static NuError Nu_ExpandLZW1(LZWExpandState* lzwState, uint32_t expectedLen)
 bail:
     if (outbuf != outbufend) {
         err = kNuErrBadData;
-        Nu_ReportError(lzwState->NU_BLOB, err, "LZW expansion failed");
+        if (!lzwState->quiet)
+            Nu_ReportError(lzwState->NU_BLOB, err, "LZW expansion failed");
         return err;
     }
 
@@ -1133,7 +1480,10 @@ clear_table:
     /*printf("PUT 0x%02x\n", *(outbuf-1));*/
     if (incode > 0xff) {
         err = kNuErrBadData;
-        Nu_ReportError(lzwState->NU_BLOB, err, "invalid initial LZW symbol");
+        if (!lzwState->quiet) {
+            Nu_ReportError(lzwState->NU_BLOB, err,
+                "invalid initial LZW symbol");
+        }
         goto bail;
     }
 
@@ -1253,14 +1603,18 @@ static NuError Nu_ExpandRLE(LZWExpandState* lzwState, const uint8_t* inbuf,
 
     if (outbuf != outbufend) {
         err = kNuErrBadData;
-        Nu_ReportError(lzwState->NU_BLOB, err,
-            "RLE output glitch (off by %d)", (int)(outbufend-outbuf));
+        if (!lzwState->quiet) {
+            Nu_ReportError(lzwState->NU_BLOB, err,
+                "RLE output glitch (off by %d)", (int)(outbufend-outbuf));
+        }
         goto bail;
     }
     if (inbuf != inbufend) {
         err = kNuErrBadData;
-        Nu_ReportError(lzwState->NU_BLOB, err,
-            "RLE input glitch (off by %d)", (int)(inbufend-inbuf));
+        if (!lzwState->quiet) {
+            Nu_ReportError(lzwState->NU_BLOB, err,
+                "RLE input glitch (off by %d)", (int)(inbufend-inbuf));
+        }
         goto bail;
     }
 
@@ -1280,116 +1634,846 @@ static inline uint8_t Nu_GetHeaderByte(LZWExpandState* lzwState)
 }
 
 /*
- * Expand ShrinkIt-style "LZW/1" and "LZW/2".
+ * Expand one chunk, starting with its header at lzwState->dataPtr.  The
+ * header and compressed data are consumed, and "*pWriteBuf" is pointed
+ * at the expanded data.  "writeLen" is the amount of data we expect to
+ * get out of it, which is less than 4K for the last chunk in a thread.
  *
- * This manages the input data buffer, passing chunks of compressed data
- * into the appropriate expansion function.
- *
- * Pass in NULL for "pThreadCrc" if no thread CRC is desired.  Otherwise,
- * "*pThreadCrc" should already be set to its initial value.  On exit it
- * will contain the CRC of the uncompressed data.
+ * If "ignoreLZW2Len" is set, the LZW/2 compressed length is not checked.
  */
-NuError Nu_ExpandLZW(NuArchive* pArchive, const NuRecord* pRecord,
-    const NuThread* pThread, FILE* infp, NuFunnel* pFunnel,
-    uint16_t* pThreadCrc)
+static NuError Nu_ExpandLZWChunk(LZWExpandState* lzwState, Boolean isType2,
+    Boolean ignoreLZW2Len, uint32_t writeLen, const uint8_t** pWriteBuf)
 {
     NuError err = kNuErrNone;
-    Boolean isType2;
-    LZWExpandState* lzwState;
-    uint32_t compRemaining, uncompRemaining, minSize;
-
-    Assert(pArchive != NULL);
-    Assert(pThread != NULL);
-    Assert(infp != NULL);
-    Assert(pFunnel != NULL);
+    Boolean rleUsed;
+    Boolean lzwUsed;
+    uint32_t rleLen;        /* length after RLE; 4096 if no RLE */
+    uint32_t lzwLen = 0;    /* type 2 only */
+    uint32_t inCount;
+    const uint8_t* writeBuf;
 
     /*
-     * Do some initialization and set-up.
+     * Read the LZW block header.
      */
-    if (pArchive->lzwExpandState == NULL) {
-        err = Nu_AllocLZWExpandState(pArchive);
-        BailError(err);
-    }
-    Assert(pArchive->lzwExpandState != NULL);
-    Assert(pArchive->compBuf != NULL);
+    if (isType2) {
+        rleLen = Nu_GetHeaderByte(lzwState);
+        rleLen |= Nu_GetHeaderByte(lzwState) << 8;
+        lzwUsed = rleLen & 0x8000 ? true : false;
+        rleLen &= 0x1fff;
+        rleUsed = (rleLen != kNuLZWBlockSize);
 
-    lzwState = pArchive->lzwExpandState;
-    lzwState->pArchive = pArchive;
-
-    if (pThread->thThreadFormat == kNuThreadFormatLZW1) {
-        isType2 = false;
-        minSize = 7;    /* crc-lo,crc-hi,vol,rle-delim,len-lo,len-hi,lzw-used */
-        lzwState->chunkCrc = kNuInitialChunkCRC;        /* 0x0000 */
-    } else if (pThread->thThreadFormat == kNuThreadFormatLZW2) {
-        isType2 = true;
-        minSize = 4;    /* vol,rle-delim,len-lo,len-hi */
+        if (lzwUsed) {
+            lzwLen = Nu_GetHeaderByte(lzwState);
+            lzwLen |= Nu_GetHeaderByte(lzwState) << 8;
+            lzwLen -= 4;    /* don't include header bytes */
+        }
     } else {
-        err = kNuErrBadFormat;
-        goto bail;
+        rleLen = Nu_GetHeaderByte(lzwState);
+        rleLen |= Nu_GetHeaderByte(lzwState) << 8;
+        lzwUsed = Nu_GetHeaderByte(lzwState);
+        if (lzwUsed != 0 && lzwUsed != 1) {
+            err = kNuErrBadData;
+            if (!lzwState->quiet)
+                Nu_ReportError(lzwState->NU_BLOB, err, "garbled LZW header");
+            goto bail;
+        }
+        rleUsed = (rleLen != kNuLZWBlockSize);
     }
 
-    uncompRemaining = pThread->actualThreadEOF;
-    compRemaining = pThread->thCompThreadEOF;
-    if (compRemaining < minSize) {
-        err = kNuErrBadData;
-        Nu_ReportError(NU_BLOB, err, "thread too short to be valid LZW");
-        goto bail;
-    }
-    if (compRemaining && !uncompRemaining) {
-        err = kNuErrBadData;
-        Nu_ReportError(NU_BLOB, err,
-            "compressed data but no uncompressed data??");
-        goto bail;
-    }
+    /*DBUG_LZW(("### CHUNK rleLen=%d(%d) lzwLen=%d(%d) writeLen=%ld\n",
+        rleLen, rleUsed, lzwLen, lzwUsed, writeLen));*/
+
+    #ifndef NDEBUG
+    writeBuf = NULL;
+    #endif
 
     /*
-     * Read the LZW header out of the data stream.
+     * Decode the chunk, and point "writeBuf" at the uncompressed data.
+     *
+     * LZW always expands from the read buffer into lzwState->lzwOutBuf.
+     * RLE expands from a specific buffer to lzwState->rleOutBuf.
      */
-    if (!isType2) {
-        lzwState->fileCrc = getc(infp);
-        lzwState->fileCrc |= getc(infp) << 8;
-        compRemaining -= 2;
-    }
-    lzwState->diskVol = getc(infp);     /* disk volume #; not really used */
-    lzwState->rleEscape = getc(infp);   /* RLE escape char for this thread */
-    compRemaining -= 2;
+    if (lzwUsed) {
+        if (!isType2) {
+            err = Nu_ExpandLZW1(lzwState, rleLen);
+        } else {
+            if (ignoreLZW2Len) {
+                /* might be big-endian, might be okay; just ignore it */
+                lzwLen = (uint32_t) -1;
+            } else if (lzwState->dataInBuffer < lzwLen) {
+                /* rare -- GSHK will do this if you don't let it finish */
+                err = kNuErrBufferUnderrun;
+                if (!lzwState->quiet) {
+                    Nu_ReportError(lzwState->NU_BLOB, err,
+                        "not enough compressed data "
+                        "-- archive truncated during creation?");
+                }
+                goto bail;
+            }
+            err = Nu_ExpandLZW2(lzwState, rleLen, lzwLen);
+        }
 
-    lzwState->dataInBuffer = 0;
-    lzwState->dataPtr = NULL;
+        BailError(err);
 
-    /* reset pointers */
-    lzwState->entry = kNuLZWFirstCode;  /* 0x0101 */
-    lzwState->resetFix = false;
+        if (rleUsed) {
+            err = Nu_ExpandRLE(lzwState, lzwState->lzwOutBuf, rleLen);
+            BailError(err);
+            writeBuf = lzwState->rleOutBuf;
+        } else {
+            writeBuf = lzwState->lzwOutBuf;
+        }
 
-    /*DBUG_LZW(("### LZW%d block, vol=0x%02x, rleEsc=0x%02x\n",
-        isType2 +1, lzwState->diskVol, lzwState->rleEscape));*/
+    } else {
+        if (rleUsed) {
+            err = Nu_ExpandRLE(lzwState, lzwState->dataPtr, rleLen);
+            BailError(err);
+            writeBuf = lzwState->rleOutBuf;
+            inCount = rleLen;
+        } else {
+            writeBuf = lzwState->dataPtr;
+            inCount = writeLen;
+        }
 
-    /*
-     * Read large blocks of the source file into compBuf, taking care not
-     * to read past the end of the thread data.
-     *
-     * The motivation for doing it this way rather than just reading the
-     * next compressed chunk are (1) compBuf is considerably larger than
-     * stdio BUFSIZ on most systems, and (2) for LZW/1 we don't know the
-     * size of the compressed data anyway.
-     *
-     * We need to ensure that we have at least one full compressed chunk
-     * in the buffer.  Since the compressor will refuse to store the
-     * compressed data if it grows, we know that we need 4K plus the
-     * chunk header.
-     *
-     * Once we have what looks like a full chunk, invoke the LZW decoder.
-     */
-    while (uncompRemaining) {
-        Boolean rleUsed;
-        Boolean lzwUsed;
-        uint32_t getSize;
-        uint32_t rleLen;        /* length after RLE; 4096 if no RLE */
-        uint32_t lzwLen = 0;    /* type 2 only */
-        uint32_t writeLen, inCount;
-        const uint8_t* writeBuf;
+        /*
+         * Advance the input buffer data pointers to consume the input.
+         * The LZW expansion functions do this for us, but we're not
+         * using LZW.
+         */
+        lzwState->dataPtr += inCount;
+        lzwState->dataInBuffer -= inCount;
+        Assert(lzwState->dataInBuffer < 32767*65536);
 
-        /* if we're low, and there's more data available, read more */
+        /* no LZW used, reset pointers */
+        lzwState->entry = kNuLZWFirstCode;  /* 0x0101 */
+        lzwState->resetFix = false;
+    }
+
+    Assert(writeBuf != NULL);
+    *pWriteBuf = writeBuf;
+
+bail:
+    return err;
+}
+
+/*
+ * Expanding with worker threads.
+ *
+ * We can't hand out chunks until we know where they start, and for LZW/1
+ * the only way to find out is to walk through the codes.  We don't need
+ * to produce any output to do that, though, just keep track of how long
+ * each string is.  That's a lot cheaper than expanding it.
+ *
+ * LZW/2 is the same, except that the table carries over from one chunk
+ * to the next.  The scan keeps the full table, and we take a snapshot of
+ * it at the start of each segment, so a worker can pick up from there.
+ *
+ * Damaged data is left to the regular code.  If the scan or a worker
+ * runs into trouble, we write out the segments before the one with the
+ * problem, then go back to the start of that segment and do the rest of
+ * the thread one chunk at a time on the calling thread, the same way
+ * Nu_ExpandLZW would.  That way we recover (or fail) exactly where the
+ * serial code would, and the scan doesn't have to be as forgiving.
+ */
+
+typedef struct LZWScanState {
+    TableEntry      trie[4096-256];     /* same as LZWExpandState */
+    uint16_t        strLen[4096];       /* length of string for each code */
+    uint8_t         strFirst[4096];     /* first char of string */
+
+    uint32_t        entry;
+    uint32_t        oldcode;
+    uint32_t        incode;
+    uint32_t        finalc;
+    Boolean         resetFix;
+} LZWScanState;
+
+typedef struct LZWExpandChunk {
+    uint32_t        offset;             /* offset of chunk header in inBuf */
+    uint32_t        writeLen;
+} LZWExpandChunk;
+
+typedef struct LZWExpandSegment {
+    /* LZW/2 state at the start of the segment */
+    uint32_t        entry;
+    uint32_t        oldcode;
+    uint32_t        incode;
+    uint32_t        finalc;
+    Boolean         resetFix;
+    TableEntry*     trie;
+
+    NuError         err;
+
+    /* CRCs of just this segment's output, zero-seeded */
+    uint16_t        threadCrc;
+    uint16_t        chunkCrc;
+    uint32_t        outLen;
+} LZWExpandSegment;
+
+typedef struct LZWExpandBatch {
+    Boolean             isType2;
+    Boolean             ignoreLZW2Len;
+    Boolean             wantThreadCrc;
+    uint8_t             rleEscape;
+    int                 numWorkers;
+    int                 numChunks;
+    LZWExpandState*     workerState;    /* one per worker */
+    const uint8_t*      inBuf;
+    uint32_t            inBufCount;
+    uint8_t*            outBuf;         /* 4K per chunk */
+    LZWExpandChunk*     chunks;
+    LZWExpandSegment*   segs;
+} LZWExpandBatch;
+
+/*
+ * Walk through the LZW codes for one chunk, updating the table but
+ * not producing any output.  This follows Nu_ExpandLZW1 and
+ * Nu_ExpandLZW2 step for step.  The number of bytes of input used is
+ * returned in "*pInputUsed".
+ */
+static NuError Nu_ScanLZWCodes(LZWScanState* scan, Boolean isType2,
+    const uint8_t* inbufStart, uint32_t expectedLen, uint32_t* pInputUsed)
+{
+    NuError err = kNuErrNone;
+    TableEntry* tablePtr;
+    const uint8_t* inbuf = inbufStart;
+    int atBit;
+    uint32_t entry, oldcode, incode, ptr;
+    uint32_t lastByte, finalc, outCount;
+
+    tablePtr = scan->trie - 256;
+    atBit = 0;
+    lastByte = 0;
+    outCount = 0;
+
+    if (isType2 && (scan->entry != kNuLZWFirstCode || scan->resetFix)) {
+        entry = scan->entry;
+        oldcode = scan->oldcode;
+        incode = scan->incode;
+        finalc = scan->finalc;
+        scan->resetFix = false;
+        goto main_loop;
+    }
+
+clear_table:
+    entry = kNuLZWFirstCode;
+    if (outCount == expectedLen) {
+        oldcode = incode = finalc = 0;
+        goto main_loop;
+    }
+    finalc = oldcode = incode = Nu_LZWGetCode(&inbuf, entry, &atBit, &lastByte);
+    outCount++;
+    if (incode > 0xff) {
+        DBUG(("--- invalid initial LZW symbol\n"));
+        err = kNuErrBadData;
+        goto bail;
+    }
+    if (isType2 && outCount == expectedLen)
+        scan->resetFix = true;
+
+main_loop:
+    while (outCount < expectedLen) {
+        incode = ptr = Nu_LZWGetCode(&inbuf, entry, &atBit, &lastByte);
+        if (incode == kNuLZWClearCode) {
+            if (isType2)
+                goto clear_table;
+            DBUG(("--- table clear in LZW/1 chunk\n"));
+            err = kNuErrBadData;
+            goto bail;
+        }
+
+        if (ptr >= entry) {
+            if (ptr != entry) {
+                DBUG(("--- bad code (ptr=%d entry=%d)\n", ptr, entry));
+                err = kNuErrBadData;
+                goto bail;
+            }
+            /* KwKwK: the previous string plus its own first char */
+            outCount += scan->strLen[oldcode] + 1;
+            finalc = scan->strFirst[oldcode];
+        } else {
+            outCount += scan->strLen[ptr];
+            finalc = scan->strFirst[ptr];
+        }
+
+        if (outCount > expectedLen || entry > kNuLZWMaxCode) {
+            DBUG(("--- LZW scan overran the chunk\n"));
+            err = kNuErrBadData;
+            goto bail;
+        }
+
+        tablePtr[entry].ch = finalc;
+        tablePtr[entry].prefix = oldcode;
+        scan->strLen[entry] = scan->strLen[oldcode] + 1;
+        scan->strFirst[entry] = scan->strFirst[oldcode];
+        entry++;
+        oldcode = incode;
+    }
+
+    scan->entry = entry;
+    scan->oldcode = oldcode;
+    scan->incode = incode;
+    scan->finalc = finalc;
+
+    *pInputUsed = inbuf - inbufStart;
+
+bail:
+    return err;
+}
+
+/*
+ * Scan the chunk at "inbuf", which has "inCount" bytes of data after it.
+ * On success, "*pChunkLen" holds the length of the chunk, including the
+ * header.  This follows Nu_ExpandLZWChunk.
+ *
+ * Nothing is reported on failure; the caller hands the chunk to
+ * Nu_ExpandLZWChunk, which decides how bad it really is.
+ */
+static NuError Nu_ScanLZWChunk(LZWScanState* scan, Boolean isType2,
+    Boolean ignoreLZW2Len, const uint8_t* inbuf, uint32_t inCount,
+    uint32_t writeLen, uint32_t* pChunkLen)
+{
+    NuError err = kNuErrNone;
+    const uint8_t* ptr = inbuf;
+    Boolean lzwUsed;
+    uint32_t rleLen, lzwLen = 0, used;
+
+    if (inCount < (uint32_t) (isType2 ? 4 : 3))
+        goto short_data;
+
+    rleLen = ptr[0] | ptr[1] << 8;
+    ptr += 2;
+    if (isType2) {
+        lzwUsed = rleLen & 0x8000 ? true : false;
+        rleLen &= 0x1fff;
+        if (lzwUsed) {
+            lzwLen = ptr[0] | ptr[1] << 8;
+            lzwLen -= 4;    /* don't include header bytes */
+            ptr += 2;
+        }
+    } else {
+        lzwUsed = *ptr++;
+        if (lzwUsed != 0 && lzwUsed != 1) {
+            err = kNuErrBadData;
+            goto bail;
+        }
+    }
+    inCount -= ptr - inbuf;
+
+    if (lzwUsed) {
+        if (rleLen == 0 || rleLen > kNuLZWBlockSize) {
+            err = kNuErrBadData;
+            goto bail;
+        }
+        if (isType2 && !ignoreLZW2Len && inCount < lzwLen) {
+            err = kNuErrBufferUnderrun;
+            goto bail;
+        }
+
+        err = Nu_ScanLZWCodes(scan, isType2, ptr, rleLen, &used);
+        BailError(err);
+
+        if (isType2 && !ignoreLZW2Len && used != lzwLen) {
+            DBUG(("--- LZW/2 length mismatch (diff=%d)\n", lzwLen - used));
+            err = kNuErrBadData;
+            goto bail;
+        }
+    } else {
+        used = (rleLen != kNuLZWBlockSize) ? rleLen : writeLen;
+
+        /* no LZW used, reset pointers */
+        scan->entry = kNuLZWFirstCode;
+        scan->resetFix = false;
+    }
+
+    if (used > inCount)
+        goto short_data;
+
+    *pChunkLen = (ptr - inbuf) + used;
+
+bail:
+    return err;
+
+short_data:
+    DBUG(("--- compressed data ended early\n"));
+    return kNuErrBadData;
+}
+
+/*
+ * Set up "lzwState" to expand the chunks in segment "seg".
+ */
+static void Nu_LZWStartSegment(const LZWExpandBatch* pBatch, int seg,
+    LZWExpandState* lzwState)
+{
+    const LZWExpandSegment* pSeg = &pBatch->segs[seg];
+
+    lzwState->rleEscape = pBatch->rleEscape;
+    if (pBatch->isType2) {
+        lzwState->entry = pSeg->entry;
+        lzwState->oldcode = pSeg->oldcode;
+        lzwState->incode = pSeg->incode;
+        lzwState->finalc = pSeg->finalc;
+        lzwState->resetFix = pSeg->resetFix;
+        memcpy(lzwState->trie, pSeg->trie,
+            (pSeg->entry - 256) * sizeof(TableEntry));
+    } else {
+        lzwState->entry = kNuLZWFirstCode;
+        lzwState->resetFix = false;
+    }
+}
+
+/*
+ * Expand one segment of the batch, using "lzwState".
+ */
+static NuError Nu_ExpandLZWSegment(LZWExpandBatch* pBatch, int seg,
+    LZWExpandState* lzwState)
+{
+    NuError err = kNuErrNone;
+    LZWExpandSegment* pSeg = &pBatch->segs[seg];
+    int segChunks = Nu_LZWSegmentChunks(pBatch->isType2);
+    int idx, endIdx;
+
+    Nu_LZWStartSegment(pBatch, seg, lzwState);
+
+    pSeg->threadCrc = pSeg->chunkCrc = 0;
+    pSeg->outLen = 0;
+
+    idx = seg * segChunks;
+    endIdx = idx + segChunks;
+    if (endIdx > pBatch->numChunks)
+        endIdx = pBatch->numChunks;
+
+    for ( ; idx < endIdx; idx++) {
+        const LZWExpandChunk* pChunk = &pBatch->chunks[idx];
+        const uint8_t* writeBuf;
+
+        lzwState->dataPtr = (uint8_t*) pBatch->inBuf + pChunk->offset;
+        lzwState->dataInBuffer = pBatch->inBufCount - pChunk->offset;
+        err = Nu_ExpandLZWChunk(lzwState, pBatch->isType2,
+                pBatch->ignoreLZW2Len, pChunk->writeLen, &writeBuf);
+        if (err != kNuErrNone)
+            break;
+
+        if (pBatch->wantThreadCrc) {
+            pSeg->threadCrc = Nu_CalcCRC16(pSeg->threadCrc, writeBuf,
+                                pChunk->writeLen);
+        }
+        if (!pBatch->isType2) {
+            /* LZW/1 wants the CRC of the full 4K */
+            pSeg->chunkCrc = Nu_CalcCRC16(pSeg->chunkCrc, writeBuf,
+                                kNuLZWBlockSize);
+        }
+        pSeg->outLen += pChunk->writeLen;
+
+        memcpy(pBatch->outBuf + idx * kNuLZWBlockSize, writeBuf,
+            pChunk->writeLen);
+    }
+
+    return err;
+}
+
+/*
+ * Expand every segment that belongs to "workerIdx".
+ */
+static void Nu_ExpandLZWWorker(void* arg, int workerIdx)
+{
+    LZWExpandBatch* pBatch = (LZWExpandBatch*) arg;
+    int segChunks = Nu_LZWSegmentChunks(pBatch->isType2);
+    int numSegs, seg;
+
+    numSegs = (pBatch->numChunks + segChunks - 1) / segChunks;
+
+    for (seg = workerIdx; seg < numSegs; seg += pBatch->numWorkers) {
+        pBatch->segs[seg].err = Nu_ExpandLZWSegment(pBatch, seg,
+                                    &pBatch->workerState[workerIdx]);
+    }
+}
+
+/*
+ * Expand the rest of the thread using "numWorkers" threads.  This
+ * replaces the main loop in Nu_ExpandLZW, and leaves things as it would,
+ * with any unused input in lzwState->dataInBuffer.
+ */
+static NuError Nu_ExpandLZWParallel(NuArchive* pArchive,
+    LZWExpandState* lzwState, Boolean isType2, Boolean ignoreLZW2Len,
+    FILE* infp, NuFunnel* pFunnel, uint16_t* pThreadCrc,
+    uint32_t* pCompRemaining, uint32_t* pUncompRemaining, int numWorkers)
+{
+    NuError err = kNuErrNone;
+    LZWExpandBatch batch;
+    LZWScanState* scan = NULL;
+    TableEntry* segTries = NULL;
+    uint8_t* inBuf = NULL;
+    uint32_t compRemaining = *pCompRemaining;
+    uint32_t uncompRemaining = *pUncompRemaining;
+    uint32_t bufSize, inBufCount, pos, getSize, writeLen, chunkLen;
+    int segChunks = Nu_LZWSegmentChunks(isType2);
+    int maxChunks, numSegs, seg, idx;
+    int goodChunks, scanChunks, restartChunk;
+    Boolean serial;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.isType2 = isType2;
+    batch.ignoreLZW2Len = ignoreLZW2Len;
+    batch.wantThreadCrc = (pThreadCrc != NULL);
+    batch.rleEscape = lzwState->rleEscape;
+    maxChunks = numWorkers * segChunks;
+
+    /*
+     * Room for a full batch plus whatever's left over from the previous
+     * one.  The padding at the end covers the 4K copy of the last chunk.
+     */
+    bufSize = (maxChunks + 1) * kNuLZWDesiredChunk;
+    inBuf = Nu_Malloc(pArchive, bufSize + kNuLZWBlockSize + kNuSafetyPadding);
+    BailAlloc(inBuf);
+    batch.inBuf = inBuf;
+
+    batch.workerState = Nu_Malloc(pArchive,
+                            numWorkers * sizeof(LZWExpandState));
+    BailAlloc(batch.workerState);
+    batch.outBuf = Nu_Malloc(pArchive, maxChunks * kNuLZWBlockSize);
+    BailAlloc(batch.outBuf);
+    batch.chunks = Nu_Malloc(pArchive, maxChunks * sizeof(LZWExpandChunk));
+    BailAlloc(batch.chunks);
+    batch.segs = Nu_Calloc(pArchive, numWorkers * sizeof(LZWExpandSegment));
+    BailAlloc(batch.segs);
+    if (isType2) {
+        segTries = Nu_Malloc(pArchive,
+                    numWorkers * (4096-256) * sizeof(TableEntry));
+        BailAlloc(segTries);
+    }
+
+    for (idx = 0; idx < numWorkers; idx++) {
+        batch.workerState[idx].pArchive = pArchive;
+        batch.workerState[idx].quiet = true;
+    }
+
+    scan = Nu_Malloc(pArchive, sizeof(LZWScanState));
+    BailAlloc(scan);
+    for (idx = 0; idx < 256; idx++) {
+        scan->strLen[idx] = 1;
+        scan->strFirst[idx] = idx;
+    }
+    scan->entry = kNuLZWFirstCode;
+    scan->resetFix = false;
+
+    inBufCount = pos = 0;
+    serial = false;
+    while (uncompRemaining) {
+        /*
+         * Slide what's left to the start of the buffer, and top it off.
+         * Once we're going a chunk at a time, only do that when we run
+         * low, like Nu_ExpandLZW does.
+         */
+        if (!serial ||
+            (inBufCount - pos < kNuLZWDesiredChunk && compRemaining))
+        {
+            if (pos) {
+                memmove(inBuf, inBuf + pos, inBufCount - pos);
+                inBufCount -= pos;
+                pos = 0;
+            }
+            getSize = bufSize - inBufCount;
+            if (getSize > compRemaining)
+                getSize = compRemaining;
+            if (getSize) {
+                err = Nu_FRead(infp, inBuf + inBufCount, getSize);
+                if (err != kNuErrNone) {
+                    Nu_ReportError(NU_BLOB, err,
+                        "failed reading compressed data (%u bytes)", getSize);
+                    goto bail;
+                }
+                inBufCount += getSize;
+                compRemaining -= getSize;
+            }
+            memset(inBuf + inBufCount, 0, kNuLZWBlockSize + kNuSafetyPadding);
+        }
+
+        if (serial) {
+            /*
+             * Something went wrong earlier.  Expand a chunk on this
+             * thread, reporting failures, same as the main loop in
+             * Nu_ExpandLZW.
+             */
+            const uint8_t* writeBuf;
+
+            if (uncompRemaining <= kNuLZWBlockSize)
+                writeLen = uncompRemaining;     /* last block */
+            else
+                writeLen = kNuLZWBlockSize;
+
+            lzwState->dataPtr = inBuf + pos;
+            lzwState->dataInBuffer = inBufCount - pos;
+            err = Nu_ExpandLZWChunk(lzwState, isType2, ignoreLZW2Len,
+                    writeLen, &writeBuf);
+            BailError(err);
+            pos = lzwState->dataPtr - inBuf;
+
+            if (pThreadCrc != NULL)
+                *pThreadCrc = Nu_CalcCRC16(*pThreadCrc, writeBuf, writeLen);
+            if (!isType2) {
+                lzwState->chunkCrc = Nu_CalcCRC16(lzwState->chunkCrc,
+                    writeBuf, kNuLZWBlockSize);
+            }
+
+            err = Nu_FunnelWrite(pArchive, pFunnel, writeBuf, writeLen);
+            if (err != kNuErrNone) {
+                if (err != kNuErrAborted)
+                    Nu_ReportError(NU_BLOB, err, "unable to write output");
+                goto bail;
+            }
+            uncompRemaining -= writeLen;
+            continue;
+        }
+
+        /*
+         * Find the chunks, stopping when we run low on data.  If the scan
+         * fails, the segment it was working on is left for the serial
+         * code.
+         */
+        batch.numChunks = 0;
+        restartChunk = -1;
+        while (uncompRemaining && batch.numChunks < maxChunks) {
+            if (inBufCount - pos < kNuLZWDesiredChunk && compRemaining)
+                break;
+
+            if (uncompRemaining <= kNuLZWBlockSize)
+                writeLen = uncompRemaining;     /* last block */
+            else
+                writeLen = kNuLZWBlockSize;
+
+            if ((batch.numChunks % segChunks) == 0 && isType2) {
+                LZWExpandSegment* pSeg =
+                    &batch.segs[batch.numChunks / segChunks];
+
+                pSeg->entry = scan->entry;
+                pSeg->oldcode = scan->oldcode;
+                pSeg->incode = scan->incode;
+                pSeg->finalc = scan->finalc;
+                pSeg->resetFix = scan->resetFix;
+                pSeg->trie = segTries +
+                                (batch.numChunks / segChunks) * (4096-256);
+                memcpy(pSeg->trie, scan->trie,
+                    (scan->entry - 256) * sizeof(TableEntry));
+            }
+
+            err = Nu_ScanLZWChunk(scan, isType2, ignoreLZW2Len,
+                    inBuf + pos, inBufCount - pos, writeLen, &chunkLen);
+            if (err != kNuErrNone) {
+                DBUG(("--- LZW scan failed (err=%d), going serial\n", err));
+                restartChunk = batch.numChunks - batch.numChunks % segChunks;
+                err = kNuErrNone;
+                break;
+            }
+
+            batch.chunks[batch.numChunks].offset = pos;
+            batch.chunks[batch.numChunks].writeLen = writeLen;
+            batch.numChunks++;
+            pos += chunkLen;
+            uncompRemaining -= writeLen;
+        }
+
+        goodChunks = (restartChunk >= 0) ? restartChunk : batch.numChunks;
+        numSegs = (goodChunks + segChunks - 1) / segChunks;
+        if (numSegs) {
+            batch.numWorkers = (numSegs < numWorkers) ? numSegs : numWorkers;
+            batch.inBufCount = inBufCount;
+            scanChunks = batch.numChunks;
+            batch.numChunks = goodChunks;
+            Nu_RunWorkers(batch.numWorkers, Nu_ExpandLZWWorker, &batch);
+            batch.numChunks = scanChunks;
+        }
+
+        /*
+         * Fold in the CRCs and write the data, in order, stopping at the
+         * first segment that failed.
+         */
+        for (seg = 0; seg < numSegs; seg++) {
+            LZWExpandSegment* pSeg = &batch.segs[seg];
+            int firstIdx = seg * segChunks;
+            int endIdx = firstIdx + segChunks;
+
+            if (endIdx > goodChunks)
+                endIdx = goodChunks;
+            if (pSeg->err != kNuErrNone) {
+                DBUG(("--- LZW segment failed (err=%d), going serial\n",
+                    pSeg->err));
+                restartChunk = firstIdx;
+                break;
+            }
+
+            if (pThreadCrc != NULL) {
+                *pThreadCrc = Nu_CombineCRC16(*pThreadCrc,
+                                pSeg->threadCrc, pSeg->outLen);
+            }
+            if (!isType2) {
+                lzwState->chunkCrc = Nu_CombineCRC16(lzwState->chunkCrc,
+                    pSeg->chunkCrc, (endIdx - firstIdx) * kNuLZWBlockSize);
+            }
+
+            for (idx = firstIdx; idx < endIdx; idx++) {
+                err = Nu_FunnelWrite(pArchive, pFunnel,
+                        batch.outBuf + idx * kNuLZWBlockSize,
+                        batch.chunks[idx].writeLen);
+                if (err != kNuErrNone) {
+                    if (err != kNuErrAborted)
+                        Nu_ReportError(NU_BLOB, err, "unable to write output");
+                    goto bail;
+                }
+            }
+        }
+
+        /*
+         * If something failed, back up to the start of the segment, and
+         * do the rest one chunk at a time.
+         */
+        if (restartChunk >= 0) {
+            for (idx = restartChunk; idx < batch.numChunks; idx++)
+                uncompRemaining += batch.chunks[idx].writeLen;
+            if (restartChunk < batch.numChunks)
+                pos = batch.chunks[restartChunk].offset;
+            Nu_LZWStartSegment(&batch, restartChunk / segChunks, lzwState);
+            serial = true;
+        }
+    }
+
+    /* hand back the leftovers, for the "fluff" check */
+    lzwState->dataPtr = NULL;
+    lzwState->dataInBuffer = inBufCount - pos;
+    *pCompRemaining = compRemaining;
+    *pUncompRemaining = uncompRemaining;
+
+bail:
+    Nu_Free(pArchive, scan);
+    Nu_Free(pArchive, segTries);
+    Nu_Free(pArchive, inBuf);
+    Nu_Free(pArchive, batch.workerState);
+    Nu_Free(pArchive, batch.outBuf);
+    Nu_Free(pArchive, batch.chunks);
+    Nu_Free(pArchive, batch.segs);
+    return err;
+}
+
+/*
+ * Expand ShrinkIt-style "LZW/1" and "LZW/2".
+ *
+ * This manages the input data buffer, passing chunks of compressed data
+ * into the appropriate expansion function.
+ *
+ * Pass in NULL for "pThreadCrc" if no thread CRC is desired.  Otherwise,
+ * "*pThreadCrc" should already be set to its initial value.  On exit it
+ * will contain the CRC of the uncompressed data.
+ */
+NuError Nu_ExpandLZW(NuArchive* pArchive, const NuRecord* pRecord,
+    const NuThread* pThread, FILE* infp, NuFunnel* pFunnel,
+    uint16_t* pThreadCrc)
+{
+    NuError err = kNuErrNone;
+    Boolean isType2;
+    LZWExpandState* lzwState;
+    uint32_t compRemaining, uncompRemaining, minSize;
+
+    Assert(pArchive != NULL);
+    Assert(pThread != NULL);
+    Assert(infp != NULL);
+    Assert(pFunnel != NULL);
+
+    /*
+     * Do some initialization and set-up.
+     */
+    if (pArchive->lzwExpandState == NULL) {
+        err = Nu_AllocLZWExpandState(pArchive);
+        BailError(err);
+    }
+    Assert(pArchive->lzwExpandState != NULL);
+    Assert(pArchive->compBuf != NULL);
+
+    lzwState = pArchive->lzwExpandState;
+    lzwState->pArchive = pArchive;
+
+    if (pThread->thThreadFormat == kNuThreadFormatLZW1) {
+        isType2 = false;
+        minSize = 7;    /* crc-lo,crc-hi,vol,rle-delim,len-lo,len-hi,lzw-used */
+        lzwState->chunkCrc = kNuInitialChunkCRC;        /* 0x0000 */
+    } else if (pThread->thThreadFormat == kNuThreadFormatLZW2) {
+        isType2 = true;
+        minSize = 4;    /* vol,rle-delim,len-lo,len-hi */
+    } else {
+        err = kNuErrBadFormat;
+        goto bail;
+    }
+
+    uncompRemaining = pThread->actualThreadEOF;
+    compRemaining = pThread->thCompThreadEOF;
+    if (compRemaining < minSize) {
+        err = kNuErrBadData;
+        Nu_ReportError(NU_BLOB, err, "thread too short to be valid LZW");
+        goto bail;
+    }
+    if (compRemaining && !uncompRemaining) {
+        err = kNuErrBadData;
+        Nu_ReportError(NU_BLOB, err,
+            "compressed data but no uncompressed data??");
+        goto bail;
+    }
+
+    /*
+     * Read the LZW header out of the data stream.
+     */
+    if (!isType2) {
+        lzwState->fileCrc = getc(infp);
+        lzwState->fileCrc |= getc(infp) << 8;
+        compRemaining -= 2;
+    }
+    lzwState->diskVol = getc(infp);     /* disk volume #; not really used */
+    lzwState->rleEscape = getc(infp);   /* RLE escape char for this thread */
+    compRemaining -= 2;
+
+    lzwState->dataInBuffer = 0;
+    lzwState->dataPtr = NULL;
+
+    /* reset pointers */
+    lzwState->entry = kNuLZWFirstCode;  /* 0x0101 */
+    lzwState->resetFix = false;
+
+    /*DBUG_LZW(("### LZW%d block, vol=0x%02x, rleEsc=0x%02x\n",
+        isType2 +1, lzwState->diskVol, lzwState->rleEscape));*/
+
+    /*
+     * Large threads can be handed to worker threads.  This does all of
+     * the work; the loop below will have nothing left to do.
+     */
+    if (pArchive->valCodecThreads > 1 &&
+        uncompRemaining > kNuLZWBlockSize * Nu_LZWSegmentChunks(isType2))
+    {
+        err = Nu_ExpandLZWParallel(pArchive, lzwState, isType2,
+                pRecord->isBadMac || pArchive->valIgnoreLZW2Len, infp,
+                pFunnel, pThreadCrc, &compRemaining, &uncompRemaining,
+                (int) pArchive->valCodecThreads);
+        BailError(err);
+    }
+
+    /*
+     * Read large blocks of the source file into compBuf, taking care not
+     * to read past the end of the thread data.
+     *
+     * The motivation for doing it this way rather than just reading the
+     * next compressed chunk are (1) compBuf is considerably larger than
+     * stdio BUFSIZ on most systems, and (2) for LZW/1 we don't know the
+     * size of the compressed data anyway.
+     *
+     * We need to ensure that we have at least one full compressed chunk
+     * in the buffer.  Since the compressor will refuse to store the
+     * compressed data if it grows, we know that we need 4K plus the
+     * chunk header.
+     *
+     * Once we have what looks like a full chunk, invoke the LZW decoder.
+     */
+    while (uncompRemaining) {
+        uint32_t getSize;
+        uint32_t writeLen;
+        const uint8_t* writeBuf;
+
+        /* if we're low, and there's more data available, read more */
         if (lzwState->dataInBuffer < kNuLZWDesiredChunk && compRemaining) {
             /*
              * First thing we do is slide the old data to the start of
@@ -1427,104 +2511,15 @@ NuError Nu_ExpandLZW(NuArchive* pArchive, const NuRecord* pRecord,
         }
         Assert(lzwState->dataInBuffer);
 
-        /*
-         * Read the LZW block header.
-         */
-        if (isType2) {
-            rleLen = Nu_GetHeaderByte(lzwState);
-            rleLen |= Nu_GetHeaderByte(lzwState) << 8;
-            lzwUsed = rleLen & 0x8000 ? true : false;
-            rleLen &= 0x1fff;
-            rleUsed = (rleLen != kNuLZWBlockSize);
-
-            if (lzwUsed) {
-                lzwLen = Nu_GetHeaderByte(lzwState);
-                lzwLen |= Nu_GetHeaderByte(lzwState) << 8;
-                lzwLen -= 4;    /* don't include header bytes */
-            }
-        } else {
-            rleLen = Nu_GetHeaderByte(lzwState);
-            rleLen |= Nu_GetHeaderByte(lzwState) << 8;
-            lzwUsed = Nu_GetHeaderByte(lzwState);
-            if (lzwUsed != 0 && lzwUsed != 1) {
-                err = kNuErrBadData;
-                Nu_ReportError(NU_BLOB, err, "garbled LZW header");
-                goto bail;
-            }
-            rleUsed = (rleLen != kNuLZWBlockSize);
-        }
-
-        /*DBUG_LZW(("### CHUNK rleLen=%d(%d) lzwLen=%d(%d) uncompRem=%ld\n",
-            rleLen, rleUsed, lzwLen, lzwUsed, uncompRemaining));*/
-
         if (uncompRemaining <= kNuLZWBlockSize)
             writeLen = uncompRemaining;     /* last block */
         else
             writeLen = kNuLZWBlockSize;
 
-        #ifndef NDEBUG
-        writeBuf = NULL;
-        #endif
-
-        /*
-         * Decode the chunk, and point "writeBuf" at the uncompressed data.
-         *
-         * LZW always expands from the read buffer into lzwState->lzwOutBuf.
-         * RLE expands from a specific buffer to lzwState->rleOutBuf.
-         */
-        if (lzwUsed) {
-            if (!isType2) {
-                err = Nu_ExpandLZW1(lzwState, rleLen);
-            } else {
-                if (pRecord->isBadMac || pArchive->valIgnoreLZW2Len) {
-                    /* might be big-endian, might be okay; just ignore it */
-                    lzwLen = (uint32_t) -1;
-                } else if (lzwState->dataInBuffer < lzwLen) {
-                    /* rare -- GSHK will do this if you don't let it finish */
-                    err = kNuErrBufferUnderrun;
-                    Nu_ReportError(NU_BLOB, err, "not enough compressed data "
-                        "-- archive truncated during creation?");
-                    goto bail;
-                }
-                err = Nu_ExpandLZW2(lzwState, rleLen, lzwLen);
-            }
-
-            BailError(err);
-
-            if (rleUsed) {
-                err = Nu_ExpandRLE(lzwState, lzwState->lzwOutBuf, rleLen);
-                BailError(err);
-                writeBuf = lzwState->rleOutBuf;
-            } else {
-                writeBuf = lzwState->lzwOutBuf;
-            }
-
-        } else {
-            if (rleUsed) {
-                err = Nu_ExpandRLE(lzwState, lzwState->dataPtr, rleLen);
-                BailError(err);
-                writeBuf = lzwState->rleOutBuf;
-                inCount = rleLen;
-            } else {
-                writeBuf = lzwState->dataPtr;
-                inCount = writeLen;
-            }
-            
-            /*
-             * Advance the input buffer data pointers to consume the input.
-             * The LZW expansion functions do this for us, but we're not
-             * using LZW.
-             */
-            lzwState->dataPtr += inCount;
-            lzwState->dataInBuffer -= inCount;
-            Assert(lzwState->dataInBuffer < 32767*65536);
-
-            /* no LZW used, reset pointers */
-            lzwState->entry = kNuLZWFirstCode;  /* 0x0101 */
-            lzwState->resetFix = false;
-        }
-
-        Assert(writeBuf != NULL);
+        err = Nu_ExpandLZWChunk(lzwState, isType2,
+                pRecord->isBadMac || pArchive->valIgnoreLZW2Len, writeLen,
+                &writeBuf);
+        BailError(err);
 
         /*
          * Compute the CRC of the uncompressed data, and write it.  For
@@ -1619,4 +2614,334 @@ bail:
     return err;
 }
 
+
+/*
+ * ===========================================================================
+ *      Random access
+ * ===========================================================================
+ */
+
+/*
+ * Enough input for any one chunk.  The compressor won't store a chunk
+ * that grew, so it's never more than 4K plus the chunk header.
+ */
+#define kNuReaderInBufSize  (kNuLZWBlockSize * 2)
+
+/*
+ * Create a reader for the thread with index "threadIdx".
+ *
+ * Only uncompressed, LZW/1, and LZW/2 threads are supported.  The archive
+ * must not be modified while the reader exists, and the reader must be
+ * freed before the archive is closed.
+ */
+NuError Nu_ThreadReader_New(NuArchive* pArchive, NuThreadIdx threadIdx,
+    NuThreadReader** ppReader)
+{
+    NuError err;
+    NuRecord* pRecord;
+    NuThread* pThread;
+    NuThreadReader* pReader = NULL;
+    LZWExpandState* lzwState;
+    uint8_t hdr[4];
+
+    if (Nu_IsStreaming(pArchive))
+        return kNuErrUsage;
+    if (threadIdx == 0 || ppReader == NULL)
+        return kNuErrInvalidArg;
+    err = Nu_GetTOCIfNeeded(pArchive);
+    BailError(err);
+
+    err = Nu_RecordSet_FindByThreadIdx(&pArchive->origRecordSet, threadIdx,
+            &pRecord, &pThread);
+    BailError(err);
+
+    if (pThread->thThreadFormat != kNuThreadFormatUncompressed &&
+        pThread->thThreadFormat != kNuThreadFormatLZW1 &&
+        pThread->thThreadFormat != kNuThreadFormatLZW2)
+    {
+        err = kNuErrBadFormat;
+        Nu_ReportError(NU_BLOB, err,
+            "compression format %u not supported for random access",
+            pThread->thThreadFormat);
+        goto bail;
+    }
+
+    pReader = Nu_Calloc(pArchive, sizeof(*pReader));
+    BailAlloc(pReader);
+    pReader->pArchive = pArchive;
+    pReader->pRecord = pRecord;
+    pReader->format = pThread->thThreadFormat;
+    pReader->ignoreLZW2Len = pRecord->isBadMac || pArchive->valIgnoreLZW2Len;
+    pReader->dataOffset = pThread->fileOffset;
+    pReader->compLen = pThread->thCompThreadEOF;
+    pReader->uncompLen = pThread->actualThreadEOF;
+    pReader->numChunks =
+        (pReader->uncompLen + kNuLZWBlockSize - 1) / kNuLZWBlockSize;
+    pReader->nextChunk = pReader->numChunks;    /* no state yet */
+
+    pReader->chunkOffset = Nu_Calloc(pArchive,
+                            (pReader->numChunks + 1) * sizeof(uint32_t));
+    BailAlloc(pReader->chunkOffset);
+    pReader->chunkRestart = Nu_Calloc(pArchive,
+                            (pReader->numChunks + 1) * sizeof(Boolean));
+    BailAlloc(pReader->chunkRestart);
+
+    pReader->checkThreadCrc =
+        Nu_ThreadHasCRC(pRecord->recVersionNumber, NuGetThreadID(pThread)) &&
+        !pArchive->valIgnoreCRC;
+    pReader->threadCrc = pThread->thThreadCRC;
+    pReader->calcThreadCrc = kNuInitialThreadCRC;
+
+    if (pReader->format == kNuThreadFormatUncompressed) {
+        if (pReader->compLen < pReader->uncompLen) {
+            err = kNuErrBadData;
+            Nu_ReportError(NU_BLOB, err, "uncompressed thread is short");
+            goto bail;
+        }
+        goto done;
+    }
+
+    /*
+     * Read the LZW header, which comes before the first chunk.
+     */
+    if (pReader->compLen < (pReader->format == kNuThreadFormatLZW1 ? 7 : 4)) {
+        err = kNuErrBadData;
+        Nu_ReportError(NU_BLOB, err, "thread too short to be valid LZW");
+        goto bail;
+    }
+
+    pReader->lzwState = Nu_Malloc(pArchive, sizeof(LZWExpandState));
+    BailAlloc(pReader->lzwState);
+    pReader->inBuf = Nu_Calloc(pArchive, kNuReaderInBufSize + kNuSafetyPadding);
+    BailAlloc(pReader->inBuf);
+
+    err = Nu_FSeek(pArchive->archiveFp, pReader->dataOffset, SEEK_SET);
+    BailError(err);
+    lzwState = pReader->lzwState;
+    lzwState->pArchive = pArchive;
+    lzwState->quiet = false;
+    if (pReader->format == kNuThreadFormatLZW1) {
+        err = Nu_FRead(pArchive->archiveFp, hdr, 4);
+        BailError(err);
+        pReader->fileCrc = hdr[0] | hdr[1] << 8;
+        lzwState->diskVol = hdr[2];
+        lzwState->rleEscape = hdr[3];
+        pReader->chunkOffset[0] = 4;
+        pReader->checkLZW1Crc = !pArchive->valIgnoreCRC;
+        pReader->calcLZW1Crc = kNuInitialChunkCRC;
+    } else {
+        err = Nu_FRead(pArchive->archiveFp, hdr, 2);
+        BailError(err);
+        lzwState->diskVol = hdr[0];
+        lzwState->rleEscape = hdr[1];
+        pReader->chunkOffset[0] = 2;
+    }
+    pReader->chunkRestart[0] = true;
+
+done:
+    *ppReader = pReader;
+    pReader = NULL;
+
+bail:
+    if (pReader != NULL)
+        (void) Nu_ThreadReader_Free(pReader);
+    return err;
+}
+
+/*
+ * Fold a chunk into the CRCs, if we've seen every chunk before it.  When
+ * we reach the end, check them.
+ */
+static NuError Nu_ThreadReader_UpdateCrc(NuThreadReader* pReader,
+    uint32_t chunkIdx, const uint8_t* buf, uint32_t len)
+{
+    NuArchive* pArchive = pReader->pArchive;
+    NuError err = kNuErrNone;
+
+    if (chunkIdx != pReader->crcChunk)
+        return kNuErrNone;
+
+    pReader->calcThreadCrc = Nu_CalcCRC16(pReader->calcThreadCrc, buf, len);
+    if (pReader->format == kNuThreadFormatLZW1) {
+        /* includes the zeros that pad the last chunk out to 4K */
+        pReader->calcLZW1Crc = Nu_CalcCRC16(pReader->calcLZW1Crc, buf,
+                                kNuLZWBlockSize);
+    }
+    pReader->crcChunk++;
+    if (pReader->crcChunk != pReader->numChunks)
+        return kNuErrNone;
+
+    if (pReader->checkLZW1Crc && pReader->calcLZW1Crc != pReader->fileCrc) {
+        if (!Nu_ShouldIgnoreBadCRC(pArchive, pReader->pRecord,
+                kNuErrBadDataCRC))
+        {
+            err = kNuErrBadDataCRC;
+            Nu_ReportError(NU_BLOB, err, "expected 0x%04x, got 0x%04x (LZW/1)",
+                pReader->fileCrc, pReader->calcLZW1Crc);
+            goto bail;
+        }
+    }
+    if (pReader->checkThreadCrc &&
+        pReader->calcThreadCrc != pReader->threadCrc)
+    {
+        if (!Nu_ShouldIgnoreBadCRC(pArchive, pReader->pRecord,
+                kNuErrBadThreadCRC))
+        {
+            err = kNuErrBadDataCRC;
+            Nu_ReportError(NU_BLOB, err, "expected 0x%04x, got 0x%04x",
+                pReader->threadCrc, pReader->calcThreadCrc);
+            goto bail;
+        }
+    }
+
+bail:
+    return err;
+}
+
+/*
+ * Expand chunk "chunkIdx".  The expander must be ready for it, i.e. we
+ * either just expanded the chunk before it, or it's a restart point and
+ * the string table has been cleared.
+ */
+static NuError Nu_ThreadReader_ExpandChunk(NuThreadReader* pReader,
+    uint32_t chunkIdx, const uint8_t** pWriteBuf, uint32_t* pWriteLen)
+{
+    NuArchive* pArchive = pReader->pArchive;
+    LZWExpandState* lzwState = pReader->lzwState;
+    NuError err;
+    uint32_t offset, getSize, writeLen;
+
+    offset = pReader->chunkOffset[chunkIdx];
+    Assert(offset != 0);
+    if (offset >= pReader->compLen) {
+        err = kNuErrBadData;
+        Nu_ReportError(NU_BLOB, err, "compressed data ended early");
+        goto bail;
+    }
+    getSize = pReader->compLen - offset;
+    if (getSize > kNuReaderInBufSize)
+        getSize = kNuReaderInBufSize;
+
+    err = Nu_FSeek(pArchive->archiveFp, pReader->dataOffset + offset,
+            SEEK_SET);
+    BailError(err);
+    err = Nu_FRead(pArchive->archiveFp, pReader->inBuf, getSize);
+    if (err != kNuErrNone) {
+        Nu_ReportError(NU_BLOB, err,
+            "failed reading compressed data (%u bytes)", getSize);
+        goto bail;
+    }
+    lzwState->dataPtr = pReader->inBuf;
+    lzwState->dataInBuffer = getSize;
+
+    if (pReader->format == kNuThreadFormatLZW2) {
+        pReader->chunkRestart[chunkIdx] =
+            (lzwState->entry == kNuLZWFirstCode && !lzwState->resetFix);
+    } else {
+        pReader->chunkRestart[chunkIdx] = true;
+    }
+
+    writeLen = pReader->uncompLen - chunkIdx * kNuLZWBlockSize;
+    if (writeLen > kNuLZWBlockSize)
+        writeLen = kNuLZWBlockSize;
+
+    err = Nu_ExpandLZWChunk(lzwState,
+            pReader->format == kNuThreadFormatLZW2, pReader->ignoreLZW2Len,
+            writeLen, pWriteBuf);
+    BailError(err);
+
+    pReader->chunkOffset[chunkIdx+1] =
+        offset + (getSize - lzwState->dataInBuffer);
+    pReader->nextChunk = chunkIdx + 1;
+    *pWriteLen = writeLen;
+
+    err = Nu_ThreadReader_UpdateCrc(pReader, chunkIdx, *pWriteBuf, writeLen);
+
+bail:
+    return err;
+}
+
+/*
+ * Read chunk "chunkIdx" of the expanded thread into "buf", which must
+ * hold kNuThreadChunkSize bytes.  The last chunk is padded with zeroes.
+ *
+ * LZW/2 chunks may depend on the ones before them, so we start from the
+ * closest restart point (or from where we left off, if that's closer)
+ * and work forward.  Reading chunks in order is cheapest.
+ *
+ * The CRCs are checked when the last chunk is read, if every chunk has
+ * been read in order.  Otherwise they're not checked at all.
+ */
+NuError Nu_ThreadReader_Read(NuThreadReader* pReader, uint32_t chunkIdx,
+    uint8_t* buf)
+{
+    NuArchive* pArchive = pReader->pArchive;
+    NuError err = kNuErrNone;
+    const uint8_t* writeBuf = NULL;
+    uint32_t writeLen = 0;
+    uint32_t start;
+
+    if (chunkIdx >= pReader->numChunks || buf == NULL)
+        return kNuErrInvalidArg;
+
+    if (pReader->format == kNuThreadFormatUncompressed) {
+        writeLen = pReader->uncompLen - chunkIdx * kNuLZWBlockSize;
+        if (writeLen > kNuLZWBlockSize)
+            writeLen = kNuLZWBlockSize;
+        err = Nu_FSeek(pArchive->archiveFp,
+                pReader->dataOffset + chunkIdx * kNuLZWBlockSize, SEEK_SET);
+        BailError(err);
+        err = Nu_FRead(pArchive->archiveFp, buf, writeLen);
+        BailError(err);
+        memset(buf + writeLen, 0, kNuLZWBlockSize - writeLen);
+
+        err = Nu_ThreadReader_UpdateCrc(pReader, chunkIdx, buf, writeLen);
+        goto bail;
+    }
+
+    /* find the closest chunk we can start from; chunk 0 always works */
+    start = chunkIdx;
+    while (pReader->chunkOffset[start] == 0 || !pReader->chunkRestart[start])
+        start--;
+    if (pReader->nextChunk > start && pReader->nextChunk <= chunkIdx) {
+        start = pReader->nextChunk;
+    } else {
+        LZWExpandState* lzwState = pReader->lzwState;
+        lzwState->entry = kNuLZWFirstCode;
+        lzwState->resetFix = false;
+    }
+
+    for ( ; start <= chunkIdx; start++) {
+        err = Nu_ThreadReader_ExpandChunk(pReader, start, &writeBuf,
+                &writeLen);
+        if (err != kNuErrNone) {
+            pReader->nextChunk = pReader->numChunks;    /* state is suspect */
+            goto bail;
+        }
+    }
+
+    Assert(writeBuf != NULL);
+    memcpy(buf, writeBuf, writeLen);
+    memset(buf + writeLen, 0, kNuLZWBlockSize - writeLen);
+
+bail:
+    return err;
+}
+
+/*
+ * Free a thread reader.
+ */
+NuError Nu_ThreadReader_Free(NuThreadReader* pReader)
+{
+    if (pReader == NULL)
+        return kNuErrNone;
+
+    Nu_Free(NULL, pReader->chunkOffset);
+    Nu_Free(NULL, pReader->chunkRestart);
+    Nu_Free(NULL, pReader->lzwState);
+    Nu_Free(NULL, pReader->inBuf);
+    Nu_Free(NULL, pReader);
+    return kNuErrNone;
+}
+
 #endif /*ENABLE_LZW*/
@@ -23,9 +23,8 @@ static const char* kNufxLibName = "nufxlib";
 const char* Nu_StrError(NuError err)
 {
     /*
-     * BUG: this should be set up as per-thread storage in an MT environment.
-     * I would be more inclined to worry about this if I was expecting
-     * it to be used.  So long as valid values are passed in, and the
+     * Per-thread, so callers on different threads don't see each other's
+     * numbers.  So long as valid values are passed in, and the
      * switch statement is kept up to date, we should never have cause
      * to return this.
      *
@@ -35,7 +34,7 @@ const char* Nu_StrError(NuError err)
      * debug builds, though, as it's helpful to know *which* error is not
      * recognized.
      */
-    static char defaultMsg[32];
+    static NU_THREAD_LOCAL char defaultMsg[32];
 
     switch (err) {
     case kNuErrNone:
@@ -278,6 +278,14 @@ enum {
  */
 typedef struct NuArchive NuArchive;
 
+/*
+ * Random-access reader for the expanded contents of a thread.  Also
+ * opaque.  Data is read in chunks of kNuThreadChunkSize bytes.
+ */
+typedef struct NuThreadReader NuThreadReader;
+
+#define kNuThreadChunkSize  4096
+
 /*
  * Generic callback prototype.
  */
@@ -302,10 +310,22 @@ typedef enum NuValueID {
     kNuValueStripHighASCII      = 12,
     kNuValueJunkSkipMax         = 13,
     kNuValueIgnoreLZW2Len       = 14,
-    kNuValueHandleBadMac        = 15
+    kNuValueHandleBadMac        = 15,
+    kNuValueCodecThreads        = 16,
+    /*
+     * Append new records to the end of the original archive instead of
+     * rebuilding it in the temp file, when nothing else changed (default
+     * off).  A failed flush truncates the file back, but a crash or a
+     * failed truncate can leave junk past the end, or a damaged archive
+     * if it happens while the master header is being rewritten.
+     */
+    kNuValueAppendInPlace       = 17
 } NuValueID;
 typedef uint32_t NuValue;
 
+/* largest value accepted for kNuValueCodecThreads */
+#define kNuMaxCodecThreads  16
+
 /*
  * Enumerated values for things you pass in a NuValue.
  */
@@ -780,12 +800,18 @@ NUFXLIB_API NuError NuGetRecordIdxByName(NuArchive* pArchive,
             const char* nameMOR, NuRecordIdx* pRecordIdx);
 NUFXLIB_API NuError NuGetRecordIdxByPosition(NuArchive* pArchive,
             uint32_t position, NuRecordIdx* pRecordIdx);
+NUFXLIB_API NuError NuCreateThreadReader(NuArchive* pArchive,
+            NuThreadIdx threadIdx, NuThreadReader** ppReader);
+NUFXLIB_API NuError NuReadThreadChunk(NuThreadReader* pReader,
+            uint32_t chunkIdx, uint8_t* buf);
+NUFXLIB_API NuError NuFreeThreadReader(NuThreadReader* pReader);
 
 /* read/write interfaces */
 NUFXLIB_API NuError NuOpenRW(const UNICHAR* archivePathnameUNI,
             const UNICHAR* tempPathnameUNI, uint32_t flags,
             NuArchive** ppArchive);
 NUFXLIB_API NuError NuFlush(NuArchive* pArchive, uint32_t* pStatusFlags);
+NUFXLIB_API NuError NuCompact(NuArchive* pArchive, uint32_t* pStatusFlags);
 NUFXLIB_API NuError NuAddRecord(NuArchive* pArchive,
             const NuFileDetails* pFileDetails, NuRecordIdx* pRecordIdx);
 NUFXLIB_API NuError NuAddThread(NuArchive* pArchive, NuRecordIdx recordIdx,
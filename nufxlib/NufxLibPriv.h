@@ -83,12 +83,16 @@ typedef enum NuOpenMode {
  * record set was initialized from "orig", and then had all of its records
  * deleted, you couldn't look at "numRecords" and decide whether it was
  * appropriate to use "orig" or not.
+ *
+ * "pIndex" holds hash tables and a position vector for fast lookups.  It's
+ * built the first time a big set is searched, and is private to Record.c.
  */
 typedef struct NuRecordSet {
     Boolean         loaded;
     uint32_t        numRecords;
     NuRecord*       nuRecordHead;
     NuRecord*       nuRecordTail;
+    struct NuRecordIndex* pIndex;
 } NuRecordSet;
 
 /*
@@ -158,6 +162,8 @@ struct NuArchive {
     NuValue         valJunkSkipMax;         /* scan this far for header */
     NuValue         valIgnoreLZW2Len;       /* don't verify LZW/II len field */
     NuValue         valHandleBadMac;        /* handle "bad Mac" archives */
+    NuValue         valCodecThreads;        /* #of threads for LZW codec */
+    NuValue         valAppendInPlace;       /* append new recs w/o temp file? */
 
     /* callback functions */
     NuCallback      selectionFilterFunc;
@@ -172,6 +178,43 @@ struct NuArchive {
 #define kNuDefaultRecordName    "UNKNOWN"   /* use ASCII charset */
 
 
+/*
+ * Random-access thread reader state (see Lzw.c).
+ *
+ * We learn where each compressed chunk starts as we expand the one
+ * before it.  An LZW/2 chunk can only be expanded on its own if the
+ * string table was empty when it started; "chunkRestart" remembers which
+ * ones those are, so we can back up to the closest one instead of going
+ * back to the start of the thread.
+ */
+struct NuThreadReader {
+    NuArchive*      pArchive;
+    const NuRecord* pRecord;
+    NuThreadFormat  format;
+    Boolean         ignoreLZW2Len;      /* don't verify LZW/II len field */
+    long            dataOffset;         /* file offset of thread data */
+    uint32_t        compLen;            /* thCompThreadEOF */
+    uint32_t        uncompLen;          /* actualThreadEOF */
+    uint32_t        numChunks;
+
+    uint32_t*       chunkOffset;        /* chunk hdr offset, 0 if unknown */
+    Boolean*        chunkRestart;       /* can expand without predecessors */
+    uint32_t        nextChunk;          /* expander state is ready for this */
+
+    /* CRCs are only checked when every chunk is expanded in order */
+    Boolean         checkThreadCrc;
+    Boolean         checkLZW1Crc;
+    uint16_t        threadCrc;          /* expected thread CRC (v3) */
+    uint16_t        fileCrc;            /* expected LZW/1 CRC */
+    uint16_t        calcThreadCrc;
+    uint16_t        calcLZW1Crc;
+    uint32_t        crcChunk;           /* CRCs cover chunks before this */
+
+    void*           lzwState;           /* LZWExpandState */
+    uint8_t*        inBuf;              /* compressed input */
+};
+
+
 /*
  * ===========================================================================
  *      ThreadMod definition
@@ -563,6 +606,11 @@ NuError Nu_CopyPresizedToArchive(NuArchive* pArchive,
 /* Crc16.c */
 extern const uint16_t gNuCrc16Table[256];
 uint16_t Nu_CalcCRC16(uint16_t seed, const uint8_t* ptr, int count);
+uint16_t Nu_CalcCRC16Bytewise(uint16_t seed, const uint8_t* ptr, int count);
+uint16_t Nu_CalcCRC16Slice8(uint16_t seed, const uint8_t* ptr, int count);
+uint16_t Nu_CalcCRC16Clmul(uint16_t seed, const uint8_t* ptr, int count);
+Boolean Nu_CanUseCRC16Clmul(void);
+uint16_t Nu_CombineCRC16(uint16_t crcA, uint16_t crcB, uint32_t lenB);
 /*
  * Update the CRC-16.
  *
@@ -594,6 +642,7 @@ void Nu_FreeThreadMods(NuArchive* pArchive, NuRecord* pRecord);
 NuThreadMod* Nu_ThreadMod_FindByThreadIdx(const NuRecord* pRecord,
     NuThreadIdx threadIdx);
 NuError Nu_Flush(NuArchive* pArchive, uint32_t* pStatusFlags);
+NuError Nu_Compact(NuArchive* pArchive, uint32_t* pStatusFlags);
 
 /* Deflate.c */
 NuError Nu_CompressDeflate(NuArchive* pArchive, NuStraw* pStraw, FILE* fp,
@@ -621,6 +670,8 @@ NuError Nu_FTell(FILE* fp, long* pOffset);
 NuError Nu_FSeek(FILE* fp, long offset, int ptrname);
 NuError Nu_FRead(FILE* fp, void* buf, size_t nbyte);
 NuError Nu_FWrite(FILE* fp, const void* buf, size_t nbyte);
+NuError Nu_MoveFileSection(NuArchive* pArchive, FILE* fp, long dstOffset,
+    long srcOffset, long length);
 NuError Nu_CopyFileSection(NuArchive* pArchive, FILE* dstFp, FILE* srcFp,
     long length);
 NuError Nu_GetFileLength(NuArchive* pArchive, FILE* fp, long* pLength);
@@ -670,6 +721,11 @@ NuError Nu_ExpandLZC(NuArchive* pArchive, const NuRecord* pRecord,
     const NuThread* pThread, FILE* infp, NuFunnel* pFunnel, uint16_t* pCrc);
 
 /* Lzw.c */
+NuError Nu_ThreadReader_New(NuArchive* pArchive, NuThreadIdx threadIdx,
+    NuThreadReader** ppReader);
+NuError Nu_ThreadReader_Read(NuThreadReader* pReader, uint32_t chunkIdx,
+    uint8_t* buf);
+NuError Nu_ThreadReader_Free(NuThreadReader* pReader);
 NuError Nu_CompressLZW1(NuArchive* pArchive, NuStraw* pStraw, FILE* fp,
     uint32_t srcLen, uint32_t* pDstLen, uint16_t* pCrc);
 NuError Nu_CompressLZW2(NuArchive* pArchive, NuStraw* pStraw, FILE* fp,
@@ -723,8 +779,11 @@ NuError Nu_RecordSet_Clone(NuArchive* pArchive, NuRecordSet* pDstSet,
     const NuRecordSet* pSrcSet);
 NuError Nu_RecordSet_MoveAllRecords(NuArchive* pArchive, NuRecordSet* pDstSet,
     NuRecordSet* pSrcSet);
-NuError Nu_RecordSet_FindByIdx(const NuRecordSet* pRecordSet, NuRecordIdx rec,
+void Nu_RecordSet_InvalidateIndex(NuRecordSet* pRecordSet);
+NuError Nu_RecordSet_FindByIdx(NuRecordSet* pRecordSet, NuRecordIdx rec,
     NuRecord** ppRecord);
+NuError Nu_RecordSet_FindByPosition(NuRecordSet* pRecordSet,
+    uint32_t position, NuRecord** ppRecord);
 NuError Nu_RecordSet_FindByThreadIdx(NuRecordSet* pRecordSet,
     NuThreadIdx threadIdx, NuRecord** ppRecord, NuThread** ppThread);
 NuError Nu_RecordSet_ReplaceRecord(NuArchive* pArchive, NuRecordSet* pBadSet,
@@ -858,4 +917,8 @@ NuThreadFormat Nu_ConvertCompressValToFormat(NuArchive* pArchive,
 NuError Nu_GetVersion(int32_t* pMajorVersion, int32_t* pMinorVersion,
     int32_t* pBugVersion, const char** ppBuildDate, const char** ppBuildFlags);
 
+/* Workers.c */
+typedef void (*NuWorkerFunc)(void* arg, int workerIdx);
+void Nu_RunWorkers(int numWorkers, NuWorkerFunc func, void* arg);
+
 #endif /*NUFXLIB_NUFXLIBPRIV_H*/
@@ -7,6 +7,7 @@
  * Record-level operations.
  */
 #include "NufxLibPriv.h"
+#include <ctype.h>
 
 
 /*
@@ -323,6 +324,367 @@ Boolean Nu_RecordSet_IsEmpty(const NuRecordSet* pRecordSet)
     return false;
 }
 
+/*
+ * ===========================================================================
+ *      NuRecordSet indexes
+ * ===========================================================================
+ */
+
+/*
+ * Walking the list is fine for a few dozen records, but archives with
+ * thousands of entries make every per-record call quadratic.  Once a set
+ * gets big enough, the first lookup builds hash tables keyed on record
+ * index, thread index, and filename, plus a vector of records in list
+ * order.
+ *
+ * The tables are updated as records are added and deleted.  The position
+ * vector is just thrown out on a delete, and rebuilt when next needed.
+ * Filenames and threads can change during a flush, so the flush code
+ * calls Nu_RecordSet_InvalidateIndex when it's done.
+ *
+ * If we can't allocate memory for an index, we just walk the list.
+ */
+#define kNuRecordIndexMinRecords    16      /* don't index smaller sets */
+#define kNuRecordIndexMinSlots      64
+
+typedef struct NuRecordIndexEntry {
+    NuRecord*       pRecord;            /* NULL if empty */
+    uint32_t        key;                /* recordIdx, threadIdx, name hash */
+    uint32_t        seq;                /* order in the list */
+} NuRecordIndexEntry;
+
+typedef struct NuRecordHashTable {
+    NuRecordIndexEntry* entries;
+    uint32_t        numSlots;           /* always a power of 2 */
+    uint32_t        numUsed;            /* live entries plus tombstones */
+} NuRecordHashTable;
+
+typedef struct NuRecordIndex {
+    NuRecordHashTable byIdx;
+    NuRecordHashTable byThreadIdx;
+    NuRecordHashTable byName;
+    uint32_t        nextSeq;
+
+    NuRecord**      byPosition;         /* NULL when out of date */
+    uint32_t        positionAlloc;
+    uint32_t        numPositions;
+} NuRecordIndex;
+
+/* marks a deleted hash table entry */
+static char gNuIndexTombstone;
+#define kNuIndexTombstone   ((NuRecord*) &gNuIndexTombstone)
+
+/*
+ * Scramble a 32-bit key.
+ */
+static inline uint32_t Nu_HashKey(uint32_t key)
+{
+    key *= 0x9e3779b1;
+    return key ^ (key >> 16);
+}
+
+/*
+ * Hash a filename the same way Nu_CompareRecordNames compares them.
+ */
+static uint32_t Nu_HashRecordName(const char* nameMOR)
+{
+    uint32_t hash = 2166136261U;
+
+    while (*nameMOR != '\0') {
+#ifdef NU_CASE_SENSITIVE
+        hash ^= (uint8_t) *nameMOR;
+#else
+        hash ^= (uint8_t) tolower((uint8_t) *nameMOR);
+#endif
+        hash *= 16777619;
+        nameMOR++;
+    }
+    return hash;
+}
+
+/*
+ * Add an entry to a hash table, growing it if it's getting full.
+ * Returns "false" if we ran out of memory.
+ */
+static Boolean Nu_RecordHash_Insert(NuRecordHashTable* pTable,
+    NuRecord* pRecord, uint32_t key, uint32_t seq)
+{
+    NuRecordIndexEntry* pEntry;
+    uint32_t slot;
+
+    /* keep it no more than half full, counting tombstones */
+    if ((pTable->numUsed + 1) * 2 > pTable->numSlots) {
+        NuRecordHashTable newTable;
+        uint32_t numLive = 0;
+        uint32_t idx;
+
+        for (idx = 0; idx < pTable->numSlots; idx++) {
+            pEntry = &pTable->entries[idx];
+            if (pEntry->pRecord != NULL && pEntry->pRecord != kNuIndexTombstone)
+                numLive++;
+        }
+
+        newTable.numSlots = kNuRecordIndexMinSlots;
+        while (newTable.numSlots < (numLive + 1) * 4)
+            newTable.numSlots *= 2;
+        newTable.numUsed = 0;
+        newTable.entries = Nu_Calloc(NULL,
+                            newTable.numSlots * sizeof(NuRecordIndexEntry));
+        if (newTable.entries == NULL)
+            return false;
+
+        for (idx = 0; idx < pTable->numSlots; idx++) {
+            pEntry = &pTable->entries[idx];
+            if (pEntry->pRecord != NULL && pEntry->pRecord != kNuIndexTombstone)
+            {
+                (void) Nu_RecordHash_Insert(&newTable, pEntry->pRecord,
+                        pEntry->key, pEntry->seq);
+            }
+        }
+
+        Nu_Free(NULL, pTable->entries);
+        *pTable = newTable;
+    }
+
+    slot = Nu_HashKey(key) & (pTable->numSlots - 1);
+    while (pTable->entries[slot].pRecord != NULL)
+        slot = (slot + 1) & (pTable->numSlots - 1);
+
+    pEntry = &pTable->entries[slot];
+    pEntry->pRecord = pRecord;
+    pEntry->key = key;
+    pEntry->seq = seq;
+    pTable->numUsed++;
+    return true;
+}
+
+/*
+ * Remove every entry for "pRecord" with the given key.  Returns "false"
+ * if there wasn't one.
+ */
+static Boolean Nu_RecordHash_Remove(NuRecordHashTable* pTable,
+    const NuRecord* pRecord, uint32_t key)
+{
+    NuRecordIndexEntry* pEntry;
+    Boolean found = false;
+    uint32_t slot;
+
+    if (pTable->numSlots == 0)
+        return false;
+
+    slot = Nu_HashKey(key) & (pTable->numSlots - 1);
+    while ((pEntry = &pTable->entries[slot])->pRecord != NULL) {
+        if (pEntry->pRecord == pRecord && pEntry->key == key) {
+            pEntry->pRecord = kNuIndexTombstone;
+            found = true;
+        }
+        slot = (slot + 1) & (pTable->numSlots - 1);
+    }
+    return found;
+}
+
+/*
+ * Free an index.
+ */
+static void Nu_RecordIndex_Free(NuRecordIndex* pIndex)
+{
+    if (pIndex == NULL)
+        return;
+
+    Nu_Free(NULL, pIndex->byIdx.entries);
+    Nu_Free(NULL, pIndex->byThreadIdx.entries);
+    Nu_Free(NULL, pIndex->byName.entries);
+    Nu_Free(NULL, pIndex->byPosition);
+    Nu_Free(NULL, pIndex);
+}
+
+/*
+ * Add a record to the hash tables.  Returns "false" if we ran out of
+ * memory, in which case the index should be discarded.
+ */
+static Boolean Nu_RecordIndex_AddRecord(NuRecordIndex* pIndex,
+    NuRecord* pRecord, uint32_t seq)
+{
+    uint32_t idx;
+
+    if (!Nu_RecordHash_Insert(&pIndex->byIdx, pRecord, pRecord->recordIdx,
+            seq))
+    {
+        return false;
+    }
+    if (!Nu_RecordHash_Insert(&pIndex->byName, pRecord,
+            Nu_HashRecordName(pRecord->filenameMOR), seq))
+    {
+        return false;
+    }
+    for (idx = 0; idx < pRecord->recTotalThreads; idx++) {
+        if (!Nu_RecordHash_Insert(&pIndex->byThreadIdx, pRecord,
+                pRecord->pThreads[idx].threadIdx, seq))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Remove a record from the hash tables.  Returns "false" if it wasn't
+ * where we expected, which means the index is out of date.
+ */
+static Boolean Nu_RecordIndex_RemoveRecord(NuRecordIndex* pIndex,
+    const NuRecord* pRecord)
+{
+    Boolean result = true;
+    uint32_t idx;
+
+    if (!Nu_RecordHash_Remove(&pIndex->byIdx, pRecord, pRecord->recordIdx))
+        result = false;
+    if (!Nu_RecordHash_Remove(&pIndex->byName, pRecord,
+            Nu_HashRecordName(pRecord->filenameMOR)))
+    {
+        result = false;
+    }
+    for (idx = 0; idx < pRecord->recTotalThreads; idx++) {
+        /* a record could have two threads with the same idx; ignore that */
+        (void) Nu_RecordHash_Remove(&pIndex->byThreadIdx, pRecord,
+                pRecord->pThreads[idx].threadIdx);
+    }
+
+    /* positions after this one are now wrong */
+    Nu_Free(NULL, pIndex->byPosition);
+    pIndex->byPosition = NULL;
+
+    return result;
+}
+
+/*
+ * Throw out the record set's index.  It'll be rebuilt if needed.
+ */
+void Nu_RecordSet_InvalidateIndex(NuRecordSet* pRecordSet)
+{
+    Assert(pRecordSet != NULL);
+
+    Nu_RecordIndex_Free(pRecordSet->pIndex);
+    pRecordSet->pIndex = NULL;
+}
+
+/*
+ * Get the record set's index, building it if necessary.  Returns NULL if
+ * the set is too small to bother with, or we're out of memory.
+ */
+static NuRecordIndex* Nu_RecordSet_GetIndex(NuRecordSet* pRecordSet)
+{
+    NuRecordIndex* pIndex;
+    NuRecord* pRecord;
+
+    if (pRecordSet->pIndex != NULL)
+        return pRecordSet->pIndex;
+    if (pRecordSet->numRecords < kNuRecordIndexMinRecords)
+        return NULL;
+
+    pIndex = Nu_Calloc(NULL, sizeof(*pIndex));
+    if (pIndex == NULL)
+        return NULL;
+
+    for (pRecord = pRecordSet->nuRecordHead; pRecord != NULL;
+        pRecord = pRecord->pNext)
+    {
+        if (!Nu_RecordIndex_AddRecord(pIndex, pRecord, pIndex->nextSeq++)) {
+            Nu_RecordIndex_Free(pIndex);
+            return NULL;
+        }
+    }
+
+    pRecordSet->pIndex = pIndex;
+    return pIndex;
+}
+
+/*
+ * Get the position vector, building it if necessary.  Returns NULL if
+ * we can't.
+ */
+static NuRecord** Nu_RecordSet_GetPositions(NuRecordSet* pRecordSet)
+{
+    NuRecordIndex* pIndex;
+    NuRecord* pRecord;
+    uint32_t count;
+
+    pIndex = Nu_RecordSet_GetIndex(pRecordSet);
+    if (pIndex == NULL)
+        return NULL;
+    if (pIndex->byPosition != NULL)
+        return pIndex->byPosition;
+
+    pIndex->positionAlloc = pRecordSet->numRecords + kNuRecordIndexMinSlots;
+    pIndex->byPosition = Nu_Malloc(NULL,
+                            pIndex->positionAlloc * sizeof(NuRecord*));
+    if (pIndex->byPosition == NULL)
+        return NULL;
+
+    count = 0;
+    for (pRecord = pRecordSet->nuRecordHead; pRecord != NULL;
+        pRecord = pRecord->pNext)
+    {
+        pIndex->byPosition[count++] = pRecord;
+    }
+    Assert(count == pRecordSet->numRecords);
+    pIndex->numPositions = count;
+
+    return pIndex->byPosition;
+}
+
+/*
+ * Update the index (if any) for a record just added to the end of the
+ * list.
+ */
+static void Nu_RecordSet_IndexAppend(NuRecordSet* pRecordSet,
+    NuRecord* pRecord)
+{
+    NuRecordIndex* pIndex = pRecordSet->pIndex;
+
+    if (pIndex == NULL)
+        return;
+
+    if (!Nu_RecordIndex_AddRecord(pIndex, pRecord, pIndex->nextSeq++)) {
+        Nu_RecordSet_InvalidateIndex(pRecordSet);
+        return;
+    }
+
+    if (pIndex->byPosition != NULL) {
+        if (pIndex->numPositions == pIndex->positionAlloc) {
+            NuRecord** newPositions;
+
+            newPositions = Nu_Realloc(NULL, pIndex->byPosition,
+                            pIndex->positionAlloc * 2 * sizeof(NuRecord*));
+            if (newPositions == NULL) {
+                Nu_Free(NULL, pIndex->byPosition);
+                pIndex->byPosition = NULL;
+                return;
+            }
+            pIndex->byPosition = newPositions;
+            pIndex->positionAlloc *= 2;
+        }
+        pIndex->byPosition[pIndex->numPositions++] = pRecord;
+    }
+}
+
+/*
+ * Update the index (if any) for a record about to be removed from the list.
+ */
+static void Nu_RecordSet_IndexRemove(NuRecordSet* pRecordSet,
+    const NuRecord* pRecord)
+{
+    if (pRecordSet->pIndex == NULL)
+        return;
+
+    if (!Nu_RecordIndex_RemoveRecord(pRecordSet->pIndex, pRecord)) {
+        /* somebody changed it behind our back; start over */
+        DBUG(("--- record index out of date, discarding\n"));
+        Nu_RecordSet_InvalidateIndex(pRecordSet);
+    }
+}
+
+
 /*
  * Free the list of records, and reset the record sets to initial state.
  */
@@ -333,6 +695,8 @@ NuError Nu_RecordSet_FreeAllRecords(NuArchive* pArchive,
     NuRecord* pRecord;
     NuRecord* pNextRecord;
 
+    Nu_RecordSet_InvalidateIndex(pRecordSet);
+
     if (!pRecordSet->loaded) {
         Assert(pRecordSet->nuRecordHead == NULL);
         Assert(pRecordSet->nuRecordTail == NULL);
@@ -385,6 +749,7 @@ static NuError Nu_RecordSet_AddRecord(NuRecordSet* pRecordSet,
     }
 
     pRecordSet->numRecords++;
+    Nu_RecordSet_IndexAppend(pRecordSet, pRecord);
 
     return kNuErrNone;
 }
@@ -410,6 +775,7 @@ NuError Nu_RecordSet_DeleteRecordPtr(NuArchive* pArchive,
 
     /* save a copy of the record we're freeing */
     pRecord = *ppRecord;
+    Nu_RecordSet_IndexRemove(pRecordSet, pRecord);
 
     /* update the pHead or pNext pointer */
     *ppRecord = (*ppRecord)->pNext;
@@ -484,6 +850,7 @@ NuError Nu_RecordSet_Clone(NuArchive* pArchive, NuRecordSet* pDstSet,
     Assert(pSrcSet != NULL);
     Assert(Nu_RecordSet_GetLoaded(pDstSet) == false);
     Assert(Nu_RecordSet_GetLoaded(pSrcSet) == true);
+    Assert(pDstSet->pIndex == NULL);    /* built on demand */
 
     DBUG(("--- Cloning record set\n"));
 
@@ -528,6 +895,18 @@ NuError Nu_RecordSet_MoveAllRecords(NuArchive* pArchive, NuRecordSet* pDstSet,
         Assert(pSrcSet->loaded);
         Assert(pSrcSet->nuRecordHead != NULL);
         Assert(pSrcSet->nuRecordTail != NULL);
+
+        /* bring the destination's index up to date, if it has one */
+        if (pDstSet->pIndex != NULL) {
+            NuRecord* pRecord;
+
+            for (pRecord = pSrcSet->nuRecordHead; pRecord != NULL;
+                pRecord = pRecord->pNext)
+            {
+                Nu_RecordSet_IndexAppend(pDstSet, pRecord);
+            }
+        }
+
         if (pDstSet->nuRecordHead == NULL) {
             /* empty dst list */
             Assert(pDstSet->nuRecordTail == NULL);
@@ -553,6 +932,7 @@ NuError Nu_RecordSet_MoveAllRecords(NuArchive* pArchive, NuRecordSet* pDstSet,
     }
 
     /* nuke all pointers in original list */
+    Nu_RecordSet_InvalidateIndex(pSrcSet);
     pSrcSet->nuRecordHead = pSrcSet->nuRecordTail = NULL;
     pSrcSet->numRecords = 0;
     pSrcSet->loaded = false;
@@ -564,11 +944,31 @@ NuError Nu_RecordSet_MoveAllRecords(NuArchive* pArchive, NuRecordSet* pDstSet,
 /*
  * Find a record in the list by index.
  */
-NuError Nu_RecordSet_FindByIdx(const NuRecordSet* pRecordSet,
+NuError Nu_RecordSet_FindByIdx(NuRecordSet* pRecordSet,
     NuRecordIdx recIdx, NuRecord** ppRecord)
 {
+    NuRecordIndex* pIndex;
     NuRecord* pRecord;
 
+    pIndex = Nu_RecordSet_GetIndex(pRecordSet);
+    if (pIndex != NULL) {
+        const NuRecordHashTable* pTable = &pIndex->byIdx;
+        uint32_t slot = Nu_HashKey(recIdx) & (pTable->numSlots - 1);
+
+        for ( ; (pRecord = pTable->entries[slot].pRecord) != NULL;
+            slot = (slot + 1) & (pTable->numSlots - 1))
+        {
+            if (pRecord != kNuIndexTombstone &&
+                pTable->entries[slot].key == recIdx)
+            {
+                Assert(pRecord->recordIdx == recIdx);
+                *ppRecord = pRecord;
+                return kNuErrNone;
+            }
+        }
+        return kNuErrRecIdxNotFound;
+    }
+
     pRecord = pRecordSet->nuRecordHead;
     while (pRecord != NULL) {
         if (pRecord->recordIdx == recIdx) {
@@ -590,8 +990,46 @@ NuError Nu_RecordSet_FindByThreadIdx(NuRecordSet* pRecordSet,
     NuThreadIdx threadIdx, NuRecord** ppRecord, NuThread** ppThread)
 {
     NuError err = kNuErrThreadIdxNotFound;
+    NuRecordIndex* pIndex;
     NuRecord* pRecord;
 
+    pIndex = Nu_RecordSet_GetIndex(pRecordSet);
+    if (pIndex != NULL) {
+        const NuRecordHashTable* pTable = &pIndex->byThreadIdx;
+        const NuRecordIndexEntry* pBest = NULL;
+        uint32_t slot;
+
+        if (pTable->numSlots == 0)
+            return kNuErrThreadIdxNotFound;     /* no threads at all */
+
+        /* if two records claim it, the list walk would find the first */
+        slot = Nu_HashKey(threadIdx) & (pTable->numSlots - 1);
+        for ( ; (pRecord = pTable->entries[slot].pRecord) != NULL;
+            slot = (slot + 1) & (pTable->numSlots - 1))
+        {
+            if (pRecord != kNuIndexTombstone &&
+                pTable->entries[slot].key == threadIdx &&
+                (pBest == NULL || pTable->entries[slot].seq < pBest->seq))
+            {
+                pBest = &pTable->entries[slot];
+            }
+        }
+        if (pBest == NULL)
+            return kNuErrThreadIdxNotFound;
+
+        err = Nu_FindThreadByIdx(pBest->pRecord, threadIdx, ppThread);
+        if (err == kNuErrNone) {
+            *ppRecord = pBest->pRecord;
+            return kNuErrNone;
+        }
+
+        /* shouldn't happen; fall back on the slow way */
+        DBUG(("--- thread index out of date, discarding\n"));
+        Assert(false);
+        Nu_RecordSet_InvalidateIndex(pRecordSet);
+        err = kNuErrThreadIdxNotFound;
+    }
+
     pRecord = Nu_RecordSet_GetListHead(pRecordSet);
     while (pRecord != NULL) {
         err = Nu_FindThreadByIdx(pRecord, threadIdx, ppThread);
@@ -606,6 +1044,38 @@ NuError Nu_RecordSet_FindByThreadIdx(NuRecordSet* pRecordSet,
     return err;
 }
 
+/*
+ * Find the record at the specified position (0-based) in the list.
+ */
+NuError Nu_RecordSet_FindByPosition(NuRecordSet* pRecordSet,
+    uint32_t position, NuRecord** ppRecord)
+{
+    NuRecord** positions;
+    NuRecord* pRecord;
+
+    Assert(pRecordSet != NULL);
+    Assert(pRecordSet->loaded);
+    Assert(ppRecord != NULL);
+
+    if (position >= pRecordSet->numRecords)
+        return kNuErrRecordNotFound;
+
+    positions = Nu_RecordSet_GetPositions(pRecordSet);
+    if (positions != NULL) {
+        *ppRecord = positions[position];
+        return kNuErrNone;
+    }
+
+    pRecord = pRecordSet->nuRecordHead;
+    while (position--) {
+        Assert(pRecord->pNext != NULL);
+        pRecord = pRecord->pNext;
+    }
+
+    *ppRecord = pRecord;
+    return kNuErrNone;
+}
+
 
 /*
  * Compare two record filenames.  This comes into play when looking for
@@ -639,12 +1109,44 @@ static int Nu_CompareRecordNames(const char* name1MOR, const char* name2MOR)
 }
 
 
+/*
+ * Find a record by name with the hash table.  If there's more than one,
+ * returns the first or last in list order.
+ */
+static NuRecord* Nu_RecordIndex_FindByName(const NuRecordIndex* pIndex,
+    const char* nameMOR, Boolean wantLast)
+{
+    const NuRecordHashTable* pTable = &pIndex->byName;
+    const NuRecordIndexEntry* pBest = NULL;
+    const NuRecordIndexEntry* pEntry;
+    uint32_t hash = Nu_HashRecordName(nameMOR);
+    uint32_t slot;
+
+    slot = Nu_HashKey(hash) & (pTable->numSlots - 1);
+    for ( ; (pEntry = &pTable->entries[slot])->pRecord != NULL;
+        slot = (slot + 1) & (pTable->numSlots - 1))
+    {
+        if (pEntry->pRecord == kNuIndexTombstone || pEntry->key != hash)
+            continue;
+        if (pBest != NULL &&
+            (wantLast ? pEntry->seq < pBest->seq : pEntry->seq > pBest->seq))
+        {
+            continue;
+        }
+        if (Nu_CompareRecordNames(pEntry->pRecord->filenameMOR, nameMOR) == 0)
+            pBest = pEntry;
+    }
+
+    return (pBest != NULL) ? pBest->pRecord : NULL;
+}
+
 /*
  * Find a record in the list by storageName.
  */
-static NuError Nu_RecordSet_FindByName(const NuRecordSet* pRecordSet,
+static NuError Nu_RecordSet_FindByName(NuRecordSet* pRecordSet,
     const char* nameMOR, NuRecord** ppRecord)
 {
+    NuRecordIndex* pIndex;
     NuRecord* pRecord;
 
     Assert(pRecordSet != NULL);
@@ -652,6 +1154,15 @@ static NuError Nu_RecordSet_FindByName(const NuRecordSet* pRecordSet,
     Assert(nameMOR != NULL);
     Assert(ppRecord != NULL);
 
+    pIndex = Nu_RecordSet_GetIndex(pRecordSet);
+    if (pIndex != NULL) {
+        pRecord = Nu_RecordIndex_FindByName(pIndex, nameMOR, false);
+        if (pRecord == NULL)
+            return kNuErrRecNameNotFound;
+        *ppRecord = pRecord;
+        return kNuErrNone;
+    }
+
     pRecord = pRecordSet->nuRecordHead;
     while (pRecord != NULL) {
         if (Nu_CompareRecordNames(pRecord->filenameMOR, nameMOR) == 0) {
@@ -670,12 +1181,13 @@ static NuError Nu_RecordSet_FindByName(const NuRecordSet* pRecordSet,
  * searching backwards.
  *
  * Since we don't actually have a "prev" pointer in the record, we end
- * up scanning the entire list and keeping the last match.  If this
- * causes a notable reduction in efficiency we'll have to fix this.
+ * up scanning the entire list and keeping the last match, unless the set
+ * is big enough to have an index.
  */
-static NuError Nu_RecordSet_ReverseFindByName(const NuRecordSet* pRecordSet,
+static NuError Nu_RecordSet_ReverseFindByName(NuRecordSet* pRecordSet,
     const char* nameMOR, NuRecord** ppRecord)
 {
+    NuRecordIndex* pIndex;
     NuRecord* pRecord;
     NuRecord* pFoundRecord = NULL;
 
@@ -684,6 +1196,15 @@ static NuError Nu_RecordSet_ReverseFindByName(const NuRecordSet* pRecordSet,
     Assert(nameMOR != NULL);
     Assert(ppRecord != NULL);
 
+    pIndex = Nu_RecordSet_GetIndex(pRecordSet);
+    if (pIndex != NULL) {
+        pRecord = Nu_RecordIndex_FindByName(pIndex, nameMOR, true);
+        if (pRecord == NULL)
+            return kNuErrRecNameNotFound;
+        *ppRecord = pRecord;
+        return kNuErrNone;
+    }
+
     pRecord = pRecordSet->nuRecordHead;
     while (pRecord != NULL) {
         if (Nu_CompareRecordNames(pRecord->filenameMOR, nameMOR) == 0)
@@ -740,8 +1261,9 @@ NuError Nu_RecordSet_ReplaceRecord(NuArchive* pArchive, NuRecordSet* pBadSet,
 
     /*
      * Insert the new one into the "bad" record set, in the exact same
-     * position.
+     * position.  The index still points at the old one, so drop it.
      */
+    Nu_RecordSet_InvalidateIndex(pBadSet);
     pNewRecord->pNext = pBadRecord->pNext;
     if (pBadSet->nuRecordTail == pBadRecord)
         pBadSet->nuRecordTail = pNewRecord;
@@ -1964,7 +2486,7 @@ NuError Nu_GetRecordIdxByPosition(NuArchive* pArchive, uint32_t position,
     NuRecordIdx* pRecordIdx)
 {
     NuError err;
-    const NuRecord* pRecord;
+    NuRecord* pRecord;
 
     if (pRecordIdx == NULL)
         return kNuErrInvalidArg;
@@ -1974,16 +2496,9 @@ NuError Nu_GetRecordIdxByPosition(NuArchive* pArchive, uint32_t position,
     err = Nu_GetTOCIfNeeded(pArchive);
     BailError(err);
 
-    if (position >= Nu_RecordSet_GetNumRecords(&pArchive->origRecordSet)) {
-        err = kNuErrRecordNotFound;
-        goto bail;
-    }
-
-    pRecord = Nu_RecordSet_GetListHead(&pArchive->origRecordSet);
-    while (position--) {
-        Assert(pRecord->pNext != NULL);
-        pRecord = pRecord->pNext;
-    }
+    err = Nu_RecordSet_FindByPosition(&pArchive->origRecordSet, position,
+            &pRecord);
+    BailError(err);
 
     *pRecordIdx = pRecord->recordIdx;
 
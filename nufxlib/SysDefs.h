@@ -135,4 +135,13 @@
 # define HAS_MALLOC_CHECK_
 #endif
 
+/* per-thread storage, for the few statics that need it */
+#if defined(_MSC_VER)
+# define NU_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+# define NU_THREAD_LOCAL __thread
+#else
+# define NU_THREAD_LOCAL
+#endif
+
 #endif /*NUFXLIB_SYSDEFS_H*/
@@ -67,6 +67,12 @@ NuError Nu_GetValue(NuArchive* pArchive, NuValueID ident, NuValue* pValue)
     case kNuValueHandleBadMac:
         *pValue = pArchive->valHandleBadMac;
         break;
+    case kNuValueCodecThreads:
+        *pValue = pArchive->valCodecThreads;
+        break;
+    case kNuValueAppendInPlace:
+        *pValue = pArchive->valAppendInPlace;
+        break;
     default:
         err = kNuErrInvalidArg;
         Nu_ReportError(NU_BLOB, err, "Unknown ValueID %d requested", ident);
@@ -206,6 +212,22 @@ NuError Nu_SetValue(NuArchive* pArchive, NuValueID ident, NuValue value)
         }
         pArchive->valHandleBadMac = value;
         break;
+    case kNuValueCodecThreads:
+        if (value < 1 || value > kNuMaxCodecThreads) {
+            Nu_ReportError(NU_BLOB, err,
+                "Invalid kNuValueCodecThreads value %u", value);
+            goto bail;
+        }
+        pArchive->valCodecThreads = value;
+        break;
+    case kNuValueAppendInPlace:
+        if (value != true && value != false) {
+            Nu_ReportError(NU_BLOB, err,
+                "Invalid kNuValueAppendInPlace value %u", value);
+            goto bail;
+        }
+        pArchive->valAppendInPlace = value;
+        break;
     default:
         Nu_ReportError(NU_BLOB, err, "Unknown ValueID %d requested", ident);
         goto bail;
@@ -0,0 +1,122 @@
+/*
+ * NuFX archive manipulation library
+ * Copyright (C) 2000-2007 by Andy McFadden, All Rights Reserved.
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the BSD License, see the file COPYING-LIB.
+ *
+ * Worker threads for the compression code.
+ *
+ * This is deliberately minimal: the caller hands us a function and a
+ * worker count, we run the function once per worker index, and we don't
+ * return until they're all done.  The function is expected to divide
+ * up the work by index, so no locking is needed.  If threads aren't
+ * available (or we can't start one), the indices are run on the
+ * calling thread instead, so the result is the same either way.
+ */
+#include "NufxLibPriv.h"
+
+#if defined(_WIN32)
+# include <windows.h>
+# include <process.h>
+# define NU_HAVE_WORKERS
+#elif defined(HAVE_PTHREAD)
+# include <pthread.h>
+# define NU_HAVE_WORKERS
+#endif
+
+
+#ifdef NU_HAVE_WORKERS
+typedef struct NuWorkerStart {
+    NuWorkerFunc    func;
+    void*           arg;
+    int             workerIdx;
+} NuWorkerStart;
+
+# ifdef _WIN32
+static unsigned __stdcall Nu_WorkerThreadEntry(void* vstart)
+{
+    NuWorkerStart* pStart = (NuWorkerStart*) vstart;
+    (*pStart->func)(pStart->arg, pStart->workerIdx);
+    return 0;
+}
+# else
+static void* Nu_WorkerThreadEntry(void* vstart)
+{
+    NuWorkerStart* pStart = (NuWorkerStart*) vstart;
+    (*pStart->func)(pStart->arg, pStart->workerIdx);
+    return NULL;
+}
+# endif
+#endif /*NU_HAVE_WORKERS*/
+
+/*
+ * Run "func" once for each worker index in [0, numWorkers).  Index zero
+ * always runs on the calling thread.
+ */
+void Nu_RunWorkers(int numWorkers, NuWorkerFunc func, void* arg)
+{
+    int idx;
+
+    Assert(func != NULL);
+
+    if (numWorkers > kNuMaxCodecThreads)
+        numWorkers = kNuMaxCodecThreads;
+    if (numWorkers < 1)
+        numWorkers = 1;
+
+#ifdef NU_HAVE_WORKERS
+    {
+        NuWorkerStart start[kNuMaxCodecThreads];
+        int numStarted = 1;
+# ifdef _WIN32
+        HANDLE threads[kNuMaxCodecThreads];
+# else
+        pthread_t threads[kNuMaxCodecThreads];
+# endif
+
+        while (numStarted < numWorkers) {
+            start[numStarted].func = func;
+            start[numStarted].arg = arg;
+            start[numStarted].workerIdx = numStarted;
+# ifdef _WIN32
+            {
+                uintptr_t handle = _beginthreadex(NULL, 0,
+                                    Nu_WorkerThreadEntry, &start[numStarted],
+                                    0, NULL);
+                if (handle == 0)
+                    break;
+                threads[numStarted] = (HANDLE) handle;
+            }
+# else
+            if (pthread_create(&threads[numStarted], NULL,
+                    Nu_WorkerThreadEntry, &start[numStarted]) != 0)
+            {
+                break;
+            }
+# endif
+            numStarted++;
+        }
+        if (numStarted < numWorkers) {
+            DBUG(("--- only started %d of %d workers\n",
+                numStarted, numWorkers));
+        }
+
+        /* do our share, plus anything we couldn't hand off */
+        (*func)(arg, 0);
+        for (idx = numStarted; idx < numWorkers; idx++)
+            (*func)(arg, idx);
+
+        for (idx = 1; idx < numStarted; idx++) {
+# ifdef _WIN32
+            WaitForSingleObject(threads[idx], INFINITE);
+            CloseHandle(threads[idx]);
+# else
+            pthread_join(threads[idx], NULL);
+# endif
+        }
+    }
+#else
+    for (idx = 0; idx < numWorkers; idx++)
+        (*func)(arg, idx);
+#endif
+}
@@ -0,0 +1,175 @@
+/*
+ * NuFX archive manipulation library
+ * Copyright (C) 2000-2007 by Andy McFadden, All Rights Reserved.
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the BSD License, see the file COPYING.LIB.
+ *
+ * CRC-16 benchmark.  Checks that the different CRC routines agree with
+ * each other (including Nu_CombineCRC16), then times each of them on a
+ * buffer of pseudo-random data.
+ *
+ * This calls library internals, so it must be linked against the static
+ * library rather than the DLL.
+ *
+ * Usage: crc-bench [buffer-size [megabytes]]
+ */
+#include <stdio.h>
+#include <time.h>
+#include "NufxLibPriv.h"
+
+typedef uint16_t (*CrcFunc)(uint16_t seed, const uint8_t* ptr, int count);
+
+typedef struct CrcEngine {
+    const char* name;
+    CrcFunc     func;
+} CrcEngine;
+
+static const CrcEngine gEngines[] = {
+    { "bytewise",   Nu_CalcCRC16Bytewise },
+    { "slice-by-8", Nu_CalcCRC16Slice8 },
+    { "clmul",      Nu_CalcCRC16Clmul },
+    { "auto",       Nu_CalcCRC16 },
+};
+#define kNumEngines ((int) NELEM(gEngines))
+
+/*
+ * Fill a buffer with junk.  We want the same junk every time.
+ */
+static void FillBuffer(uint8_t* buf, long len)
+{
+    uint32_t val = 0x12345678;
+    long i;
+
+    for (i = 0; i < len; i++) {
+        val = val * 1103515245 + 12345;
+        buf[i] = (uint8_t) (val >> 16);
+    }
+}
+
+/*
+ * Compare every engine against the byte-at-a-time code, for every length
+ * up to "maxLen" and a few different seeds and alignments.  Then make sure
+ * that splitting the buffer and combining the pieces gives the same
+ * answer.
+ *
+ * Returns the number of failures.
+ */
+static int CheckEngines(const uint8_t* buf, int maxLen)
+{
+    static const uint16_t kSeeds[] = { 0x0000, 0xffff, 0x1234 };
+    int failures = 0;
+    int len, off, seedIdx, eng, split;
+
+    for (seedIdx = 0; seedIdx < (int) NELEM(kSeeds); seedIdx++) {
+        uint16_t seed = kSeeds[seedIdx];
+
+        for (off = 0; off < 4; off++) {
+            for (len = 0; len <= maxLen; len++) {
+                uint16_t expected =
+                    Nu_CalcCRC16Bytewise(seed, buf + off, len);
+
+                for (eng = 1; eng < kNumEngines; eng++) {
+                    uint16_t crc = (*gEngines[eng].func)(seed, buf + off, len);
+                    if (crc != expected) {
+                        fprintf(stderr, "ERROR: %s seed=0x%04x off=%d "
+                                        "len=%d: 0x%04x vs 0x%04x\n",
+                            gEngines[eng].name, seed, off, len, crc,
+                            expected);
+                        failures++;
+                    }
+                }
+
+                for (split = 0; split <= len; split += 1 + len / 7) {
+                    uint16_t crcA, crcB;
+
+                    crcA = Nu_CalcCRC16(seed, buf + off, split);
+                    crcB = Nu_CalcCRC16(0, buf + off + split, len - split);
+                    if (Nu_CombineCRC16(crcA, crcB, len - split) != expected) {
+                        fprintf(stderr, "ERROR: combine seed=0x%04x len=%d "
+                                        "split=%d\n", seed, len, split);
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+
+    return failures;
+}
+
+/*
+ * Time one engine.  Returns the throughput in MB/sec.
+ */
+static double TimeEngine(const CrcEngine* pEngine, const uint8_t* buf,
+    int bufSize, long totalMB, uint16_t* pCrc)
+{
+    long iterations = (totalMB * 1024 * 1024) / bufSize;
+    uint16_t crc = 0xffff;
+    clock_t start, end;
+    double secs;
+    long i;
+
+    if (iterations < 1)
+        iterations = 1;
+
+    start = clock();
+    for (i = 0; i < iterations; i++)
+        crc = (*pEngine->func)(crc, buf, bufSize);
+    end = clock();
+
+    *pCrc = crc;
+    secs = (double) (end - start) / CLOCKS_PER_SEC;
+    if (secs <= 0.0)
+        secs = 1.0 / CLOCKS_PER_SEC;
+    return ((double) iterations * bufSize) / (1024.0 * 1024.0) / secs;
+}
+
+int main(int argc, char** argv)
+{
+    int bufSize = 4096;         /* same as an LZW chunk */
+    long totalMB = 256;
+    uint8_t* buf;
+    int failures, eng;
+
+    if (argc > 3) {
+        fprintf(stderr, "Usage: %s [buffer-size [megabytes]]\n", argv[0]);
+        exit(2);
+    }
+    if (argc > 1)
+        bufSize = atoi(argv[1]);
+    if (argc > 2)
+        totalMB = atol(argv[2]);
+    if (bufSize < 1 || totalMB < 1) {
+        fprintf(stderr, "ERROR: bad buffer size or length\n");
+        exit(2);
+    }
+
+    buf = (uint8_t*) malloc(bufSize < 1024 ? 1024 : bufSize);
+    if (buf == NULL) {
+        fprintf(stderr, "ERROR: malloc failed\n");
+        exit(1);
+    }
+    FillBuffer(buf, bufSize < 1024 ? 1024 : bufSize);
+
+    failures = CheckEngines(buf, 600);
+    if (failures != 0) {
+        fprintf(stderr, "ERROR: %d mismatches, not timing\n", failures);
+        exit(1);
+    }
+    printf("All CRC routines agree.\n");
+    if (!Nu_CanUseCRC16Clmul())
+        printf("(CPU has no PCLMULQDQ, clmul is just slice-by-8)\n");
+
+    printf("Buffer %d bytes, %ld MB per routine:\n", bufSize, totalMB);
+    for (eng = 0; eng < kNumEngines; eng++) {
+        uint16_t crc;
+        double rate;
+
+        rate = TimeEngine(&gEngines[eng], buf, bufSize, totalMB, &crc);
+        printf("  %-12s %9.1f MB/sec  (crc=0x%04x)\n",
+            gEngines[eng].name, rate, crc);
+    }
+
+    free(buf);
+    exit(0);
+}
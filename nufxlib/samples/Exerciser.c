@@ -651,6 +651,25 @@ static NuError FlushFunc(ExerciserState* pState, int argc, char** argv)
     return err;
 }
 
+/*
+ * co - flush changes and compact the archive
+ */
+static NuError CompactFunc(ExerciserState* pState, int argc, char** argv)
+{
+    NuError err;
+    uint32_t flushStatus;
+
+    (void) pState, (void) argc, (void) argv;    /* shut up, gcc */
+    assert(ExerciserState_GetNuArchive(pState) != NULL);
+    assert(argc == 1);
+
+    err = NuCompact(ExerciserState_GetNuArchive(pState), &flushStatus);
+    if (err != kNuErrNone)
+        printf("Exerciser: compact failed, status flags=0x%04x\n",
+            flushStatus);
+    return err;
+}
+
 /*
  * gev - get value
  *
@@ -1068,6 +1087,8 @@ static const struct {
         "Add thread to record" },
     { "cl", CloseFunc, 0, "", kFlagArchiveReq,
         "Close archive after flushing any changes" },
+    { "co", CompactFunc, 0, "", kFlagArchiveReq,
+        "Flush changes and rewrite archive" },
     { "d", DeleteFunc, 0, "", kFlagArchiveReq,
         "Delete all records" },
     { "dr", DeleteRecordFunc, 1, "recordIdx", kFlagArchiveReq,
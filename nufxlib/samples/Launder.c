@@ -470,6 +470,12 @@ int LaunderArchive(const char* inFile, const char* outFile,
                 "ERROR: couldn't disable modify orig (err=%d)\n", err);
             goto bail;
         }
+        err = NuSetValue(pOutArchive, kNuValueAppendInPlace, false);
+        if (err != kNuErrNone) {
+            fprintf(stderr,
+                "ERROR: couldn't disable append in place (err=%d)\n", err);
+            goto bail;
+        }
     }
 
     err = NuGetMasterHeader(pInArchive, &pMasterHeader);
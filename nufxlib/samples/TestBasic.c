@@ -13,6 +13,7 @@
 
 #define kTestArchive    "nlbt.shk"
 #define kTestTempFile   "nlbt.tmp"
+#define kTestLZWArchive "nlbt-lzw.shk"
 
 #define kNumEntries     3   /* how many records are we going to add? */
 
@@ -946,6 +947,210 @@ failed:
 }
 
 
+/*
+ * Extract the data fork of the first record in the damaged LZW archive,
+ * using "codecThreads" threads.  The result of the extraction goes into
+ * "*pErr".
+ *
+ * Returns 0 on success, -1 if we couldn't get as far as extracting.
+ */
+int ExtractDamagedLZW(long codecThreads, int ignoreCRC, uint8_t* buf,
+    uint32_t bufLen, NuError* pErr)
+{
+    NuError err;
+    NuArchive* pArchive = NULL;
+    NuRecordIdx recordIdx;
+    const NuRecord* pRecord;
+    const NuThread* pThread = NULL;
+    NuDataSink* pDataSink = NULL;
+    int i, result = -1;
+
+    err = NuOpenRO(kTestLZWArchive, &pArchive);
+    if (err != kNuErrNone) {
+        fprintf(stderr, "ERROR: NuOpenRO failed (err=%d)\n", err);
+        goto bail;
+    }
+    NuSetErrorMessageHandler(pArchive, ErrorMessageHandler);
+    if (NuSetValue(pArchive, kNuValueCodecThreads, codecThreads) !=
+            kNuErrNone ||
+        NuSetValue(pArchive, kNuValueIgnoreCRC, ignoreCRC) != kNuErrNone)
+    {
+        fprintf(stderr, "ERROR: couldn't set values\n");
+        goto bail;
+    }
+
+    err = NuGetRecordIdxByPosition(pArchive, 0, &recordIdx);
+    if (err == kNuErrNone)
+        err = NuGetRecord(pArchive, recordIdx, &pRecord);
+    if (err != kNuErrNone) {
+        fprintf(stderr, "ERROR: couldn't get record (err=%d)\n", err);
+        goto bail;
+    }
+    for (i = 0; i < (int) NuRecordGetNumThreads(pRecord); i++) {
+        if (NuGetThreadID(NuGetThread(pRecord, i)) == kNuThreadIDDataFork)
+            pThread = NuGetThread(pRecord, i);
+    }
+    if (pThread == NULL || pThread->actualThreadEOF != bufLen) {
+        fprintf(stderr, "ERROR: didn't find the data fork\n");
+        goto bail;
+    }
+
+    err = NuCreateDataSinkForBuffer(true, kNuConvertOff, buf, bufLen,
+            &pDataSink);
+    if (err != kNuErrNone) {
+        fprintf(stderr, "ERROR: couldn't create data sink (err=%d)\n", err);
+        goto bail;
+    }
+    memset(buf, 0, bufLen);
+
+    FAIL_OK;
+    *pErr = NuExtractThread(pArchive, pThread->threadIdx, pDataSink);
+    FAIL_BAD;
+    result = 0;
+
+bail:
+    NuFreeDataSink(pDataSink);
+    if (pArchive != NULL)
+        NuClose(pArchive);
+    return result;
+}
+
+/*
+ * Damage an LZW/2 thread big enough to be expanded with worker threads,
+ * and make sure we get the same results with and without them.
+ *
+ * The bit we flip is past the first segment, so the expansion fails
+ * partway through.  Everything up to the bad chunk should have been
+ * written out, the same way it is without worker threads.
+ */
+#define kTestLZWLen         (512 * 1024)
+#define kTestLZWDamageAt    61990       /* offset in archive file */
+#define kTestLZWIntactLen   (64 * 4096)
+int Test_DamagedLZW(void)
+{
+    NuError err, err1, errN;
+    NuArchive* pArchive = NULL;
+    NuDataSource* pDataSource = NULL;
+    NuRecordIdx recordIdx;
+    uint8_t* buf = NULL;
+    uint8_t* buf1 = NULL;
+    uint8_t* bufN = NULL;
+    uint32_t status;
+    FILE* fp;
+    int i, ch;
+
+    printf("... checking damaged LZW/2 data with worker threads\n");
+
+    buf = malloc(kTestLZWLen);
+    buf1 = malloc(kTestLZWLen);
+    bufN = malloc(kTestLZWLen);
+    if (buf == NULL || buf1 == NULL || bufN == NULL)
+        goto failed;
+    for (i = 0; i < kTestLZWLen; i++) {
+        if (i % 97 < 40)
+            buf[i] = "abcdefgh"[(i / 7) & 0x07];
+        else
+            buf[i] = (uint8_t) (i * 7);
+    }
+
+    err = NuOpenRW(kTestLZWArchive, kTestTempFile, kNuOpenCreat|kNuOpenExcl,
+            &pArchive);
+    if (err != kNuErrNone) {
+        fprintf(stderr, "ERROR: NuOpenRW failed (err=%d)\n", err);
+        goto failed;
+    }
+    NuSetErrorMessageHandler(pArchive, ErrorMessageHandler);
+    err = NuSetValue(pArchive, kNuValueDataCompression, kNuCompressLZW2);
+    if (err != kNuErrNone) {
+        fprintf(stderr, "ERROR: couldn't set compression (err=%d)\n", err);
+        goto failed;
+    }
+    err = AddSimpleRecord(pArchive, "damaged", &recordIdx);
+    if (err != kNuErrNone) {
+        fprintf(stderr, "ERROR: couldn't add record (err=%d)\n", err);
+        goto failed;
+    }
+    err = NuCreateDataSourceForBuffer(kNuThreadFormatUncompressed,
+            0, buf, 0, kTestLZWLen, NULL, &pDataSource);
+    if (err != kNuErrNone) {
+        fprintf(stderr, "ERROR: data source create failed (err=%d)\n", err);
+        goto failed;
+    }
+    err = NuAddThread(pArchive, recordIdx, kNuThreadIDDataFork, pDataSource,
+            NULL);
+    if (err != kNuErrNone) {
+        fprintf(stderr, "ERROR: couldn't add thread (err=%d)\n", err);
+        goto failed;
+    }
+    pDataSource = NULL;  /* now owned by library */
+    err = NuFlush(pArchive, &status);
+    if (err != kNuErrNone) {
+        fprintf(stderr, "ERROR: flush failed (err=%d, status=%d)\n",
+            err, status);
+        goto failed;
+    }
+    NuClose(pArchive);
+    pArchive = NULL;
+
+    /* flip a bit in the compressed data */
+    fp = fopen(kTestLZWArchive, "r+b");
+    if (fp == NULL) {
+        perror("fopen kTestLZWArchive");
+        goto failed;
+    }
+    fseek(fp, kTestLZWDamageAt, SEEK_SET);
+    ch = getc(fp);
+    fseek(fp, kTestLZWDamageAt, SEEK_SET);
+    putc(ch ^ 0x10, fp);
+    fclose(fp);
+
+    if (ExtractDamagedLZW(1, true, buf1, kTestLZWLen, &err1) != 0 ||
+        ExtractDamagedLZW(4, true, bufN, kTestLZWLen, &errN) != 0)
+    {
+        goto failed;
+    }
+    if (err1 != kNuErrBadData) {
+        fprintf(stderr, "ERROR: damaged LZW/2 gave err=%d\n", err1);
+        goto failed;
+    }
+    if (errN != err1) {
+        fprintf(stderr, "ERROR: worker threads gave err=%d, not %d\n",
+            errN, err1);
+        goto failed;
+    }
+    if (memcmp(buf1, bufN, kTestLZWLen) != 0) {
+        fprintf(stderr, "ERROR: worker threads expanded it differently\n");
+        goto failed;
+    }
+    if (memcmp(buf1, buf, kTestLZWIntactLen) != 0) {
+        fprintf(stderr, "ERROR: data before the damage didn't survive\n");
+        goto failed;
+    }
+
+    free(buf);
+    free(buf1);
+    free(bufN);
+
+    printf("... removing '%s'\n", kTestLZWArchive);
+    if (unlink(kTestLZWArchive) < 0) {
+        perror("unlink kTestLZWArchive");
+        return -1;
+    }
+    return 0;
+
+failed:
+    if (pArchive != NULL) {
+        NuAbort(pArchive);
+        NuClose(pArchive);
+    }
+    NuFreeDataSource(pDataSource);
+    free(buf);
+    free(buf1);
+    free(bufN);
+    return -1;
+}
+
+
 /*
  * Run some tests.
  *
@@ -967,6 +1172,9 @@ int DoTests(void)
     if (RemoveTestFile("Test temp file", kTestTempFile) < 0) {
         goto failed;
     }
+    if (RemoveTestFile("LZW test archive", kTestLZWArchive) < 0) {
+        goto failed;
+    }
 
     /*
      * Test some of the open flags.
@@ -1130,6 +1338,12 @@ int DoTests(void)
         goto failed;
     }
 
+    /*
+     * Make sure worker threads handle damaged LZW data the same way.
+     */
+    if (Test_DamagedLZW() != 0)
+        goto failed;
+
 
 leave:
     if (pArchive != NULL) {